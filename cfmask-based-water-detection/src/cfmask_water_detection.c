@@ -1,10 +1,10 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <unistd.h>
 #include "espa_metadata.h"
 #include "parse_metadata.h"
 #include "write_metadata.h"
-#include "raw_binary_io.h"
 
 
 #include "const.h"
@@ -12,6 +12,7 @@
 #include "utilities.h"
 #include "get_args.h"
 #include "input.h"
+#include "io_backend.h"
 
 
 /*****************************************************************************
@@ -109,29 +110,35 @@ int
 write_u16bit_data
 (
     char *output_filename,
+    Io_Backend_e io_backend,
     int element_count,
     uint16_t *data
 )
 {
-    FILE *fd = NULL;
+    Io_Writer_t *writer = NULL;
     char msg[512];
 
-    fd = fopen(output_filename, "w");
-    if (fd == NULL)
+    writer = open_io_writer(io_backend, output_filename);
+    if (writer == NULL)
     {
         snprintf(msg, sizeof(msg), "Failed creating file %s",
                  output_filename);
         RETURN_ERROR(msg, MODULE_NAME, ERROR);
     }
 
-    if (write_raw_binary(fd, 1, element_count, sizeof(uint16_t),
-                         data) != SUCCESS)
+    if (write_io_writer(writer, data, element_count * sizeof(uint16_t))
+        != SUCCESS)
     {
+        close_io_writer(writer);
         snprintf(msg, sizeof(msg), "Failed writing file %s", output_filename);
         RETURN_ERROR(msg, MODULE_NAME, ERROR);
     }
 
-    fclose(fd);
+    if (close_io_writer(writer) != SUCCESS)
+    {
+        snprintf(msg, sizeof(msg), "Failed closing file %s", output_filename);
+        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+    }
 
     return SUCCESS;
 }
@@ -164,9 +171,15 @@ main (int argc, char *argv[])
 {
     /* Command line parameters */
     char *xml_filename = NULL;  /* filename for the XML input */
+    char *archive_filename = NULL; /* tar archive holding the bands */
+    char *io_backend_name = NULL; /* how the image files are read and
+                                     written */
     Espa_internal_meta_t xml_metadata;  /* XML metadata structure */
     bool verbose_flag = false;
 
+    Io_Backend_e io_backend = IO_BACKEND_BUFFERED;
+    Tar_Archive_t *archive = NULL; /* index of the tar archive */
+    const Tar_Member_t *member;    /* member of the archive with the XML */
     Input_Data_t *input_data = NULL;
     /* Band data */
     int16_t *band_red = NULL;  /* TM TOA_Band3,  OLI TOA_Band4 */
@@ -185,12 +198,19 @@ main (int argc, char *argv[])
 
 
     /* Get the command line arguments */
-    if (get_args(argc, argv, &xml_filename, &verbose_flag) != SUCCESS)
+    if (get_args(argc, argv, &xml_filename, &archive_filename,
+                 &io_backend_name, &verbose_flag) != SUCCESS)
     {
         /* get_args generates all the error messages we need */
         return EXIT_FAILURE;
     }
 
+    if (io_backend_name != NULL)
+    {
+        io_backend = find_io_backend(io_backend_name);
+        free(io_backend_name);
+    }
+
     LOG_MESSAGE("Starting CFmask based water detection processing ...",
                 MODULE_NAME);
 
@@ -199,6 +219,38 @@ main (int argc, char *argv[])
     if (verbose_flag)
     {
         printf("   XML Input File: %s\n", xml_filename);
+        if (archive_filename != NULL)
+            printf("     Band Archive: %s\n", archive_filename);
+        printf("      I/O Backend: %s\n",
+               (io_backend == IO_BACKEND_MMAP) ? "mmap"
+               : (io_backend == IO_BACKEND_DIRECT) ? "direct" : "buffered");
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* Index the archive, and extract the XML from it when the XML is not
+       there already, since the water detection is added to it */
+    if (archive_filename != NULL)
+    {
+        archive = open_tar_archive(archive_filename);
+        if (archive == NULL)
+        {
+            /* Error messages already written */
+            return EXIT_FAILURE;
+        }
+
+        if (access(xml_filename, F_OK) != 0)
+        {
+            member = find_tar_member(archive, xml_filename);
+            if (member == NULL
+                || extract_tar_member(archive, member, xml_filename)
+                   != SUCCESS)
+            {
+                ERROR_MESSAGE("Failed getting the XML file from the archive",
+                              MODULE_NAME);
+                close_tar_archive(archive);
+                return EXIT_FAILURE;
+            }
+        }
     }
 
     /* -------------------------------------------------------------------- */
@@ -206,6 +258,7 @@ main (int argc, char *argv[])
     if (validate_xml_file(xml_filename) != SUCCESS)
     {
         /* Error messages already written */
+        close_tar_archive(archive);
         return EXIT_FAILURE;
     }
 
@@ -218,6 +271,7 @@ main (int argc, char *argv[])
     if (parse_metadata(xml_filename, &xml_metadata) != SUCCESS)
     {
         /* Cleanup memory */
+        close_tar_archive(archive);
         free(xml_filename);
 
         /* Error messages already written */
@@ -226,7 +280,12 @@ main (int argc, char *argv[])
 
     /* -------------------------------------------------------------------- */
     /* Open the input files */
-    input_data = open_input(&xml_metadata);
+    input_data = open_input(&xml_metadata, archive, io_backend);
+
+    /* The archive index is only needed to open the bands */
+    close_tar_archive(archive);
+    free(archive_filename);
+
     if (input_data == NULL)
     {
         ERROR_MESSAGE("Failed opening input files", MODULE_NAME);
@@ -399,7 +458,8 @@ main (int argc, char *argv[])
     snprintf(temp_filename, sizeof(temp_filename), "temp_%s",
              input_data->band_name[I_BAND_QA]);
 
-    if (write_u16bit_data(temp_filename, pixel_count, band_pixel_qa) != SUCCESS)
+    if (write_u16bit_data(temp_filename, io_backend, pixel_count,
+                          band_pixel_qa) != SUCCESS)
     {
         ERROR_MESSAGE("Failed writing L2 QA band data", MODULE_NAME);
 
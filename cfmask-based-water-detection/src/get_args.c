@@ -10,6 +10,7 @@
 #include "cfmask_water_detection.h"
 #include "utilities.h"
 #include "get_args.h"
+#include "io_backend.h"
 
 
 /*****************************************************************************
@@ -49,6 +50,22 @@ usage ()
             "(envi) format\n\n");
 
     printf("where the following parameters are optional:\n");
+    printf("    --archive: Landsat tar archive (.tar, .tar.gz or .tgz) to"
+           " read the bands of\n"
+           "               the XML from without extracting them; the XML"
+           " itself is\n"
+           "               extracted from it when missing (default is the"
+           " band files\n"
+           "               named in the XML)\n\n");
+
+    printf("    --io_backend: How the image files are read and written:"
+           " buffered (through\n"
+           "                  the page cache), mmap (through mappings of"
+           " the files) or\n"
+           "                  direct (around the page cache with O_DIRECT,"
+           " leaving it to\n"
+           "                  other jobs) (default is buffered)\n\n");
+
     printf("    --verbose: Should intermediate messages be printed? (default"
            " is false)\n\n");
 
@@ -77,6 +94,9 @@ get_args
     int argc,          /* I: number of cmd-line args */
     char *argv[],      /* I: string of cmd-line args */
     char **xml_infile, /* O: input XML filename */
+    char **archive_infile, /* O: archive to read the bands from, NULL when
+                                 not given */
+    char **io_backend_name, /* O: I/O backend name, NULL when not given */
     bool *verbose_flag /* O: verbose messaging */
 )
 {
@@ -88,6 +108,8 @@ get_args
     struct option long_options[] = {
         /* These options provide values */
         {"xml", required_argument, 0, 'x'},
+        {"archive", required_argument, 0, 'f'},
+        {"io_backend", required_argument, 0, 'u'},
 
         /* Special options */
         {"verbose", no_argument, &tmp_verbose_flag, true},
@@ -140,6 +162,14 @@ get_args
             *xml_infile = strdup(optarg);
             break;
 
+        case 'f':
+            *archive_infile = strdup(optarg);
+            break;
+
+        case 'u':
+            *io_backend_name = strdup(optarg);
+            break;
+
         case '?':
         default:
             snprintf(msg, sizeof(msg),
@@ -167,5 +197,12 @@ get_args
         return ERROR;
     }
 
+    if (*io_backend_name != NULL && find_io_backend(*io_backend_name) < 0)
+    {
+        ERROR_MESSAGE("Unknown I/O backend\n\n", MODULE_NAME);
+        usage();
+        return ERROR;
+    }
+
     return SUCCESS;
 }
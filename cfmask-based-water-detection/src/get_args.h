@@ -10,6 +10,10 @@ int
 get_args (int argc,                    /* I: number of cmd-line args */
           char *argv[],                /* I: string of cmd-line args */
           char **xml_infile,           /* O: input XML filename */
+          char **archive_infile,       /* O: archive to read the bands
+                                             from, NULL when not given */
+          char **io_backend_name,      /* O: I/O backend name, NULL when
+                                             not given */
           bool * verbose_flag);        /* O: verbose messaging */
 
 
@@ -1,17 +1,55 @@
 
 #include <stdio.h>
+#include <unistd.h>
+#include <sys/types.h>
 
 #include "cfmask_water_detection.h"
 #include "utilities.h"
 #include "input.h"
 
 
+/*****************************************************************************
+  NAME:  open_direct_band
+
+  PURPOSE:  Reopen the file of a band with O_DIRECT, for the direct I/O
+            backend.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. Where the file system has no O_DIRECT, or the band is a stream from
+       a compressed archive, the band is read without it.
+*****************************************************************************/
+static void
+open_direct_band
+(
+    Input_Data_t *input_data, /* IO: input data record */
+    Input_Bands_e band_index  /* I: band opened in band_fd */
+)
+{
+    if (input_data->io_backend != IO_BACKEND_DIRECT
+        || input_data->band_fd[band_index] == NULL
+        || fileno(input_data->band_fd[band_index]) < 0)
+    {
+        return;
+    }
+
+    input_data->band_direct_fd[band_index] =
+        open_direct_fd(fileno(input_data->band_fd[band_index]));
+}
+
+
 /*****************************************************************************
   NAME:  open_band
 
   PURPOSE:  Open the specified file and allocate the memory for the filename.
 
   RETURN VALUE:  None
+
+  NOTES:
+    1. A band in the tar archive is read from the archive in place, through
+       a stream that starts at the band.  Bands that are not in the archive
+       are opened from disk.
 *****************************************************************************/
 void
 open_band
@@ -21,11 +59,23 @@ open_band
     Input_Bands_e band_index  /* I: index to place the band into */
 )
 {
+    const Tar_Member_t *member = NULL;
     char msg[256];
 
     /* Grab the name from the input */
     input_data->band_name[band_index] = strdup(filename);
 
+    if (input_data->archive != NULL)
+        member = find_tar_member(input_data->archive, filename);
+    if (member != NULL)
+    {
+        /* open_tar_member reports its own errors */
+        input_data->band_fd[band_index] =
+            open_tar_member(input_data->archive, member);
+        open_direct_band(input_data, band_index);
+        return;
+    }
+
     /* Open a file descriptor for the band */
     input_data->band_fd[band_index] =
         fopen(input_data->band_name[band_index], "rb");
@@ -36,6 +86,7 @@ open_band
                  input_data->band_name[band_index]);
         ERROR_MESSAGE(msg, MODULE_NAME);
     }
+    open_direct_band(input_data, band_index);
 }
 
 
@@ -201,7 +252,10 @@ GetXMLInput
 Input_Data_t *
 open_input
 (
-    Espa_internal_meta_t *metadata /* I: input metadata */
+    Espa_internal_meta_t *metadata, /* I: input metadata */
+    const Tar_Archive_t *archive,   /* I: archive to read the images from
+                                          when in it, NULL for none */
+    Io_Backend_e io_backend         /* I: how to read the image files */
 )
 {
     int index;
@@ -220,12 +274,15 @@ open_input
     {
         input_data->band_name[index] = NULL;
         input_data->band_fd[index] = NULL;
+        input_data->band_direct_fd[index] = -1;
         input_data->fill_value[index] = -1;
         input_data->meta_index[index] = -1;
     }
 
     input_data->lines = 0;
     input_data->samples = 0;
+    input_data->archive = archive;
+    input_data->io_backend = io_backend;
 
     /* Open the input images from the XML file */
     if (GetXMLInput(metadata, input_data) != SUCCESS)
@@ -234,6 +291,7 @@ open_input
         close_input(input_data);
         return NULL;
     }
+    input_data->archive = NULL;
 
     return input_data;
 }
@@ -265,6 +323,12 @@ close_input
     had_issue = false;
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
+        if (input_data->band_direct_fd[index] >= 0)
+        {
+            close(input_data->band_direct_fd[index]);
+            input_data->band_direct_fd[index] = -1;
+        }
+
         if (input_data->band_fd[index] != NULL)
         {
             status = fclose(input_data->band_fd[index]);
@@ -296,6 +360,51 @@ close_input
 }
 
 
+/*****************************************************************************
+  NAME:  read_band
+
+  PURPOSE:  Read a whole band with the I/O backend, from where its file is
+            positioned at the band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The band was read.
+      ERROR    The file ended or could not be read.
+
+  NOTES:
+    1. A band in a compressed archive is a stream without a file
+       descriptor, so it is read through the stream.
+*****************************************************************************/
+static int
+read_band
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read */
+    size_t size,              /* I: size of the band in bytes */
+    void *band                /* O: memory for the band */
+)
+{
+    FILE *band_fd = input_data->band_fd[band_index];
+    off_t offset;
+
+    if (fileno(band_fd) < 0)
+    {
+        if (fread(band, 1, size, band_fd) != size)
+            return ERROR;
+        return SUCCESS;
+    }
+
+    offset = ftello(band_fd);
+    if (offset < 0)
+        return ERROR;
+
+    return read_io_range(input_data->io_backend, fileno(band_fd),
+                         input_data->band_direct_fd[band_index], offset,
+                         size, band);
+}
+
+
 /*****************************************************************************
   NAME: read_bands_into_memory
 
@@ -318,29 +427,24 @@ read_bands_into_memory
     int pixel_count
 )
 {
-    int count;
-
-    count = fread(band_red, sizeof(int16_t), pixel_count,
-                  input_data->band_fd[I_BAND_RED]);
-    if (count != pixel_count)
+    if (read_band(input_data, I_BAND_RED, pixel_count * sizeof(int16_t),
+                  band_red) != SUCCESS)
     {
         ERROR_MESSAGE("Failed reading red band data", MODULE_NAME);
 
         return ERROR;
     }
 
-    count = fread(band_nir, sizeof(int16_t), pixel_count,
-                  input_data->band_fd[I_BAND_NIR]);
-    if (count != pixel_count)
+    if (read_band(input_data, I_BAND_NIR, pixel_count * sizeof(int16_t),
+                  band_nir) != SUCCESS)
     {
         ERROR_MESSAGE("Failed reading nir band data", MODULE_NAME);
 
         return ERROR;
     }
 
-    count = fread(band_pixel_qa, sizeof(uint16_t), pixel_count,
-                  input_data->band_fd[I_BAND_QA]);
-    if (count != pixel_count)
+    if (read_band(input_data, I_BAND_QA, pixel_count * sizeof(uint16_t),
+                  band_pixel_qa) != SUCCESS)
     {
         ERROR_MESSAGE("Failed reading QA band data", MODULE_NAME);
 
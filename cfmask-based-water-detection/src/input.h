@@ -8,6 +8,8 @@
 #include "espa_metadata.h"
 
 #include "const.h"
+#include "tar_archive.h"
+#include "io_backend.h"
 
 
 /* Structure for the 'input' data */
@@ -17,15 +19,25 @@ typedef struct
     int samples;
     char *band_name[MAX_INPUT_BANDS]; /* Name of the input image files */
     FILE *band_fd[MAX_INPUT_BANDS];   /* Open fd's for the image */
+    int band_direct_fd[MAX_INPUT_BANDS]; /* The fd's reopened with O_DIRECT
+                                         for the direct I/O backend, -1 for
+                                         none */
+    Io_Backend_e io_backend;          /* How the image files are read */
     int fill_value[MAX_INPUT_BANDS];  /* Fill value from the metadata */
     int meta_index[MAX_INPUT_BANDS];  /* Index in the band metadata */
+    const Tar_Archive_t *archive;     /* Archive the images are read from
+                                         when in it, NULL for none; only
+                                         used while opening */
 } Input_Data_t;
 
 
 Input_Data_t *
 open_input
 (
-    Espa_internal_meta_t *metadata /* I: input metadata */
+    Espa_internal_meta_t *metadata, /* I: input metadata */
+    const Tar_Archive_t *archive,   /* I: archive to read the images from
+                                          when in it, NULL for none */
+    Io_Backend_e io_backend         /* I: how to read the image files */
 );
 
 
@@ -0,0 +1,595 @@
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "const.h"
+#include "cfmask_water_detection.h"
+#include "utilities.h"
+#include "io_backend.h"
+
+
+/* Rounds an offset or size down and up to the O_DIRECT alignment */
+#define ALIGN_DOWN(value) ((value) & ~((off_t) IO_DIRECT_ALIGNMENT - 1))
+#define ALIGN_UP(value) ALIGN_DOWN((value) + IO_DIRECT_ALIGNMENT - 1)
+
+
+/*****************************************************************************
+  NAME:  find_io_backend
+
+  PURPOSE:  Look up an I/O backend by its name on the command line.
+
+  RETURN VALUE:  Type = Io_Backend_e
+      Value    Description
+      -------  ---------------------------------------------------------------
+      -1       No I/O backend has the name.
+      *        The I/O backend.
+*****************************************************************************/
+Io_Backend_e
+find_io_backend
+(
+    const char *name          /* I: name of the I/O backend */
+)
+{
+    if (strcmp(name, "buffered") == 0)
+        return IO_BACKEND_BUFFERED;
+    if (strcmp(name, "mmap") == 0)
+        return IO_BACKEND_MMAP;
+    if (strcmp(name, "direct") == 0)
+        return IO_BACKEND_DIRECT;
+
+    return (Io_Backend_e) -1;
+}
+
+
+/*****************************************************************************
+  NAME:  open_direct_fd
+
+  PURPOSE:  Open a file already open for reading a second time, with
+            O_DIRECT.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      -1       The file system does not support O_DIRECT.
+      *        The new file descriptor, to be closed by the caller.
+
+  NOTES:
+    1. The file is reopened through /proc/self/fd, so it works for any
+       open file, including a member of a tar archive.
+*****************************************************************************/
+int
+open_direct_fd
+(
+    int fd                    /* I: file open for reading */
+)
+{
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+    return open(path, O_RDONLY | O_DIRECT);
+}
+
+
+/*****************************************************************************
+  NAME:  pread_all
+
+  PURPOSE:  Read bytes at an offset of a file, retrying short reads.
+
+  RETURN VALUE:  Type = ssize_t
+      Value    Description
+      -------  ---------------------------------------------------------------
+      -1       The file could not be read.
+      n        The number of bytes read, less than size at the end of the
+               file.
+*****************************************************************************/
+static ssize_t
+pread_all
+(
+    int fd,                   /* I: file to read */
+    void *buffer,             /* O: memory for size bytes */
+    size_t size,              /* I: number of bytes to read */
+    off_t offset              /* I: offset of the first byte to read */
+)
+{
+    char *next = buffer;
+    size_t remaining = size;
+    ssize_t count;
+
+    while (remaining > 0)
+    {
+        count = pread(fd, next, remaining, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0)
+            return -1;
+        if (count == 0)
+            break;
+
+        next += count;
+        offset += count;
+        remaining -= count;
+    }
+
+    return size - remaining;
+}
+
+
+/*****************************************************************************
+  NAME:  read_mapped_range
+
+  PURPOSE:  Copy a range of a file from a mapping of it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The range was read.
+      ERROR    The file is too small or could not be mapped.
+*****************************************************************************/
+static int
+read_mapped_range
+(
+    int fd,                   /* I: file to read */
+    off_t offset,             /* I: offset of the first byte to read */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+)
+{
+    struct stat file_stat;
+    off_t map_offset;         /* Page aligned start of the mapping */
+    size_t map_size;
+    void *map;
+
+    /* Mapping past the end of the file would fault on access */
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < offset + size)
+        return ERROR;
+
+    map_offset = offset & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+    map_size = size + (offset - map_offset);
+    map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, map_offset);
+    if (map == MAP_FAILED)
+        return ERROR;
+    madvise(map, map_size, MADV_SEQUENTIAL);
+
+    memcpy(buffer, (char *) map + (offset - map_offset), size);
+
+    munmap(map, map_size);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_direct_range
+
+  PURPOSE:  Read a range of a file with O_DIRECT, through an aligned buffer.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The range was read.
+      ERROR    The file ended or could not be read.
+
+  NOTES:
+    1. The aligned blocks around the range are read and the range is copied
+       out of them, so the caller's offset, size and buffer need no
+       alignment.
+*****************************************************************************/
+static int
+read_direct_range
+(
+    int direct_fd,            /* I: file opened with O_DIRECT */
+    off_t offset,             /* I: offset of the first byte to read */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+)
+{
+    char *next = buffer;
+    void *aligned;            /* Aligned memory for the transfers */
+    off_t block_offset;       /* Aligned offset of the next transfer */
+    off_t skip;               /* Bytes of the transfer before the range */
+    size_t transfer;          /* Bytes in the transfer */
+    size_t copy;              /* Bytes of the transfer in the range */
+    ssize_t count;
+
+    if (posix_memalign(&aligned, IO_DIRECT_ALIGNMENT,
+                       IO_DIRECT_BUFFER_SIZE) != 0)
+    {
+        return ERROR;
+    }
+
+    while (size > 0)
+    {
+        block_offset = ALIGN_DOWN(offset);
+        skip = offset - block_offset;
+        transfer = ALIGN_UP(skip + size);
+        if (transfer > IO_DIRECT_BUFFER_SIZE)
+            transfer = IO_DIRECT_BUFFER_SIZE;
+
+        /* The last transfer is short at the end of the file */
+        count = pread_all(direct_fd, aligned, transfer, block_offset);
+        if (count <= skip)
+        {
+            free(aligned);
+            return ERROR;
+        }
+
+        copy = count - skip;
+        if (copy > size)
+            copy = size;
+        memcpy(next, (char *) aligned + skip, copy);
+
+        next += copy;
+        offset += copy;
+        size -= copy;
+    }
+
+    free(aligned);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_io_range
+
+  PURPOSE:  Read a range of a file with an I/O backend.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The range was read.
+      ERROR    The file ended or could not be read.
+
+  NOTES:
+    1. The reads are positional, so different ranges of a file can be read
+       from any thread.
+    2. Without an O_DIRECT file the direct backend reads through the page
+       cache and drops the pages of the range afterwards.
+*****************************************************************************/
+int
+read_io_range
+(
+    Io_Backend_e backend,     /* I: how to read the file */
+    int fd,                   /* I: file to read */
+    int direct_fd,            /* I: the file opened by open_direct_fd, -1
+                                    for none */
+    off_t offset,             /* I: offset of the first byte to read */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+)
+{
+    if (backend == IO_BACKEND_MMAP)
+        return read_mapped_range(fd, offset, size, buffer);
+
+    if (backend == IO_BACKEND_DIRECT && direct_fd >= 0)
+        return read_direct_range(direct_fd, offset, size, buffer);
+
+    if (pread_all(fd, buffer, size, offset) != size)
+        return ERROR;
+
+    if (backend == IO_BACKEND_DIRECT)
+        posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  write_all
+
+  PURPOSE:  Write bytes at an offset of a file, retrying short writes.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were written.
+      ERROR    The file could not be written.
+*****************************************************************************/
+static int
+write_all
+(
+    int fd,                   /* I: file to write */
+    const void *data,         /* I: bytes to write */
+    size_t size,              /* I: number of bytes to write */
+    off_t offset              /* I: offset of the first byte to write */
+)
+{
+    const char *next = data;
+    ssize_t count;
+
+    while (size > 0)
+    {
+        count = pwrite(fd, next, size, offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return ERROR;
+
+        next += count;
+        offset += count;
+        size -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  flush_direct_buffer
+
+  PURPOSE:  Write the buffered data of a direct writer to its file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The data was written.
+      ERROR    The file could not be written.
+
+  NOTES:
+    1. With O_DIRECT a partial buffer, which only the end of the file
+       leaves, is padded to the alignment and the file cut back to its size
+       afterwards.
+*****************************************************************************/
+static int
+flush_direct_buffer
+(
+    Io_Writer_t *writer       /* IO: direct writer */
+)
+{
+    off_t offset = writer->size - writer->buffered;
+    size_t transfer = writer->buffered;
+
+    if (writer->buffered == 0)
+        return SUCCESS;
+
+    if (writer->direct)
+    {
+        transfer = ALIGN_UP(writer->buffered);
+        memset(&writer->buffer[writer->buffered], 0,
+               transfer - writer->buffered);
+    }
+
+    if (write_all(writer->fd, writer->buffer, transfer, offset) != SUCCESS)
+        return ERROR;
+
+    if (transfer != writer->buffered
+        && ftruncate(writer->fd, writer->size) != 0)
+    {
+        return ERROR;
+    }
+    writer->buffered = 0;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_io_writer
+
+  PURPOSE:  Create an image file to write from start to end with an I/O
+            backend.
+
+  RETURN VALUE:  Type = Io_Writer_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The writer, to be closed with close_io_writer.
+
+  NOTES:
+    1. The direct backend falls back to plain writes when the file system
+       does not support O_DIRECT, and drops the pages of the file when it
+       is closed.
+*****************************************************************************/
+Io_Writer_t *
+open_io_writer
+(
+    Io_Backend_e backend,     /* I: how to write the file */
+    const char *filename      /* I: file to create */
+)
+{
+    Io_Writer_t *writer;
+    char msg[PATH_MAX + 64];
+
+    writer = calloc(1, sizeof(Io_Writer_t));
+    if (writer == NULL)
+        RETURN_ERROR("Failed allocating a writer", MODULE_NAME, NULL);
+    writer->backend = backend;
+    writer->fd = -1;
+    writer->filename = strdup(filename);
+    if (writer->filename == NULL)
+    {
+        free(writer);
+        RETURN_ERROR("Failed allocating a writer", MODULE_NAME, NULL);
+    }
+
+    switch (backend)
+    {
+        case IO_BACKEND_BUFFERED:
+            writer->file = fopen(filename, "w");
+            break;
+
+        case IO_BACKEND_MMAP:
+            writer->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+            break;
+
+        case IO_BACKEND_DIRECT:
+            writer->fd = open(filename,
+                              O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+            writer->direct = (writer->fd >= 0);
+            if (writer->fd < 0 && errno == EINVAL)
+                writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC,
+                                  0666);
+            if (posix_memalign((void **) &writer->buffer,
+                               IO_DIRECT_ALIGNMENT,
+                               IO_DIRECT_BUFFER_SIZE) != 0)
+            {
+                writer->buffer = NULL;
+            }
+            break;
+    }
+
+    if ((backend == IO_BACKEND_BUFFERED && writer->file == NULL)
+        || (backend != IO_BACKEND_BUFFERED && writer->fd < 0)
+        || (backend == IO_BACKEND_DIRECT && writer->buffer == NULL))
+    {
+        close_io_writer(writer);
+        snprintf(msg, sizeof(msg), "Failed creating file %s", filename);
+        RETURN_ERROR(msg, MODULE_NAME, NULL);
+    }
+
+    return writer;
+}
+
+
+/*****************************************************************************
+  NAME:  write_io_writer
+
+  PURPOSE:  Append data to an image file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The data was written.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+write_io_writer
+(
+    Io_Writer_t *writer,      /* IO: writer from open_io_writer */
+    const void *data,         /* I: data to append to the file */
+    size_t size               /* I: number of bytes to append */
+)
+{
+    const char *next = data;
+    off_t map_offset;         /* Page aligned start of the mapping */
+    size_t map_size;
+    size_t copy;
+    void *map;
+    int status = SUCCESS;
+    char msg[PATH_MAX + 64];
+
+    switch (writer->backend)
+    {
+        case IO_BACKEND_BUFFERED:
+            if (fwrite(data, 1, size, writer->file) != size)
+                status = ERROR;
+            break;
+
+        case IO_BACKEND_MMAP:
+            if (size == 0)
+                break;
+            /* The appended blocks are allocated before the copy, since
+               a write through the mapping that finds the disk full raises
+               SIGBUS rather than returning an error */
+            if (posix_fallocate(writer->fd, writer->size, size) != 0)
+            {
+                status = ERROR;
+                break;
+            }
+            map_offset = writer->size
+                         & ~((off_t) sysconf(_SC_PAGESIZE) - 1);
+            map_size = size + (writer->size - map_offset);
+            map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       writer->fd, map_offset);
+            if (map == MAP_FAILED)
+            {
+                status = ERROR;
+                break;
+            }
+            memcpy((char *) map + (writer->size - map_offset), data, size);
+            munmap(map, map_size);
+            writer->size += size;
+            break;
+
+        case IO_BACKEND_DIRECT:
+            while (size > 0 && status == SUCCESS)
+            {
+                copy = IO_DIRECT_BUFFER_SIZE - writer->buffered;
+                if (copy > size)
+                    copy = size;
+                memcpy(&writer->buffer[writer->buffered], next, copy);
+                writer->buffered += copy;
+                writer->size += copy;
+                next += copy;
+                size -= copy;
+
+                if (writer->buffered == IO_DIRECT_BUFFER_SIZE)
+                    status = flush_direct_buffer(writer);
+            }
+            break;
+    }
+
+    if (status != SUCCESS)
+    {
+        snprintf(msg, sizeof(msg), "Failed writing file %s",
+                 writer->filename);
+        RETURN_ERROR(msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  close_io_writer
+
+  PURPOSE:  Write out what is left of an image file and close it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The file was written and closed.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+close_io_writer
+(
+    Io_Writer_t *writer       /* I: writer from open_io_writer */
+)
+{
+    int status = SUCCESS;
+    char msg[PATH_MAX + 64];
+
+    if (writer->file != NULL && fclose(writer->file) != 0)
+        status = ERROR;
+
+    if (writer->fd >= 0)
+    {
+        if (writer->backend == IO_BACKEND_DIRECT)
+        {
+            if (flush_direct_buffer(writer) != SUCCESS)
+                status = ERROR;
+
+            /* Dirty pages are not dropped, so write them out first */
+            if (!writer->direct && fdatasync(writer->fd) != 0)
+                status = ERROR;
+            posix_fadvise(writer->fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+
+        if (close(writer->fd) != 0)
+            status = ERROR;
+    }
+
+    if (status != SUCCESS)
+    {
+        snprintf(msg, sizeof(msg), "Failed writing file %s",
+                 writer->filename);
+        ERROR_MESSAGE(msg, MODULE_NAME);
+    }
+
+    free(writer->buffer);
+    free(writer->filename);
+    free(writer);
+
+    return status;
+}
@@ -0,0 +1,98 @@
+
+#ifndef IO_BACKEND_H
+#define IO_BACKEND_H
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+
+/* How the image files are read and written */
+typedef enum
+{
+    IO_BACKEND_BUFFERED = 0,  /* Through the page cache with stdio and
+                                 pread */
+    IO_BACKEND_MMAP,          /* Through mappings of the files, copied to
+                                 and from the buffers */
+    IO_BACKEND_DIRECT         /* Around the page cache with O_DIRECT, or
+                                 dropping the pages after use where the
+                                 file system has no O_DIRECT */
+} Io_Backend_e;
+
+
+/* Alignment of the file offsets, sizes and buffers of O_DIRECT transfers */
+#define IO_DIRECT_ALIGNMENT 4096
+
+/* Bytes moved per O_DIRECT transfer */
+#define IO_DIRECT_BUFFER_SIZE (1024 * 1024)
+
+
+/* Structure for an image file being written from start to end */
+typedef struct
+{
+    Io_Backend_e backend;     /* How the file is written */
+    char *filename;           /* Name of the file, for messages */
+    FILE *file;               /* The file, when buffered */
+    int fd;                   /* The file, otherwise */
+    bool direct;              /* fd is open with O_DIRECT */
+    uint8_t *buffer;          /* Aligned data not yet written, when direct */
+    size_t buffered;          /* Bytes in the buffer */
+    off_t size;               /* Bytes of the file written so far, including
+                                 the buffer */
+} Io_Writer_t;
+
+
+Io_Backend_e
+find_io_backend
+(
+    const char *name          /* I: name of the I/O backend */
+);
+
+
+int
+open_direct_fd
+(
+    int fd                    /* I: file open for reading */
+);
+
+
+int
+read_io_range
+(
+    Io_Backend_e backend,     /* I: how to read the file */
+    int fd,                   /* I: file to read */
+    int direct_fd,            /* I: the file opened by open_direct_fd, -1
+                                    for none */
+    off_t offset,             /* I: offset of the first byte to read */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+);
+
+
+Io_Writer_t *
+open_io_writer
+(
+    Io_Backend_e backend,     /* I: how to write the file */
+    const char *filename      /* I: file to create */
+);
+
+
+int
+write_io_writer
+(
+    Io_Writer_t *writer,      /* IO: writer from open_io_writer */
+    const void *data,         /* I: data to append to the file */
+    size_t size               /* I: number of bytes to append */
+);
+
+
+int
+close_io_writer
+(
+    Io_Writer_t *writer       /* I: writer from open_io_writer */
+);
+
+
+#endif /* IO_BACKEND_H */
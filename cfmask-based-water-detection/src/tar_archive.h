@@ -0,0 +1,72 @@
+
+#ifndef TAR_ARCHIVE_H
+#define TAR_ARCHIVE_H
+
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Structure for a regular file stored in a tar archive */
+typedef struct
+{
+    char *name;           /* Name of the member in the archive */
+    uint64_t offset;      /* Offset of the member data in the uncompressed
+                             archive */
+    uint64_t size;        /* Size of the member data in bytes */
+} Tar_Member_t;
+
+
+/* Structure for the index of a tar archive, built from one scan of its
+   headers */
+typedef struct
+{
+    char *filename;       /* Name of the archive file */
+    bool compressed;      /* The archive is gzip compressed */
+    int member_count;     /* Number of regular files in the archive */
+    Tar_Member_t *members; /* The regular files in archive order */
+} Tar_Archive_t;
+
+
+Tar_Archive_t *
+open_tar_archive
+(
+    const char *filename      /* I: name of a .tar, .tar.gz or .tgz file */
+);
+
+
+const Tar_Member_t *
+find_tar_member
+(
+    const Tar_Archive_t *archive, /* I: archive from open_tar_archive */
+    const char *filename      /* I: file to look for, matched on the name
+                                    without its directories */
+);
+
+
+FILE *
+open_tar_member
+(
+    const Tar_Archive_t *archive, /* I: archive from open_tar_archive */
+    const Tar_Member_t *member /* I: member to read */
+);
+
+
+int
+extract_tar_member
+(
+    const Tar_Archive_t *archive, /* I: archive from open_tar_archive */
+    const Tar_Member_t *member, /* I: member to extract */
+    const char *filename      /* I: file to write the member data to */
+);
+
+
+void
+close_tar_archive
+(
+    Tar_Archive_t *archive    /* I: archive from open_tar_archive */
+);
+
+
+#endif /* TAR_ARCHIVE_H */
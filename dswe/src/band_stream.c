@@ -0,0 +1,358 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "band_stream.h"
+
+
+/* Size of the compressed data read from the file at a time, and of the
+   decompressed data discarded at a time when skipping forward */
+#define BAND_STREAM_BUFFER_SIZE (256 * 1024)
+
+
+/*****************************************************************************
+  NAME:  has_suffix
+
+  PURPOSE:  Check whether a filename ends with a suffix.
+
+  RETURN VALUE:  Type = bool
+      True when the filename ends with the suffix.
+*****************************************************************************/
+static bool
+has_suffix
+(
+    const char *filename,     /* I: name to check */
+    const char *suffix        /* I: suffix to look for */
+)
+{
+    size_t length = strlen (filename);
+    size_t suffix_length = strlen (suffix);
+
+    return length > suffix_length
+           && strcmp (filename + length - suffix_length, suffix) == 0;
+}
+
+
+/*****************************************************************************
+  NAME:  find_band_compression
+
+  PURPOSE:  Determine how an image file is compressed from its suffix.
+
+  RETURN VALUE:  Type = Band_Compression_e
+      The compression, BAND_COMPRESSION_NONE for an uncompressed file.
+*****************************************************************************/
+Band_Compression_e
+find_band_compression
+(
+    const char *filename      /* I: name of the image file */
+)
+{
+    if (has_suffix (filename, ".gz") || has_suffix (filename, ".tgz"))
+        return BAND_COMPRESSION_GZIP;
+    if (has_suffix (filename, ".xz"))
+        return BAND_COMPRESSION_XZ;
+
+    return BAND_COMPRESSION_NONE;
+}
+
+
+/*****************************************************************************
+  NAME:  open_band_stream
+
+  PURPOSE:  Open a compressed image file for decompressing it as a stream.
+
+  RETURN VALUE:  Type = Band_Stream_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The stream, positioned at the start of the decompressed
+               file.
+
+  NOTES:
+    1. The xz decoder accepts concatenated streams, as produced by parallel
+       compressors, and has no memory limit since the band files are
+       trusted.
+*****************************************************************************/
+Band_Stream_t *
+open_band_stream
+(
+    const char *filename,     /* I: name of a gzip or xz compressed image
+                                    file */
+    off_t band_offset         /* I: offset of the band in the decompressed
+                                    file */
+)
+{
+    Band_Stream_t *stream = NULL;
+    lzma_stream xz_init = LZMA_STREAM_INIT;
+    char msg[256];
+
+    stream = calloc (1, sizeof (Band_Stream_t));
+    if (stream == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for a band stream",
+                       MODULE_NAME);
+        return NULL;
+    }
+    stream->compression = find_band_compression (filename);
+    stream->band_offset = band_offset;
+    stream->xz = xz_init;
+
+    stream->skip_buffer = malloc (BAND_STREAM_BUFFER_SIZE);
+    if (stream->skip_buffer == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for a band stream",
+                       MODULE_NAME);
+        close_band_stream (stream);
+        return NULL;
+    }
+
+    if (stream->compression == BAND_COMPRESSION_GZIP)
+    {
+        stream->gz = gzopen (filename, "rb");
+        if (stream->gz == NULL)
+        {
+            snprintf (msg, sizeof (msg), "Failed to open (%s)", filename);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+            close_band_stream (stream);
+            return NULL;
+        }
+        gzbuffer (stream->gz, BAND_STREAM_BUFFER_SIZE);
+    }
+    else if (stream->compression == BAND_COMPRESSION_XZ)
+    {
+        stream->file = fopen (filename, "rb");
+        if (stream->file == NULL)
+        {
+            snprintf (msg, sizeof (msg), "Failed to open (%s)", filename);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+            close_band_stream (stream);
+            return NULL;
+        }
+
+        stream->xz_input = malloc (BAND_STREAM_BUFFER_SIZE);
+        if (stream->xz_input == NULL)
+        {
+            ERROR_MESSAGE ("Error allocating memory for a band stream",
+                           MODULE_NAME);
+            close_band_stream (stream);
+            return NULL;
+        }
+
+        if (lzma_stream_decoder (&stream->xz, UINT64_MAX, LZMA_CONCATENATED)
+            != LZMA_OK)
+        {
+            snprintf (msg, sizeof (msg), "Failed to start decompressing (%s)",
+                      filename);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+            close_band_stream (stream);
+            return NULL;
+        }
+    }
+    else
+    {
+        snprintf (msg, sizeof (msg), "Unknown compression of (%s)", filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        close_band_stream (stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+
+/*****************************************************************************
+  NAME:  decompress_gzip
+
+  PURPOSE:  Decompress the next bytes of a gzip compressed band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were decompressed.
+      ERROR    The file is corrupt or ends before the bytes.
+*****************************************************************************/
+static int
+decompress_gzip
+(
+    Band_Stream_t *stream,    /* IO: gzip compressed stream */
+    size_t size,              /* I: number of bytes to decompress */
+    uint8_t *buffer           /* O: memory for size bytes */
+)
+{
+    unsigned int chunk;
+    int count;
+
+    /* gzread counts in unsigned ints and returns ints */
+    while (size > 0)
+    {
+        chunk = (size > INT_MAX) ? INT_MAX : (unsigned int) size;
+        count = gzread (stream->gz, buffer, chunk);
+        if (count <= 0)
+            return ERROR;
+
+        buffer += count;
+        size -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  decompress_xz
+
+  PURPOSE:  Decompress the next bytes of an xz compressed band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were decompressed.
+      ERROR    The file is corrupt or ends before the bytes.
+*****************************************************************************/
+static int
+decompress_xz
+(
+    Band_Stream_t *stream,    /* IO: xz compressed stream */
+    size_t size,              /* I: number of bytes to decompress */
+    uint8_t *buffer           /* O: memory for size bytes */
+)
+{
+    lzma_stream *xz = &stream->xz;
+    lzma_ret ret;
+
+    xz->next_out = buffer;
+    xz->avail_out = size;
+    while (xz->avail_out > 0)
+    {
+        if (xz->avail_in == 0 && !stream->xz_file_end)
+        {
+            xz->next_in = stream->xz_input;
+            xz->avail_in = fread (stream->xz_input, 1,
+                                  BAND_STREAM_BUFFER_SIZE, stream->file);
+            if (ferror (stream->file))
+                return ERROR;
+            if (feof (stream->file))
+                stream->xz_file_end = true;
+        }
+
+        ret = lzma_code (xz, stream->xz_file_end ? LZMA_FINISH : LZMA_RUN);
+        if (ret != LZMA_OK)
+        {
+            /* The end of the data before the bytes is an error too */
+            if (ret != LZMA_STREAM_END || xz->avail_out > 0)
+                return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_band_stream
+
+  PURPOSE:  Read bytes of a band from its compressed image file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were read.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The reads of a band have to go from its start to its end, since a
+       compressed stream cannot seek back.  The bytes between two reads,
+       and before the band, are decompressed and discarded.
+*****************************************************************************/
+int
+read_band_stream
+(
+    Band_Stream_t *stream,    /* IO: stream from open_band_stream */
+    off_t offset,             /* I: byte of the band to start at, not before
+                                    the end of the previous read */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+)
+{
+    size_t skip;
+    int status;
+
+    /* The band may start past the start of the file */
+    offset += stream->band_offset;
+    if (offset < stream->position)
+    {
+        RETURN_ERROR ("A compressed band can only be read from its start to"
+                      " its end", MODULE_NAME, ERROR);
+    }
+
+    while (stream->position < offset)
+    {
+        skip = offset - stream->position;
+        if (skip > BAND_STREAM_BUFFER_SIZE)
+            skip = BAND_STREAM_BUFFER_SIZE;
+
+        if (stream->compression == BAND_COMPRESSION_GZIP)
+            status = decompress_gzip (stream, skip, stream->skip_buffer);
+        else
+            status = decompress_xz (stream, skip, stream->skip_buffer);
+        if (status != SUCCESS)
+        {
+            RETURN_ERROR ("Failed decompressing band data", MODULE_NAME,
+                          ERROR);
+        }
+        stream->position += skip;
+    }
+
+    if (stream->compression == BAND_COMPRESSION_GZIP)
+        status = decompress_gzip (stream, size, buffer);
+    else
+        status = decompress_xz (stream, size, buffer);
+    if (status != SUCCESS)
+    {
+        RETURN_ERROR ("Failed decompressing band data", MODULE_NAME, ERROR);
+    }
+    stream->position += size;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  close_band_stream
+
+  PURPOSE:  Close a compressed image file and free its stream.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  No errors were encountered.
+      ERROR    The file failed to close.
+*****************************************************************************/
+int
+close_band_stream
+(
+    Band_Stream_t *stream     /* I: stream from open_band_stream */
+)
+{
+    int status = SUCCESS;
+
+    if (stream == NULL)
+        return SUCCESS;
+
+    if (stream->gz != NULL && gzclose (stream->gz) != Z_OK)
+        status = ERROR;
+    if (stream->file != NULL && fclose (stream->file) != 0)
+        status = ERROR;
+    lzma_end (&stream->xz);
+
+    free (stream->xz_input);
+    free (stream->skip_buffer);
+    free (stream);
+
+    return status;
+}
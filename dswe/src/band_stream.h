@@ -0,0 +1,77 @@
+
+#ifndef BAND_STREAM_H
+#define BAND_STREAM_H
+
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <zlib.h>
+#include <lzma.h>
+
+
+/* How the image file of a band is compressed */
+typedef enum
+{
+    BAND_COMPRESSION_NONE = 0,
+    BAND_COMPRESSION_GZIP,    /* .gz or .tgz, read through zlib */
+    BAND_COMPRESSION_XZ       /* .xz, read through liblzma */
+} Band_Compression_e;
+
+
+/* Structure for a band image file decompressed as a stream.  The band can
+   only be read from start to end, skipping forward over what is not
+   needed. */
+typedef struct
+{
+    Band_Compression_e compression; /* How the file is compressed */
+    gzFile gz;            /* The file, when gzip compressed */
+    FILE *file;           /* The file, when xz compressed */
+    lzma_stream xz;       /* Decoder, when xz compressed */
+    uint8_t *xz_input;    /* Compressed data read from the file for the
+                             decoder */
+    bool xz_file_end;     /* All of the file was given to the decoder */
+    uint8_t *skip_buffer; /* Decompressed data skipped over */
+    off_t band_offset;    /* Offset of the band in the decompressed file,
+                             non zero for a member of a tar archive */
+    off_t position;       /* Bytes of the file decompressed so far */
+} Band_Stream_t;
+
+
+Band_Compression_e
+find_band_compression
+(
+    const char *filename      /* I: name of the image file */
+);
+
+
+Band_Stream_t *
+open_band_stream
+(
+    const char *filename,     /* I: name of a gzip or xz compressed image
+                                    file */
+    off_t band_offset         /* I: offset of the band in the decompressed
+                                    file */
+);
+
+
+int
+read_band_stream
+(
+    Band_Stream_t *stream,    /* IO: stream from open_band_stream */
+    off_t offset,             /* I: byte of the band to start at, not before
+                                    the end of the previous read */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+);
+
+
+int
+close_band_stream
+(
+    Band_Stream_t *stream     /* I: stream from open_band_stream */
+);
+
+
+#endif /* BAND_STREAM_H */
@@ -1,17 +1,88 @@
+#include <stdlib.h>
 #include <math.h>
 #include <stdint.h>
 
+#include "const.h"
+#include "build_hillshade_band.h"
+#include "gradient_operator.h"
+#include "terrain_kernels.h"
+
+
+/* Shade value for the gradients scaled to the 0 to 255 output range; see
+   hillshade_row for the derivation */
+static inline uint8_t scaled_shade
+(
+    float x_slope,        /* I: slope at this point in east/west direction */
+    float y_slope,        /* I: slope at this point in north/south direction */
+    float sun_term,       /* I: sin(sun_elevation) */
+    float x_term,         /* I: cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term          /* I: cos(sun_elevation) * cos(solar_azimuth) */
+)
+{
+    float relief;         /* shaded relief value at this point */
+    float scaled;         /* shaded relief scaled to the output range */
+
+    /* Compute the shade value */
+    relief = (sun_term + x_slope * x_term - y_slope * y_term)
+        / sqrtf (1.0f + x_slope * x_slope + y_slope * y_slope);
+
+    /* Scale the shaded relief values from 0.0 to 1.0 to 0 to 255, with the
+       rounding folded into the truncating conversion */
+    scaled = 254.0f * relief + 1.5f;
+    scaled = (relief > 0.0f) ? scaled : 0.0f;
+
+    return (uint8_t) scaled;
+}
+
+
+/* Whether the hillshade value for the gradients is above the threshold,
+   tested without the division, square root, or scaling; see
+   hillshade_mask_row */
+static inline uint8_t exceeds_threshold
+(
+    float x_slope,        /* I: slope at this point in east/west direction */
+    float y_slope,        /* I: slope at this point in north/south direction */
+    float sun_term,       /* I: sin(sun_elevation) */
+    float x_term,         /* I: cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term,         /* I: cos(sun_elevation) * cos(solar_azimuth) */
+    float threshold_squared /* I: squared shade threshold */
+)
+{
+    float numerator;      /* numerator of the shade value */
+    float denominator_squared; /* squared denominator of the shade value */
+
+    numerator = sun_term + x_slope * x_term - y_slope * y_term;
+    denominator_squared = 1.0f + x_slope * x_slope + y_slope * y_slope;
+
+    return (numerator > 0.0f)
+           & (numerator * numerator >= threshold_squared * denominator_squared);
+}
+
+
+/* Sun terms of the shade computation, which are constant for a scene */
+static void sun_terms
+(
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth,  /* I: solar azimuth angle in radians */
+    float *sun_term,      /* O: sin(sun_elevation) */
+    float *x_term,        /* O: cos(sun_elevation) * sin(solar_azimuth) */
+    float *y_term         /* O: cos(sun_elevation) * cos(solar_azimuth) */
+)
+{
+    *sun_term = sin (sun_elevation);
+    *x_term = cos (sun_elevation) * sin (solar_azimuth);
+    *y_term = cos (sun_elevation) * cos (solar_azimuth);
+}
+
+
 /******************************************************************************
- * MODULE:  hillshade
+ * MODULE:  hillshade_row
  *
  * PURPOSE:  Performs the hillshade algorithm (from GDALDEM) to compute the
- * shaded relief for the current 3x3 window.
+ * shaded relief for every interior sample of one line of the DEM.
  *
  * RETURN VALUE:
- * Type = float 
- * Value      Description
- * -----      -----------
- *  0.0 - 1.0  Represents the shaded relief for the current pixel area
+ * Type = None
  *
  *  PROJECT:  Land Satellites Data System Science Research and Development 
  *  (LSRD) at the USGS EROS
@@ -21,86 +92,283 @@
  *  --------    ---------------  -------------------------------------
  *  12/31/2012  Gail Schmidt     Original Development (based on GDALHillshade
  *                               algorithm in GDALDEM v1.9.2)
- *                               2/1/2013    Gail Schmidt     
- *                               The north/south resolution needs to indicate
- *                               that we decrease in meters as we go from the
- *                               top to the bottom of the image.  Thus the 
- *                               ns_resolution needs to be negative or the 
- *                               slope is incorrect.
- *                               2/1/2013    Gail Schmidt     Added z scaling 
- *                               for Horn's algorithm.
- *
- *                               NOTES:
- *                               1. Algorithm is based on Lambert's cosine law 
- *                               using Horn's algorithm for calculating the
- *                               slope of the current point.  The other option 
- *                               is to use Zevenbergen and Thorn's algorithm.
- *                               The literature suggests Zevenbergen and Thorne
- *                               to be more suited to smooth landscapes, 
- *                               whereas Horn's formulai to perform better on
- *                               rougher terrain.
- *                               2. Input and output arrays are 1D arrays of 
- *                               size 3 lines x 3 samples where the 3x3 indices
- *                               are and the current pixel being processed is 4.
- *                               0 1 2
- *                               3 4 5
- *                               6 7 8
+ *
+ *  NOTES:
+ *  1. Algorithm is based on Lambert's cosine law using Horn's algorithm for
+ *     calculating the slope of the current point.  With the z scaling folded
+ *     in, the Horn gradients are
+ *         p = ((w0 + 2w3 + w6) - (w2 + 2w5 + w8)) / (8 * ew_resolution)
+ *         q = ((w0 + 2w1 + w2) - (w6 + 2w7 + w8)) / (8 * ns_resolution)
+ *     where w0..w8 is the 3x3 window around the current pixel (w4).  The
+ *     GDALDEM formula
+ *         (sin(elev) - cos(elev) * sqrt(p*p + q*q) * sin(aspect - azimuth))
+ *           / sqrt(1 + p*p + q*q)
+ *     with aspect = atan2(q, p) expands, since sqrt(p*p + q*q) * sin(aspect)
+ *     is q and sqrt(p*p + q*q) * cos(aspect) is p, to
+ *         (sin(elev) + p * cos(elev) * sin(azimuth)
+ *                    - q * cos(elev) * cos(azimuth)) / sqrt(1 + p*p + q*q)
+ *     so the sun terms are computed once per band and each pixel costs a dot
+ *     product and one reciprocal square root.
+ *  2. The loop body is branch free so the compiler can vectorize it across
+ *     the samples of the line.
+ *  3. The gradient operator is selected per run (Horn's by default); the
+ *     samples at the edges are not processed since its window is not
+ *     available for them.
  ******************************************************************************/
-float hillshade
+static void hillshade_row
 (
-    double *elevation_window, /* I: 3x3 array of elevation values in meters */
-    float ew_resolution,  /* I: east/west resolution of the elevation data in
-                                meters */
-    float ns_resolution,  /* I: north/south resolution of the elevation data in
-                                meters */
-    float sun_elevation,  /* I: sun elevation angle in radians; 0 deg at the
-                                horizon and 90 deg if directly above the DEM */
-    float solar_azimuth   /* I: solar azimuth angle in radians; 0 deg=North,
-                                90 deg=East, 180 deg=South, 270 deg=West */
+    const int *restrict x_sum, /* I: east/west gradient sums for the line */
+    const int *restrict y_sum, /* I: north/south gradient sums for the line */
+    int margin,           /* I: samples at each end of the line the window
+                                does not fit around */
+    int num_samples,      /* I: number of samples of data */
+    float x_scale,        /* I: 1 / (divisor * east/west resolution) */
+    float y_scale,        /* I: 1 / (divisor * north/south resolution) */
+    float sun_term,       /* I: sin(sun_elevation) */
+    float x_term,         /* I: cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term,         /* I: cos(sun_elevation) * cos(solar_azimuth) */
+    uint8_t *restrict shaded_relief /* O: shaded relief for the line */
 )
 {
+    int sample;           /* sample being processed */
     float x_slope;        /* slope at this point in east/west direction */
     float y_slope;        /* slope at this point in north/south direction */
-    float xx_plus_yy;     /* value of x * x + y * y */
-    float aspect;         /* aspect at this point in radians */
-    float relief;         /* shaded relief value at this point */
-    float z_scale = 0.125; /* constant from GDAL for Horn algorithm (1/8) */
-
-    /* Since the data goes from west to east, leave the ew_resolution as 
-       positive. However since the data goes from north to south, we need to 
-       negate the ns_resolution. */
-    ns_resolution = -ns_resolution;
-
-    /* Compute the slope */
-    x_slope = ((elevation_window[0] 
-                + 2.0 * elevation_window[3] + elevation_window[6]) -
-               (elevation_window[2] + 2.0 * elevation_window[5] 
-                + elevation_window[8])) / ew_resolution;
-    y_slope = ((elevation_window[6] + 2.0 * elevation_window[7] 
-                + elevation_window[8]) -
-               (elevation_window[0] + 2.0 * elevation_window[1] 
-                + elevation_window[2])) / ns_resolution;
-    xx_plus_yy = x_slope * x_slope + y_slope * y_slope;
-
-    /* Compute the aspect */
-    aspect = atan2 (y_slope, x_slope);
 
-    /* Compute the shade value */
-    relief = (sin (sun_elevation) - cos (sun_elevation) * z_scale 
-        * sqrt (xx_plus_yy) * sin (aspect - solar_azimuth)) 
-        / sqrt (1.0 + z_scale * z_scale * xx_plus_yy);
+    for (sample = margin; sample < num_samples - margin; sample++)
+    {
+        /* Compute the slope */
+        x_slope = (float) x_sum[sample] * x_scale;
+        y_slope = (float) y_sum[sample] * y_scale;
 
-    return relief;
+        shaded_relief[sample] = scaled_shade (x_slope, y_slope, sun_term,
+            x_term, y_term);
+    }
 }
 
 
 /******************************************************************************
- * MODULE:  build_hillshade_band
+ * MODULE:  gradient_row
  *
- * PURPOSE:  Computes the shaded relief based on the DEM
+ * PURPOSE:  Computes the scaled gradients (p and q in hillshade_row) for
+ * every sample of one line the window of the gradient operator fits around.
+ *
+ * RETURN VALUE:
+ * Type = None
+ ******************************************************************************/
+static void gradient_row
+(
+    const int *restrict x_sum, /* I: east/west gradient sums for the line */
+    const int *restrict y_sum, /* I: north/south gradient sums for the line */
+    int margin,           /* I: samples at each end of the line the window
+                                does not fit around */
+    int num_samples,      /* I: number of samples of data */
+    float x_scale,        /* I: 1 / (divisor * east/west resolution) */
+    float y_scale,        /* I: 1 / (divisor * north/south resolution) */
+    float *restrict x_gradient, /* O: east/west gradient for the line */
+    float *restrict y_gradient  /* O: north/south gradient for the line */
+)
+{
+    int sample;           /* sample being processed */
+
+    for (sample = margin; sample < num_samples - margin; sample++)
+    {
+        x_gradient[sample] = (float) x_sum[sample] * x_scale;
+        y_gradient[sample] = (float) y_sum[sample] * y_scale;
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  gradient_shade_row
+ *
+ * PURPOSE:  Computes the shaded relief for every interior sample of one line
+ * from previously computed gradients.
+ *
+ * RETURN VALUE:
+ * Type = None
+ ******************************************************************************/
+static void gradient_shade_row
+(
+    const float *restrict x_gradient, /* I: east/west gradient for the line */
+    const float *restrict y_gradient, /* I: north/south gradient for the line */
+    int margin,           /* I: samples at each end of the line the window
+                                did not fit around */
+    int num_samples,      /* I: number of samples of data */
+    float sun_term,       /* I: sin(sun_elevation) */
+    float x_term,         /* I: cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term,         /* I: cos(sun_elevation) * cos(solar_azimuth) */
+    uint8_t *restrict shaded_relief /* O: shaded relief for the line */
+)
+{
+    int sample;           /* sample being processed */
+
+    for (sample = margin; sample < num_samples - margin; sample++)
+    {
+        shaded_relief[sample] = scaled_shade (x_gradient[sample],
+            y_gradient[sample], sun_term, x_term, y_term);
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  hillshade_mask_threshold
+ *
+ * PURPOSE:  Converts the hillshade threshold (0 to 255) into the squared shade
+ * threshold used by exceeds_threshold.
+ *
+ * RETURN VALUE:
+ * Type = float
+ *
+ *  NOTES:
+ *  1. The hillshade value is 0 for a shade at or below 0, otherwise the shade
+ *     scaled by 254, offset by 1.5 and truncated.  So the value is above a
+ *     threshold of 0 exactly when the shade is above 0, and above a threshold
+ *     of 1 to 254 exactly when the shade is at least (threshold - 0.5) / 254.
+ *     A threshold of 255 is never exceeded, which a squared threshold above
+ *     1 gives since the shade is at most 1.
+ ******************************************************************************/
+static float hillshade_mask_threshold
+(
+    int hillshade_threshold /* I: hillshade value to exceed (0 to 255) */
+)
+{
+    float shade_threshold; /* shade value the hillshade threshold maps to */
+
+    if (hillshade_threshold <= 0)
+        return 0.0f;
+    if (hillshade_threshold >= 255)
+        return 2.0f;
+
+    shade_threshold = (hillshade_threshold - 0.5f) / 254.0f;
+
+    return shade_threshold * shade_threshold;
+}
+
+
+/******************************************************************************
+ * MODULE:  hillshade_mask_row
+ *
+ * PURPOSE:  Flags every interior sample of one line of the DEM whose
+ * hillshade value is above the threshold.
+ *
+ * RETURN VALUE:
+ * Type = None
+ *
+ *  NOTES:
+ *  1. With the shade being numerator / sqrt(denominator_squared) (see
+ *     hillshade_row), shade >= threshold is tested as numerator > 0 and
+ *     numerator^2 >= threshold^2 * denominator_squared.
+ ******************************************************************************/
+static void hillshade_mask_row
+(
+    const int *restrict x_sum, /* I: east/west gradient sums for the line */
+    const int *restrict y_sum, /* I: north/south gradient sums for the line */
+    int margin,           /* I: samples at each end of the line the window
+                                does not fit around */
+    int num_samples,      /* I: number of samples of data */
+    float x_scale,        /* I: 1 / (divisor * east/west resolution) */
+    float y_scale,        /* I: 1 / (divisor * north/south resolution) */
+    float sun_term,       /* I: sin(sun_elevation) */
+    float x_term,         /* I: cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term,         /* I: cos(sun_elevation) * cos(solar_azimuth) */
+    float threshold_squared, /* I: squared shade threshold */
+    uint8_t *restrict flags  /* O: 1 where the threshold is exceeded */
+)
+{
+    int sample;           /* sample being processed */
+    float x_slope;        /* slope at this point in east/west direction */
+    float y_slope;        /* slope at this point in north/south direction */
+
+    for (sample = margin; sample < num_samples - margin; sample++)
+    {
+        x_slope = (float) x_sum[sample] * x_scale;
+        y_slope = (float) y_sum[sample] * y_scale;
+
+        flags[sample] = exceeds_threshold (x_slope, y_slope, sun_term, x_term,
+            y_term, threshold_squared);
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  gradient_mask_row
+ *
+ * PURPOSE:  Flags every interior sample of one line whose hillshade value,
+ * from previously computed gradients, is above the threshold.
  *
  * RETURN VALUE:
  * Type = None
+ ******************************************************************************/
+static void gradient_mask_row
+(
+    const float *restrict x_gradient, /* I: east/west gradient for the line */
+    const float *restrict y_gradient, /* I: north/south gradient for the line */
+    int margin,           /* I: samples at each end of the line the window
+                                did not fit around */
+    int num_samples,      /* I: number of samples of data */
+    float sun_term,       /* I: sin(sun_elevation) */
+    float x_term,         /* I: cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term,         /* I: cos(sun_elevation) * cos(solar_azimuth) */
+    float threshold_squared, /* I: squared shade threshold */
+    uint8_t *restrict flags  /* O: 1 where the threshold is exceeded */
+)
+{
+    int sample;           /* sample being processed */
+
+    for (sample = margin; sample < num_samples - margin; sample++)
+    {
+        flags[sample] = exceeds_threshold (x_gradient[sample],
+            y_gradient[sample], sun_term, x_term, y_term, threshold_squared);
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  pack_mask_row
+ *
+ * PURPOSE:  Packs the per sample flags of one line into the bits of the
+ * hillshade mask line.
+ *
+ * RETURN VALUE:
+ * Type = None
+ *
+ *  NOTES:
+ *  1. The flags array must hold HILLSHADE_MASK_LINE_BYTES(num_samples) * 8
+ *     values, with the ones past the end of the line zero.
+ ******************************************************************************/
+static void pack_mask_row
+(
+    const uint8_t *restrict flags, /* I: 0 or 1 per sample */
+    int num_samples,               /* I: number of samples of data */
+    uint8_t *restrict mask_line    /* O: packed mask for the line */
+)
+{
+    int mask_byte;        /* byte of the mask line being packed */
+    int bit;              /* bit of the mask byte being packed */
+    uint8_t bits;         /* packed bits for the mask byte */
+
+    for (mask_byte = 0; mask_byte < HILLSHADE_MASK_LINE_BYTES (num_samples);
+         mask_byte++)
+    {
+        bits = 0;
+        for (bit = 0; bit < 8; bit++)
+            bits |= flags[mask_byte * 8 + bit] << bit;
+
+        mask_line[mask_byte] = bits;
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  build_hillshade_band
+ *
+ * PURPOSE:  Computes the shaded relief based on the DEM
+ *
+ * RETURN VALUE:  Type = int
+ *     Value    Description
+ *     -------  ---------------------------------------------------------------
+ *     SUCCESS  Successfully created the shaded relief.
+ *     ERROR    Failed to allocate memory for the work rows.
  *
  * PROJECT:  Land Satellites Data System Science Research and Development (LSRD)
  * at the USGS EROS
@@ -124,7 +392,7 @@ float hillshade
  *      provided surrounding each pixel, thus the extra line(s) of data.
  *    3. Output mask arrays are 1D arrays of size num_lines * num_samples.
  ******************************************************************************/
-void build_hillshade_band
+int build_hillshade_band
 (
     int16_t *dem,        /* I: array of DEM values in meters (num_lines+[1or2] x
                                num_samples values - see NOTES);  if processing
@@ -134,10 +402,10 @@ void build_hillshade_band
                                at the end will not be available */
     int num_lines,       /* I: number of lines of data  */
     int num_samples,     /* I: number of samples of data */
-    double ew_resolution, /* I: east/west resolution of the elevation data in
-                               meters */
-    double ns_resolution, /* I: north/south resolution of the elevation data in
-                               meters */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        gradients */
     float sun_elevation, /* I: sun elevation angle in radians */
     float solar_azimuth, /* I: solar azimuth angle in radians */
     uint8_t *shaded_relief /* O: array of shaded relief values (multiplied
@@ -146,52 +414,348 @@ void build_hillshade_band
 )
 {
     int line;              /* line being processed */
-    int sample;            /* sample being processed */
-    int current_pixel;     /* current input pixel being processed */
-    int output_pixel;      /* current output pixel being processed */
-    float shade;           /* shaded relief value for the current pixel */
-    double elevation_window[9]; /* 3x3 window of elevation values surrounding 
-                              the current pixel */
-
-    /* Don't process the first and last lines and first and last
-       samples of the DEM since we can't determine what the preceding
-       and following values are */
-    for (line = 1; line < num_lines - 1; line++)
+    int output_pixel;      /* first pixel of the line being processed */
+    int margin = gradient_operator->margin;
+    float x_scale;         /* x gradient scaling for the resolution */
+    float y_scale;         /* y gradient scaling for the resolution */
+    float sun_term;        /* sin(sun_elevation) */
+    float x_term;          /* cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term;          /* cos(sun_elevation) * cos(solar_azimuth) */
+    int *gradient_sums;    /* work rows for the gradient sums */
+    int *x_sum;            /* east/west gradient sums for the line */
+    int *y_sum;            /* north/south gradient sums for the line */
+
+    gradient_sums = allocate_gradient_sums (num_samples);
+    if (gradient_sums == NULL)
+        return ERROR;
+
+    /* The sun position is constant for the scene so compute its
+       contribution to the shade once */
+    sun_terms (sun_elevation, solar_azimuth, &sun_term, &x_term, &y_term);
+
+    /* Don't process the lines and samples at the edges of the DEM since we
+       can't determine what the preceding and following values are.  The
+       lines are split into one block per thread; each block reads the DEM
+       lines bordering it but writes only its own lines, so the result does
+       not depend on the thread count */
+#ifdef _OPENMP
+    #pragma omp parallel for private (output_pixel, x_scale, y_scale, \
+        x_sum, y_sum) schedule (static)
+#endif
+    for (line = margin; line < num_lines - margin; line++)
+    {
+        output_pixel = line * num_samples;
+
+        /* Fold the z scaling into the resolution scaling of the line */
+        x_scale = (1.0 / gradient_operator->divisor)
+                  / geometry->ew_resolution[line];
+        y_scale = (1.0 / gradient_operator->divisor)
+                  / geometry->ns_resolution[line];
+
+        compute_gradient_sums (gradient_operator, &dem[output_pixel],
+            num_samples, gradient_sums, &x_sum, &y_sum);
+        hillshade_row (x_sum, y_sum, margin, num_samples, x_scale, y_scale,
+            sun_term, x_term, y_term, &shaded_relief[output_pixel]);
+    }
+
+    free (gradient_sums);
+
+    return SUCCESS;
+}
+
+
+/******************************************************************************
+ * MODULE:  build_gradient_bands
+ *
+ * PURPOSE:  Computes the sun independent part of the shaded relief, the
+ * scaled gradients of the DEM, so it can be kept and reused for scenes
+ * sharing the DEM.
+ *
+ * RETURN VALUE:  Type = int
+ *     Value    Description
+ *     -------  ---------------------------------------------------------------
+ *     SUCCESS  Successfully created the gradient bands.
+ *     ERROR    Failed to allocate memory for the work rows.
+ *
+ *  NOTES:
+ *   1. The lines and samples at the edges are not written, the same as for
+ *      build_hillshade_band.
+ *   2. build_hillshade_band_from_gradients applied to these gradients gives
+ *      the same values as build_hillshade_band applied to the DEM.
+ ******************************************************************************/
+int build_gradient_bands
+(
+    int16_t *dem,         /* I: array of DEM values in meters */
+    int num_lines,        /* I: number of lines of data */
+    int num_samples,      /* I: number of samples of data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        gradients */
+    float *x_gradient,    /* O: east/west gradient of size
+                                num_lines * num_samples */
+    float *y_gradient     /* O: north/south gradient of size
+                                num_lines * num_samples */
+)
+{
+    int line;              /* line being processed */
+    int output_pixel;      /* first pixel of the line being processed */
+    int margin = gradient_operator->margin;
+    float x_scale;         /* x gradient scaling for the resolution */
+    float y_scale;         /* y gradient scaling for the resolution */
+    int *gradient_sums;    /* work rows for the gradient sums */
+    int *x_sum;            /* east/west gradient sums for the line */
+    int *y_sum;            /* north/south gradient sums for the line */
+
+    gradient_sums = allocate_gradient_sums (num_samples);
+    if (gradient_sums == NULL)
+        return ERROR;
+
+#ifdef _OPENMP
+    #pragma omp parallel for private (output_pixel, x_scale, y_scale, \
+        x_sum, y_sum) schedule (static)
+#endif
+    for (line = margin; line < num_lines - margin; line++)
     {
-        for (sample = 1; sample < num_samples - 1; sample++)
-        {
-            output_pixel = line * num_samples + sample;
-
-            /* Fill in the 3x3 elevation window surrounding the current 
-               pixel */
-            current_pixel = output_pixel - num_samples - 1;
-            elevation_window[0] = dem[current_pixel];
-            elevation_window[1] = dem[current_pixel + 1];
-            elevation_window[2] = dem[current_pixel + 2];
-            current_pixel += num_samples; 
-            elevation_window[3] = dem[current_pixel];
-            elevation_window[4] = dem[current_pixel + 1];
-            elevation_window[5] = dem[current_pixel + 2];
-            current_pixel += num_samples; 
-            elevation_window[6] = dem[current_pixel];
-            elevation_window[7] = dem[current_pixel + 1];
-            elevation_window[8] = dem[current_pixel + 2];
-
-            /* Compute the shaded relief for the current pixel */
-            shade = hillshade (elevation_window, ew_resolution, 
-                ns_resolution, sun_elevation, solar_azimuth);
-
-            /* Scale the shaded relief values from 0.0 to 1.0 to 0 to 255 */
-            if (shade <= 0.0)
-            {
-                shaded_relief[output_pixel] = 0;
-            }
-            else
-            {
-                shaded_relief[output_pixel] = (uint8_t) 
-                    (round(254.0 * shade) + 1.0);
-            }
-        }
+        output_pixel = line * num_samples;
+
+        /* Fold the z scaling into the resolution scaling of the line */
+        x_scale = (1.0 / gradient_operator->divisor)
+                  / geometry->ew_resolution[line];
+        y_scale = (1.0 / gradient_operator->divisor)
+                  / geometry->ns_resolution[line];
+
+        compute_gradient_sums (gradient_operator, &dem[output_pixel],
+            num_samples, gradient_sums, &x_sum, &y_sum);
+        gradient_row (x_sum, y_sum, margin, num_samples, x_scale, y_scale,
+            &x_gradient[output_pixel], &y_gradient[output_pixel]);
     }
+
+    free (gradient_sums);
+
+    return SUCCESS;
 }
 
+
+/******************************************************************************
+ * MODULE:  build_hillshade_band_from_gradients
+ *
+ * PURPOSE:  Computes the shaded relief from gradients previously generated by
+ * build_gradient_bands.
+ *
+ * RETURN VALUE:
+ * Type = None
+ ******************************************************************************/
+void build_hillshade_band_from_gradients
+(
+    float *x_gradient,   /* I: east/west gradient from
+                               build_gradient_bands */
+    float *y_gradient,   /* I: north/south gradient from
+                               build_gradient_bands */
+    int num_lines,       /* I: number of lines of data */
+    int num_samples,     /* I: number of samples of data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator the
+                                                        gradients are from */
+    float sun_elevation, /* I: sun elevation angle in radians */
+    float solar_azimuth, /* I: solar azimuth angle in radians */
+    uint8_t *shaded_relief /* O: array of shaded relief values of size
+                               num_lines * num_samples */
+)
+{
+    int line;              /* line being processed */
+    int output_pixel;      /* first pixel of the line being processed */
+    int margin = gradient_operator->margin;
+    float sun_term;        /* sin(sun_elevation) */
+    float x_term;          /* cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term;          /* cos(sun_elevation) * cos(solar_azimuth) */
+
+    sun_terms (sun_elevation, solar_azimuth, &sun_term, &x_term, &y_term);
+
+#ifdef _OPENMP
+    #pragma omp parallel for private (output_pixel) schedule (static)
+#endif
+    for (line = margin; line < num_lines - margin; line++)
+    {
+        output_pixel = line * num_samples;
+
+        gradient_shade_row (&x_gradient[output_pixel],
+            &y_gradient[output_pixel], margin, num_samples, sun_term, x_term,
+            y_term, &shaded_relief[output_pixel]);
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  build_hillshade_mask
+ *
+ * PURPOSE:  Computes a packed mask of the pixels whose hillshade value (as
+ * build_hillshade_band would generate it) is above the threshold, without
+ * generating the hillshade values.
+ *
+ * RETURN VALUE:  Type = int
+ *     Value    Description
+ *     -------  ---------------------------------------------------------------
+ *     SUCCESS  Successfully created the hillshade mask.
+ *     ERROR    Failed to allocate memory for the work buffers.
+ *
+ *  NOTES:
+ *   1. Each line of the mask is HILLSHADE_MASK_LINE_BYTES(num_samples) bytes
+ *      with sample s of the line in bit (s % 8) of byte (s / 8); see
+ *      HILLSHADE_MASK_IS_SET.
+ *   2. The lines and samples at the edges are left clear, matching the
+ *      0 hillshade value build_hillshade_band leaves for them.
+ *   3. The test is exact in real arithmetic; in floating point a pixel whose
+ *      shade is within rounding of the threshold may go either way.
+ ******************************************************************************/
+int build_hillshade_mask
+(
+    int16_t *dem,         /* I: array of DEM values in meters */
+    int num_lines,        /* I: number of lines of data */
+    int num_samples,      /* I: number of samples of data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        gradients */
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth,  /* I: solar azimuth angle in radians */
+    int hillshade_threshold, /* I: hillshade value to exceed (0 to 255) */
+    uint8_t *hillshade_mask  /* O: packed mask of num_lines *
+                                   HILLSHADE_MASK_LINE_BYTES(num_samples)
+                                   bytes */
+)
+{
+    int line;              /* line being processed */
+    int output_pixel;      /* first pixel of the line being processed */
+    int line_bytes;        /* bytes per line of the mask */
+    int margin = gradient_operator->margin;
+    float x_scale;         /* x gradient scaling for the resolution */
+    float y_scale;         /* y gradient scaling for the resolution */
+    float sun_term;        /* sin(sun_elevation) */
+    float x_term;          /* cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term;          /* cos(sun_elevation) * cos(solar_azimuth) */
+    float threshold_squared; /* squared shade threshold */
+    int flags_size;        /* size of the flags of one thread */
+    uint8_t *flags;        /* per sample flags of each thread */
+    uint8_t *line_flags;   /* flags for the line being processed */
+    int *gradient_sums;    /* work rows for the gradient sums */
+    int *x_sum;            /* east/west gradient sums for the line */
+    int *y_sum;            /* north/south gradient sums for the line */
+
+    line_bytes = HILLSHADE_MASK_LINE_BYTES (num_samples);
+
+    /* The edge samples and the padding at the end of the line stay 0 */
+    flags_size = line_bytes * 8;
+    flags = calloc (line_thread_count () * flags_size, sizeof (uint8_t));
+    gradient_sums = allocate_gradient_sums (num_samples);
+    if (flags == NULL || gradient_sums == NULL)
+    {
+        free (flags);
+        free (gradient_sums);
+        return ERROR;
+    }
+
+    sun_terms (sun_elevation, solar_azimuth, &sun_term, &x_term, &y_term);
+    threshold_squared = hillshade_mask_threshold (hillshade_threshold);
+
+#ifdef _OPENMP
+    #pragma omp parallel for private (output_pixel, line_flags, x_scale, \
+        y_scale, x_sum, y_sum) schedule (static)
+#endif
+    for (line = margin; line < num_lines - margin; line++)
+    {
+        output_pixel = line * num_samples;
+        line_flags = &flags[line_thread_index () * flags_size];
+
+        /* Fold the z scaling into the resolution scaling of the line */
+        x_scale = (1.0 / gradient_operator->divisor)
+                  / geometry->ew_resolution[line];
+        y_scale = (1.0 / gradient_operator->divisor)
+                  / geometry->ns_resolution[line];
+
+        compute_gradient_sums (gradient_operator, &dem[output_pixel],
+            num_samples, gradient_sums, &x_sum, &y_sum);
+        hillshade_mask_row (x_sum, y_sum, margin, num_samples, x_scale,
+            y_scale, sun_term, x_term, y_term, threshold_squared, line_flags);
+        pack_mask_row (line_flags, num_samples,
+            &hillshade_mask[line * line_bytes]);
+    }
+
+    free (flags);
+    free (gradient_sums);
+
+    return SUCCESS;
+}
+
+
+/******************************************************************************
+ * MODULE:  build_hillshade_mask_from_gradients
+ *
+ * PURPOSE:  Computes the packed hillshade mask (see build_hillshade_mask) from
+ * gradients previously generated by build_gradient_bands.
+ *
+ * RETURN VALUE:  Type = int
+ *     Value    Description
+ *     -------  ---------------------------------------------------------------
+ *     SUCCESS  Successfully created the hillshade mask.
+ *     ERROR    Failed to allocate memory for the work buffers.
+ ******************************************************************************/
+int build_hillshade_mask_from_gradients
+(
+    float *x_gradient,   /* I: east/west gradient from
+                               build_gradient_bands */
+    float *y_gradient,   /* I: north/south gradient from
+                               build_gradient_bands */
+    int num_lines,       /* I: number of lines of data */
+    int num_samples,     /* I: number of samples of data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator the
+                                                        gradients are from */
+    float sun_elevation, /* I: sun elevation angle in radians */
+    float solar_azimuth, /* I: solar azimuth angle in radians */
+    int hillshade_threshold, /* I: hillshade value to exceed (0 to 255) */
+    uint8_t *hillshade_mask  /* O: packed mask of num_lines *
+                                   HILLSHADE_MASK_LINE_BYTES(num_samples)
+                                   bytes */
+)
+{
+    int line;              /* line being processed */
+    int output_pixel;      /* first pixel of the line being processed */
+    int line_bytes;        /* bytes per line of the mask */
+    int margin = gradient_operator->margin;
+    float sun_term;        /* sin(sun_elevation) */
+    float x_term;          /* cos(sun_elevation) * sin(solar_azimuth) */
+    float y_term;          /* cos(sun_elevation) * cos(solar_azimuth) */
+    float threshold_squared; /* squared shade threshold */
+    int flags_size;        /* size of the flags of one thread */
+    uint8_t *flags;        /* per sample flags of each thread */
+    uint8_t *line_flags;   /* flags for the line being processed */
+
+    line_bytes = HILLSHADE_MASK_LINE_BYTES (num_samples);
+
+    flags_size = line_bytes * 8;
+    flags = calloc (line_thread_count () * flags_size, sizeof (uint8_t));
+    if (flags == NULL)
+        return ERROR;
+
+    sun_terms (sun_elevation, solar_azimuth, &sun_term, &x_term, &y_term);
+    threshold_squared = hillshade_mask_threshold (hillshade_threshold);
+
+#ifdef _OPENMP
+    #pragma omp parallel for private (output_pixel, line_flags) \
+        schedule (static)
+#endif
+    for (line = margin; line < num_lines - margin; line++)
+    {
+        output_pixel = line * num_samples;
+        line_flags = &flags[line_thread_index () * flags_size];
+
+        gradient_mask_row (&x_gradient[output_pixel],
+            &y_gradient[output_pixel], margin, num_samples, sun_term, x_term,
+            y_term, threshold_squared, line_flags);
+        pack_mask_row (line_flags, num_samples,
+            &hillshade_mask[line * line_bytes]);
+    }
+
+    free (flags);
+
+    return SUCCESS;
+}
@@ -7,19 +7,92 @@
 #include <stdint.h>
 
 
-void build_hillshade_band
+#include "gradient_operator.h"
+#include "dem_grid.h"
+
+
+/* Number of bytes per line of the packed hillshade mask */
+#define HILLSHADE_MASK_LINE_BYTES(num_samples) (((num_samples) + 7) / 8)
+
+/* Whether the hillshade mask is set for the line and sample */
+#define HILLSHADE_MASK_IS_SET(mask, line_bytes, line, sample) \
+    (((mask)[(line) * (line_bytes) + ((sample) >> 3)] >> ((sample) & 7)) & 1)
+
+int build_hillshade_band
 (
     int16_t *band_dem,    /* I: the elevation data to use in meters */
     int num_lines,        /* I: the number of lines in the data */
     int num_samples,      /* I: the number of samples in the data */
-    double ew_resolution, /* I: east/west resolution of the elevation data in
-                                meters */
-    double ns_resolution, /* I: north/south resolution of the elevation data
-                                in meters */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        gradients */
     float sun_elevation,  /* I: sun elevation angle in radians */
     float solar_azimuth,  /* I: solar azimuth angle in radians */
     uint8_t *band_hillshade /* O: the hillshade band generated from the DEM */
 );
 
 
+int build_gradient_bands
+(
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        gradients */
+    float *x_gradient,    /* O: the east/west gradient */
+    float *y_gradient     /* O: the north/south gradient */
+);
+
+
+void build_hillshade_band_from_gradients
+(
+    float *x_gradient,    /* I: the east/west gradient */
+    float *y_gradient,    /* I: the north/south gradient */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator the
+                                                        gradients are from */
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth,  /* I: solar azimuth angle in radians */
+    uint8_t *band_hillshade /* O: the hillshade band generated from the
+                                  gradients */
+);
+
+
+int build_hillshade_mask
+(
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        gradients */
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth,  /* I: solar azimuth angle in radians */
+    int hillshade_threshold, /* I: hillshade value to exceed (0 to 255) */
+    uint8_t *hillshade_mask  /* O: packed mask of the pixels above the
+                                   threshold */
+);
+
+
+int build_hillshade_mask_from_gradients
+(
+    float *x_gradient,    /* I: the east/west gradient */
+    float *y_gradient,    /* I: the north/south gradient */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator the
+                                                        gradients are from */
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth,  /* I: solar azimuth angle in radians */
+    int hillshade_threshold, /* I: hillshade value to exceed (0 to 255) */
+    uint8_t *hillshade_mask  /* O: packed mask of the pixels above the
+                                   threshold */
+);
+
+
 #endif /* BUILD_HILLSHADE_H */
@@ -0,0 +1,316 @@
+
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "const.h"
+#include "build_horizon_band.h"
+#include "terrain_kernels.h"
+
+
+/* Layout of the profiles swept across the DEM.  The profiles step one pixel
+   at a time along the primary axis, which is the axis (lines or samples) the
+   direction away from the sun is closest to, and drift along the secondary
+   axis. */
+typedef struct
+{
+    int primary_count;    /* Pixels along the primary axis */
+    int primary_start;    /* First primary index, on the side toward the
+                             sun */
+    int primary_step;     /* Primary index step away from the sun (1 or -1) */
+    int primary_stride;   /* Array stride of the primary axis */
+    int secondary_count;  /* Pixels along the secondary axis */
+    int secondary_stride; /* Array stride of the secondary axis */
+    double shift;         /* Secondary pixels of drift per primary step */
+    double step_length;   /* Ground distance in meters per primary step */
+} Sweep_Layout_t;
+
+
+/******************************************************************************
+ * MODULE:  horizon_sector
+ *
+ * PURPOSE:  Determines the azimuth sector the solar azimuth falls in.
+ *
+ * RETURN VALUE:  Type = int
+ *     The sector, 0 to HORIZON_SECTOR_COUNT - 1, whose center is nearest the
+ *     solar azimuth.
+ ******************************************************************************/
+int horizon_sector
+(
+    float solar_azimuth   /* I: solar azimuth angle in radians */
+)
+{
+    double sector_width = 2.0 * M_PI / HORIZON_SECTOR_COUNT;
+    int sector;
+
+    sector = (int) floor (solar_azimuth / sector_width + 0.5)
+             % HORIZON_SECTOR_COUNT;
+    if (sector < 0)
+        sector += HORIZON_SECTOR_COUNT;
+
+    return sector;
+}
+
+
+/******************************************************************************
+ * MODULE:  horizon_sector_azimuth
+ *
+ * PURPOSE:  Determines the azimuth of the center of an azimuth sector.
+ *
+ * RETURN VALUE:  Type = double
+ *     The azimuth in radians.
+ ******************************************************************************/
+double horizon_sector_azimuth
+(
+    int sector            /* I: azimuth sector from horizon_sector */
+)
+{
+    return sector * 2.0 * M_PI / HORIZON_SECTOR_COUNT;
+}
+
+
+/******************************************************************************
+ * MODULE:  horizon_angle_threshold
+ *
+ * PURPOSE:  Converts the sun elevation to the units of the horizon angle
+ * band.  A pixel is in cast shadow when its horizon angle is greater than the
+ * threshold.
+ *
+ * RETURN VALUE:  Type = int16_t
+ *     The sun elevation in hundredths of a degree.
+ ******************************************************************************/
+int16_t horizon_angle_threshold
+(
+    float sun_elevation   /* I: sun elevation angle in radians */
+)
+{
+    return (int16_t) lround (sun_elevation / RAD * HORIZON_ANGLE_SCALE);
+}
+
+
+/******************************************************************************
+ * MODULE:  sweep_layout
+ *
+ * PURPOSE:  Sets up the profiles for sweeping the DEM away from the sun.
+ *
+ * RETURN VALUE:  None
+ ******************************************************************************/
+static void sweep_layout
+(
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    double ew_resolution, /* I: east/west resolution in meters */
+    double ns_resolution, /* I: north/south resolution in meters */
+    double solar_azimuth, /* I: solar azimuth angle in radians */
+    Sweep_Layout_t *layout /* O: layout of the profiles */
+)
+{
+    double east = sin (solar_azimuth);   /* east component toward the sun */
+    double north = cos (solar_azimuth);  /* north component toward the sun */
+
+    if (fabs (east) * ns_resolution <= fabs (north) * ew_resolution)
+    {
+        /* Step lines, drifting less than a sample per line; lines increase
+           to the south */
+        layout->primary_count = num_lines;
+        layout->primary_start = (north > 0.0) ? 0 : num_lines - 1;
+        layout->primary_step = (north > 0.0) ? 1 : -1;
+        layout->primary_stride = num_samples;
+        layout->secondary_count = num_samples;
+        layout->secondary_stride = 1;
+        layout->shift = -east * ns_resolution / (fabs (north) * ew_resolution);
+        layout->step_length = ns_resolution / fabs (north);
+    }
+    else
+    {
+        /* Step samples, drifting less than a line per sample */
+        layout->primary_count = num_samples;
+        layout->primary_start = (east > 0.0) ? num_samples - 1 : 0;
+        layout->primary_step = (east > 0.0) ? -1 : 1;
+        layout->primary_stride = 1;
+        layout->secondary_count = num_lines;
+        layout->secondary_stride = num_samples;
+        layout->shift = north * ew_resolution / (fabs (east) * ns_resolution);
+        layout->step_length = ew_resolution / fabs (east);
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  horizon_profile
+ *
+ * PURPOSE:  Computes the horizon angle toward the sun for every pixel of one
+ * profile.
+ *
+ * RETURN VALUE:  None
+ *
+ * NOTES:
+ *   1. The profile is walked away from the sun while keeping the upper convex
+ *      hull of the elevations already passed.  The point of the hull next to
+ *      the current pixel is the one seen at the highest angle from it, and
+ *      hull points dropped while adding the pixel can never be the highest
+ *      for pixels further along, so each pixel is pushed and popped at most
+ *      once.
+ ******************************************************************************/
+static void horizon_profile
+(
+    int16_t *band_dem,    /* I: the elevation data in meters */
+    const Sweep_Layout_t *layout, /* I: layout of the profiles */
+    const int *offsets,   /* I: secondary drift of each primary step */
+    int start,            /* I: secondary index of the profile at the first
+                                primary step */
+    double *hull_distance, /* I: work array of primary_count entries */
+    double *hull_height,  /* I: work array of primary_count entries */
+    int16_t *band_horizon /* O: the horizon angle band */
+)
+{
+    int step;             /* primary step along the profile */
+    int secondary;        /* secondary index of the pixel */
+    int hull_count = 0;   /* number of points on the hull */
+    size_t pixel;         /* index of the pixel */
+    double distance;      /* distance of the pixel along the profile */
+    double height;        /* elevation of the pixel */
+    double angle;         /* horizon angle of the pixel in degrees */
+
+    for (step = 0; step < layout->primary_count; step++)
+    {
+        secondary = start + offsets[step];
+        if (secondary < 0 || secondary >= layout->secondary_count)
+        {
+            /* The drift is monotonic, so once off the DEM the profile does
+               not come back */
+            if (hull_count > 0)
+                break;
+            continue;
+        }
+
+        pixel = (size_t) (layout->primary_start
+                          + step * layout->primary_step)
+                * layout->primary_stride
+                + (size_t) secondary * layout->secondary_stride;
+        distance = step * layout->step_length;
+        height = band_dem[pixel];
+
+        /* Drop the top of the hull while it is on or below the line from the
+           pixel to the point before it */
+        while (hull_count >= 2
+               && (hull_height[hull_count - 2] - height)
+                  * (distance - hull_distance[hull_count - 1])
+                  >= (hull_height[hull_count - 1] - height)
+                     * (distance - hull_distance[hull_count - 2]))
+        {
+            hull_count--;
+        }
+
+        if (hull_count == 0)
+            band_horizon[pixel] = HORIZON_ANGLE_NONE;
+        else
+        {
+            angle = atan2 (hull_height[hull_count - 1] - height,
+                           distance - hull_distance[hull_count - 1]) / RAD;
+            band_horizon[pixel] = (int16_t) lround (angle
+                                                    * HORIZON_ANGLE_SCALE);
+        }
+
+        hull_distance[hull_count] = distance;
+        hull_height[hull_count] = height;
+        hull_count++;
+    }
+}
+
+
+/******************************************************************************
+ * MODULE:  build_horizon_band
+ *
+ * PURPOSE:  Computes for every pixel of the DEM the angle above the horizontal
+ * of the terrain seen looking toward the sun.  A pixel is in cast shadow when
+ * the sun is lower than its horizon angle (see horizon_angle_threshold), which
+ * covers the valleys shadowed by distant ridges that the local hillshade test
+ * misses.
+ *
+ * RETURN VALUE:  Type = int
+ *     Value    Description
+ *     -------  ---------------------------------------------------------------
+ *     SUCCESS  Successfully created the horizon angle band.
+ *     ERROR    Failed to allocate memory for the work buffers.
+ *
+ * NOTES:
+ *   1. The DEM is swept with parallel profiles along the solar azimuth, each
+ *      pixel falling on exactly one profile, and each profile is processed in
+ *      linear time (see horizon_profile), so the whole band costs one pass
+ *      over the DEM.
+ *   2. The horizon angles only depend on the DEM and the azimuth, so they can
+ *      be cached for an azimuth sector (see horizon_sector) and reused for
+ *      every sun elevation.
+ *   3. The values are in hundredths of a degree; pixels with no terrain
+ *      toward the sun get HORIZON_ANGLE_NONE.
+ ******************************************************************************/
+int build_horizon_band
+(
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    double solar_azimuth, /* I: solar azimuth angle in radians */
+    int16_t *band_horizon /* O: the horizon angle band generated from the
+                                DEM */
+)
+{
+    Sweep_Layout_t layout; /* layout of the profiles */
+    int step;              /* primary step along the profiles */
+    int start;             /* secondary index a profile starts at */
+    int first_start;       /* secondary index of the first profile */
+    int last_start;        /* secondary index of the last profile */
+    int last_offset;       /* drift of the last primary step */
+    int *offsets;          /* secondary drift of each primary step */
+    double *hull;          /* hull work arrays of each thread */
+    double *hull_distance; /* hull distances of the calling thread */
+    double *hull_height;   /* hull heights of the calling thread */
+
+    /* The profiles are straight lines on the grid, so a geographic DEM is
+       swept with the resolution of its center line */
+    sweep_layout (num_lines, num_samples,
+                  geometry->ew_resolution[num_lines / 2],
+                  geometry->ns_resolution[num_lines / 2], solar_azimuth,
+                  &layout);
+
+    offsets = malloc (layout.primary_count * sizeof (int));
+    hull = malloc ((size_t) line_thread_count () * 2 * layout.primary_count
+                   * sizeof (double));
+    if (offsets == NULL || hull == NULL)
+    {
+        free (offsets);
+        free (hull);
+        return ERROR;
+    }
+
+    /* Every profile drifts the same, so pixel (step, secondary) is on the
+       profile starting at secondary - offsets[step] */
+    for (step = 0; step < layout.primary_count; step++)
+        offsets[step] = (int) lround (step * layout.shift);
+
+    last_offset = offsets[layout.primary_count - 1];
+    first_start = (last_offset > 0) ? -last_offset : 0;
+    last_start = layout.secondary_count - 1
+                 - ((last_offset < 0) ? last_offset : 0);
+
+#ifdef _OPENMP
+    #pragma omp parallel for private (hull_distance, hull_height) \
+        schedule (static)
+#endif
+    for (start = first_start; start <= last_start; start++)
+    {
+        hull_distance = &hull[(size_t) line_thread_index () * 2
+                              * layout.primary_count];
+        hull_height = hull_distance + layout.primary_count;
+
+        horizon_profile (band_dem, &layout, offsets, start, hull_distance,
+                         hull_height, band_horizon);
+    }
+
+    free (offsets);
+    free (hull);
+
+    return SUCCESS;
+}
@@ -0,0 +1,55 @@
+
+#ifndef BUILD_HORIZON_H
+#define BUILD_HORIZON_H
+
+
+#include <stdint.h>
+
+
+#include "dem_grid.h"
+
+
+/* The horizon angles are computed for the center of the azimuth sector the
+   sun is in, so scenes of a path/row with nearby solar azimuths can share
+   them */
+#define HORIZON_SECTOR_COUNT 72
+
+/* Horizon angles are stored in hundredths of a degree */
+#define HORIZON_ANGLE_SCALE 100
+
+/* Horizon angle of pixels with no terrain between them and the edge of the
+   DEM toward the sun, which are never shadowed */
+#define HORIZON_ANGLE_NONE (-90 * HORIZON_ANGLE_SCALE)
+
+int horizon_sector
+(
+    float solar_azimuth   /* I: solar azimuth angle in radians */
+);
+
+
+double horizon_sector_azimuth
+(
+    int sector            /* I: azimuth sector from horizon_sector */
+);
+
+
+int16_t horizon_angle_threshold
+(
+    float sun_elevation   /* I: sun elevation angle in radians */
+);
+
+
+int build_horizon_band
+(
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    double solar_azimuth, /* I: solar azimuth angle in radians */
+    int16_t *band_horizon /* O: the horizon angle band generated from the
+                                DEM */
+);
+
+
+#endif /* BUILD_HORIZON_H */
@@ -1,140 +1,200 @@
 
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <math.h>
+#include <float.h>
 
 
 #include "const.h"
+#include "build_slope_band.h"
+#include "gradient_operator.h"
+#include "dem_grid.h"
 
 
 /*****************************************************************************
-  NAME: calculate_slope_horn
+  NAME: squared_slope
 
-  PURPOSE: Performs the Horn's slope algorithm (from GDALDEM) to compute the
-           terrain slope for the current 3x3 window.
+  PURPOSE: Computes the square of the terrain slope from the gradient sums of
+           a gradient operator.
 
-  RETURN VALUE: Type = float
+  RETURN VALUE: Type = double
       Value          Description
       -------------  -------------------------------------------------------
-      0.0 - MAX_FLT  Represents the percent slope for the current pixel area
+      0.0 - MAX_FLT  Represents the squared slope for the current pixel area
 
   NOTES:
-    Original Development (based on GDALHillshade algorithm in GDALDEM v1.9.2)
-
-    1. Algorithm is based on Lambert's cosine law using Horn's algorithm for
-       calculating the slope of the current point.  The other option is to use
-       Zevenbergen and Thorn's algorithm.  The literature suggests
-       Zevenbergen and Thorne is more suited to smooth landscapes, and Horn's
-       formula performs better on rougher terrain.
-
-    2. Input and output arrays are 1D arrays of size 3 lines x 3 samples where
-       the 3x3 indices are and the current pixel being processed is 4.
-         0 1 2
-         3 4 5
-         6 7 8
+    1. The sums are exact integers and converted to double once.  The sign
+       of the gradients does not matter for the slope.
 *****************************************************************************/
-double calculate_slope_horn
+static inline double squared_slope
 (
-    double *elevation_window, /* I: 3x3 array of elevation values in meters */
-    double ew_resolution,     /* I: east/west resolution of the elevation
-                                    data in meters */
-    double ns_resolution      /* I: north/south resolution of the elevation
-                                    data in meters */
+    int x_sum,            /* I: east/west gradient sum of the pixel */
+    int y_sum,            /* I: north/south gradient sum of the pixel */
+    double x_denominator, /* I: operator divisor * east/west resolution */
+    double y_denominator  /* I: operator divisor * north/south resolution */
 )
 {
     double x_slope;
     double y_slope;
-    double ew_res;
-    double ns_res;
-    double slope;
-
-    /* Since the date goes from west to east, leave the ew_resolution as
-       positive.  However since the data goes from north to south, we need to
-       negate the ns_resolution. */
-    ew_res = ew_resolution;
-    ns_res = -ns_resolution;
-
-    /* Compute the slope */
-    x_slope = ((elevation_window[0]
-                + 2.0 * elevation_window[3]
-                + elevation_window[6])
-               - (elevation_window[2]
-                  + 2.0 * elevation_window[5]
-                  + elevation_window[8]))
-              / (8.0 * ew_res);
-
-    y_slope = ((elevation_window[6]
-                + 2.0 * elevation_window[7]
-                + elevation_window[8])
-               - (elevation_window[0]
-                  + 2.0 * elevation_window[1]
-                  + elevation_window[2]))
-              / (8.0 * ns_res);
-
-    slope = sqrt(x_slope * x_slope + y_slope * y_slope);
-
-    return slope;
+
+    x_slope = x_sum / x_denominator;
+    y_slope = y_sum / y_denominator;
+
+    return x_slope * x_slope + y_slope * y_slope;
 }
 
 
-/******************************************************************************
-MODULE:  calculate_slope_zevenbergen_thorne
-
-PURPOSE:  Performs the Zevenbergen and Thorne's slope algorithm  
-          to compute the terrain slope for the current 3x3 window.
-
-RETURN VALUE:
-Type = float 
-Value      Description
------      -----------
-0.0 - 1.000  Represents the percent slope for the current pixel area
-
-HISTORY:
-Date        Programmer       Reason
---------    ---------------  -------------------------------------
-06/21/2013  Song Guo         Original Development (based on Zevenbergen and 
-                             Thorne, 1987)
-
-NOTES:
-  1. Algorithm is based on Zevenbergen and Thorn's algorithm.  The literature 
-     suggests Zevenbergen and Thorne to be more suited to smooth landscapes, 
-     whereas Horn's formula to perform better on rougher terrain.
-  2. Input and output arrays are 1D arrays of size 3 lines x 3 samples where
-     the 3x3 indices are and the current pixel being processed is 4.
-       0 1 2
-       3 4 5
-       6 7 8
-******************************************************************************/
-double calculate_slope_zevenbergen_thorne
+/*****************************************************************************
+  NAME: percent_slope_from_squared
+
+  PURPOSE: Converts a squared slope to the percent slope stored in the
+           percent slope band.
+
+  RETURN VALUE: Type = float
+      Value          Description
+      -------------  -------------------------------------------------------
+      0.0 - MAX_FLT  Represents the percent slope for the squared slope
+*****************************************************************************/
+static inline float percent_slope_from_squared
 (
-    double *elevation_window, /* I: 3x3 array of elevation values in meters */
-    double ew_resolution,     /* I: east/west resolution of the elevation
-                                    data in meters */
-    double ns_resolution      /* I: north/south resolution of the elevation
-                                    data in meters */
+    double squared_slope  /* I: squared slope of the pixel */
 )
 {
-    double x_slope;
-    double y_slope;
-    double ew_res;
-    double ns_res;
-    double slope; /* value of -sqrt(x * x + y * y) */
+    /* Multiply by 100 to make it a percentage.  It could be greater than
+       100% after this since 1.0 is a 45 degree slope */
+    return 100.0 * sqrt(squared_slope);
+}
 
-    /* Since the data goes from west to east, leave the ew_res as positive.
-       However since the data goes from north to south, we need to negate the
-       ns_res. */
-    ew_res = ew_resolution;
-    ns_res = -ns_resolution;
 
-    /* Compute the slope */
-    x_slope = ((elevation_window[5] - elevation_window[3])) / (2.0 * ew_res);
-    y_slope = ((elevation_window[1] - elevation_window[7])) / (2.0 * ns_res);
+/*****************************************************************************
+  NAME: squared_slope_cutoff
 
-    /* The negative sign from the algorithm has been ignored as it only
-       shows the direction which down-slope is negative */
-    slope = sqrt(x_slope * x_slope +  y_slope * y_slope); 
+  PURPOSE: Finds the smallest squared slope whose percent slope (as stored in
+           the percent slope band) is at or above the threshold, so the
+           threshold can be tested on the squared slope directly.
 
-    return slope;
+  RETURN VALUE: Type = double
+      Value          Description
+      -------------  -------------------------------------------------------
+      0.0 - INF      Squared slopes at or above this value are at or above
+                     the percent slope threshold
+
+  NOTES:
+    1. The percent slope is a non-decreasing function of the squared slope
+       and the bit patterns of non-negative doubles sort the same as their
+       values, so a bisection over the bit patterns finds the exact cutoff
+       including the rounding to float.
+*****************************************************************************/
+static double squared_slope_cutoff
+(
+    float percent_slope_threshold /* I: percent slope threshold */
+)
+{
+    union
+    {
+        double value;
+        uint64_t bits;
+    } low, high, middle;
+
+    low.value = 0.0;
+    if (percent_slope_from_squared (low.value) >= percent_slope_threshold)
+        return 0.0;
+
+    high.value = DBL_MAX;
+    if (percent_slope_from_squared (high.value) < percent_slope_threshold)
+        return INFINITY;
+
+    /* low is always below the threshold and high at or above it */
+    while (high.bits - low.bits > 1)
+    {
+        middle.bits = low.bits + (high.bits - low.bits) / 2;
+        if (percent_slope_from_squared (middle.value)
+            >= percent_slope_threshold)
+        {
+            high.bits = middle.bits;
+        }
+        else
+        {
+            low.bits = middle.bits;
+        }
+    }
+
+    return high.value;
+}
+
+
+/*****************************************************************************
+  NAME: slope_class
+
+  PURPOSE: Computes the slope class code of a pixel from its squared slope.
+
+  RETURN VALUE: Type = uint8_t
+      Bit SLOPE_CLASS_* is set when the percent slope is at or above the
+      corresponding threshold.
+*****************************************************************************/
+static inline uint8_t slope_class
+(
+    double squared_slope,  /* I: squared slope of the pixel */
+    const double *cutoffs  /* I: squared slope cutoff for each slope class */
+)
+{
+    /* Written out per class so the per sample loops stay vectorizable */
+    return ((squared_slope >= cutoffs[SLOPE_CLASS_HIGH])
+            << SLOPE_CLASS_HIGH)
+           | ((squared_slope >= cutoffs[SLOPE_CLASS_MODERATE])
+              << SLOPE_CLASS_MODERATE)
+           | ((squared_slope >= cutoffs[SLOPE_CLASS_WETLAND])
+              << SLOPE_CLASS_WETLAND)
+           | ((squared_slope >= cutoffs[SLOPE_CLASS_LOW])
+              << SLOPE_CLASS_LOW);
+}
+
+
+/*****************************************************************************
+  NAME: percent_slope_row
+
+  PURPOSE: Computes the percent slope for every sample of one line of the DEM
+           the window of the gradient operator fits around.
+
+  RETURN VALUE: Type = None
+
+  NOTES:
+    1. The loops are branch free so the compiler can vectorize them across
+       the samples of the line.
+*****************************************************************************/
+static void percent_slope_row
+(
+    const Gradient_Operator_t *gradient_operator, /* I: operator to apply */
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,      /* I: the number of samples in the data */
+    double ew_resolution, /* I: east/west resolution of the line in meters */
+    double ns_resolution, /* I: north/south resolution of the line in
+                                meters */
+    int *gradient_sums,   /* I: work rows from allocate_gradient_sums */
+    float *restrict ps_line /* O: percent slope for the line */
+)
+{
+    int sample;
+    int last_sample;      /* last sample the window fits around */
+    int *x_sum;           /* east/west gradient sums for the line */
+    int *y_sum;           /* north/south gradient sums for the line */
+    double x_denominator;
+    double y_denominator;
+
+    compute_gradient_sums (gradient_operator, dem_line, num_samples,
+                           gradient_sums, &x_sum, &y_sum);
+
+    x_denominator = gradient_operator->divisor * ew_resolution;
+    y_denominator = gradient_operator->divisor * ns_resolution;
+    last_sample = num_samples - 1 - gradient_operator->margin;
+
+    for (sample = gradient_operator->margin; sample <= last_sample; sample++)
+    {
+        ps_line[sample] = percent_slope_from_squared (
+            squared_slope (x_sum[sample], y_sum[sample], x_denominator,
+                           y_denominator));
+    }
 }
 
 
@@ -148,73 +208,175 @@ double calculate_slope_zevenbergen_thorne
       Value    Description
       -------  ---------------------------------------------------------------
       SUCCESS  Successfully created the percent slope band.
-      ERROR    Failed to create the percent slope band.
+      ERROR    Failed to allocate memory for the work rows.
 *****************************************************************************/
-void build_slope_band
+int build_slope_band
 (
     int16_t *band_dem,    /* I: the elevation data to use in meters */
     int num_lines,        /* I: the number of lines in the data */
     int num_samples,      /* I: the number of samples in the data */
-    double ew_resolution, /* I: east/west resolution of the elevation data in
-                                meters */
-    double ns_resolution, /* I: north/south resolution of the elevation data
-                                in meters */
-    bool use_zeven_thorne_flag, /* I: whether or not to use this algorithm
-                                      for the percent slope calculation */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        percent slope */
     float *band_ps        /* O: the percent slope band generated from the
                                 DEM */
 )
 {
     int line;
-    int sample;
-    int current_pixel;
     int output_pixel;
-    double elevation_window[9];
-    double slope;
+    int margin = gradient_operator->margin;
+    int *gradient_sums;   /* work rows for the gradient sums */
+
+    gradient_sums = allocate_gradient_sums (num_samples);
+    if (gradient_sums == NULL)
+        return ERROR;
+
+    /* Don't process the lines and samples at the edges of the DEM since we
+       can't determine what the preceding and following values are.  The
+       lines are split into one block per thread; each block reads the DEM
+       lines bordering it but writes only its own lines, so the result does
+       not depend on the thread count */
+#ifdef _OPENMP
+    #pragma omp parallel for private (output_pixel) schedule (static)
+#endif
+    for (line = margin; line < num_lines - margin; line++)
+    {
+        output_pixel = line * num_samples;
+
+        percent_slope_row (gradient_operator, &band_dem[output_pixel],
+            num_samples, geometry->ew_resolution[line],
+            geometry->ns_resolution[line], gradient_sums,
+            &band_ps[output_pixel]);
+    }
+
+    free (gradient_sums);
+
+    return SUCCESS;
+}
 
-    /* Don't process the first and last lines and first and last samples of
-       the DEM since we can't determine what the preceding and following 
-       values are */
-    for (line = 1; line < num_lines - 1; line++)
+
+/*****************************************************************************
+  NAME: build_slope_class_band_from_percent_slope
+
+  PURPOSE: Takes a percent slope band as input and create a slope class band
+           as output, for when the percent slope band is already available.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void build_slope_class_band_from_percent_slope
+(
+    float *band_ps,       /* I: the percent slope band */
+    int pixel_count,      /* I: the number of pixels in the data */
+    float *percent_slope_thresholds, /* I: percent slope threshold for each
+                                           of the SLOPE_CLASS_COUNT slope
+                                           classes */
+    uint8_t *band_slope_class /* O: the slope class band */
+)
+{
+    int index;
+    int class_index;
+    uint8_t class_code;
+
+#ifdef _OPENMP
+    #pragma omp parallel for private (class_index, class_code) \
+        schedule (static)
+#endif
+    for (index = 0; index < pixel_count; index++)
     {
-        for (sample = 1; sample < num_samples - 1; sample++)
+        class_code = 0;
+        for (class_index = 0; class_index < SLOPE_CLASS_COUNT; class_index++)
         {
-            output_pixel = line * num_samples + sample;
-
-            /* Fill in the 3x3 elevation window surrounding the current
-               pixel
-                                [0, 1, 2,
-                                 3, 4, 5,
-                                 6, 7, 8]
-             */
-            /* TOP row [0, 1, 2] */
-            current_pixel = output_pixel - num_samples - 1;  // [0]
-            elevation_window[0] = band_dem[current_pixel];   // [0]
-            elevation_window[1] = band_dem[current_pixel+1]; // [1]
-            elevation_window[2] = band_dem[current_pixel+2]; // [2]
-
-            /* MIDDLE row [3, 4, 5] */
-            current_pixel += num_samples;                    // [3]
-            elevation_window[3] = band_dem[current_pixel];   // [3]
-            elevation_window[4] = band_dem[current_pixel+1]; // [4]
-            elevation_window[5] = band_dem[current_pixel+2]; // [5]
-
-            /* BOTTOM row [6, 7, 8] */
-            current_pixel += num_samples;                    // [6]
-            elevation_window[6] = band_dem[current_pixel];   // [6]
-            elevation_window[7] = band_dem[current_pixel+1]; // [7]
-            elevation_window[8] = band_dem[current_pixel+2]; // [8]
-
-            if (use_zeven_thorne_flag)
-                slope = calculate_slope_zevenbergen_thorne(
-                            elevation_window, ew_resolution, ns_resolution);
-            else
-                slope = calculate_slope_horn(elevation_window,
-                                             ew_resolution, ns_resolution);
-
-            /* Multiply by 100 to make it a percentage.  It could be greater
-               than 100% after this since 1.0 is a 45 degree slope */
-            band_ps[output_pixel] = 100.0 * slope;
+            class_code |= (band_ps[index]
+                           >= percent_slope_thresholds[class_index])
+                          << class_index;
         }
+        band_slope_class[index] = class_code;
+    }
+}
+
+
+/*****************************************************************************
+  NAME: init_slope_class_context
+
+  PURPOSE: Prepares the per band values pixel_slope_class needs, for when the
+           slope class is only needed at some of the pixels.
+
+  RETURN VALUE:  Type = None
+*****************************************************************************/
+void init_slope_class_context
+(
+    Slope_Class_Context_t *context, /* O: context for pixel_slope_class */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        slope */
+    float *percent_slope_thresholds /* I: percent slope threshold for each
+                                          of the SLOPE_CLASS_COUNT slope
+                                          classes */
+)
+{
+    int class_index;
+
+    context->band_dem = band_dem;
+    context->num_lines = num_lines;
+    context->num_samples = num_samples;
+    context->gradient_operator = gradient_operator;
+    context->ew_resolution = geometry->ew_resolution;
+    context->ns_resolution = geometry->ns_resolution;
+
+    for (class_index = 0; class_index < SLOPE_CLASS_COUNT; class_index++)
+    {
+        context->cutoffs[class_index] =
+            squared_slope_cutoff (percent_slope_thresholds[class_index]);
+    }
+    context->flat_class = slope_class (0.0, context->cutoffs);
+}
+
+
+/*****************************************************************************
+  NAME: pixel_slope_class
+
+  PURPOSE: Computes the slope class code of a single pixel, reading the
+           window of the gradient operator around it from the DEM.
+
+  RETURN VALUE: Type = uint8_t
+      Bit SLOPE_CLASS_* is set when the percent slope is at or above the
+      corresponding threshold.
+
+  NOTES:
+    1. The code is the same build_slope_class_band_from_percent_slope gives
+       for the percent slope build_slope_band computes at the pixel,
+       including the flat class of the 0 percent slope left at the edges.
+*****************************************************************************/
+uint8_t pixel_slope_class
+(
+    const Slope_Class_Context_t *context, /* I: context from
+                                                 init_slope_class_context */
+    int line,             /* I: line of the pixel */
+    int sample            /* I: sample of the pixel */
+)
+{
+    int margin = context->gradient_operator->margin;
+    double divisor = context->gradient_operator->divisor;
+    int x_sum;            /* east/west gradient sum of the pixel */
+    int y_sum;            /* north/south gradient sum of the pixel */
+
+    if (line < margin || line >= context->num_lines - margin
+        || sample < margin || sample >= context->num_samples - margin)
+    {
+        return context->flat_class;
     }
+
+    context->gradient_operator->sum_pixel (
+        &context->band_dem[line * context->num_samples],
+        context->num_samples, sample, &x_sum, &y_sum);
+
+    return slope_class (squared_slope (x_sum, y_sum,
+                            divisor * context->ew_resolution[line],
+                            divisor * context->ns_resolution[line]),
+                        context->cutoffs);
 }
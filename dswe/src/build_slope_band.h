@@ -7,20 +7,88 @@
 #include <stdint.h>
 
 
-void build_slope_band
+#include "gradient_operator.h"
+#include "dem_grid.h"
+
+
+/* Bits of the slope class band, each set when the percent slope is at or
+   above the corresponding threshold */
+#define SLOPE_CLASS_HIGH 0
+#define SLOPE_CLASS_MODERATE 1
+#define SLOPE_CLASS_WETLAND 2
+#define SLOPE_CLASS_LOW 3
+#define SLOPE_CLASS_COUNT 4
+
+/* Slope class band value of a pixel whose class has not been computed yet,
+   which no class code uses */
+#define SLOPE_CLASS_NOT_COMPUTED 0xFF
+
+
+/* Structure for computing the slope class of single pixels on demand */
+typedef struct
+{
+    int16_t *band_dem;    /* The elevation data in meters */
+    int num_lines;        /* Number of lines in the data */
+    int num_samples;      /* Number of samples in the data */
+    const Gradient_Operator_t *gradient_operator; /* Operator for the slope */
+    const double *ew_resolution; /* East/west resolution of each line in
+                                    meters */
+    const double *ns_resolution; /* North/south resolution of each line in
+                                    meters */
+    double cutoffs[SLOPE_CLASS_COUNT]; /* Squared slope cutoff for each
+                                          slope class */
+    uint8_t flat_class;   /* Class code of the unprocessed edge pixels */
+} Slope_Class_Context_t;
+
+
+int build_slope_band
 (
     int16_t *band_dem,    /* I: the elevation data to use in meters */
     int num_lines,        /* I: the number of lines in the data */
     int num_samples,      /* I: the number of samples in the data */
-    double ew_resolution, /* I: east/west resolution of the elevation data in
-                                meters */
-    double ns_resolution, /* I: north/south resolution of the elevation data
-                                in meters */
-    bool use_zeven_thorne_flag, /* I: wether or not to use this algorithm
-                                      for the percent slope calculation */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        percent slope */
     float *band_ps        /* O: the percent slope band generated from the
                                 DEM */
 );
 
 
+void build_slope_class_band_from_percent_slope
+(
+    float *band_ps,       /* I: the percent slope band */
+    int pixel_count,      /* I: the number of pixels in the data */
+    float *percent_slope_thresholds, /* I: percent slope threshold for each
+                                           of the SLOPE_CLASS_COUNT slope
+                                           classes */
+    uint8_t *band_slope_class /* O: the slope class band */
+);
+
+
+void init_slope_class_context
+(
+    Slope_Class_Context_t *context, /* O: context for pixel_slope_class */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *gradient_operator, /* I: operator for the
+                                                        slope */
+    float *percent_slope_thresholds /* I: percent slope threshold for each
+                                          of the SLOPE_CLASS_COUNT slope
+                                          classes */
+);
+
+
+uint8_t pixel_slope_class
+(
+    const Slope_Class_Context_t *context, /* I: context from
+                                                 init_slope_class_context */
+    int line,             /* I: line of the pixel */
+    int sample            /* I: sample of the pixel */
+);
+
+
 #endif /* BUILD_SLOPE_BAND_H */
@@ -0,0 +1,995 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "classify.h"
+#include "build_hillshade_band.h"
+
+
+#define PIXELQA_CLOUD_SHADOW_BIT_MASK (1<<3)
+#define PIXELQA_SNOW_BIT_MASK (1<<4)
+#define PIXELQA_CLOUD_BIT_MASK (1<<5)
+
+
+/*****************************************************************************
+  NAME:  above_hillshade_threshold
+
+  PURPOSE:  Determine if the hillshade of a pixel exceeds the threshold, from
+            the hillshade band when it is generated for output and from the
+            mask otherwise.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The hillshade exceeds the threshold.
+      false    The pixel is in the terrain shade.
+*****************************************************************************/
+static bool
+above_hillshade_threshold
+(
+    const Dswe_Classifier_t *c, /* I: classification settings */
+    int line,                   /* I: reflectance line of the pixel */
+    int sample,                 /* I: reflectance sample of the pixel */
+    int dem_index               /* I: elevation grid pixel of the pixel */
+)
+{
+    if (c->include_hs_flag)
+        return c->band_hillshade[dem_index] > c->hillshade;
+
+    return HILLSHADE_MASK_IS_SET (c->band_hillshade_mask,
+                                  c->hillshade_mask_line_bytes,
+                                  c->dem_grid_map->dem_line[line],
+                                  c->dem_grid_map->dem_sample[sample]);
+}
+
+
+/*****************************************************************************
+  NAME:  water_tests
+
+  PURPOSE:  Apply the five water tests to the reflectance of a pixel, in the
+            0 to 10000 units of the tolerance values.
+
+  RETURN VALUE:  Type = int16_t
+      Value    Description
+      -------  ---------------------------------------------------------------
+      0-11111  The raw DSWE value, one decimal digit per test.
+*****************************************************************************/
+static int16_t
+water_tests
+(
+    const Dswe_Classifier_t *c, /* I: classification settings */
+    int16_t blue,               /* I: blue value of the pixel */
+    int16_t green,              /* I: green value of the pixel */
+    int16_t red,                /* I: red value of the pixel */
+    int16_t nir,                /* I: nir value of the pixel */
+    int16_t swir1,              /* I: swir1 value of the pixel */
+    int16_t swir2               /* I: swir2 value of the pixel */
+)
+{
+    float mndwi;                /* (green - swir1) / (green + swir1) */
+    float mbsrv;                /* (green + red) */
+    float mbsrn;                /* (nir + swir1) */
+    float awesh;                /* (blue
+                                   + (2.5 * green)
+                                   - (1.5 * MBSRN)
+                                   - (0.25 * bt)) */
+    float ndvi;                /* (nir - red) / (nir + red) */
+
+    float band_blue_float;
+    float band_green_float;
+    float band_red_float;
+    float band_nir_float;
+    float band_swir1_float;
+    float band_swir2_float;
+
+    int16_t raw_dswe_value;
+
+    /* Convert to float */
+    band_blue_float = blue;
+    band_green_float = green;
+    band_red_float = red;
+    band_nir_float = nir;
+    band_swir1_float = swir1;
+    band_swir2_float = swir2;
+
+    /* Modified Normalized Difference Wetness Index (MNDWI) */
+    mndwi = (band_green_float - band_swir1_float) /
+            (band_green_float + band_swir1_float);
+
+    /* Multi-band Spectral Relationship Visible (MBSRV) */
+    mbsrv = band_green_float + band_red_float;
+
+    /* Multi-band Spectral Relationship Near-Infrared (MBSRN) */
+    mbsrn = band_nir_float + band_swir1_float;
+
+    /* Automated Water Extent Shadow (AWEsh) */
+    awesh = (band_blue_float
+             + (2.5 * band_green_float)
+             - (1.5 * mbsrn)
+             - (0.25 * band_swir2_float));
+
+    /* Initialize to 0 or 1 on the first test */
+    if (mndwi > c->wigt)
+        raw_dswe_value = 1; /* > wigt */  /* Set the ones digit */
+    else
+        raw_dswe_value = 0;
+
+    if (mbsrv > mbsrn)
+        raw_dswe_value += 10; /* Set the tens digit */
+
+    if (awesh > c->awgt)
+        raw_dswe_value += 100; /* Set the hundreds digit */
+
+    /* Calculate NDVI */
+    ndvi = (band_nir_float - band_red_float) /
+           (band_nir_float + band_red_float);
+
+    /* Partial Surface Water 1 (PSW1)
+       The logic in the if results in a true/false called PSW1 */
+    if (mndwi > c->pswt_1_mndwi &&
+        band_swir1_float < c->pswt_1_swir1 &&
+        band_nir_float < c->pswt_1_nir &&
+        ndvi < c->pswt_1_ndvi)
+    {
+        raw_dswe_value += 1000; /* Set the thousands digit */
+    }
+
+    /* Partial Surface Water 2 (PSW2)
+       The logic in the if results in a true/false called PSW2 */
+    if (mndwi > c->pswt_2_mndwi &&
+        band_blue_float < c->pswt_2_blue &&
+        band_swir1_float < c->pswt_2_swir1 &&
+        band_swir2_float < c->pswt_2_swir2 &&
+        band_nir_float < c->pswt_2_nir)
+    {
+        raw_dswe_value += 10000; /* Set the ten thousands digit */
+    }
+
+    return raw_dswe_value;
+}
+
+
+/*****************************************************************************
+  NAME:  ratio_above, ratio_below
+
+  PURPOSE:  Compare the normalized difference numerator / denominator with a
+            tolerance value without dividing.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The ratio is above (below) the tolerance value.
+      false    It is not, or the ratio is 0 / 0.
+
+  NOTES:
+    1. The products are exact in double precision for the magnitudes
+       set_dswe_reflectance_scaling allows, and a zero denominator compares
+       as the infinity the float division gives.
+*****************************************************************************/
+static inline bool
+ratio_above
+(
+    int32_t numerator,          /* I: numerator of the ratio */
+    int32_t denominator,        /* I: denominator of the ratio */
+    float tolerance             /* I: tolerance value */
+)
+{
+    if (denominator > 0)
+        return numerator > (double) tolerance * denominator;
+    if (denominator < 0)
+        return numerator < (double) tolerance * denominator;
+    return numerator > 0;
+}
+
+static inline bool
+ratio_below
+(
+    int32_t numerator,          /* I: numerator of the ratio */
+    int32_t denominator,        /* I: denominator of the ratio */
+    float tolerance             /* I: tolerance value */
+)
+{
+    if (denominator > 0)
+        return numerator < (double) tolerance * denominator;
+    if (denominator < 0)
+        return numerator > (double) tolerance * denominator;
+    return numerator < 0;
+}
+
+
+/*****************************************************************************
+  NAME:  scaled_water_tests
+
+  PURPOSE:  Apply the five water tests to the unsigned, scaled reflectance of
+            a pixel, against the tolerance values converted to its units by
+            set_dswe_reflectance_scaling.
+
+  RETURN VALUE:  Type = int16_t
+      Value    Description
+      -------  ---------------------------------------------------------------
+      0-11111  The raw DSWE value, one decimal digit per test.
+
+  NOTES:
+    1. With reflectance = scale * value + offset and offset / scale = P / Q,
+       MNDWI = Q (green - swir1) / (Q (green + swir1) + 2 P), and likewise
+       for NDVI, so both are compared in integers.
+    2. MBSRV and MBSRN carry the same two offsets, which cancel.  The
+       AWEsh coefficients sum to 0.25, so 4 AWEsh is one offset plus the
+       scaled integer sum compared against awgt_value.
+*****************************************************************************/
+static int16_t
+scaled_water_tests
+(
+    const Dswe_Classifier_t *c, /* I: classification settings */
+    int16_t blue_bits,          /* I: blue value of the pixel */
+    int16_t green_bits,         /* I: green value of the pixel */
+    int16_t red_bits,           /* I: red value of the pixel */
+    int16_t nir_bits,           /* I: nir value of the pixel */
+    int16_t swir1_bits,         /* I: swir1 value of the pixel */
+    int16_t swir2_bits          /* I: swir2 value of the pixel */
+)
+{
+    /* The bands are read into int16 memory, the values are unsigned */
+    int32_t blue = (uint16_t) blue_bits;
+    int32_t green = (uint16_t) green_bits;
+    int32_t red = (uint16_t) red_bits;
+    int32_t nir = (uint16_t) nir_bits;
+    int32_t swir1 = (uint16_t) swir1_bits;
+    int32_t swir2 = (uint16_t) swir2_bits;
+
+    int32_t mndwi_numerator;
+    int32_t mndwi_denominator;
+    int32_t ndvi_numerator;
+    int32_t ndvi_denominator;
+    int32_t awesh;              /* 4 AWEsh in the units of the bands, less
+                                   the offset */
+
+    int16_t raw_dswe_value;
+
+    mndwi_numerator = c->ratio_scale * (green - swir1);
+    mndwi_denominator = c->ratio_scale * (green + swir1) + c->ratio_offset;
+
+    awesh = 4 * blue + 10 * green - 6 * (nir + swir1) - swir2;
+
+    /* Initialize to 0 or 1 on the first test */
+    if (ratio_above (mndwi_numerator, mndwi_denominator, c->wigt))
+        raw_dswe_value = 1; /* Set the ones digit */
+    else
+        raw_dswe_value = 0;
+
+    if (green + red > nir + swir1)
+        raw_dswe_value += 10; /* Set the tens digit */
+
+    if (awesh > c->awgt_value)
+        raw_dswe_value += 100; /* Set the hundreds digit */
+
+    ndvi_numerator = c->ratio_scale * (nir - red);
+    ndvi_denominator = c->ratio_scale * (nir + red) + c->ratio_offset;
+
+    /* Partial Surface Water 1 (PSW1) */
+    if (ratio_above (mndwi_numerator, mndwi_denominator, c->pswt_1_mndwi) &&
+        swir1 < c->pswt_1_swir1_value &&
+        nir < c->pswt_1_nir_value &&
+        ratio_below (ndvi_numerator, ndvi_denominator, c->pswt_1_ndvi))
+    {
+        raw_dswe_value += 1000; /* Set the thousands digit */
+    }
+
+    /* Partial Surface Water 2 (PSW2) */
+    if (ratio_above (mndwi_numerator, mndwi_denominator, c->pswt_2_mndwi) &&
+        blue < c->pswt_2_blue_value &&
+        swir1 < c->pswt_2_swir1_value &&
+        swir2 < c->pswt_2_swir2_value &&
+        nir < c->pswt_2_nir_value)
+    {
+        raw_dswe_value += 10000; /* Set the ten thousands digit */
+    }
+
+    return raw_dswe_value;
+}
+
+
+/*****************************************************************************
+  NAME:  reflectance_value
+
+  PURPOSE:  Return the value of a reflectance pixel read into int16 memory,
+            as unsigned for scaled reflectance, for comparing against the
+            fill value of the band.
+
+  RETURN VALUE:  Type = int32_t
+      The value of the pixel in the data type of the band.
+*****************************************************************************/
+static inline int32_t
+reflectance_value
+(
+    const Dswe_Classifier_t *c, /* I: classification settings */
+    int16_t bits                /* I: reflectance pixel as read */
+)
+{
+    if (c->scaled_reflectance)
+        return (uint16_t) bits;
+    return bits;
+}
+
+
+/*****************************************************************************
+  NAME:  classify_dswe_samples
+
+  PURPOSE:  Classify a run of pixels on one reflectance line, populating the
+            DSWE bands of those pixels.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The input and output bands point at the first pixel of the run.
+    2. Slope classes that have not been computed yet are computed and
+       stored in the slope class band, so only one thread may classify at a
+       time.
+*****************************************************************************/
+void
+classify_dswe_samples
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    int line,                   /* I: reflectance line of the pixels */
+    int first_sample,           /* I: first sample to classify */
+    int sample_count,           /* I: number of samples to classify */
+    const int16_t *band_blue,   /* I: blue values of the pixels */
+    const int16_t *band_green,  /* I: green values of the pixels */
+    const int16_t *band_red,    /* I: red values of the pixels */
+    const int16_t *band_nir,    /* I: nir values of the pixels */
+    const int16_t *band_swir1,  /* I: swir1 values of the pixels */
+    const int16_t *band_swir2,  /* I: swir2 values of the pixels */
+    const uint16_t *band_pixelqa, /* I: Pixel QA values of the pixels */
+    int16_t *band_dswe_diag,    /* O: diagnostic values of the pixels, only
+                                      when include_tests_flag */
+    uint8_t *band_dswe_interpreted, /* O: interpreted values of the
+                                          pixels */
+    uint8_t *band_dswe_pshsccss, /* O: filtered interpreted values of the
+                                       pixels */
+    uint8_t *band_mask          /* O: mask values of the pixels */
+)
+{
+    const Dswe_Classifier_t *c = classifier;
+    const Dem_Grid_Map_t *dem_grid_map = c->dem_grid_map;
+
+    bool hillshade_flag;
+
+    int16_t raw_dswe_value;
+    uint8_t interp_ps_hs_ccss_dswe_value; /* Interpreted DSWE value, but set to
+                                   DSWE_NOT_WATER if percent slope or hillshade
+                                   apply, and DSWE_CLOUD_CLOUD_SHADOW_SNOW if
+                                   one or more of those is set in the QA band */
+    uint8_t mask_value;         /* Tracks whether a pixel is masked due to snow,
+                                   shadow, cloud, slope, and/or hillshade */
+    uint8_t slope_class_code;   /* Slope class of the pixel, see
+                                   SLOPE_CLASS_* */
+
+    int index;                  /* Pixel within the run */
+    int scene_index;            /* Pixel within the scene */
+    int sample;
+    int dem_index;              /* Elevation grid pixel for the pixel */
+    int dem_line_offset;        /* Elevation grid pixel starting the line */
+    int dem_samples = dem_grid_map->dem_samples;
+
+    dem_line_offset = dem_grid_map->dem_line[line] * dem_samples;
+
+    for (index = 0; index < sample_count; index++)
+    {
+        sample = first_sample + index;
+
+        /* The terrain products are on the elevation grid */
+        dem_index = dem_line_offset + dem_grid_map->dem_sample[sample];
+
+        /* If any of the input is fill, make the output fill */
+        if (reflectance_value (c, band_blue[index]) == c->blue_fill_value ||
+            reflectance_value (c, band_green[index]) == c->green_fill_value ||
+            reflectance_value (c, band_red[index]) == c->red_fill_value ||
+            reflectance_value (c, band_nir[index]) == c->nir_fill_value ||
+            reflectance_value (c, band_swir1[index]) == c->swir1_fill_value ||
+            reflectance_value (c, band_swir2[index]) == c->swir2_fill_value ||
+            band_pixelqa[index] == c->pixelqa_fill_value)
+        {
+            if (c->include_tests_flag)
+            {
+                band_dswe_diag[index] = TESTS_NO_DATA_VALUE;
+            }
+            band_dswe_interpreted[index] = DSWE_NO_DATA_VALUE;
+            band_dswe_pshsccss[index] = DSWE_NO_DATA_VALUE;
+            band_mask[index] = DSWE_NO_DATA_VALUE;
+            continue;
+        }
+
+        /* The water tests */
+        if (c->scaled_reflectance)
+        {
+            raw_dswe_value = scaled_water_tests (c, band_blue[index],
+                band_green[index], band_red[index], band_nir[index],
+                band_swir1[index], band_swir2[index]);
+        }
+        else
+        {
+            raw_dswe_value = water_tests (c, band_blue[index],
+                band_green[index], band_red[index], band_nir[index],
+                band_swir1[index], band_swir2[index]);
+        }
+
+        /* Assign it to the tests band */
+        if (c->include_tests_flag)
+        {
+            band_dswe_diag[index] = raw_dswe_value;
+        }
+
+        /* Determine if hillshade exceeds threshold */
+        hillshade_flag = above_hillshade_threshold (c, line, sample,
+                                                    dem_index);
+
+        /* Recode the raw value to an interpreted value to fit an 8bit
+           output product */
+        switch (raw_dswe_value)
+        {
+            case 0:
+            case 1:
+            case 10:
+            case 100:
+            case 1000:
+                raw_dswe_value = DSWE_NOT_WATER;
+                break;
+
+            case 1111:
+            case 10111:
+            case 11011:
+            case 11101:
+            case 11110:
+            case 11111:
+                raw_dswe_value = DSWE_WATER_HIGH_CONFIDENCE;
+                break;
+
+            case 111:
+            case 1011:
+            case 1101:
+            case 1110:
+            case 10011:
+            case 10101:
+            case 10110:
+            case 11001:
+            case 11010:
+            case 11100:
+                raw_dswe_value = DSWE_WATER_MODERATE_CONFIDENCE;
+                break;
+
+            case 11000:
+                raw_dswe_value = DSWE_POTENTIAL_WETLAND;
+                break;
+
+            case 11:
+            case 101:
+            case 110:
+            case 1001:
+            case 1010:
+            case 1100:
+            case 10000:
+            case 10001:
+            case 10010:
+            case 10100:
+                raw_dswe_value = DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND;
+                break;
+
+            default:
+                raw_dswe_value = DSWE_NO_DATA_VALUE;
+                break;
+        }
+
+        /* The following few chunks of code produce the following paths
+           to the output products.
+
+           interpreted -> output
+           interpreted -> percent-slope -> hillshade -> cloud ->
+                  cloud shadow -> snow -> output
+           percent-slope -> hillshade -> cloud -> cloud shadow -> snow ->
+                  output
+        */
+
+        /* Default the Percent Slope, Hillshade, Cloud, Cloud Shadow, and
+           Snow output to the interpreted DSWE value */
+        interp_ps_hs_ccss_dswe_value = raw_dswe_value;
+
+        /* Initialize the mask value based on some bits in the pixel
+           QA. */
+        mask_value = 0;
+        if (band_pixelqa[index] & PIXELQA_CLOUD_SHADOW_BIT_MASK)
+        {
+            mask_value |= (1 << MASK_SHADOW);
+        }
+        if (band_pixelqa[index] & PIXELQA_SNOW_BIT_MASK)
+        {
+            mask_value |= (1 << MASK_SNOW);
+        }
+        if (band_pixelqa[index] & PIXELQA_CLOUD_BIT_MASK)
+        {
+            mask_value |= (1 << MASK_CLOUD);
+        }
+
+        /* Only the water and wetland classes use the slope class; when
+           it is built on demand the first pixel needing it computes
+           it */
+        slope_class_code = 0;
+        if (raw_dswe_value >= DSWE_WATER_HIGH_CONFIDENCE
+            && raw_dswe_value <= DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND)
+        {
+            slope_class_code = c->band_slope_class[dem_index];
+            if (slope_class_code == SLOPE_CLASS_NOT_COMPUTED)
+            {
+                slope_class_code = pixel_slope_class (
+                                       c->slope_class_context,
+                                       dem_grid_map->dem_line[line],
+                                       dem_grid_map->dem_sample[sample]);
+                c->band_slope_class[dem_index] = slope_class_code;
+            }
+        }
+
+        /* Apply the Percent Slope constraint to the Percent Slope,
+           Cloud, Cloud Shadow, and Snow output.  Also update the mask
+           output. */
+        if (raw_dswe_value == DSWE_WATER_MODERATE_CONFIDENCE)
+        {
+            if (slope_class_code & (1 << SLOPE_CLASS_MODERATE))
+            {
+                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
+                mask_value |= (1 << MASK_PS);
+            }
+        }
+        else if (raw_dswe_value == DSWE_POTENTIAL_WETLAND)
+        {
+            if (slope_class_code & (1 << SLOPE_CLASS_WETLAND))
+            {
+                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
+                mask_value |= (1 << MASK_PS);
+            }
+        }
+        else if (raw_dswe_value == DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND)
+        {
+            if (slope_class_code & (1 << SLOPE_CLASS_LOW))
+            {
+                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
+                mask_value |= (1 << MASK_PS);
+            }
+        }
+        else if (raw_dswe_value == DSWE_WATER_HIGH_CONFIDENCE)
+        {
+            if (slope_class_code & (1 << SLOPE_CLASS_HIGH))
+            {
+                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
+                mask_value |= (1 << MASK_PS);
+            }
+        }
+
+        /* Apply the hillshade constraint to the Percent Slope, Cloud,
+           Cloud Shadow, and Snow output.  Also update the mask
+           output. */
+        if (!hillshade_flag)
+        {
+            interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
+            mask_value |= (1 << MASK_HS);
+        }
+
+        /* Apply the cast shadow constraint to the Percent Slope, Cloud,
+           Cloud Shadow, and Snow output, for pixels where terrain
+           toward the sun rises above the sun.  Also update the mask
+           output. */
+        if (c->cast_shadow_flag
+            && c->band_horizon[dem_index] > c->cast_shadow_threshold)
+        {
+            interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
+            mask_value |= (1 << MASK_CAST_SHADOW);
+        }
+
+        /* Apply the Pixel QA Cloud constraint to the Percent Slope,
+           Hillshade, Cloud, Cloud Shadow, and Snow output */
+        if ((band_pixelqa[index] & PIXELQA_CLOUD_BIT_MASK)
+             || (band_pixelqa[index] & PIXELQA_CLOUD_SHADOW_BIT_MASK)
+             || (band_pixelqa[index] & PIXELQA_SNOW_BIT_MASK))
+        {
+            /* classified as 11999 in prototype code using 9 due to
+               recode */
+            interp_ps_hs_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
+        }
+
+        /* Assign the values to the correct output band */
+        band_dswe_interpreted[index] = raw_dswe_value;
+        band_dswe_pshsccss[index] = interp_ps_hs_ccss_dswe_value;
+        band_mask[index] = mask_value;
+
+        /* Let the user know where we are in the processing */
+        scene_index = line * c->samples + sample;
+        if (scene_index%99999 == 0)
+        {
+            printf ("\r");
+            printf ("Processed data element %d", scene_index);
+        }
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  classify_dswe_lines
+
+  PURPOSE:  Classify the pixels of a run of reflectance lines, populating the
+            DSWE bands of those lines.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The input and output bands hold only the lines being classified,
+       starting with first_line, so the whole scene can be classified at
+       once or a strip at a time.
+*****************************************************************************/
+void
+classify_dswe_lines
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    int first_line,             /* I: first reflectance line to classify */
+    int line_count,             /* I: number of lines to classify */
+    const int16_t *band_blue,   /* I: blue values of the lines */
+    const int16_t *band_green,  /* I: green values of the lines */
+    const int16_t *band_red,    /* I: red values of the lines */
+    const int16_t *band_nir,    /* I: nir values of the lines */
+    const int16_t *band_swir1,  /* I: swir1 values of the lines */
+    const int16_t *band_swir2,  /* I: swir2 values of the lines */
+    const uint16_t *band_pixelqa, /* I: Pixel QA values of the lines */
+    int16_t *band_dswe_diag,    /* O: diagnostic values of the lines, only
+                                      when include_tests_flag */
+    uint8_t *band_dswe_interpreted, /* O: interpreted values of the lines */
+    uint8_t *band_dswe_pshsccss, /* O: filtered interpreted values of the
+                                       lines */
+    uint8_t *band_mask          /* O: mask values of the lines */
+)
+{
+    int line;
+    size_t offset;              /* First pixel of the line in the bands */
+
+    for (line = 0; line < line_count; line++)
+    {
+        offset = (size_t) line * classifier->samples;
+
+        classify_dswe_samples (classifier, first_line + line, 0,
+            classifier->samples, &band_blue[offset], &band_green[offset],
+            &band_red[offset], &band_nir[offset], &band_swir1[offset],
+            &band_swir2[offset], &band_pixelqa[offset],
+            (band_dswe_diag != NULL) ? &band_dswe_diag[offset] : NULL,
+            &band_dswe_interpreted[offset], &band_dswe_pshsccss[offset],
+            &band_mask[offset]);
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  dswe_block_needs_reflectance
+
+  PURPOSE:  Determine from the Pixel QA alone whether the reflectance of a
+            block of pixels is needed to classify it.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     A pixel of the block is neither fill nor cloud, cloud shadow or
+               snow, so it needs the water tests.
+      false    mask_dswe_samples can populate the whole block.
+*****************************************************************************/
+bool
+dswe_block_needs_reflectance
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    const uint16_t *band_pixelqa, /* I: Pixel QA of the first pixel of the
+                                        block */
+    int line_count,             /* I: lines in the block */
+    int sample_count,           /* I: samples in the block */
+    int line_stride             /* I: Pixel QA values per line */
+)
+{
+    const uint16_t qa_bits = PIXELQA_CLOUD_BIT_MASK
+                             | PIXELQA_CLOUD_SHADOW_BIT_MASK
+                             | PIXELQA_SNOW_BIT_MASK;
+    const uint16_t *qa;
+    int line;
+    int sample;
+
+    for (line = 0; line < line_count; line++)
+    {
+        qa = &band_pixelqa[(size_t) line * line_stride];
+        for (sample = 0; sample < sample_count; sample++)
+        {
+            if (qa[sample] != classifier->pixelqa_fill_value
+                && (qa[sample] & qa_bits) == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+
+/*****************************************************************************
+  NAME:  mask_dswe_samples
+
+  PURPOSE:  Populate the DSWE bands of a run of fill, cloud, cloud shadow or
+            snow pixels on one reflectance line from their Pixel QA alone.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The input and output bands point at the first pixel of the run.
+    2. Pixel QA fill gives the same values as classify_dswe_samples.  For
+       cloud, cloud shadow and snow the filtered interpreted band gets the
+       same class, and the mask the same QA, hillshade and cast shadow
+       bits.  The water tests are not run, so the interpreted and
+       diagnostic bands are fill and the mask has no percent slope bit.
+*****************************************************************************/
+void
+mask_dswe_samples
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    int line,                   /* I: reflectance line of the pixels */
+    int first_sample,           /* I: first sample to populate */
+    int sample_count,           /* I: number of samples to populate */
+    const uint16_t *band_pixelqa, /* I: Pixel QA values of the pixels */
+    int16_t *band_dswe_diag,    /* O: diagnostic values of the pixels, only
+                                      when include_tests_flag */
+    uint8_t *band_dswe_interpreted, /* O: interpreted values of the
+                                          pixels */
+    uint8_t *band_dswe_pshsccss, /* O: filtered interpreted values of the
+                                       pixels */
+    uint8_t *band_mask          /* O: mask values of the pixels */
+)
+{
+    const Dswe_Classifier_t *c = classifier;
+    const Dem_Grid_Map_t *dem_grid_map = c->dem_grid_map;
+    uint8_t mask_value;
+    int index;                  /* Pixel within the run */
+    int sample;
+    int dem_index;              /* Elevation grid pixel for the pixel */
+    int dem_line_offset;        /* Elevation grid pixel starting the line */
+
+    dem_line_offset = dem_grid_map->dem_line[line]
+                      * dem_grid_map->dem_samples;
+
+    for (index = 0; index < sample_count; index++)
+    {
+        sample = first_sample + index;
+        dem_index = dem_line_offset + dem_grid_map->dem_sample[sample];
+
+        if (c->include_tests_flag)
+            band_dswe_diag[index] = TESTS_NO_DATA_VALUE;
+        band_dswe_interpreted[index] = DSWE_NO_DATA_VALUE;
+
+        if (band_pixelqa[index] == c->pixelqa_fill_value)
+        {
+            band_dswe_pshsccss[index] = DSWE_NO_DATA_VALUE;
+            band_mask[index] = DSWE_NO_DATA_VALUE;
+            continue;
+        }
+
+        mask_value = 0;
+        if (band_pixelqa[index] & PIXELQA_CLOUD_SHADOW_BIT_MASK)
+            mask_value |= (1 << MASK_SHADOW);
+        if (band_pixelqa[index] & PIXELQA_SNOW_BIT_MASK)
+            mask_value |= (1 << MASK_SNOW);
+        if (band_pixelqa[index] & PIXELQA_CLOUD_BIT_MASK)
+            mask_value |= (1 << MASK_CLOUD);
+
+        if (!above_hillshade_threshold (c, line, sample, dem_index))
+            mask_value |= (1 << MASK_HS);
+
+        if (c->cast_shadow_flag
+            && c->band_horizon[dem_index] > c->cast_shadow_threshold)
+        {
+            mask_value |= (1 << MASK_CAST_SHADOW);
+        }
+
+        band_dswe_pshsccss[index] = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
+        band_mask[index] = mask_value;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  scale_percent_slope_lines
+
+  PURPOSE:  Convert the percent slope of a run of reflectance lines to a
+            scaled 16 bit integer value on the reflectance grid.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+scale_percent_slope_lines
+(
+    const Dem_Grid_Map_t *dem_grid_map, /* I: maps the reflectance grid onto
+                                              the elevation grid */
+    const float *band_ps,       /* I: percent slope on the elevation grid */
+    int first_line,             /* I: first reflectance line to scale */
+    int line_count,             /* I: number of lines to scale */
+    int16_t *band_ps_int16      /* O: scaled percent slope of the lines */
+)
+{
+    int line;
+    int sample;
+    int index;                  /* Pixel within the lines */
+    int dem_index;              /* Elevation grid pixel for the pixel */
+    int dem_line_offset;        /* Elevation grid pixel starting the line */
+    float percent_slope;        /* Single percent slope value */
+
+    index = 0;
+    for (line = first_line; line < first_line + line_count; line++)
+    {
+        dem_line_offset = dem_grid_map->dem_line[line]
+                          * dem_grid_map->dem_samples;
+
+        for (sample = 0; sample < dem_grid_map->samples; sample++, index++)
+        {
+            dem_index = dem_line_offset + dem_grid_map->dem_sample[sample];
+
+            percent_slope = (band_ps[dem_index]
+                             * PERCENT_SLOPE_MULT_FACTOR) + 0.5;
+
+            /* If the scaled value is outside the range, pull it back */
+            if (percent_slope > GDAL_INT16_MAX)
+            {
+                percent_slope = GDAL_INT16_MAX;
+            }
+            band_ps_int16[index] = (int16_t)percent_slope;
+        }
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  limit_value
+
+  PURPOSE:  Round a converted tolerance value to an integer within limits.
+
+  RETURN VALUE:  Type = int32_t
+      Value    Description
+      -------  ---------------------------------------------------------------
+      n        The value, pulled back into the limits.
+*****************************************************************************/
+static int32_t
+limit_value
+(
+    double value,               /* I: integral tolerance value */
+    int32_t low,                /* I: lowest value to return */
+    int32_t high                /* I: highest value to return */
+)
+{
+    if (value < low)
+        return low;
+    if (value > high)
+        return high;
+    return (int32_t) value;
+}
+
+
+/*****************************************************************************
+  NAME:  set_dswe_reflectance_scaling
+
+  PURPOSE:  Convert the tolerance values once into the units of unsigned,
+            scaled reflectance, such as the Collection 2 surface reflectance,
+            so the water tests compare the values as read.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The classifier uses the scaled water tests.
+      ERROR    The scale factor and offset are not supported.
+
+  NOTES:
+    1. The band and AWEsh tolerance values are reflectance times 10000, as
+       for the signed reflectance, and have to be set first.  The MNDWI and
+       NDVI tolerance values are unitless and are used as they are.
+    2. The scale factor and offset are decimals in the XML, so they are
+       taken as the decimals nearest their float values.  The ratio of the
+       offset to the scale factor is then exact, -80000 / 11 for
+       Collection 2.
+*****************************************************************************/
+int
+set_dswe_reflectance_scaling
+(
+    Dswe_Classifier_t *classifier, /* IO: classification settings with the
+                                          tolerance values */
+    float scale_factor,         /* I: scale factor of the reflectance */
+    float add_offset            /* I: offset of the reflectance */
+)
+{
+    Dswe_Classifier_t *c = classifier;
+    double power;               /* 10 to the number of decimal digits */
+    double scale;               /* Scale factor times power */
+    double offset;              /* Offset times power */
+    double band_scale;          /* Converts tolerance values to the units
+                                   of the bands */
+    double band_offset;         /* Offset in the units of the bands */
+    long long numerator;        /* Offset over scale factor as a fraction */
+    long long denominator;
+    long long a;
+    long long b;
+    long long t;
+    int digits;
+
+    if (!(scale_factor > 0.0))
+    {
+        RETURN_ERROR ("Reflectance scale factor has to be positive",
+                      MODULE_NAME, ERROR);
+    }
+
+    /* Find the fewest decimal digits making both integers */
+    power = 1.0;
+    for (digits = 0; digits <= 9; digits++, power *= 10.0)
+    {
+        scale = rint ((double) scale_factor * power);
+        offset = rint ((double) add_offset * power);
+        if (scale >= 1.0
+            && fabs ((double) scale_factor * power - scale) <= 1e-6 * scale
+            && fabs ((double) add_offset * power - offset)
+               <= 1e-6 * fabs (offset))
+        {
+            break;
+        }
+    }
+    if (digits > 9)
+    {
+        RETURN_ERROR ("Unsupported reflectance scale factor and offset",
+                      MODULE_NAME, ERROR);
+    }
+
+    /* Reduce offset / scale factor */
+    numerator = (long long) offset;
+    denominator = (long long) scale;
+    a = llabs (numerator);
+    b = denominator;
+    while (b != 0)
+    {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    numerator /= a;
+    denominator /= a;
+
+    /* Keep the normalized difference terms exact in the water tests */
+    if (denominator > 1000 || llabs (numerator) > (1 << 27))
+    {
+        RETURN_ERROR ("Unsupported reflectance scale factor and offset",
+                      MODULE_NAME, ERROR);
+    }
+    c->ratio_scale = denominator;
+    c->ratio_offset = 2 * numerator;
+
+    /* value < tolerance in the units of the bands becomes
+       value < ceil (tolerance), and value > tolerance becomes
+       value > floor (tolerance) */
+    band_scale = power / (10000.0 * scale);
+    band_offset = (double) numerator / denominator;
+    c->pswt_1_nir_value = limit_value (ceil (c->pswt_1_nir * band_scale
+                                             - band_offset), 0, 65536);
+    c->pswt_1_swir1_value = limit_value (ceil (c->pswt_1_swir1 * band_scale
+                                               - band_offset), 0, 65536);
+    c->pswt_2_blue_value = limit_value (ceil (c->pswt_2_blue * band_scale
+                                              - band_offset), 0, 65536);
+    c->pswt_2_nir_value = limit_value (ceil (c->pswt_2_nir * band_scale
+                                             - band_offset), 0, 65536);
+    c->pswt_2_swir1_value = limit_value (ceil (c->pswt_2_swir1 * band_scale
+                                               - band_offset), 0, 65536);
+    c->pswt_2_swir2_value = limit_value (ceil (c->pswt_2_swir2 * band_scale
+                                               - band_offset), 0, 65536);
+    c->awgt_value = limit_value (floor (4.0 * c->awgt * band_scale
+                                        - band_offset), -(1 << 30), 1 << 30);
+
+    c->scaled_reflectance = true;
+
+    return SUCCESS;
+}
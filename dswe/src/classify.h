@@ -0,0 +1,177 @@
+
+#ifndef CLASSIFY_H
+#define CLASSIFY_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "build_slope_band.h"
+#include "dem_grid.h"
+
+
+/* Structure for everything the classification of a pixel needs besides its
+   reflectance and QA values: the tolerances, the fill values and the
+   terrain products on the elevation grid */
+typedef struct
+{
+    int samples;                 /* Samples of the reflectance grid */
+
+    int32_t blue_fill_value;     /* Fill values in the data type of the
+                                    band, so up to 65535 for scaled
+                                    reflectance */
+    int32_t green_fill_value;
+    int32_t red_fill_value;
+    int32_t nir_fill_value;
+    int32_t swir1_fill_value;
+    int32_t swir2_fill_value;
+    uint16_t pixelqa_fill_value;
+
+    float wigt;                  /* tolerance value */
+    float awgt;                  /* tolerance value */
+    float pswt_1_mndwi;          /* tolerance value */
+    float pswt_1_nir;            /* tolerance value */
+    float pswt_1_swir1;          /* tolerance value */
+    float pswt_1_ndvi;           /* tolerance value */
+    float pswt_2_mndwi;          /* tolerance value */
+    float pswt_2_blue;           /* tolerance value */
+    float pswt_2_nir;            /* tolerance value */
+    float pswt_2_swir1;          /* tolerance value */
+    float pswt_2_swir2;          /* tolerance value */
+    int hillshade;               /* Hillshade tolerance value */
+
+    bool scaled_reflectance;     /* The reflectance is unsigned and scaled,
+                                    and compared against the tolerance
+                                    values converted to its units */
+    int32_t ratio_scale;         /* Q and 2 P, for offset / scale = P / Q */
+    int32_t ratio_offset;
+    int32_t awgt_value;          /* Converted tolerance values */
+    int32_t pswt_1_nir_value;
+    int32_t pswt_1_swir1_value;
+    int32_t pswt_2_blue_value;
+    int32_t pswt_2_nir_value;
+    int32_t pswt_2_swir1_value;
+    int32_t pswt_2_swir2_value;
+
+    bool include_tests_flag;     /* Produce the diagnostic band */
+    bool include_hs_flag;        /* The hillshade band is generated, so it
+                                    is used instead of the hillshade mask */
+    bool cast_shadow_flag;       /* Apply the cast shadow mask */
+
+    Dem_Grid_Map_t *dem_grid_map; /* Maps the reflectance grid onto the
+                                     elevation grid */
+    uint8_t *band_hillshade;     /* Hillshade, when include_hs_flag */
+    uint8_t *band_hillshade_mask; /* Packed mask of the pixels above the
+                                     hillshade threshold, otherwise */
+    int hillshade_mask_line_bytes; /* Bytes per line of the hillshade
+                                      mask */
+    uint8_t *band_slope_class;   /* Slope class of each elevation pixel,
+                                    see SLOPE_CLASS_* */
+    const Slope_Class_Context_t *slope_class_context; /* For computing the
+                                    slope classes that have not been */
+    int16_t *band_horizon;       /* Horizon angles, when cast_shadow_flag */
+    int16_t cast_shadow_threshold; /* Sun elevation in the units of the
+                                      horizon angles */
+} Dswe_Classifier_t;
+
+
+void
+classify_dswe_samples
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    int line,                   /* I: reflectance line of the pixels */
+    int first_sample,           /* I: first sample to classify */
+    int sample_count,           /* I: number of samples to classify */
+    const int16_t *band_blue,   /* I: blue values of the pixels */
+    const int16_t *band_green,  /* I: green values of the pixels */
+    const int16_t *band_red,    /* I: red values of the pixels */
+    const int16_t *band_nir,    /* I: nir values of the pixels */
+    const int16_t *band_swir1,  /* I: swir1 values of the pixels */
+    const int16_t *band_swir2,  /* I: swir2 values of the pixels */
+    const uint16_t *band_pixelqa, /* I: Pixel QA values of the pixels */
+    int16_t *band_dswe_diag,    /* O: diagnostic values of the pixels, only
+                                      when include_tests_flag */
+    uint8_t *band_dswe_interpreted, /* O: interpreted values of the
+                                          pixels */
+    uint8_t *band_dswe_pshsccss, /* O: filtered interpreted values of the
+                                       pixels */
+    uint8_t *band_mask          /* O: mask values of the pixels */
+);
+
+
+void
+classify_dswe_lines
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    int first_line,             /* I: first reflectance line to classify */
+    int line_count,             /* I: number of lines to classify */
+    const int16_t *band_blue,   /* I: blue values of the lines */
+    const int16_t *band_green,  /* I: green values of the lines */
+    const int16_t *band_red,    /* I: red values of the lines */
+    const int16_t *band_nir,    /* I: nir values of the lines */
+    const int16_t *band_swir1,  /* I: swir1 values of the lines */
+    const int16_t *band_swir2,  /* I: swir2 values of the lines */
+    const uint16_t *band_pixelqa, /* I: Pixel QA values of the lines */
+    int16_t *band_dswe_diag,    /* O: diagnostic values of the lines, only
+                                      when include_tests_flag */
+    uint8_t *band_dswe_interpreted, /* O: interpreted values of the lines */
+    uint8_t *band_dswe_pshsccss, /* O: filtered interpreted values of the
+                                       lines */
+    uint8_t *band_mask          /* O: mask values of the lines */
+);
+
+
+bool
+dswe_block_needs_reflectance
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    const uint16_t *band_pixelqa, /* I: Pixel QA of the first pixel of the
+                                        block */
+    int line_count,             /* I: lines in the block */
+    int sample_count,           /* I: samples in the block */
+    int line_stride             /* I: Pixel QA values per line */
+);
+
+
+void
+mask_dswe_samples
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    int line,                   /* I: reflectance line of the pixels */
+    int first_sample,           /* I: first sample to populate */
+    int sample_count,           /* I: number of samples to populate */
+    const uint16_t *band_pixelqa, /* I: Pixel QA values of the pixels */
+    int16_t *band_dswe_diag,    /* O: diagnostic values of the pixels, only
+                                      when include_tests_flag */
+    uint8_t *band_dswe_interpreted, /* O: interpreted values of the
+                                          pixels */
+    uint8_t *band_dswe_pshsccss, /* O: filtered interpreted values of the
+                                       pixels */
+    uint8_t *band_mask          /* O: mask values of the pixels */
+);
+
+
+int
+set_dswe_reflectance_scaling
+(
+    Dswe_Classifier_t *classifier, /* IO: classification settings with the
+                                          tolerance values */
+    float scale_factor,         /* I: scale factor of the reflectance */
+    float add_offset            /* I: offset of the reflectance */
+);
+
+
+void
+scale_percent_slope_lines
+(
+    const Dem_Grid_Map_t *dem_grid_map, /* I: maps the reflectance grid onto
+                                              the elevation grid */
+    const float *band_ps,       /* I: percent slope on the elevation grid */
+    int first_line,             /* I: first reflectance line to scale */
+    int line_count,             /* I: number of lines to scale */
+    int16_t *band_ps_int16      /* O: scaled percent slope of the lines */
+);
+
+
+#endif /* CLASSIFY_H */
@@ -72,5 +72,6 @@ typedef enum
 #define MASK_CLOUD  2
 #define MASK_PS     3
 #define MASK_HS     4
+#define MASK_CAST_SHADOW 5 /* Only set when the cast shadow mask is applied */
 
 #endif /* CONST_H */
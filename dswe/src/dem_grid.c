@@ -0,0 +1,365 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "dem_grid.h"
+
+
+/*****************************************************************************
+  NAME:  dem_grid_cell
+
+  PURPOSE:  Finds along one axis the elevation grid cell of the scene
+            containing the center of a reflectance grid cell of the scene.
+
+  RETURN VALUE:  Type = int
+      The elevation cell, counted from the upper left corner of the scene.
+
+  NOTES:
+    1. This is a nearest neighbor, and for the same pixel size the identity.
+       Cells past the elevation extent use the last elevation cell.
+*****************************************************************************/
+int
+dem_grid_cell
+(
+    int index,              /* I: reflectance cell of the scene */
+    double pixel_size,      /* I: reflectance pixel size */
+    double dem_pixel_size,  /* I: elevation pixel size */
+    int dem_count           /* I: number of elevation cells of the scene */
+)
+{
+    int dem_index;
+
+    dem_index = (int) floor ((index + 0.5) * pixel_size / dem_pixel_size);
+
+    if (dem_index < 0)
+        dem_index = 0;
+    else if (dem_index > dem_count - 1)
+        dem_index = dem_count - 1;
+
+    return dem_index;
+}
+
+
+/*****************************************************************************
+  NAME:  grid_lookup_table
+
+  PURPOSE:  Computes for each cell along one axis of the reflectance grid the
+            elevation grid cell containing its center.
+
+  RETURN VALUE:  Type = int *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to allocate memory for the table.
+      *        The lookup table of count entries.
+*****************************************************************************/
+static int *
+grid_lookup_table
+(
+    int count,              /* I: number of reflectance cells */
+    double pixel_size,      /* I: reflectance pixel size */
+    int first,              /* I: reflectance cell of the scene at the first
+                                  reflectance cell */
+    double dem_pixel_size,  /* I: elevation pixel size */
+    int dem_first,          /* I: elevation cell of the scene at the first
+                                  elevation cell */
+    int dem_scene_count     /* I: number of elevation cells of the scene */
+)
+{
+    int index;
+    int *table = NULL;
+
+    table = malloc (count * sizeof (int));
+    if (table == NULL)
+        return NULL;
+
+    for (index = 0; index < count; index++)
+    {
+        table[index] = dem_grid_cell (first + index, pixel_size,
+                                      dem_pixel_size, dem_scene_count)
+                       - dem_first;
+    }
+
+    return table;
+}
+
+
+/*****************************************************************************
+  NAME:  create_dem_grid_map
+
+  PURPOSE:  Builds the lookup tables for sampling products generated on the
+            elevation grid, such as the slope and hillshade, onto the
+            reflectance grid.
+
+  RETURN VALUE:  Type = Dem_Grid_Map_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A pointer to the populated Dem_Grid_Map_t structure.
+
+  NOTES:
+    1. The elevation band may be on a coarser grid than the reflectance bands
+       (for example 90m against 30m), which lets the terrain products be
+       computed at the native elevation resolution instead of from an
+       upsampled copy.
+    2. An elevation band extracted from a DEM tile store has a halo of
+       pixels around the reflectance extent, which gives the terrain
+       products real neighbors at the edges; the halo is skipped here.
+    3. When a window of the scene is processed, the reflectance grid is the
+       window and the elevation grid the part of the elevation band read
+       around it.  Both are placed by their first cell in the scene.
+*****************************************************************************/
+Dem_Grid_Map_t *
+create_dem_grid_map
+(
+    int lines,              /* I: lines of the reflectance grid */
+    int samples,            /* I: samples of the reflectance grid */
+    double x_pixel_size,    /* I: reflectance pixel size in x */
+    double y_pixel_size,    /* I: reflectance pixel size in y */
+    int window_line,        /* I: line of the scene at the first line of
+                                  the reflectance grid */
+    int window_sample,      /* I: sample of the scene at the first sample
+                                  of the reflectance grid */
+    int dem_lines,          /* I: lines of the elevation grid */
+    int dem_samples,        /* I: samples of the elevation grid */
+    double dem_x_pixel_size, /* I: elevation pixel size in x */
+    double dem_y_pixel_size, /* I: elevation pixel size in y */
+    int dem_first_line,     /* I: elevation line of the scene at the first
+                                  line of the elevation grid, negative in a
+                                  halo above the scene */
+    int dem_first_sample,   /* I: elevation sample of the scene at the first
+                                  sample of the elevation grid */
+    int dem_scene_lines,    /* I: elevation lines of the scene */
+    int dem_scene_samples   /* I: elevation samples of the scene */
+)
+{
+    Dem_Grid_Map_t *map = NULL;
+
+    map = calloc (1, sizeof (Dem_Grid_Map_t));
+    if (map == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for the elevation grid map",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    map->lines = lines;
+    map->samples = samples;
+    map->dem_lines = dem_lines;
+    map->dem_samples = dem_samples;
+    map->same_grid = (lines == dem_lines && samples == dem_samples
+                      && x_pixel_size == dem_x_pixel_size
+                      && y_pixel_size == dem_y_pixel_size
+                      && window_line == dem_first_line
+                      && window_sample == dem_first_sample);
+
+    map->dem_line = grid_lookup_table (lines, y_pixel_size, window_line,
+                                       dem_y_pixel_size, dem_first_line,
+                                       dem_scene_lines);
+    map->dem_sample = grid_lookup_table (samples, x_pixel_size,
+                                         window_sample, dem_x_pixel_size,
+                                         dem_first_sample,
+                                         dem_scene_samples);
+    if (map->dem_line == NULL || map->dem_sample == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for the elevation grid"
+                       " lookup tables", MODULE_NAME);
+        free_dem_grid_map (map);
+        return NULL;
+    }
+
+    return map;
+}
+
+
+/*****************************************************************************
+  NAME:  free_dem_grid_map
+
+  PURPOSE:  Frees the memory of a map from create_dem_grid_map.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_dem_grid_map
+(
+    Dem_Grid_Map_t *map     /* I: map from create_dem_grid_map */
+)
+{
+    if (map == NULL)
+        return;
+
+    free (map->dem_line);
+    free (map->dem_sample);
+    free (map);
+}
+
+
+/*****************************************************************************
+  NAME:  resample_dem_grid_uint8
+
+  PURPOSE:  Samples a band generated on the elevation grid onto the
+            reflectance grid.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+resample_dem_grid_uint8
+(
+    Dem_Grid_Map_t *map,    /* I: map from create_dem_grid_map */
+    uint8_t *dem_band,      /* I: band on the elevation grid */
+    uint8_t *band           /* O: band on the reflectance grid */
+)
+{
+    resample_dem_grid_lines_uint8 (map, dem_band, 0, map->lines, band);
+}
+
+
+/*****************************************************************************
+  NAME:  resample_dem_grid_lines_uint8
+
+  PURPOSE:  Samples a band generated on the elevation grid onto a run of
+            lines of the reflectance grid.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+resample_dem_grid_lines_uint8
+(
+    const Dem_Grid_Map_t *map, /* I: map from create_dem_grid_map */
+    const uint8_t *dem_band, /* I: band on the elevation grid */
+    int first_line,         /* I: first reflectance line to sample */
+    int line_count,         /* I: number of lines to sample */
+    uint8_t *band           /* O: the lines on the reflectance grid */
+)
+{
+    int line;
+    int sample;
+    const uint8_t *dem_row; /* elevation grid line for the current line */
+    uint8_t *row;           /* reflectance grid line being filled */
+
+    if (map->same_grid)
+    {
+        memcpy (band, &dem_band[(size_t) first_line * map->samples],
+                (size_t) line_count * map->samples);
+        return;
+    }
+
+    for (line = 0; line < line_count; line++)
+    {
+        dem_row = &dem_band[map->dem_line[first_line + line]
+                            * map->dem_samples];
+        row = &band[line * map->samples];
+
+        for (sample = 0; sample < map->samples; sample++)
+            row[sample] = dem_row[map->dem_sample[sample]];
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  create_dem_geometry
+
+  PURPOSE:  Computes the ground resolution in meters of each line of the
+            elevation grid.
+
+  RETURN VALUE:  Type = Dem_Geometry_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A pointer to the populated Dem_Geometry_t structure.
+
+  NOTES:
+    1. For geographic grids the meters per degree are taken at the latitude
+       of the center of each line on the WGS84 ellipsoid, using the usual
+       series for the length of a degree of latitude and of longitude.  The
+       trigonometry is done once per line so the gradient kernels only look
+       up the resolution of the line they are processing.
+    2. Lines are assumed to run from north to south.
+*****************************************************************************/
+Dem_Geometry_t *
+create_dem_geometry
+(
+    int dem_lines,          /* I: lines of the elevation grid */
+    double dem_x_pixel_size, /* I: elevation pixel size in x */
+    double dem_y_pixel_size, /* I: elevation pixel size in y */
+    bool geographic,        /* I: pixel sizes are in degrees */
+    double ul_latitude      /* I: latitude in degrees of the top edge of the
+                                  grid, only used when geographic */
+)
+{
+    Dem_Geometry_t *geometry = NULL;
+    int line;
+    double latitude;        /* latitude of the center of the line */
+
+    geometry = calloc (1, sizeof (Dem_Geometry_t));
+    if (geometry == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for the elevation geometry",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    geometry->lines = dem_lines;
+    geometry->x_pixel_size = dem_x_pixel_size;
+    geometry->y_pixel_size = dem_y_pixel_size;
+    geometry->geographic = geographic;
+    geometry->ul_latitude = geographic ? ul_latitude : 0.0;
+
+    geometry->ew_resolution = malloc (dem_lines * sizeof (double));
+    geometry->ns_resolution = malloc (dem_lines * sizeof (double));
+    if (geometry->ew_resolution == NULL || geometry->ns_resolution == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for the elevation line"
+                       " resolutions", MODULE_NAME);
+        free_dem_geometry (geometry);
+        return NULL;
+    }
+
+    for (line = 0; line < dem_lines; line++)
+    {
+        if (geographic)
+        {
+            latitude = (ul_latitude - (line + 0.5) * dem_y_pixel_size) * RAD;
+
+            geometry->ew_resolution[line] = dem_x_pixel_size
+                * (111412.84 * cos (latitude) - 93.5 * cos (3.0 * latitude)
+                   + 0.118 * cos (5.0 * latitude));
+            geometry->ns_resolution[line] = dem_y_pixel_size
+                * (111132.954 - 559.822 * cos (2.0 * latitude)
+                   + 1.175 * cos (4.0 * latitude));
+        }
+        else
+        {
+            geometry->ew_resolution[line] = dem_x_pixel_size;
+            geometry->ns_resolution[line] = dem_y_pixel_size;
+        }
+    }
+
+    return geometry;
+}
+
+
+/*****************************************************************************
+  NAME:  free_dem_geometry
+
+  PURPOSE:  Frees the memory of a geometry from create_dem_geometry.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+free_dem_geometry
+(
+    Dem_Geometry_t *geometry /* I: geometry from create_dem_geometry */
+)
+{
+    if (geometry == NULL)
+        return;
+
+    free (geometry->ew_resolution);
+    free (geometry->ns_resolution);
+    free (geometry);
+}
@@ -0,0 +1,126 @@
+
+#ifndef DEM_GRID_H
+#define DEM_GRID_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Structure for sampling products on the elevation grid onto the reflectance
+   grid; both grids are placed in the scene by their first cell, so the
+   elevation grid can have a halo of pixels around the reflectance extent */
+typedef struct
+{
+    int lines;          /* Lines of the reflectance grid */
+    int samples;        /* Samples of the reflectance grid */
+    int dem_lines;      /* Lines of the elevation grid */
+    int dem_samples;    /* Samples of the elevation grid */
+    int *dem_line;      /* Elevation line of each reflectance line */
+    int *dem_sample;    /* Elevation sample of each reflectance sample */
+    bool same_grid;     /* Both grids are the same, so the mapping is the
+                           identity */
+} Dem_Grid_Map_t;
+
+
+/* Structure for the ground resolution of each line of the elevation grid.
+   Projected grids have the same resolution on every line; for geographic
+   grids the east/west meters per pixel shrink toward the poles, so the
+   terrain products look the resolution up per line. */
+typedef struct
+{
+    int lines;              /* Lines of the elevation grid */
+    double x_pixel_size;    /* Elevation pixel size in x */
+    double y_pixel_size;    /* Elevation pixel size in y */
+    bool geographic;        /* Pixel sizes are in degrees of longitude and
+                               latitude rather than meters */
+    double ul_latitude;     /* Latitude in degrees of the top edge of the
+                               grid, only used when geographic */
+    double *ew_resolution;  /* East/west resolution of each line in meters */
+    double *ns_resolution;  /* North/south resolution of each line in
+                               meters */
+} Dem_Geometry_t;
+
+
+int
+dem_grid_cell
+(
+    int index,              /* I: reflectance cell of the scene */
+    double pixel_size,      /* I: reflectance pixel size */
+    double dem_pixel_size,  /* I: elevation pixel size */
+    int dem_count           /* I: number of elevation cells of the scene */
+);
+
+
+Dem_Grid_Map_t *
+create_dem_grid_map
+(
+    int lines,              /* I: lines of the reflectance grid */
+    int samples,            /* I: samples of the reflectance grid */
+    double x_pixel_size,    /* I: reflectance pixel size in x */
+    double y_pixel_size,    /* I: reflectance pixel size in y */
+    int window_line,        /* I: line of the scene at the first line of
+                                  the reflectance grid */
+    int window_sample,      /* I: sample of the scene at the first sample
+                                  of the reflectance grid */
+    int dem_lines,          /* I: lines of the elevation grid */
+    int dem_samples,        /* I: samples of the elevation grid */
+    double dem_x_pixel_size, /* I: elevation pixel size in x */
+    double dem_y_pixel_size, /* I: elevation pixel size in y */
+    int dem_first_line,     /* I: elevation line of the scene at the first
+                                  line of the elevation grid, negative in a
+                                  halo above the scene */
+    int dem_first_sample,   /* I: elevation sample of the scene at the first
+                                  sample of the elevation grid */
+    int dem_scene_lines,    /* I: elevation lines of the scene */
+    int dem_scene_samples   /* I: elevation samples of the scene */
+);
+
+
+void
+free_dem_grid_map
+(
+    Dem_Grid_Map_t *map     /* I: map from create_dem_grid_map */
+);
+
+
+void
+resample_dem_grid_uint8
+(
+    Dem_Grid_Map_t *map,    /* I: map from create_dem_grid_map */
+    uint8_t *dem_band,      /* I: band on the elevation grid */
+    uint8_t *band           /* O: band on the reflectance grid */
+);
+
+
+void
+resample_dem_grid_lines_uint8
+(
+    const Dem_Grid_Map_t *map, /* I: map from create_dem_grid_map */
+    const uint8_t *dem_band, /* I: band on the elevation grid */
+    int first_line,         /* I: first reflectance line to sample */
+    int line_count,         /* I: number of lines to sample */
+    uint8_t *band           /* O: the lines on the reflectance grid */
+);
+
+
+Dem_Geometry_t *
+create_dem_geometry
+(
+    int dem_lines,          /* I: lines of the elevation grid */
+    double dem_x_pixel_size, /* I: elevation pixel size in x */
+    double dem_y_pixel_size, /* I: elevation pixel size in y */
+    bool geographic,        /* I: pixel sizes are in degrees */
+    double ul_latitude      /* I: latitude in degrees of the top edge of the
+                                  grid, only used when geographic */
+);
+
+
+void
+free_dem_geometry
+(
+    Dem_Geometry_t *geometry /* I: geometry from create_dem_geometry */
+);
+
+
+#endif /* DEM_GRID_H */
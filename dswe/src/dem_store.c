@@ -0,0 +1,595 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "espa_metadata.h"
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "dem_store.h"
+
+
+#define DEM_STORE_MAGIC "DSWE_DEM_TILES"
+#define DEM_STORE_VERSION 1
+
+/* Longest line of an index file */
+#define DEM_STORE_LINE_SIZE (PATH_MAX + 64)
+
+
+/*****************************************************************************
+  NAME:  compare_tiles
+
+  PURPOSE:  Orders tiles by row and then column, for sorting and searching
+            the tiles of a store.
+
+  RETURN VALUE:  Type = int
+      Less than, equal to or greater than zero as the first tile is before,
+      at or after the second.
+*****************************************************************************/
+static int
+compare_tiles
+(
+    const void *tile_a,   /* I: first tile */
+    const void *tile_b    /* I: second tile */
+)
+{
+    const Dem_Tile_t *a = tile_a;
+    const Dem_Tile_t *b = tile_b;
+
+    if (a->row != b->row)
+        return (a->row < b->row) ? -1 : 1;
+    if (a->col != b->col)
+        return (a->col < b->col) ? -1 : 1;
+    return 0;
+}
+
+
+/*****************************************************************************
+  NAME:  floor_div
+
+  PURPOSE:  Integer division rounding toward negative infinity, so pixels
+            before the origin fall in negative tiles.
+
+  RETURN VALUE:  Type = int
+      The quotient.
+*****************************************************************************/
+static int
+floor_div
+(
+    int value,            /* I: dividend */
+    int divisor           /* I: positive divisor */
+)
+{
+    return (value >= 0) ? value / divisor : -((divisor - 1 - value) / divisor);
+}
+
+
+/*****************************************************************************
+  NAME:  add_tile
+
+  PURPOSE:  Append a tile entry of an index file to the store, with its
+            filename relative to the directory of the index file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The tile was added.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+add_tile
+(
+    Dem_Tile_Store_t *store, /* IO: store to add the tile to */
+    int *tile_capacity,   /* IO: number of tiles allocated */
+    const char *index_dir, /* I: directory of the index file */
+    int row,              /* I: tile row */
+    int col,              /* I: tile column */
+    const char *filename  /* I: tile filename from the index file */
+)
+{
+    Dem_Tile_t *tiles;
+    char path[PATH_MAX];
+    int count;
+
+    if (store->tile_count == *tile_capacity)
+    {
+        *tile_capacity = (*tile_capacity == 0) ? 256 : 2 * *tile_capacity;
+        tiles = realloc (store->tiles, *tile_capacity * sizeof (Dem_Tile_t));
+        if (tiles == NULL)
+        {
+            RETURN_ERROR ("Failed allocating memory for the DEM tiles",
+                          MODULE_NAME, ERROR);
+        }
+        store->tiles = tiles;
+    }
+
+    if (filename[0] == '/')
+        count = snprintf (path, sizeof (path), "%s", filename);
+    else
+        count = snprintf (path, sizeof (path), "%s/%s", index_dir, filename);
+    if (count < 0 || count >= sizeof (path))
+        RETURN_ERROR ("DEM tile filename is too long", MODULE_NAME, ERROR);
+
+    store->tiles[store->tile_count].row = row;
+    store->tiles[store->tile_count].col = col;
+    store->tiles[store->tile_count].filename = strdup (path);
+    if (store->tiles[store->tile_count].filename == NULL)
+    {
+        RETURN_ERROR ("Failed allocating memory for the DEM tiles",
+                      MODULE_NAME, ERROR);
+    }
+    store->tile_count++;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_dem_tile_store
+
+  PURPOSE:  Read the index file of a DEM tile store.
+
+  RETURN VALUE:  Type = Dem_Tile_Store_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A pointer to the populated Dem_Tile_Store_t structure.
+
+  NOTES:
+    1. The index file is text, one keyword per line, with blank lines and
+       lines starting with # ignored:
+           DSWE_DEM_TILES 1
+           projection <GCTP projection code> <UTM zone>
+           pixel_size <x> <y>
+           origin <x> <y>            upper left corner of tile 0, 0
+           tile_size <lines> <samples>
+           missing <elevation>       optional, default 0
+           tile <row> <col> <file>   one per tile
+       Tile rows increase to the south and columns to the east, and may be
+       negative.  Each tile file holds tile_size raw INT16 elevations in
+       meters, and relative filenames are from the directory of the index.
+    2. The tiles covering only ocean can be left out; the missing value is
+       used for them.
+*****************************************************************************/
+Dem_Tile_Store_t *
+open_dem_tile_store
+(
+    const char *index_filename /* I: index file of the tile store */
+)
+{
+    Dem_Tile_Store_t *store = NULL;
+    FILE *index_fd = NULL;
+    char line[DEM_STORE_LINE_SIZE];
+    char keyword[32];
+    char filename[DEM_STORE_LINE_SIZE];
+    char index_dir[PATH_MAX];
+    char msg[PATH_MAX + 64];
+    char *slash;
+    int line_number = 0;
+    int version = 0;
+    int tile_capacity = 0;
+    int row;
+    int col;
+    int missing_value;
+    bool have_projection = false;
+    bool have_pixel_size = false;
+    bool have_origin = false;
+    bool have_tile_size = false;
+    bool valid = true;
+
+    index_fd = fopen (index_filename, "r");
+    if (index_fd == NULL)
+    {
+        snprintf (msg, sizeof (msg), "Failed to open the DEM tile store"
+                  " index (%s)", index_filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        return NULL;
+    }
+
+    store = calloc (1, sizeof (Dem_Tile_Store_t));
+    if (store == NULL)
+    {
+        fclose (index_fd);
+        ERROR_MESSAGE ("Failed allocating memory for the DEM tile store",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    /* Tile filenames are relative to the directory of the index */
+    snprintf (index_dir, sizeof (index_dir), "%s", index_filename);
+    slash = strrchr (index_dir, '/');
+    if (slash == NULL)
+        snprintf (index_dir, sizeof (index_dir), ".");
+    else if (slash == index_dir)
+        slash[1] = '\0';
+    else
+        *slash = '\0';
+
+    while (valid && fgets (line, sizeof (line), index_fd) != NULL)
+    {
+        line_number++;
+        if (sscanf (line, "%31s", keyword) != 1 || keyword[0] == '#')
+            continue;
+
+        if (version == 0)
+        {
+            valid = (strcmp (keyword, DEM_STORE_MAGIC) == 0
+                     && sscanf (line, "%*s %d", &version) == 1
+                     && version == DEM_STORE_VERSION);
+        }
+        else if (strcmp (keyword, "projection") == 0)
+        {
+            valid = (sscanf (line, "%*s %d %d", &store->proj_type,
+                             &store->zone) == 2);
+            store->geographic = (store->proj_type == GCTP_GEO_PROJ);
+            have_projection = true;
+        }
+        else if (strcmp (keyword, "pixel_size") == 0)
+        {
+            valid = (sscanf (line, "%*s %lf %lf", &store->x_pixel_size,
+                             &store->y_pixel_size) == 2
+                     && store->x_pixel_size > 0.0
+                     && store->y_pixel_size > 0.0);
+            have_pixel_size = true;
+        }
+        else if (strcmp (keyword, "origin") == 0)
+        {
+            valid = (sscanf (line, "%*s %lf %lf", &store->origin_x,
+                             &store->origin_y) == 2);
+            have_origin = true;
+        }
+        else if (strcmp (keyword, "tile_size") == 0)
+        {
+            valid = (sscanf (line, "%*s %d %d", &store->tile_lines,
+                             &store->tile_samples) == 2
+                     && store->tile_lines > 0 && store->tile_samples > 0);
+            have_tile_size = true;
+        }
+        else if (strcmp (keyword, "missing") == 0)
+        {
+            valid = (sscanf (line, "%*s %d", &missing_value) == 1
+                     && missing_value >= INT16_MIN
+                     && missing_value <= INT16_MAX);
+            store->missing_value = (int16_t) missing_value;
+        }
+        else if (strcmp (keyword, "tile") == 0)
+        {
+            valid = (sscanf (line, "%*s %d %d %s", &row, &col, filename) == 3);
+            if (valid && add_tile (store, &tile_capacity, index_dir, row, col,
+                                   filename) != SUCCESS)
+            {
+                /* error messages provided by add_tile */
+                fclose (index_fd);
+                close_dem_tile_store (store);
+                return NULL;
+            }
+        }
+        else
+            valid = false;
+    }
+    fclose (index_fd);
+
+    if (!valid || version != DEM_STORE_VERSION)
+    {
+        snprintf (msg, sizeof (msg), "Invalid DEM tile store index at line"
+                  " %d (%s)", line_number, index_filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        close_dem_tile_store (store);
+        return NULL;
+    }
+
+    if (!have_projection || !have_pixel_size || !have_origin
+        || !have_tile_size || store->tile_count == 0)
+    {
+        snprintf (msg, sizeof (msg), "Incomplete DEM tile store index (%s)",
+                  index_filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        close_dem_tile_store (store);
+        return NULL;
+    }
+
+    /* Sorted by row and column, the tiles of a scene are found with a
+       binary search each */
+    qsort (store->tiles, store->tile_count, sizeof (Dem_Tile_t),
+           compare_tiles);
+
+    return store;
+}
+
+
+/*****************************************************************************
+  NAME:  close_dem_tile_store
+
+  PURPOSE:  Free the memory of a DEM tile store.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_dem_tile_store
+(
+    Dem_Tile_Store_t *store /* I: store from open_dem_tile_store */
+)
+{
+    int index;
+
+    if (store == NULL)
+        return;
+
+    for (index = 0; index < store->tile_count; index++)
+        free (store->tiles[index].filename);
+    free (store->tiles);
+    free (store);
+}
+
+
+/*****************************************************************************
+  NAME:  find_dem_tile
+
+  PURPOSE:  Look up a tile of the store by its row and column.
+
+  RETURN VALUE:  Type = const Dem_Tile_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The store has no such tile.
+      *        The tile.
+*****************************************************************************/
+static const Dem_Tile_t *
+find_dem_tile
+(
+    const Dem_Tile_Store_t *store, /* I: store from open_dem_tile_store */
+    int row,              /* I: tile row */
+    int col               /* I: tile column */
+)
+{
+    Dem_Tile_t key;
+
+    key.row = row;
+    key.col = col;
+    return bsearch (&key, store->tiles, store->tile_count,
+                    sizeof (Dem_Tile_t), compare_tiles);
+}
+
+
+/*****************************************************************************
+  NAME:  copy_dem_tile
+
+  PURPOSE:  Copy the part of a tile covered by the elevation band into it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The tile was copied.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The tile is memory mapped, so only the tile lines under the scene
+       are read from disk.
+*****************************************************************************/
+static int
+copy_dem_tile
+(
+    const Dem_Tile_Store_t *store, /* I: store from open_dem_tile_store */
+    const Dem_Tile_t *tile, /* I: tile to copy */
+    const int *store_row, /* I: store line of each elevation line */
+    const int *store_col, /* I: store sample of each elevation sample */
+    int first_line,       /* I: first elevation line in the tile */
+    int end_line,         /* I: elevation line past the tile */
+    int first_sample,     /* I: first elevation sample in the tile */
+    int end_sample,       /* I: elevation sample past the tile */
+    int dem_samples,      /* I: samples of the elevation band */
+    int16_t *band_dem     /* IO: the elevation band */
+)
+{
+    size_t map_size = (size_t) store->tile_lines * store->tile_samples
+                      * sizeof (int16_t);
+    struct stat tile_stat;
+    int16_t *tile_dem;
+    int16_t *tile_line;
+    int first_row = tile->row * store->tile_lines; /* store line of the
+                                                      first tile line */
+    int first_col = tile->col * store->tile_samples; /* store sample of the
+                                                        first tile sample */
+    int line;
+    int sample;
+    int fd;
+    char msg[PATH_MAX + 64];
+
+    fd = open (tile->filename, O_RDONLY);
+    if (fd < 0)
+    {
+        snprintf (msg, sizeof (msg), "Failed to open DEM tile (%s)",
+                  tile->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    if (fstat (fd, &tile_stat) != 0 || (size_t) tile_stat.st_size != map_size)
+    {
+        close (fd);
+        snprintf (msg, sizeof (msg), "DEM tile has an unexpected size (%s)",
+                  tile->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    tile_dem = mmap (NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (tile_dem == MAP_FAILED)
+    {
+        snprintf (msg, sizeof (msg), "Failed mapping DEM tile (%s)",
+                  tile->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    for (line = first_line; line < end_line; line++)
+    {
+        tile_line = &tile_dem[(size_t) (store_row[line] - first_row)
+                              * store->tile_samples];
+        for (sample = first_sample; sample < end_sample; sample++)
+        {
+            band_dem[(size_t) line * dem_samples + sample] =
+                tile_line[store_col[sample] - first_col];
+        }
+    }
+
+    munmap (tile_dem, map_size);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_dem_tile_store
+
+  PURPOSE:  Extract the elevation band of a scene from the tiles of the store
+            overlapping it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The elevation band was extracted.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The elevation band is on the pixel size of the store and starts at the
+       upper left corner of the scene, so the tiles are sampled with nearest
+       neighbor when the scene corner is not on the store grid.
+    2. The halo pixels around the scene come from the neighboring tiles, so
+       the terrain products have real neighbors at the scene edges instead of
+       unprocessed edge pixels.
+    3. The band can cover a part of the scene, such as the window being
+       processed and its halo, placed by its first elevation pixel.
+*****************************************************************************/
+int
+read_dem_tile_store
+(
+    const Dem_Tile_Store_t *store, /* I: store from open_dem_tile_store */
+    double ul_x,          /* I: x of the upper left corner of the scene */
+    double ul_y,          /* I: y of the upper left corner of the scene */
+    int dem_lines,        /* I: lines of the elevation band, with the halo */
+    int dem_samples,      /* I: samples of the elevation band, with the
+                                halo */
+    int first_line,       /* I: elevation line of the scene at the first
+                                line of the band, negative in the halo */
+    int first_sample,     /* I: elevation sample of the scene at the first
+                                sample of the band, negative in the halo */
+    int16_t *band_dem     /* O: the elevation band */
+)
+{
+    int *store_row = NULL; /* store line of each elevation line */
+    int *store_col = NULL; /* store sample of each elevation sample */
+    int *col_start = NULL; /* first elevation sample of each tile column */
+    int first_tile_col;    /* tile column of the first elevation sample */
+    int tile_col_count;    /* tile columns overlapping the scene */
+    int tile_row;          /* tile row of the current lines */
+    int tile_col;          /* index of the tile column */
+    int line;
+    int end_line;
+    int sample;
+    int tile_count = 0;    /* tiles found for the scene */
+    const Dem_Tile_t *tile;
+    size_t index;
+    int status = SUCCESS;
+
+    store_row = malloc (dem_lines * sizeof (int));
+    store_col = malloc (dem_samples * sizeof (int));
+    if (store_row == NULL || store_col == NULL)
+    {
+        free (store_row);
+        free (store_col);
+        RETURN_ERROR ("Failed allocating memory for the DEM tile lookup",
+                      MODULE_NAME, ERROR);
+    }
+
+    /* The store pixel containing the center of each elevation pixel */
+    for (line = 0; line < dem_lines; line++)
+    {
+        store_row[line] = (int) floor ((store->origin_y - ul_y)
+                                       / store->y_pixel_size
+                                       + (line + first_line + 0.5));
+    }
+    for (sample = 0; sample < dem_samples; sample++)
+    {
+        store_col[sample] = (int) floor ((ul_x - store->origin_x)
+                                         / store->x_pixel_size
+                                         + (sample + first_sample + 0.5));
+    }
+
+    /* The samples of each tile column are consecutive */
+    first_tile_col = floor_div (store_col[0], store->tile_samples);
+    tile_col_count = floor_div (store_col[dem_samples - 1],
+                                store->tile_samples) - first_tile_col + 1;
+    col_start = malloc ((tile_col_count + 1) * sizeof (int));
+    if (col_start == NULL)
+    {
+        free (store_row);
+        free (store_col);
+        RETURN_ERROR ("Failed allocating memory for the DEM tile lookup",
+                      MODULE_NAME, ERROR);
+    }
+    tile_col = 0;
+    col_start[0] = 0;
+    for (sample = 0; sample < dem_samples; sample++)
+    {
+        while (floor_div (store_col[sample], store->tile_samples)
+               > first_tile_col + tile_col)
+        {
+            tile_col++;
+            col_start[tile_col] = sample;
+        }
+    }
+    col_start[tile_col_count] = dem_samples;
+
+    /* Pixels without a tile keep the missing value */
+    for (index = 0; index < (size_t) dem_lines * dem_samples; index++)
+        band_dem[index] = store->missing_value;
+
+    for (line = 0; line < dem_lines && status == SUCCESS; line = end_line)
+    {
+        tile_row = floor_div (store_row[line], store->tile_lines);
+        for (end_line = line + 1; end_line < dem_lines
+             && floor_div (store_row[end_line], store->tile_lines) == tile_row;
+             end_line++)
+            ;
+
+        for (tile_col = 0; tile_col < tile_col_count; tile_col++)
+        {
+            tile = find_dem_tile (store, tile_row, first_tile_col + tile_col);
+            if (tile == NULL)
+                continue;
+
+            status = copy_dem_tile (store, tile, store_row, store_col, line,
+                                    end_line, col_start[tile_col],
+                                    col_start[tile_col + 1], dem_samples,
+                                    band_dem);
+            if (status != SUCCESS)
+                break;
+            tile_count++;
+        }
+    }
+
+    free (store_row);
+    free (store_col);
+    free (col_start);
+
+    if (status != SUCCESS)
+    {
+        /* error messages provided by copy_dem_tile */
+        return ERROR;
+    }
+
+    if (tile_count == 0)
+    {
+        RETURN_ERROR ("The DEM tile store has no tiles overlapping the scene",
+                      MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
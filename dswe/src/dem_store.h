@@ -0,0 +1,70 @@
+
+#ifndef DEM_STORE_H
+#define DEM_STORE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Structure for one tile of a DEM tile store */
+typedef struct
+{
+    int row;              /* Tile row, increasing to the south */
+    int col;              /* Tile column, increasing to the east */
+    char *filename;       /* Raw INT16 elevation file of the tile */
+} Dem_Tile_t;
+
+
+/* Structure for a DEM tile store, which is a mosaic of equally sized raw
+   elevation tiles on one regular grid, described by an index file */
+typedef struct
+{
+    int proj_type;        /* GCTP projection code of the tile grid */
+    int zone;             /* UTM zone of the tile grid, only checked for UTM */
+    bool geographic;      /* Pixel sizes are in degrees */
+    double origin_x;      /* x of the upper left corner of tile 0, 0 */
+    double origin_y;      /* y of the upper left corner of tile 0, 0 */
+    double x_pixel_size;  /* Pixel size of the tiles in x */
+    double y_pixel_size;  /* Pixel size of the tiles in y */
+    int tile_lines;       /* Lines in each tile */
+    int tile_samples;     /* Samples in each tile */
+    int16_t missing_value; /* Elevation used where the store has no tile */
+    int tile_count;       /* Number of tiles in the store */
+    Dem_Tile_t *tiles;    /* Tiles sorted by row and column, which is the
+                             spatial index for finding the tiles of a scene */
+} Dem_Tile_Store_t;
+
+
+Dem_Tile_Store_t *
+open_dem_tile_store
+(
+    const char *index_filename /* I: index file of the tile store */
+);
+
+
+void
+close_dem_tile_store
+(
+    Dem_Tile_Store_t *store /* I: store from open_dem_tile_store */
+);
+
+
+int
+read_dem_tile_store
+(
+    const Dem_Tile_Store_t *store, /* I: store from open_dem_tile_store */
+    double ul_x,          /* I: x of the upper left corner of the scene */
+    double ul_y,          /* I: y of the upper left corner of the scene */
+    int dem_lines,        /* I: lines of the elevation band, with the halo */
+    int dem_samples,      /* I: samples of the elevation band, with the
+                                halo */
+    int first_line,       /* I: elevation line of the scene at the first
+                                line of the band, negative in the halo */
+    int first_sample,     /* I: elevation sample of the scene at the first
+                                sample of the band, negative in the halo */
+    int16_t *band_dem     /* O: the elevation band */
+);
+
+
+#endif /* DEM_STORE_H */
@@ -7,6 +7,9 @@
 #include <error.h>
 #include <string.h>
 #include <float.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "error_handler.h"
 #include "espa_metadata.h"
@@ -24,11 +27,14 @@
 #include "output.h"
 #include "build_slope_band.h"
 #include "build_hillshade_band.h"
-
-
-#define PIXELQA_CLOUD_SHADOW_BIT_MASK (1<<3)
-#define PIXELQA_SNOW_BIT_MASK (1<<4)
-#define PIXELQA_CLOUD_BIT_MASK (1<<5)
+#include "terrain_cache.h"
+#include "build_horizon_band.h"
+#include "dem_grid.h"
+#include "gradient_operator.h"
+#include "classify.h"
+#include "pipeline.h"
+#include "metadata_sidecar.h"
+#include "scene_window.h"
 
 
 /*****************************************************************************
@@ -55,7 +61,9 @@ free_band_memory
     int16_t *band_dswe_diag,
     uint8_t *band_dswe_interpreted,
     uint8_t *band_dswe_pshsccss,
-    uint8_t *band_mask
+    uint8_t *band_mask,
+    uint8_t *band_hillshade_mask,
+    uint8_t *band_slope_class
 )
 {
     free (band_blue);
@@ -73,6 +81,8 @@ free_band_memory
     free (band_dswe_interpreted);
     free (band_dswe_pshsccss);
     free (band_mask);
+    free (band_hillshade_mask);
+    free (band_slope_class);
 }
 
 
@@ -81,6 +91,11 @@ free_band_memory
 
   PURPOSE:  Allocate memory for all the input bands.
 
+  NOTES:
+    1. With strip_flag the reflectance, QA and output bands are processed a
+       strip at a time by the pipeline, which has its own buffers, so only
+       the bands on the elevation grid are allocated.
+
   RETURN VALUE:  Type = bool
       Value    Description
       -------  ---------------------------------------------------------------
@@ -91,7 +106,11 @@ free_band_memory
 int
 allocate_band_memory
 (
+    Band_Reader_e band_reader,
+    bool strip_flag,
     bool include_tests_flag,
+    bool include_ps_flag,
+    bool include_hs_flag,
     int16_t **band_blue,
     int16_t **band_green,
     int16_t **band_red,
@@ -107,95 +126,115 @@ allocate_band_memory
     uint8_t **band_dswe_interpreted,
     uint8_t **band_dswe_pshsccss,
     uint8_t **band_mask,
-    int pixel_count
+    uint8_t **band_hillshade_mask,
+    uint8_t **band_slope_class,
+    int pixel_count,
+    int dem_pixel_count,
+    int hillshade_mask_size
 )
 {
-    *band_blue = calloc (pixel_count, sizeof (int16_t));
-    if (*band_blue == NULL)
+    /* The reflectance bands are mapped from their files rather than read
+       into allocated memory when mapping.  Read bands are entirely
+       overwritten, so they do not need zero filling. */
+    if (band_reader == BAND_READER_READ && !strip_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for BLUE band", MODULE_NAME);
+        *band_blue = malloc (pixel_count * sizeof (int16_t));
+        if (*band_blue == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for BLUE band",
+                           MODULE_NAME);
 
-        /* No free because we have not allocated any memory yet */
-        return ERROR;
-    }
+            /* No free because we have not allocated any memory yet */
+            return ERROR;
+        }
 
-    *band_green = calloc (pixel_count, sizeof (int16_t));
-    if (*band_green == NULL)
-    {
-        ERROR_MESSAGE ("Failed allocating memory for GREEN band", MODULE_NAME);
+        *band_green = malloc (pixel_count * sizeof (int16_t));
+        if (*band_green == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for GREEN band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
-    }
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
 
-    *band_red = calloc (pixel_count, sizeof (int16_t));
-    if (*band_red == NULL)
-    {
-        ERROR_MESSAGE ("Failed allocating memory for RED band", MODULE_NAME);
+        *band_red = malloc (pixel_count * sizeof (int16_t));
+        if (*band_red == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for RED band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
-    }
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
 
-    *band_nir = calloc (pixel_count, sizeof (int16_t));
-    if (*band_nir == NULL)
-    {
-        ERROR_MESSAGE ("Failed allocating memory for NIR band", MODULE_NAME);
+        *band_nir = malloc (pixel_count * sizeof (int16_t));
+        if (*band_nir == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for NIR band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
-    }
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
 
-    *band_swir1 = calloc (pixel_count, sizeof (int16_t));
-    if (*band_swir1 == NULL)
-    {
-        ERROR_MESSAGE ("Failed allocating memory for SWIR1 band", MODULE_NAME);
+        *band_swir1 = malloc (pixel_count * sizeof (int16_t));
+        if (*band_swir1 == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for SWIR1 band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
-    }
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
 
-    *band_swir2 = calloc (pixel_count, sizeof (int16_t));
-    if (*band_swir2 == NULL)
-    {
-        ERROR_MESSAGE ("Failed allocating memory for brightness temp band",
-                       MODULE_NAME);
+        *band_swir2 = malloc (pixel_count * sizeof (int16_t));
+        if (*band_swir2 == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for brightness temp band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
     }
 
-    *band_elevation = calloc (pixel_count, sizeof (int16_t));
+    *band_elevation = malloc (dem_pixel_count * sizeof (int16_t));
     if (*band_elevation == NULL)
     {
         ERROR_MESSAGE ("Failed allocating memory for elevation band",
@@ -207,46 +246,77 @@ allocate_band_memory
                           *band_pixelqa, *band_ps, *band_ps_int16, 
                           *band_hillshade, *band_dswe_diag, 
                           *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
+                          *band_mask, *band_hillshade_mask, *band_slope_class);
         return ERROR;
     }
 
-    *band_pixelqa = calloc (pixel_count, sizeof (uint16_t));
-    if (*band_pixelqa == NULL)
+    if (band_reader == BAND_READER_READ && !strip_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for Pixel QA band",
-                       MODULE_NAME);
+        *band_pixelqa = malloc (pixel_count * sizeof (uint16_t));
+        if (*band_pixelqa == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for Pixel QA band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
     }
 
-    *band_ps = calloc (pixel_count, sizeof (float));
-    if (*band_ps == NULL)
+    /* The percent slope values are only needed for output, the
+       classification uses the slope class band */
+    if (include_ps_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for percent slope band",
-                       MODULE_NAME);
+        *band_ps = calloc (dem_pixel_count, sizeof (float));
+        if (*band_ps == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for percent slope band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
+
+        /* The pipeline scales the percent slope a strip at a time */
+        if (!strip_flag)
+        {
+            *band_ps_int16 = calloc (pixel_count, sizeof (int16_t));
+            if (*band_ps_int16 == NULL)
+            {
+                ERROR_MESSAGE ("Failed allocating memory for int16 percent"
+                               " slope band", MODULE_NAME);
+
+                /* Free allocated memory */
+                free_band_memory (*band_blue, *band_green, *band_red,
+                                  *band_nir, *band_swir1, *band_swir2,
+                                  *band_elevation, *band_pixelqa, *band_ps,
+                                  *band_ps_int16, *band_hillshade,
+                                  *band_dswe_diag, *band_dswe_interpreted,
+                                  *band_dswe_pshsccss, *band_mask,
+                                  *band_hillshade_mask, *band_slope_class);
+                return ERROR;
+            }
+        }
     }
 
-    *band_ps_int16 = calloc (pixel_count, sizeof (int16_t));
-    if (*band_ps_int16 == NULL)
+    *band_slope_class = calloc (dem_pixel_count, sizeof (uint8_t));
+    if (*band_slope_class == NULL)
     {
-        ERROR_MESSAGE ("Failed allocating memory for int16 percent slope band",
+        ERROR_MESSAGE ("Failed allocating memory for slope class band",
                        MODULE_NAME);
 
         /* Free allocated memory */
@@ -255,26 +325,54 @@ allocate_band_memory
                           *band_pixelqa, *band_ps, *band_ps_int16, 
                           *band_hillshade, *band_dswe_diag, 
                           *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
+                          *band_mask, *band_hillshade_mask, *band_slope_class);
         return ERROR;
     }
 
-    *band_hillshade = calloc (pixel_count, sizeof (uint8_t));
-    if (*band_hillshade == NULL)
+    /* The hillshade values are only needed for output, otherwise the packed
+       mask of the pixels above the hillshade threshold is enough */
+    if (include_hs_flag)
     {
-        ERROR_MESSAGE ("Failed allocating memory for hillshade band",
-                       MODULE_NAME);
+        *band_hillshade = calloc (dem_pixel_count, sizeof (uint8_t));
+        if (*band_hillshade == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for hillshade band",
+                           MODULE_NAME);
 
-        /* Free allocated memory */
-        free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
-                          *band_swir1, *band_swir2, *band_elevation,
-                          *band_pixelqa, *band_ps, *band_ps_int16, 
-                          *band_hillshade, *band_dswe_diag, 
-                          *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
-        return ERROR;
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
+    }
+    else
+    {
+        *band_hillshade_mask = calloc (hillshade_mask_size, sizeof (uint8_t));
+        if (*band_hillshade_mask == NULL)
+        {
+            ERROR_MESSAGE ("Failed allocating memory for hillshade mask",
+                           MODULE_NAME);
+
+            /* Free allocated memory */
+            free_band_memory (*band_blue, *band_green, *band_red, *band_nir,
+                              *band_swir1, *band_swir2, *band_elevation,
+                              *band_pixelqa, *band_ps, *band_ps_int16, 
+                              *band_hillshade, *band_dswe_diag, 
+                              *band_dswe_interpreted, *band_dswe_pshsccss, 
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
+            return ERROR;
+        }
     }
 
+    /* The pipeline classifies into its own strip buffers */
+    if (strip_flag)
+        return SUCCESS;
 
     if (include_tests_flag)
     {
@@ -290,7 +388,8 @@ allocate_band_memory
                               *band_pixelqa, *band_ps, *band_ps_int16, 
                               *band_hillshade, *band_dswe_diag, 
                               *band_dswe_interpreted, *band_dswe_pshsccss, 
-                              *band_mask);
+                              *band_mask, *band_hillshade_mask,
+                              *band_slope_class);
             return ERROR;
         }
     }
@@ -307,7 +406,7 @@ allocate_band_memory
                           *band_pixelqa, *band_ps, *band_ps_int16, 
                           *band_hillshade, *band_dswe_diag, 
                           *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
+                          *band_mask, *band_hillshade_mask, *band_slope_class);
         return ERROR;
     }
 
@@ -323,7 +422,7 @@ allocate_band_memory
                           *band_pixelqa, *band_ps, *band_ps_int16, 
                           *band_hillshade, *band_dswe_diag, 
                           *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
+                          *band_mask, *band_hillshade_mask, *band_slope_class);
         return ERROR;
     }
 
@@ -339,7 +438,7 @@ allocate_band_memory
                           *band_pixelqa, *band_ps, *band_ps_int16, 
                           *band_hillshade, *band_dswe_diag, 
                           *band_dswe_interpreted, *band_dswe_pshsccss, 
-                          *band_mask);
+                          *band_mask, *band_hillshade_mask, *band_slope_class);
         return ERROR;
     }
 
@@ -348,143 +447,350 @@ allocate_band_memory
 
 
 /*****************************************************************************
-  NAME:  main
-
-  PURPOSE:  Implements the core algorithm for DSWE.
-
-  ALGORITHM DEVELOPERS:
-
-      The algorithm implemented here was developed by the following:
+  NAME:  add_dswe_products
 
-      John W. Jones
-      Research Geographer
-      Eastern Geographic Science Center
-      U.S. Geological Survey
-      email: jwjones@usgs.gov
-
-      Michael J. Starbuck
-      Physical Scientist
-      Earth Resources Observation and Science Center
-      U.S. Geological Survey
-      email: mstarbuck@usgs.gov
+  PURPOSE:  Add the DSWE bands to the metadata file and generate the ENVI
+            images and header files, unless the pipeline has written the
+            images already.
 
   RETURN VALUE:  Type = int
       Value           Description
       --------------  --------------------------------------------------------
-      EXIT_FAILURE    An unrecoverable error occured during processing.
-      EXIT_SUCCESS    No errors encountered processing successful.
+      ERROR           An error occured adding a product.
+      SUCCESS         All the products were added.
 *****************************************************************************/
-int
-main (int argc, char *argv[])
+static int
+add_dswe_products
+(
+    char *xml_filename,        /* I: XML the bands are added to */
+    Espa_internal_meta_t *xml_metadata, /* IO: metadata of the XML */
+    bool use_toa_flag,         /* I: the scene is processed from TOA */
+    Io_Backend_e io_backend,   /* I: backend writing the images */
+    bool include_tests_flag,   /* I: add the diagnostic band */
+    bool include_ps_flag,      /* I: add the percent slope band */
+    bool include_hs_flag,      /* I: add the hillshade band */
+    bool cast_shadow_flag,     /* I: the mask has the cast shadow bit */
+    int pipeline_lines,        /* I: lines per strip of the pipeline, 0 when
+                                     the bands are in memory */
+    int lines,                 /* I: lines of the reflectance grid */
+    int pixel_count,           /* I: pixels of the reflectance grid */
+    Dem_Grid_Map_t *dem_grid_map, /* I: elevation grid of each pixel */
+    float *band_ps,            /* I: percent slope on the elevation grid */
+    int16_t *band_ps_int16,    /* O: scaled percent slope */
+    uint8_t *band_hillshade,   /* I: hillshade on the elevation grid */
+    int16_t *band_dswe_diag,   /* I: diagnostic band */
+    uint8_t *band_dswe_interpreted, /* I: interpreted band */
+    uint8_t *band_dswe_pshsccss, /* I: filtered interpreted band */
+    uint8_t *band_mask         /* I: mask band */
+)
 {
-    /* Command line parameters */
-    char *xml_filename = NULL;  /* filename for the XML input */
-    Espa_internal_meta_t xml_metadata;  /* XML metadata structure */
-    bool use_zeven_thorne_flag = false;
-    bool use_toa_flag = false;
-    bool include_tests_flag = false;
-    bool include_ps_flag = false; /* Flag for including percent slope output */
-    bool include_hs_flag = false; /* Flag for including hillshade output */
-    float wigt;                  /* tolerance value */
-    float awgt;                  /* tolerance value */
-    float pswt_1_mndwi;          /* tolerance value */
-    int pswt_1_nir;              /* tolerance value */
-    int pswt_1_swir1;            /* tolerance value */
-    float pswt_1_ndvi;           /* tolerance value */
-    float pswt_2_mndwi;          /* tolerance value */
-    int pswt_2_blue;             /* tolerance value */
-    int pswt_2_nir;              /* tolerance value */
-    int pswt_2_swir1;            /* tolerance value */
-    int pswt_2_swir2;            /* tolerance value */
-    float percent_slope_high;    /* Slope tolerance for high confidence water */
-    float percent_slope_moderate; /* Slope tolerance for moderate confidence
-                                   water */
-    float percent_slope_wetland; /* Slope tolerance for potential wetland */
-    float percent_slope_low;     /* Slope tolerance for low confidence water or
-                                     wetland */
-    int hillshade;               /* Hillshade tolerance value */ 
-    bool verbose_flag = false;
-
-    /* Band data */
-    Input_Data_t *input_data = NULL;
-    int16_t *band_blue = NULL;  /* TM SR_Band1,  OLI SR_Band2 */
-    int16_t *band_green = NULL; /* TM SR_Band2,  OLI SR_Band3 */
-    int16_t *band_red = NULL;   /* TM SR_Band3,  OLI SR_Band4 */
-    int16_t *band_nir = NULL;   /* TM SR_Band4,  OLI SR_Band5 */
-    int16_t *band_swir1 = NULL; /* TM SR_Band5,  OLI SR_Band6 */
-    int16_t *band_swir2 = NULL; /* TM SR_Band7,  OLI SR_Band7 */
-    int16_t *band_elevation = NULL; /* Contains the elevation band */
-    uint16_t *band_pixelqa = NULL;  /* Pixel QA */
-    float *band_ps = NULL;       /* Contains the generated percent slope */
-    int16_t *band_ps_int16 = NULL; /* Scaled percent slope converted to int16 */
-    uint8_t *band_hillshade = NULL; /* Contains the generated hillshade */
-    int16_t *band_dswe_diag = NULL;   /* Output DSWE diagnostic band data */
-    uint8_t *band_dswe_interpreted = NULL;    /* Output interpreted DSWE band 
-                                   data */
-    uint8_t *band_dswe_pshsccss = NULL; /* Output interpreted DSWE band data 
-                                         with Percent Slope, Hillshade, Cloud, 
-                                         and Cloud Shadow filtering applied */
-    uint8_t *band_mask = NULL;  /* Output mask band data */
-
-    /* Temp variables */
-    float mndwi;                /* (green - swir1) / (green + swir1) */
-    float mbsrv;                /* (green + red) */
-    float mbsrn;                /* (nir + swir1) */
-    float awesh;                /* (blue
-                                   + (2.5 * green)
-                                   - (1.5 * MBSRN)
-                                   - (0.25 * bt)) */
-    float ndvi;                /* (nir - red) / (nir + red) */
-
-    float band_blue_float;
-    float band_green_float;
-    float band_red_float;
-    float band_nir_float;
-    float band_swir1_float;
-    float band_swir2_float;
-
-    float percent_slope;        /* Single percent slope value */
-    bool hillshade_flag;
-
-    int16_t blue_fill_value;
-    int16_t green_fill_value;
-    int16_t red_fill_value;
-    int16_t nir_fill_value;
-    int16_t swir1_fill_value;
-    int16_t swir2_fill_value;
-    uint16_t pixelqa_fill_value;
-
-    int16_t raw_dswe_value;
-    uint8_t interp_ps_hs_ccss_dswe_value; /* Interpreted DSWE value, but set to 
-                                   DSWE_NOT_WATER if percent slope or hillshade
-                                   apply, and DSWE_CLOUD_CLOUD_SHADOW_SNOW if
-                                   one or more of those is set in the QA band */
-    uint8_t mask_value;         /* Tracks whether a pixel is masked due to snow,
-                                   shadow, cloud, slope, and/or hillshade */                       
-
-    float pswt_1_nir_float;     /* Float version of tolerance value */
-    float pswt_1_swir1_float;   /* Float version of tolerance value */
-    float pswt_2_blue_float;    /* Float version of tolerance value */
-    float pswt_2_nir_float;     /* Float version of tolerance value */
-    float pswt_2_swir1_float;   /* Float version of tolerance value */
-    float pswt_2_swir2_float;   /* Float version of tolerance value */
+    int mask_bit_count;          /* Number of bits used in the mask band */
+    uint8_t *band_hillshade_output = NULL; /* Hillshade sampled onto the
+                                              reflectance grid for output */
 
+    if (add_dswe_band_product (xml_filename, xml_metadata, use_toa_flag,
+                               io_backend,
+                               INTERPRETED_PRODUCT_NAME, INTERPRETED_BAND_NAME,
+                               INTERPRETED_SHORT_NAME, INTERPRETED_LONG_NAME, 
+                               DSWE_NOT_WATER, 
+                               DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND, 1, 0,
+                               band_dswe_interpreted)
+        != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed adding Interpreted DSWE band product", 
+                       MODULE_NAME);
 
-    /* Other variables */
-    int status;
-    int index;
-    int pixel_count;
+        return ERROR;
+    }
+
+    if (add_dswe_band_product (xml_filename, xml_metadata, use_toa_flag,
+                               io_backend,
+                               PS_SC_PRODUCT_NAME, PS_SC_BAND_NAME,
+                               PS_SC_SHORT_NAME, PS_SC_LONG_NAME,
+                               DSWE_NOT_WATER, DSWE_CLOUD_CLOUD_SHADOW_SNOW,
+                               1, 0, band_dswe_pshsccss)
+        != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE SHADOW CLOUD band"
+                       " product", MODULE_NAME);
+
+        return ERROR;
+    }
+
+    /* The cast shadow bit is only described when it is applied */
+    if (cast_shadow_flag)
+        mask_bit_count = MASK_CAST_SHADOW + 1;
+    else
+        mask_bit_count = MASK_HS + 1;
+
+    if (add_dswe_band_product (xml_filename, xml_metadata, use_toa_flag,
+                               io_backend,
+                               MASK_PRODUCT_NAME, MASK_BAND_NAME,
+                               MASK_SHORT_NAME, MASK_LONG_NAME, 0,
+                               (1 << mask_bit_count) - 1, 0, mask_bit_count,
+                               band_mask)
+        != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed adding DSWE mask band", MODULE_NAME);
+
+        return ERROR;
+    }
+
+    if (include_tests_flag)
+    {
+        if (add_test_band_product (xml_filename, xml_metadata, use_toa_flag,
+                                   io_backend,
+                                   DIAG_PRODUCT_NAME, DIAG_BAND_NAME,
+                                   DIAG_SHORT_NAME, DIAG_LONG_NAME,
+                                   0, 11111, band_dswe_diag)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding DIAGNOSTIC DSWE band product",
+                           MODULE_NAME);
+
+            return ERROR;
+        }
+    }
+
+    if (include_ps_flag)
+    {
+        /* Convert to a scaled 16 bit integer value on the reflectance
+           grid, which the pipeline has written already */
+        if (pipeline_lines == 0)
+        {
+            scale_percent_slope_lines (dem_grid_map, band_ps, 0, lines,
+                                       band_ps_int16);
+        }
+
+        if (add_ps_band_product (xml_filename, xml_metadata, use_toa_flag,
+                                 io_backend,
+                                 PS_PRODUCT_NAME, PS_BAND_NAME,
+                                 PS_SHORT_NAME, PS_LONG_NAME,
+                                 0, GDAL_INT16_MAX, band_ps_int16)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE band product",
+                           MODULE_NAME);
+
+            return ERROR;
+        }
+    }
+
+    if (include_hs_flag)
+    {
+        /* Sample the hillshade onto the reflectance grid when the elevation
+           is on its own grid, unless the pipeline has written it already */
+        if (pipeline_lines > 0)
+        {
+            band_hillshade_output = NULL;
+        }
+        else if (dem_grid_map->same_grid)
+        {
+            band_hillshade_output = band_hillshade;
+        }
+        else
+        {
+            band_hillshade_output = malloc (pixel_count * sizeof (uint8_t));
+            if (band_hillshade_output == NULL)
+            {
+                ERROR_MESSAGE ("Failed allocating memory for hillshade"
+                               " output band", MODULE_NAME);
+
+                return ERROR;
+            }
+            resample_dem_grid_uint8 (dem_grid_map, band_hillshade,
+                                     band_hillshade_output);
+        }
+
+        if (add_dswe_band_product (xml_filename, xml_metadata, use_toa_flag,
+                                   io_backend,
+                                   HS_PRODUCT_NAME, HS_BAND_NAME,
+                                   HS_SHORT_NAME, HS_LONG_NAME,
+                                   0, 255, 0, 0, band_hillshade_output)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed adding DSWE hillshade band product",
+                           MODULE_NAME);
+
+            if (band_hillshade_output != band_hillshade)
+                free (band_hillshade_output);
+            return ERROR;
+        }
+
+        if (band_hillshade_output != band_hillshade)
+            free (band_hillshade_output);
+        band_hillshade_output = NULL;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  main
+
+  PURPOSE:  Implements the core algorithm for DSWE.
+
+  ALGORITHM DEVELOPERS:
+
+      The algorithm implemented here was developed by the following:
+
+      John W. Jones
+      Research Geographer
+      Eastern Geographic Science Center
+      U.S. Geological Survey
+      email: jwjones@usgs.gov
+
+      Michael J. Starbuck
+      Physical Scientist
+      Earth Resources Observation and Science Center
+      U.S. Geological Survey
+      email: mstarbuck@usgs.gov
+
+  RETURN VALUE:  Type = int
+      Value           Description
+      --------------  --------------------------------------------------------
+      EXIT_FAILURE    An unrecoverable error occured during processing.
+      EXIT_SUCCESS    No errors encountered processing successful.
+*****************************************************************************/
+int
+main (int argc, char *argv[])
+{
+    /* Command line parameters */
+    char *xml_filename = NULL;  /* filename for the XML input */
+    Espa_internal_meta_t xml_metadata;  /* XML metadata structure */
+    Tar_Archive_t *archive = NULL;      /* Archive the bands are read from */
+    char *remote_bands = NULL;  /* URL the bands are read from over HTTP */
+    char *remote_cache_dir = NULL; /* Block cache of the remote bands */
+    bool metadata_sidecar_flag = false;
+    bool use_zeven_thorne_flag = false;
+    bool use_toa_flag = false;
+    bool include_tests_flag = false;
+    bool include_ps_flag = false; /* Flag for including percent slope output */
+    bool include_hs_flag = false; /* Flag for including hillshade output */
+    bool cast_shadow_flag = false; /* Flag for applying the cast shadow
+                                      mask */
+    bool terrain_shm_flag = false; /* Flag for sharing the terrain products
+                                      through shared memory */
+    float wigt;                  /* tolerance value */
+    float awgt;                  /* tolerance value */
+    float pswt_1_mndwi;          /* tolerance value */
+    int pswt_1_nir;              /* tolerance value */
+    int pswt_1_swir1;            /* tolerance value */
+    float pswt_1_ndvi;           /* tolerance value */
+    float pswt_2_mndwi;          /* tolerance value */
+    int pswt_2_blue;             /* tolerance value */
+    int pswt_2_nir;              /* tolerance value */
+    int pswt_2_swir1;            /* tolerance value */
+    int pswt_2_swir2;            /* tolerance value */
+    float percent_slope_high;    /* Slope tolerance for high confidence water */
+    float percent_slope_moderate; /* Slope tolerance for moderate confidence
+                                   water */
+    float percent_slope_wetland; /* Slope tolerance for potential wetland */
+    float percent_slope_low;     /* Slope tolerance for low confidence water or
+                                     wetland */
+    float slope_class_thresholds[SLOPE_CLASS_COUNT]; /* Slope tolerance of
+                                     each slope class */
+    int hillshade;               /* Hillshade tolerance value */ 
+    char *terrain_cache_dir = NULL; /* Directory for the terrain cache */
+    char *dem_store_index = NULL; /* Index file of the DEM tile store */
+    int threads;                 /* Threads for the terrain derivation, 0 for
+                                    all the available cores */
+    char *gradient_operator_name = NULL; /* Gradient operator for both the
+                                            slope and the hillshade */
+    char *band_reader_name = NULL; /* How the bands are brought into memory */
+    Band_Reader_e band_reader = BAND_READER_READ; /* Reader for the
+                                                     reflectance and QA
+                                                     bands */
+    char *io_backend_name = NULL; /* How the image files are read and
+                                     written */
+    Io_Backend_e io_backend = IO_BACKEND_BUFFERED; /* Backend for reading and
+                                                      writing the image
+                                                      files */
+    Band_Reads_t band_reads;    /* Reads of the input bands in progress */
+    int pipeline_lines;         /* Lines in each strip of the pipeline, 0
+                                   to classify the whole scene at once */
+    bool sparse_read_flag = false; /* Flag for only reading the reflectance
+                                      the pipeline needs */
+    char *window_text = NULL;   /* Window of the scene to process */
+    char *bbox_text = NULL;     /* Projected box of the scene to process */
+    Scene_Window_t window;      /* Window of the scene processed */
+    double bbox[4];             /* Projected box of the scene to process */
+    int terrain_margin;         /* Elevation pixels the gradient operators
+                                   reach on each side */
+    const Gradient_Operator_t *slope_operator; /* Operator for the slope */
+    const Gradient_Operator_t *hillshade_operator; /* Operator for the
+                                                      hillshade */
+    bool verbose_flag = false;
+
+    /* Band data */
+    Input_Data_t *input_data = NULL;
+    Terrain_Cache_t *terrain_cache = NULL; /* Cached DEM derived products */
+    Horizon_Cache_t *horizon_cache = NULL; /* Cached horizon angles */
+    Slope_Class_Context_t slope_class_context; /* For computing the slope
+                                                  class of single pixels */
+    Dem_Grid_Map_t *dem_grid_map = NULL; /* Maps the reflectance grid onto
+                                            the elevation grid */
+    Dem_Geometry_t *dem_geometry = NULL; /* Ground resolution of each
+                                            elevation line */
+    int16_t *band_blue = NULL;  /* TM SR_Band1,  OLI SR_Band2 */
+    int16_t *band_green = NULL; /* TM SR_Band2,  OLI SR_Band3 */
+    int16_t *band_red = NULL;   /* TM SR_Band3,  OLI SR_Band4 */
+    int16_t *band_nir = NULL;   /* TM SR_Band4,  OLI SR_Band5 */
+    int16_t *band_swir1 = NULL; /* TM SR_Band5,  OLI SR_Band6 */
+    int16_t *band_swir2 = NULL; /* TM SR_Band7,  OLI SR_Band7 */
+    int16_t *band_elevation = NULL; /* Contains the elevation band */
+    uint16_t *band_pixelqa = NULL;  /* Pixel QA */
+    float *band_ps = NULL;       /* Contains the generated percent slope */
+    int16_t *band_ps_int16 = NULL; /* Scaled percent slope converted to int16 */
+    uint8_t *band_hillshade = NULL; /* Contains the generated hillshade */
+    uint8_t *band_hillshade_mask = NULL; /* Packed mask of the pixels above
+                                            the hillshade threshold, used
+                                            when the hillshade band is not
+                                            output */
+    uint8_t *band_slope_class = NULL; /* Percent slope thresholds each pixel
+                                         is at or above, see SLOPE_CLASS_* */
+    int16_t *band_horizon = NULL; /* Horizon angles toward the sun, for the
+                                     cast shadow mask */
+    int16_t cast_shadow_threshold = 0; /* Sun elevation in the units of the
+                                          horizon angles */
+    int16_t *band_dswe_diag = NULL;   /* Output DSWE diagnostic band data */
+    uint8_t *band_dswe_interpreted = NULL;    /* Output interpreted DSWE band 
+                                   data */
+    uint8_t *band_dswe_pshsccss = NULL; /* Output interpreted DSWE band data 
+                                         with Percent Slope, Hillshade, Cloud, 
+                                         and Cloud Shadow filtering applied */
+    uint8_t *band_mask = NULL;  /* Output mask band data */
+    Dswe_Classifier_t classifier; /* Everything the classification of a
+                                     pixel needs besides its bands */
+    Dswe_Product_Files_t product_files; /* Output images written by the
+                                           pipeline */
+
+    /* Other variables */
+    int status;
+    int lines;                  /* Lines of the reflectance grid */
+    int samples;                /* Samples of the reflectance grid */
+    int pixel_count;
+    int dem_pixel_count;        /* Pixels of the elevation grid */
+    int azimuth_sector;         /* Azimuth sector of the horizon angles */
+    int hillshade_mask_line_bytes; /* Bytes per line of the hillshade mask */
 
 
     /* Get the command line arguments */
     status = get_args (argc, argv,
                        &xml_filename,
                        &xml_metadata,
+                       &archive,
+                       &remote_bands,
+                       &remote_cache_dir,
+                       &metadata_sidecar_flag,
                        &use_zeven_thorne_flag,
                        &use_toa_flag,
                        &include_tests_flag,
                        &include_ps_flag,
                        &include_hs_flag,
+                       &cast_shadow_flag,
+                       &terrain_shm_flag,
                        &wigt,
                        &awgt,
                        &pswt_1_mndwi,
@@ -501,6 +807,16 @@ main (int argc, char *argv[])
                        &percent_slope_wetland,
                        &percent_slope_low,
                        &hillshade,
+                       &terrain_cache_dir,
+                       &dem_store_index,
+                       &threads,
+                       &band_reader_name,
+                       &io_backend_name,
+                       &pipeline_lines,
+                       &sparse_read_flag,
+                       &window_text,
+                       &bbox_text,
+                       &gradient_operator_name,
                        &verbose_flag);
     if (status != SUCCESS)
     {
@@ -508,6 +824,44 @@ main (int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    /* Select the gradient operators once for the run; get_args has
+       validated the name.  Without one the hillshade uses Horn's operator
+       and the slope the one selected by --use_zeven_thorne */
+    if (gradient_operator_name != NULL)
+    {
+        slope_operator = find_gradient_operator (gradient_operator_name);
+        hillshade_operator = slope_operator;
+    }
+    else
+    {
+        if (use_zeven_thorne_flag)
+            slope_operator =
+                get_gradient_operator (GRADIENT_ZEVENBERGEN_THORNE);
+        else
+            slope_operator = get_gradient_operator (GRADIENT_HORN);
+        hillshade_operator = get_gradient_operator (GRADIENT_HORN);
+    }
+
+    /* get_args has validated the band reader name */
+    if (band_reader_name != NULL)
+        band_reader = find_band_reader (band_reader_name);
+
+    /* get_args has validated the I/O backend name */
+    if (io_backend_name != NULL)
+        io_backend = find_io_backend (io_backend_name);
+
+    /* Size the thread pool used for the terrain derivation */
+#ifdef _OPENMP
+    if (threads > 0)
+        omp_set_num_threads (threads);
+#else
+    if (threads > 1)
+    {
+        WARNING_MESSAGE ("Built without threading support, the number of"
+                         " threads is ignored", MODULE_NAME);
+    }
+#endif
+
     LOG_MESSAGE ("Starting dynamic surface water extent processing ...",
                  MODULE_NAME);
 
@@ -532,12 +886,36 @@ main (int argc, char *argv[])
         printf ("     Percent Slope Wetland: %0.1f\n", percent_slope_wetland);
         printf ("         Percent Slope Low: %0.1f\n", percent_slope_low);
         printf ("       Hillshade Threshold: %d\n", hillshade);
+        if (terrain_cache_dir != NULL)
+            printf ("             Terrain Cache: %s\n", terrain_cache_dir);
+        if (dem_store_index != NULL)
+            printf ("            DEM Tile Store: %s\n", dem_store_index);
+        if (archive != NULL)
+            printf ("              Band Archive: %s\n", archive->filename);
+        if (remote_bands != NULL)
+            printf ("              Remote Bands: %s\n", remote_bands);
+        if (remote_cache_dir != NULL)
+            printf ("        Remote Block Cache: %s\n", remote_cache_dir);
+        printf ("          Metadata Sidecar:");
+        if (metadata_sidecar_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
+        printf ("                   Threads: %d\n", threads);
 
         printf ("          Use Zeven Thorne:");
         if (use_zeven_thorne_flag)
             printf (" TRUE\n");
         else
             printf (" FALSE\n");
+        printf ("   Slope Gradient Operator: %s\n", slope_operator->name);
+        printf ("   Hillshade Grad Operator: %s\n",
+                hillshade_operator->name);
+
+        printf ("               Band Reader: %s\n",
+                (band_reader_name != NULL) ? band_reader_name : "read");
+        printf ("               I/O Backend: %s\n",
+                (io_backend_name != NULL) ? io_backend_name : "buffered");
 
         printf ("          Use Top Of Atmos:");
         if (use_toa_flag)
@@ -562,11 +940,39 @@ main (int argc, char *argv[])
             printf (" TRUE\n");
         else
             printf (" FALSE\n");
+
+        printf ("    Apply Cast Shadow Mask:");
+        if (cast_shadow_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
+
+        printf ("  Share Terrain Through SHM:");
+        if (terrain_shm_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
+
+        printf ("       Sparse Band Reading:");
+        if (sparse_read_flag)
+            printf (" TRUE\n");
+        else
+            printf (" FALSE\n");
     }
 
     /* -------------------------------------------------------------------- */
-    /* Open the input files */
-    input_data = open_input (&xml_metadata, use_toa_flag);
+    /* Open the input files.  An elevation band extracted from a DEM tile
+       store gets a halo wide enough for the gradient operators to reach the
+       scene edges. */
+    terrain_margin = (slope_operator->margin > hillshade_operator->margin)
+                     ? slope_operator->margin : hillshade_operator->margin;
+    input_data = open_input (&xml_metadata, use_toa_flag, archive,
+                             remote_bands, remote_cache_dir, io_backend,
+                             dem_store_index, terrain_margin);
+
+    /* The archive index is only needed to open the bands */
+    close_tar_archive (archive);
+
     if (input_data == NULL)
     {
         ERROR_MESSAGE ("Failed opening input files", MODULE_NAME);
@@ -576,21 +982,102 @@ main (int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    /* Free the metadata structure */
-    /* ******** NO LONGER NEEDED IN THIS MAIN CODE ******** */
-    free_metadata (&xml_metadata);
+    /* Compressed bands are decompressed as streams, which cannot be read a
+       block at a time, and only raw binary band files can be mapped */
+    if ((input_bands_compressed (input_data) && sparse_read_flag)
+        || (!input_bands_raw (input_data)
+            && band_reader != BAND_READER_READ))
+    {
+        ERROR_MESSAGE ("Compressed input bands can only be read with the read"
+                       " band reader and without --sparse_read, tiled and"
+                       " archived input bands with the read band reader",
+                       MODULE_NAME);
+
+        close_input (input_data);
+        free (input_data);
+        free_metadata (&xml_metadata);
+        return EXIT_FAILURE;
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* Restrict the processing to the window, the whole scene by default.
+       The elevation is read around the window as far as the gradient
+       operators reach, except for the cast shadow, whose horizons are swept
+       across the whole elevation band. */
+    window.line = 0;
+    window.sample = 0;
+    window.lines = input_data->lines;
+    window.samples = input_data->samples;
+    status = SUCCESS;
+    if (window_text != NULL)
+        status = parse_scene_window (window_text, &window);
+    else if (bbox_text != NULL)
+    {
+        status = parse_scene_bbox (bbox_text, bbox);
+        if (status == SUCCESS)
+        {
+            status = find_bbox_window (bbox, input_data->ul_x,
+                                       input_data->ul_y,
+                                       input_data->x_pixel_size,
+                                       input_data->y_pixel_size,
+                                       input_data->band_lines,
+                                       input_data->band_samples, &window);
+        }
+    }
+    if (status == SUCCESS && (window_text != NULL || bbox_text != NULL))
+    {
+        status = set_input_window (input_data, &window,
+                                   cast_shadow_flag ? -1 : terrain_margin);
+    }
+    if (status != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed setting the window of the scene",
+                       MODULE_NAME);
+
+        close_input (input_data);
+        free (input_data);
+        free_metadata (&xml_metadata);
+        return EXIT_FAILURE;
+    }
+
+    if (verbose_flag && (window_text != NULL || bbox_text != NULL))
+    {
+        printf ("                    Window: %d,%d %d x %d\n", window.line,
+                window.sample, window.samples, window.lines);
+    }
 
     /* -------------------------------------------------------------------- */
     /* Figure out the number of elements in the data */
-    pixel_count = input_data->lines * input_data->samples;
+    lines = input_data->lines;
+    samples = input_data->samples;
+    pixel_count = lines * samples;
+
+    /* The terrain products are generated on the elevation grid */
+    dem_pixel_count = input_data->dem_lines * input_data->dem_samples;
+    hillshade_mask_line_bytes =
+        HILLSHADE_MASK_LINE_BYTES (input_data->dem_samples);
+
+    if (verbose_flag)
+    {
+        printf ("            Elevation Grid: %d x %d at %g x %g%s\n",
+                input_data->dem_samples, input_data->dem_lines,
+                input_data->dem_x_pixel_size, input_data->dem_y_pixel_size,
+                input_data->dem_geographic ? " degrees" : "");
+    }
 
     /* Allocate memory buffers for input and temp processing */
-    if (allocate_band_memory (include_tests_flag, &band_blue, &band_green,
+    if (allocate_band_memory (band_reader, pipeline_lines > 0,
+                              include_tests_flag,
+                              include_ps_flag, include_hs_flag,
+                              &band_blue, &band_green,
                               &band_red, &band_nir, &band_swir1, &band_swir2,
                               &band_elevation, &band_pixelqa, &band_ps,
-                              &band_ps_int16, &band_hillshade, &band_dswe_diag, 
-                              &band_dswe_interpreted, &band_dswe_pshsccss, 
-                              &band_mask, pixel_count)
+                              &band_ps_int16, &band_hillshade,
+                              &band_dswe_diag, &band_dswe_interpreted,
+                              &band_dswe_pshsccss, &band_mask,
+                              &band_hillshade_mask, &band_slope_class,
+                              pixel_count, dem_pixel_count,
+                              input_data->dem_lines * hillshade_mask_line_bytes)
         != SUCCESS)
     {
         ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
@@ -598,21 +1085,37 @@ main (int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
-    /* -------------------------------------------------------------------- */
-    /* Read the input files into the buffers */
-    if (read_bands_into_memory (input_data, band_blue, band_green, band_red,
-                                band_nir, band_swir1, band_swir2,
-                                band_elevation, band_pixelqa, pixel_count)
-        != SUCCESS)
+    /* Map the reflectance pixels onto the elevation grid */
+    dem_grid_map = create_dem_grid_map (input_data->lines, input_data->samples,
+                       input_data->x_pixel_size, input_data->y_pixel_size,
+                       input_data->window_line, input_data->window_sample,
+                       input_data->dem_lines, input_data->dem_samples,
+                       input_data->dem_x_pixel_size,
+                       input_data->dem_y_pixel_size,
+                       input_data->dem_first_line,
+                       input_data->dem_first_sample,
+                       input_data->dem_scene_lines,
+                       input_data->dem_scene_samples);
+
+    /* The ground resolution of the elevation lines, which varies with the
+       latitude for geographic elevation data */
+    dem_geometry = create_dem_geometry (input_data->dem_lines,
+                       input_data->dem_x_pixel_size,
+                       input_data->dem_y_pixel_size,
+                       input_data->dem_geographic,
+                       input_data->dem_ul_latitude);
+    if (dem_grid_map == NULL || dem_geometry == NULL)
     {
-        ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
+        ERROR_MESSAGE ("Failed mapping the elevation grid", MODULE_NAME);
 
         /* Cleanup memory */
         free_band_memory (band_blue, band_green, band_red, band_nir,
                           band_swir1, band_swir2, band_elevation,
                           band_pixelqa, band_ps, band_ps_int16, band_hillshade, 
                           band_dswe_diag, band_dswe_interpreted, 
-                          band_dswe_pshsccss, band_mask);
+                          band_dswe_pshsccss, band_mask, band_hillshade_mask,
+                          band_slope_class);
+        free_metadata (&xml_metadata);
         free (xml_filename);
         free (input_data);
 
@@ -620,426 +1123,505 @@ main (int argc, char *argv[])
     }
 
     /* -------------------------------------------------------------------- */
-    /* Close the input files */
-    if (close_input (input_data) != SUCCESS)
+    /* Read the input files into the buffers.  The reads are all issued at
+       once, and the terrain products only need the elevation band, so they
+       are built while the other bands are still coming in. */
+    if (pipeline_lines > 0)
     {
-        WARNING_MESSAGE ("Failed closing input files", MODULE_NAME);
+        /* The pipeline reads the other bands a strip at a time */
+        start_band_reads (input_data, band_reader, NULL, NULL, NULL, NULL,
+                          NULL, NULL, band_elevation, NULL, pixel_count,
+                          &band_reads);
     }
-
-    /* -------------------------------------------------------------------- */
-    build_slope_band (band_elevation, input_data->lines, input_data->samples,
-                      input_data->x_pixel_size, input_data->y_pixel_size,
-                      use_zeven_thorne_flag, band_ps);
-
-    /* -------------------------------------------------------------------- */
-    build_hillshade_band (band_elevation, input_data->lines, 
-                      input_data->samples, input_data->x_pixel_size, 
-                      input_data->y_pixel_size, input_data->solar_elevation, 
-                      input_data->solar_azimuth, band_hillshade);
-
-    /* -------------------------------------------------------------------- */
-    blue_fill_value = input_data->fill_value[I_BAND_BLUE];
-    green_fill_value = input_data->fill_value[I_BAND_GREEN];
-    red_fill_value = input_data->fill_value[I_BAND_RED];
-    nir_fill_value = input_data->fill_value[I_BAND_NIR];
-    swir1_fill_value = input_data->fill_value[I_BAND_SWIR1];
-    swir2_fill_value = input_data->fill_value[I_BAND_SWIR2];
-    pixelqa_fill_value = input_data->fill_value[I_BAND_PIXELQA];
-
-    /* Free memory no longer needed */
-    free (input_data);
-    input_data = NULL;
-
-    /* Just convert to float */
-    pswt_1_nir_float = pswt_1_nir;
-    pswt_1_swir1_float = pswt_1_swir1;
-    pswt_2_blue_float = pswt_2_blue;
-    pswt_2_nir_float = pswt_2_nir;
-    pswt_2_swir1_float = pswt_2_swir1;
-    pswt_2_swir2_float = pswt_2_swir2;
-
-    /* -------------------------------------------------------------------- */
-    /* Process through each data element and populate the dswe band memory */
-    if (verbose_flag)
+    else
     {
-        printf ("               Pixel Count: %d\n", pixel_count);
+        start_band_reads (input_data, band_reader, &band_blue, &band_green,
+                          &band_red, &band_nir, &band_swir1, &band_swir2,
+                          band_elevation, &band_pixelqa, pixel_count,
+                          &band_reads);
     }
-    for (index = 0; index < pixel_count; index++)
+    if (wait_band_read (&band_reads, I_BAND_ELEVATION) != SUCCESS)
     {
-        /* If any of the input is fill, make the output fill */
-        if (band_blue[index] == blue_fill_value ||
-            band_green[index] == green_fill_value ||
-            band_red[index] == red_fill_value ||
-            band_nir[index] == nir_fill_value ||
-            band_swir1[index] == swir1_fill_value ||
-            band_swir2[index] == swir2_fill_value ||
-            band_pixelqa[index] == pixelqa_fill_value)
-        {
-            if (include_tests_flag)
-            {
-                band_dswe_diag[index] = TESTS_NO_DATA_VALUE;
-            }
-            band_dswe_interpreted[index] = DSWE_NO_DATA_VALUE;
-            band_dswe_pshsccss[index] = DSWE_NO_DATA_VALUE;
-            band_mask[index] = DSWE_NO_DATA_VALUE;
-            continue;
-        }
-
-        /* Convert to float */
-        band_blue_float = band_blue[index];
-        band_green_float = band_green[index];
-        band_red_float = band_red[index];
-        band_nir_float = band_nir[index];
-        band_swir1_float = band_swir1[index];
-        band_swir2_float = band_swir2[index];
-
-        /* Modified Normalized Difference Wetness Index (MNDWI) */
-        mndwi = (band_green_float - band_swir1_float) /
-                (band_green_float + band_swir1_float);
-
-        /* Multi-band Spectral Relationship Visible (MBSRV) */
-        mbsrv = band_green_float + band_red_float;
-
-        /* Multi-band Spectral Relationship Near-Infrared (MBSRN) */
-        mbsrn = band_nir_float + band_swir1_float;
-
-        /* Automated Water Extent Shadow (AWEsh) */
-        awesh = (band_blue_float
-                 + (2.5 * band_green_float)
-                 - (1.5 * mbsrn)
-                 - (0.25 * band_swir2_float));
-
-        /* Initialize to 0 or 1 on the first test */
-        if (mndwi > wigt)
-            raw_dswe_value = 1; /* > wigt */  /* Set the ones digit */
-        else
-            raw_dswe_value = 0;
-
-        if (mbsrv > mbsrn)
-            raw_dswe_value += 10; /* Set the tens digit */
-
-        if (awesh > awgt)
-            raw_dswe_value += 100; /* Set the hundreds digit */
-
-        /* Calculate NDVI */
-        ndvi = (band_nir_float - band_red_float) /
-               (band_nir_float + band_red_float);
-
-        /* Partial Surface Water 1 (PSW1)
-           The logic in the if results in a true/false called PSW1 */
-        if (mndwi > pswt_1_mndwi &&
-            band_swir1_float < pswt_1_swir1_float &&
-            band_nir_float < pswt_1_nir_float &&
-            ndvi < pswt_1_ndvi)
-        {
-            raw_dswe_value += 1000; /* Set the thousands digit */
-        }
+        ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
 
-        /* Partial Surface Water 2 (PSW2)
-           The logic in the if results in a true/false called PSW2 */
-        if (mndwi > pswt_2_mndwi &&
-            band_blue_float < pswt_2_blue_float &&
-            band_swir1_float < pswt_2_swir1_float &&
-            band_swir2_float < pswt_2_swir2_float &&
-            band_nir_float < pswt_2_nir_float)
-        {
-            raw_dswe_value += 10000; /* Set the ten thousands digit */
-        }
+        /* Cleanup memory */
+        finish_band_reads (&band_reads, false);
+        close_input (input_data);
+        release_mapped_bands (band_reader, &band_blue, &band_green,
+                              &band_red, &band_nir, &band_swir1, &band_swir2,
+                              &band_pixelqa, pixel_count);
+        free_band_memory (band_blue, band_green, band_red, band_nir,
+                          band_swir1, band_swir2, band_elevation,
+                          band_pixelqa, band_ps, band_ps_int16, band_hillshade, 
+                          band_dswe_diag, band_dswe_interpreted, 
+                          band_dswe_pshsccss, band_mask, band_hillshade_mask,
+                          band_slope_class);
+        free_dem_grid_map (dem_grid_map);
+        free_dem_geometry (dem_geometry);
+        free_metadata (&xml_metadata);
+        free (xml_filename);
+        free (input_data);
 
-        /* Assign it to the tests band */
-        if (include_tests_flag)
-        {
-            band_dswe_diag[index] = raw_dswe_value;
-        }
+        return EXIT_FAILURE;
+    }
 
-        /* Determine if hillshade exceeds threshold */
-        if (band_hillshade[index] > hillshade)
+    /* -------------------------------------------------------------------- */
+    /* The DEM derived products are the same for every scene using the DEM,
+       so share them with concurrent runs or take them from the terrain cache
+       when requested */
+    if (terrain_shm_flag)
+    {
+        terrain_cache = open_terrain_shm (band_elevation,
+                            input_data->dem_lines, input_data->dem_samples,
+                            dem_geometry, slope_operator,
+                            hillshade_operator, verbose_flag);
+        if (terrain_cache == NULL)
         {
-            hillshade_flag = true;
+            WARNING_MESSAGE ("Terrain shared memory unavailable, not sharing"
+                             " the terrain products", MODULE_NAME);
         }
         else
         {
-            hillshade_flag = false;
+            /* Use the shared copy of the DEM from here on */
+            free (band_elevation);
+            band_elevation = terrain_cache->dem;
         }
+    }
 
-        /* Recode the raw value to an interpreted value to fit an 8bit output 
-           product */
-        switch (raw_dswe_value)
+    if (terrain_cache == NULL && terrain_cache_dir != NULL)
+    {
+        terrain_cache = open_terrain_cache (terrain_cache_dir, band_elevation,
+                            input_data->dem_lines, input_data->dem_samples,
+                            dem_geometry, slope_operator,
+                            hillshade_operator,
+                            verbose_flag);
+        if (terrain_cache == NULL)
         {
-            case 0:
-            case 1:
-            case 10:
-            case 100:
-            case 1000:
-                raw_dswe_value = DSWE_NOT_WATER;
-                break;
-
-            case 1111:
-            case 10111:
-            case 11011:
-            case 11101:
-            case 11110:
-            case 11111:
-                raw_dswe_value = DSWE_WATER_HIGH_CONFIDENCE;
-                break;
-
-            case 111:
-            case 1011:
-            case 1101:
-            case 1110:
-            case 10011:
-            case 10101:
-            case 10110:
-            case 11001:
-            case 11010:
-            case 11100:
-                raw_dswe_value = DSWE_WATER_MODERATE_CONFIDENCE;
-                break;
-
-            case 11000:
-                raw_dswe_value = DSWE_POTENTIAL_WETLAND;
-                break;
-
-            case 11:
-            case 101:
-            case 110:
-            case 1001:
-            case 1010:
-            case 1100:
-            case 10000:
-            case 10001:
-            case 10010:
-            case 10100:
-                raw_dswe_value = DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND;
-                break;
-
-            default:
-                raw_dswe_value = DSWE_NO_DATA_VALUE;
-                break;
+            WARNING_MESSAGE ("Terrain cache unavailable, building the terrain"
+                             " products", MODULE_NAME);
         }
+    }
 
-        /* The following few chunks of code produce the following paths to the
-           output products.
+    /* The classification only needs to know which of the percent slope
+       thresholds each pixel is at or above */
+    slope_class_thresholds[SLOPE_CLASS_HIGH] = percent_slope_high;
+    slope_class_thresholds[SLOPE_CLASS_MODERATE] = percent_slope_moderate;
+    slope_class_thresholds[SLOPE_CLASS_WETLAND] = percent_slope_wetland;
+    slope_class_thresholds[SLOPE_CLASS_LOW] = percent_slope_low;
 
-           interpreted -> output
-           interpreted -> percent-slope -> hillshade -> cloud -> cloud shadow ->
-                  snow -> output
-           percent-slope -> hillshade -> cloud -> cloud shadow -> snow -> output
-        */
+    status = SUCCESS;
+    if (terrain_cache != NULL)
+    {
+        /* The percent slope is read from the cache instead of built */
+        free (band_ps);
+        band_ps = terrain_cache->percent_slope;
 
-        /* Default the Percent Slope, Hillshade, Cloud, Cloud Shadow, and Snow 
-           output to the interpreted DSWE value */
-        interp_ps_hs_ccss_dswe_value = raw_dswe_value;
+        build_slope_class_band_from_percent_slope (band_ps, dem_pixel_count,
+                          slope_class_thresholds, band_slope_class);
 
-        /* Initialize the mask value based on some bits in the pixel QA. */ 
-        mask_value = 0;
-        if (band_pixelqa[index] & PIXELQA_CLOUD_SHADOW_BIT_MASK)
+        if (include_hs_flag)
         {
-            mask_value |= (1 << MASK_SHADOW);
+            build_hillshade_band_from_gradients (terrain_cache->x_gradient,
+                          terrain_cache->y_gradient, input_data->dem_lines,
+                          input_data->dem_samples, hillshade_operator,
+                          input_data->solar_elevation,
+                          input_data->solar_azimuth, band_hillshade);
         }
-        if (band_pixelqa[index] & PIXELQA_SNOW_BIT_MASK)
+        else
         {
-            mask_value |= (1 << MASK_SNOW);
+            status = build_hillshade_mask_from_gradients (
+                          terrain_cache->x_gradient, terrain_cache->y_gradient,
+                          input_data->dem_lines, input_data->dem_samples,
+                          hillshade_operator, input_data->solar_elevation,
+                          input_data->solar_azimuth, hillshade,
+                          band_hillshade_mask);
         }
-        if (band_pixelqa[index] & PIXELQA_CLOUD_BIT_MASK)
+    }
+    else
+    {
+        /* The percent slope band is only built when it is output */
+        if (include_ps_flag)
         {
-            mask_value |= (1 << MASK_CLOUD);
-        }
+            status = build_slope_band (band_elevation, input_data->dem_lines,
+                          input_data->dem_samples, dem_geometry,
+                          slope_operator, band_ps);
 
-        /* Apply the Percent Slope constraint to the Percent Slope, Cloud,
-           Cloud Shadow, and Snow output.  Also update the mask output. */
-        if (raw_dswe_value == DSWE_WATER_MODERATE_CONFIDENCE)
-        {
-            if (band_ps[index] >= percent_slope_moderate)
-            {
-                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
-                mask_value |= (1 << MASK_PS);
-            }
+            build_slope_class_band_from_percent_slope (band_ps, dem_pixel_count,
+                          slope_class_thresholds, band_slope_class);
         }
-        else if (raw_dswe_value == DSWE_POTENTIAL_WETLAND)
-        {
-            if (band_ps[index] >= percent_slope_wetland)
-            {
-                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
-                mask_value |= (1 << MASK_PS);
-            }
-        }
-        else if (raw_dswe_value == DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND)
-        {
-            if (band_ps[index] >= percent_slope_low)
-            {
-                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
-                mask_value |= (1 << MASK_PS);
-            }
-        }
-        else if (raw_dswe_value == DSWE_WATER_HIGH_CONFIDENCE)
-        {
-            if (band_ps[index] >= percent_slope_high)
-            {
-                interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
-                mask_value |= (1 << MASK_PS);
-            }
-        }
-
-        /* Apply the hillshade constraint to the Percent Slope, Cloud,
-           Cloud Shadow, and Snow output.  Also update the mask output. */
-        if (!hillshade_flag)
+        else
         {
-            interp_ps_hs_ccss_dswe_value = DSWE_NOT_WATER;
-            mask_value |= (1 << MASK_HS);
+            /* Only the candidate water pixels use the slope, so their slope
+               class is computed on demand during the classification; the
+               band remembers the classes computed so far */
+            init_slope_class_context (&slope_class_context, band_elevation,
+                          input_data->dem_lines, input_data->dem_samples,
+                          dem_geometry, slope_operator,
+                          slope_class_thresholds);
+            memset (band_slope_class, SLOPE_CLASS_NOT_COMPUTED,
+                    dem_pixel_count);
         }
 
-        /* Apply the Pixel QA Cloud constraint to the Percent Slope, Hillshade,
-           Cloud, Cloud Shadow, and Snow output */
-        if ((band_pixelqa[index] & PIXELQA_CLOUD_BIT_MASK)
-             || (band_pixelqa[index] & PIXELQA_CLOUD_SHADOW_BIT_MASK)
-             || (band_pixelqa[index] & PIXELQA_SNOW_BIT_MASK))
+        if (status == SUCCESS && include_hs_flag)
         {
-            /* classified as 11999 in prototype code using 9 due to recode */
-            interp_ps_hs_ccss_dswe_value = DSWE_CLOUD_CLOUD_SHADOW_SNOW;
+            status = build_hillshade_band (band_elevation,
+                          input_data->dem_lines, input_data->dem_samples,
+                          dem_geometry, hillshade_operator,
+                          input_data->solar_elevation,
+                          input_data->solar_azimuth, band_hillshade);
         }
-
-        /* Assign the values to the correct output band */
-        band_dswe_interpreted[index] = raw_dswe_value;
-        band_dswe_pshsccss[index] = interp_ps_hs_ccss_dswe_value;
-        band_mask[index] = mask_value;
-
-        /* Let the user know where we are in the processing */
-        if (index%99999 == 0)
+        else if (status == SUCCESS)
         {
-            printf ("\r");
-            printf ("Processed data element %d", index);
+            status = build_hillshade_mask (band_elevation,
+                          input_data->dem_lines, input_data->dem_samples,
+                          dem_geometry, hillshade_operator,
+                          input_data->solar_elevation,
+                          input_data->solar_azimuth, hillshade,
+                          band_hillshade_mask);
         }
     }
 
-    /* Status output cleanup to match the final output size */
-    printf ("\r");
-    printf ("Processed data element %d", index);
-    printf ("\n");
-
-    /* Add the DSWE bands to the metadata file and generate the ENVI images
-       and header files */
-    if (add_dswe_band_product (xml_filename, use_toa_flag,
-                               INTERPRETED_PRODUCT_NAME, INTERPRETED_BAND_NAME,
-                               INTERPRETED_SHORT_NAME, INTERPRETED_LONG_NAME, 
-                               DSWE_NOT_WATER, 
-                               DSWE_LOW_CONFIDENCE_WATER_OR_WETLAND, 1, 0,
-                               band_dswe_interpreted)
-        != SUCCESS)
+    if (status != SUCCESS)
     {
-        ERROR_MESSAGE ("Failed adding Interpreted DSWE band product", 
-                       MODULE_NAME);
+        ERROR_MESSAGE ("Failed building the terrain products", MODULE_NAME);
 
         /* Cleanup memory */
+        if (terrain_cache != NULL)
+        {
+            if (terrain_cache->dem != NULL)
+                band_elevation = NULL;
+            close_terrain_cache (terrain_cache);
+            band_ps = NULL;
+        }
+        finish_band_reads (&band_reads, false);
+        close_input (input_data);
+        release_mapped_bands (band_reader, &band_blue, &band_green,
+                              &band_red, &band_nir, &band_swir1, &band_swir2,
+                              &band_pixelqa, pixel_count);
+        free_band_memory (band_blue, band_green, band_red, band_nir,
+                          band_swir1, band_swir2, band_elevation,
+                          band_pixelqa, band_ps, band_ps_int16, band_hillshade, 
+                          band_dswe_diag, band_dswe_interpreted, 
+                          band_dswe_pshsccss, band_mask, band_hillshade_mask,
+                          band_slope_class);
+        free_dem_grid_map (dem_grid_map);
+        free_dem_geometry (dem_geometry);
+        free_metadata (&xml_metadata);
         free (xml_filename);
+        free (input_data);
 
         return EXIT_FAILURE;
     }
 
-    if (add_dswe_band_product (xml_filename, use_toa_flag,
-                               PS_SC_PRODUCT_NAME, PS_SC_BAND_NAME,
-                               PS_SC_SHORT_NAME, PS_SC_LONG_NAME,
-                               DSWE_NOT_WATER, DSWE_CLOUD_CLOUD_SHADOW_SNOW,
-                               1, 0, band_dswe_pshsccss)
-        != SUCCESS)
+    /* -------------------------------------------------------------------- */
+    /* The horizon angles only depend on the DEM and the azimuth sector, so
+       they are shared through the terrain cache directory when one was
+       requested.  They are always computed for the center of the sector so
+       the mask does not depend on whether they came from the cache. */
+    if (cast_shadow_flag)
     {
-        ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE SHADOW CLOUD band"
-                       " product", MODULE_NAME);
+        azimuth_sector = horizon_sector (input_data->solar_azimuth);
 
-        /* Cleanup memory */
-        free (xml_filename);
+        if (terrain_cache_dir != NULL)
+        {
+            horizon_cache = open_horizon_cache (terrain_cache_dir,
+                                band_elevation, input_data->dem_lines,
+                                input_data->dem_samples, dem_geometry,
+                                azimuth_sector, verbose_flag);
+            if (horizon_cache != NULL)
+                band_horizon = horizon_cache->horizon;
+            else
+            {
+                WARNING_MESSAGE ("Horizon cache unavailable, building the"
+                                 " horizon angles", MODULE_NAME);
+            }
+        }
 
-        return EXIT_FAILURE;
+        if (band_horizon == NULL)
+        {
+            band_horizon = malloc (dem_pixel_count * sizeof (int16_t));
+            if (band_horizon == NULL
+                || build_horizon_band (band_elevation, input_data->dem_lines,
+                       input_data->dem_samples, dem_geometry,
+                       horizon_sector_azimuth (azimuth_sector), band_horizon)
+                   != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed building the horizon angles",
+                               MODULE_NAME);
+
+                /* Cleanup memory */
+                if (terrain_cache != NULL)
+                {
+                    if (terrain_cache->dem != NULL)
+                        band_elevation = NULL;
+                    close_terrain_cache (terrain_cache);
+                    band_ps = NULL;
+                }
+                free (band_horizon);
+                finish_band_reads (&band_reads, false);
+                close_input (input_data);
+                release_mapped_bands (band_reader, &band_blue, &band_green,
+                                      &band_red, &band_nir, &band_swir1,
+                                      &band_swir2, &band_pixelqa,
+                                      pixel_count);
+                free_band_memory (band_blue, band_green, band_red, band_nir,
+                                  band_swir1, band_swir2, band_elevation,
+                                  band_pixelqa, band_ps, band_ps_int16,
+                                  band_hillshade, band_dswe_diag,
+                                  band_dswe_interpreted, band_dswe_pshsccss,
+                                  band_mask, band_hillshade_mask,
+                                  band_slope_class);
+                free_dem_grid_map (dem_grid_map);
+                free_dem_geometry (dem_geometry);
+                free_metadata (&xml_metadata);
+                free (xml_filename);
+                free (input_data);
+
+                return EXIT_FAILURE;
+            }
+        }
+
+        cast_shadow_threshold =
+            horizon_angle_threshold (input_data->solar_elevation);
     }
 
-    if (add_dswe_band_product (xml_filename, use_toa_flag,
-                               MASK_PRODUCT_NAME, MASK_BAND_NAME,
-                               MASK_SHORT_NAME, MASK_LONG_NAME, 0, 31,
-                               0, 1, band_mask)
-        != SUCCESS)
+    /* -------------------------------------------------------------------- */
+    /* The classification needs all the bands */
+    if (finish_band_reads (&band_reads, verbose_flag) != SUCCESS)
     {
-        ERROR_MESSAGE ("Failed adding DSWE mask band", MODULE_NAME);
+        ERROR_MESSAGE ("Failed reading bands into memory", MODULE_NAME);
 
         /* Cleanup memory */
+        close_input (input_data);
+        if (terrain_cache != NULL)
+        {
+            if (terrain_cache->dem != NULL)
+                band_elevation = NULL;
+            close_terrain_cache (terrain_cache);
+            band_ps = NULL;
+        }
+        if (horizon_cache != NULL)
+            close_horizon_cache (horizon_cache);
+        else
+            free (band_horizon);
+        release_mapped_bands (band_reader, &band_blue, &band_green,
+                              &band_red, &band_nir, &band_swir1, &band_swir2,
+                              &band_pixelqa, pixel_count);
+        free_band_memory (band_blue, band_green, band_red, band_nir,
+                          band_swir1, band_swir2, band_elevation,
+                          band_pixelqa, band_ps, band_ps_int16, band_hillshade,
+                          band_dswe_diag, band_dswe_interpreted,
+                          band_dswe_pshsccss, band_mask, band_hillshade_mask,
+                          band_slope_class);
+        free_dem_grid_map (dem_grid_map);
+        free_dem_geometry (dem_geometry);
+        free_metadata (&xml_metadata);
         free (xml_filename);
+        free (input_data);
 
         return EXIT_FAILURE;
     }
 
-    if (include_tests_flag)
+    /* -------------------------------------------------------------------- */
+    /* The outputs of a window are listed in an XML of their own, and the
+       XML of the scene is left as it is, along with its sidecar */
+    if (window_text != NULL || bbox_text != NULL)
     {
-        if (add_test_band_product (xml_filename, use_toa_flag,
-                                   DIAG_PRODUCT_NAME, DIAG_BAND_NAME,
-                                   DIAG_SHORT_NAME, DIAG_LONG_NAME,
-                                   0, 11111, band_dswe_diag)
-            != SUCCESS)
+        if (create_window_metadata (&xml_filename, &xml_metadata,
+                                    use_toa_flag, &window) != SUCCESS)
         {
-            ERROR_MESSAGE ("Failed adding DIAGNOSTIC DSWE band product",
+            ERROR_MESSAGE ("Failed creating the XML of the window",
                            MODULE_NAME);
 
             /* Cleanup memory */
+            close_input (input_data);
+            if (terrain_cache != NULL)
+            {
+                if (terrain_cache->dem != NULL)
+                    band_elevation = NULL;
+                close_terrain_cache (terrain_cache);
+                band_ps = NULL;
+            }
+            if (horizon_cache != NULL)
+                close_horizon_cache (horizon_cache);
+            else
+                free (band_horizon);
+            release_mapped_bands (band_reader, &band_blue, &band_green,
+                                  &band_red, &band_nir, &band_swir1,
+                                  &band_swir2, &band_pixelqa, pixel_count);
+            free_band_memory (band_blue, band_green, band_red, band_nir,
+                              band_swir1, band_swir2, band_elevation,
+                              band_pixelqa, band_ps, band_ps_int16,
+                              band_hillshade, band_dswe_diag,
+                              band_dswe_interpreted, band_dswe_pshsccss,
+                              band_mask, band_hillshade_mask,
+                              band_slope_class);
+            free_dem_grid_map (dem_grid_map);
+            free_dem_geometry (dem_geometry);
+            free_metadata (&xml_metadata);
             free (xml_filename);
+            free (input_data);
 
             return EXIT_FAILURE;
         }
+
+        metadata_sidecar_flag = false;
     }
 
-    if (include_ps_flag)
-    {
-        /* Convert to a scaled 16 bit integer value */
-        for (index = 0; index < pixel_count; index++)
-        {
-            percent_slope = (band_ps[index] * PERCENT_SLOPE_MULT_FACTOR) + 0.5;
+    /* -------------------------------------------------------------------- */
+    /* Gather what the classification of each pixel needs */
+    classifier.samples = samples;
+    classifier.blue_fill_value = input_data->fill_value[I_BAND_BLUE];
+    classifier.green_fill_value = input_data->fill_value[I_BAND_GREEN];
+    classifier.red_fill_value = input_data->fill_value[I_BAND_RED];
+    classifier.nir_fill_value = input_data->fill_value[I_BAND_NIR];
+    classifier.swir1_fill_value = input_data->fill_value[I_BAND_SWIR1];
+    classifier.swir2_fill_value = input_data->fill_value[I_BAND_SWIR2];
+    classifier.pixelqa_fill_value = input_data->fill_value[I_BAND_PIXELQA];
+
+    classifier.wigt = wigt;
+    classifier.awgt = awgt;
+    classifier.pswt_1_mndwi = pswt_1_mndwi;
+    classifier.pswt_1_ndvi = pswt_1_ndvi;
+    classifier.pswt_2_mndwi = pswt_2_mndwi;
+    classifier.hillshade = hillshade;
 
-            /* If the scaled value is outside the range, pull it back */
-            if (percent_slope > GDAL_INT16_MAX)
-            {
-                percent_slope = GDAL_INT16_MAX;
-            }
-            band_ps_int16[index] = (int16_t)percent_slope; 
-        }
+    /* Just convert to float */
+    classifier.pswt_1_nir = pswt_1_nir;
+    classifier.pswt_1_swir1 = pswt_1_swir1;
+    classifier.pswt_2_blue = pswt_2_blue;
+    classifier.pswt_2_nir = pswt_2_nir;
+    classifier.pswt_2_swir1 = pswt_2_swir1;
+    classifier.pswt_2_swir2 = pswt_2_swir2;
+
+    classifier.include_tests_flag = include_tests_flag;
+    classifier.include_hs_flag = include_hs_flag;
+    classifier.cast_shadow_flag = cast_shadow_flag;
+
+    classifier.dem_grid_map = dem_grid_map;
+    classifier.band_hillshade = band_hillshade;
+    classifier.band_hillshade_mask = band_hillshade_mask;
+    classifier.hillshade_mask_line_bytes = hillshade_mask_line_bytes;
+    classifier.band_slope_class = band_slope_class;
+    classifier.slope_class_context = &slope_class_context;
+    classifier.band_horizon = band_horizon;
+    classifier.cast_shadow_threshold = cast_shadow_threshold;
+
+    /* The unsigned Collection 2 reflectance is compared in the units it is
+       read in, against tolerance values converted once */
+    status = SUCCESS;
+    classifier.scaled_reflectance = false;
+    if (input_data->data_type[I_BAND_BLUE] == ESPA_UINT16)
+    {
+        status = set_dswe_reflectance_scaling (&classifier,
+                     input_data->scale_factor[I_BAND_BLUE],
+                     input_data->add_offset[I_BAND_BLUE]);
+    }
 
-        if (add_ps_band_product (xml_filename, use_toa_flag,
-                                 PS_PRODUCT_NAME, PS_BAND_NAME,
-                                 PS_SHORT_NAME, PS_LONG_NAME,
-                                 0, GDAL_INT16_MAX, band_ps_int16)
-            != SUCCESS)
+    /* -------------------------------------------------------------------- */
+    /* Process through each data element and populate the dswe band memory */
+    if (verbose_flag)
+    {
+        printf ("               Pixel Count: %d\n", pixel_count);
+    }
+    if (status != SUCCESS)
+    {
+        /* Reported below */
+    }
+    else if (pipeline_lines > 0)
+    {
+        /* Stream the scene through the read, classify and write stages a
+           strip at a time, writing the output images as it goes */
+        status = open_dswe_product_files (&xml_metadata, use_toa_flag,
+                                          io_backend, include_tests_flag,
+                                          include_ps_flag, include_hs_flag,
+                                          &product_files);
+        if (status == SUCCESS)
         {
-            ERROR_MESSAGE ("Failed adding DSWE PERCENT-SLOPE band product",
-                           MODULE_NAME);
-
-            /* Cleanup memory */
-            free (xml_filename);
-
-            return EXIT_FAILURE;
+            status = run_dswe_pipeline (input_data, &classifier, band_ps,
+                                        pipeline_lines, sparse_read_flag,
+                                        &product_files, verbose_flag);
+            if (close_dswe_product_files (&product_files) != SUCCESS)
+                status = ERROR;
         }
     }
+    else
+    {
+        classify_dswe_lines (&classifier, 0, lines, band_blue, band_green,
+                             band_red, band_nir, band_swir1, band_swir2,
+                             band_pixelqa, band_dswe_diag,
+                             band_dswe_interpreted, band_dswe_pshsccss,
+                             band_mask);
+    }
 
-    if (include_hs_flag)
+    /* Status output cleanup to match the final output size */
+    printf ("\r");
+    printf ("Processed data element %d", pixel_count);
+    printf ("\n");
+
+    /* Close the input files */
+    if (close_input (input_data) != SUCCESS)
     {
-        if (add_dswe_band_product (xml_filename, use_toa_flag,
-                                   HS_PRODUCT_NAME, HS_BAND_NAME,
-                                   HS_SHORT_NAME, HS_LONG_NAME,
-                                   0, 255, 0, 0, band_hillshade)
-            != SUCCESS)
-        {
-            ERROR_MESSAGE ("Failed adding DSWE hillshade band product",
-                           MODULE_NAME);
+        WARNING_MESSAGE ("Failed closing input files", MODULE_NAME);
+    }
 
-            /* Cleanup memory */
-            free (xml_filename);
+    /* Free memory no longer needed */
+    free (input_data);
+    input_data = NULL;
 
-            return EXIT_FAILURE;
-        }
+    if (status != SUCCESS)
+    {
+        ERROR_MESSAGE ("Failed classifying the scene", MODULE_NAME);
+    }
+    else
+    {
+        /* Add the DSWE bands to the metadata file and generate the ENVI
+           images and header files */
+        status = add_dswe_products (xml_filename, &xml_metadata, use_toa_flag,
+                                    io_backend, include_tests_flag,
+                                    include_ps_flag, include_hs_flag,
+                                    cast_shadow_flag, pipeline_lines, lines,
+                                    pixel_count, dem_grid_map, band_ps,
+                                    band_ps_int16, band_hillshade,
+                                    band_dswe_diag, band_dswe_interpreted,
+                                    band_dswe_pshsccss, band_mask);
     }
 
     /* CLEANUP & EXIT ----------------------------------------------------- */
 
+    /* A failed classification or output is cleaned up here too, so it does
+       not keep its reference on shared terrain products */
+
+    /* The cached percent slope, and a shared DEM, are part of the cache
+       mapping */
+    if (terrain_cache != NULL)
+    {
+        if (terrain_cache->dem != NULL)
+            band_elevation = NULL;
+        close_terrain_cache (terrain_cache);
+        terrain_cache = NULL;
+        band_ps = NULL;
+    }
+
+    /* The cached horizon angles are part of the cache mapping */
+    if (horizon_cache != NULL)
+    {
+        close_horizon_cache (horizon_cache);
+        horizon_cache = NULL;
+    }
+    else
+        free (band_horizon);
+    band_horizon = NULL;
+
     /* Cleanup all the input band memory */
+    release_mapped_bands (band_reader, &band_blue, &band_green, &band_red,
+                          &band_nir, &band_swir1, &band_swir2, &band_pixelqa,
+                          pixel_count);
     free_band_memory (band_blue, band_green, band_red, band_nir, band_swir1,
                       band_swir2, band_elevation, band_pixelqa, band_ps,
                       band_ps_int16, band_hillshade, band_dswe_diag, 
-                      band_dswe_interpreted, band_dswe_pshsccss, band_mask);
+                      band_dswe_interpreted, band_dswe_pshsccss, band_mask,
+                      band_hillshade_mask, band_slope_class);
                       
     band_blue = NULL;
     band_green = NULL;
@@ -1056,9 +1638,38 @@ main (int argc, char *argv[])
     band_dswe_interpreted = NULL;
     band_dswe_pshsccss = NULL;
     band_mask = NULL;
+    band_hillshade_mask = NULL;
+    band_slope_class = NULL;
+
+    free_dem_grid_map (dem_grid_map);
+    free_dem_geometry (dem_geometry);
+    dem_grid_map = NULL;
+    dem_geometry = NULL;
+
+    /* Compile the metadata of the XML, which now lists the DSWE bands, for
+       the next run on it */
+    if (status == SUCCESS && metadata_sidecar_flag
+        && write_metadata_sidecar (xml_filename, &xml_metadata) != SUCCESS)
+    {
+        WARNING_MESSAGE ("The metadata sidecar was not updated",
+                         MODULE_NAME);
+    }
 
     /* Free remaining allocated memory */
+    free_metadata (&xml_metadata);
     free (xml_filename);
+    free (terrain_cache_dir);
+    free (dem_store_index);
+    free (gradient_operator_name);
+    free (band_reader_name);
+    free (io_backend_name);
+    free (window_text);
+    free (bbox_text);
+    free (remote_bands);
+    free (remote_cache_dir);
+
+    if (status != SUCCESS)
+        return EXIT_FAILURE;
 
     LOG_MESSAGE ("Processing complete.", MODULE_NAME);
 
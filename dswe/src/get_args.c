@@ -6,7 +6,9 @@
 #include <getopt.h>
 #include <error.h>
 #include <string.h>
+#include <strings.h>
 #include <limits.h>
+#include <unistd.h>
 
 
 #include "espa_metadata.h"
@@ -17,6 +19,13 @@
 #include "dswe.h"
 #include "utilities.h"
 #include "get_args.h"
+#include "gradient_operator.h"
+#include "input.h"
+#include "pipeline.h"
+#include "tar_archive.h"
+#include "http_range.h"
+#include "metadata_sidecar.h"
+#include "scene_window.h"
 
 
 /* Specify default parameter values */
@@ -50,6 +59,8 @@ static float percent_slope_moderate_default = 12;
 static float percent_slope_wetland_default = 10;
 static float percent_slope_low_default = 10;
 static int hillshade_default = 10;
+static int threads_default = 0; /* use all the available cores */
+static int pipeline_lines_default = 0; /* classify the whole scene at once */
 
 /* Parameter values should never be this, so use it to determine if a
    parameter was specified or not on the command line before applying the
@@ -167,6 +178,19 @@ usage ()
             "                  (default is false)\n");
     printf ("    --include_hs: Should hillshade be included in output?\n"
             "                  (default is false)\n");
+    printf ("    --cast_shadow: Should pixels in the cast shadow of distant"
+            " terrain be\n"
+            "                   excluded from water?  The horizon angles are"
+            " kept in the\n"
+            "                   terrain cache directory when one is given\n"
+            "                   (default is false)\n");
+    printf ("    --terrain_shm: Should the DEM and terrain products be shared"
+            " with other\n"
+            "                   concurrent runs on the same DEM through POSIX"
+            " shared\n"
+            "                   memory?  Takes precedence over the terrain"
+            " cache directory\n"
+            "                   (default is false)\n");
     printf ("    --use_zeven_thorne: Should Zevenbergen&Thorne's slope"
             " algorithm be used?\n"
             "                        (default is false, meaning Horn's slope"
@@ -174,6 +198,138 @@ usage ()
             "                        be used)\n"
             "                        Output using zeven_thorne has *NOT* been"
             " validated.\n");
+    printf ("    --gradient_operator: Gradient operator for both the slope and"
+            " the hillshade;\n"
+            "                         one of horn, zevenbergen_thorne,"
+            " evans_young or\n"
+            "                         smoothed_5x5 (default is horn for the"
+            " hillshade and\n"
+            "                         the slope selected by"
+            " --use_zeven_thorne)\n");
+
+    printf ("    --terrain_cache: Directory for caching the DEM derived"
+            " products (percent\n"
+            "                     slope and gradients) between runs using"
+            " the same DEM\n"
+            "                     (default is no caching)\n");
+
+    printf ("    --archive: Landsat tar archive (.tar, .tar.gz or .tgz) to"
+            " read the bands of\n"
+            "               the XML from without extracting them; the XML"
+            " itself is\n"
+            "               extracted from it when missing (default is the"
+            " band files\n"
+            "               named in the XML)\n");
+
+    printf ("    --remote_bands: http:// URL of a directory to read the"
+            " bands of the XML\n"
+            "                    from as tiled TIFF files, such as Cloud"
+            " Optimized\n"
+            "                    GeoTIFFs, fetching only the bytes read with"
+            " range\n"
+            "                    requests; the XML itself is downloaded from"
+            " it when\n"
+            "                    missing (default is the band files named"
+            " in the XML)\n"
+            "                    %s\n",
+            HTTPS_SUPPORTED ? "https:// URLs are read as well"
+            : "http:// only: https:// URLs need a build made with\n"
+              "                    ENABLE_TLS=yes");
+
+    printf ("    --remote_cache: Directory for caching the blocks of the"
+            " remote bands\n"
+            "                    between runs (default is no caching)\n");
+
+    printf ("    --metadata_sidecar: Should the metadata of the XML be"
+            " compiled into the\n"
+            "                        binary file <xml>%s, and read from it"
+            " instead of\n"
+            "                        validating and parsing the XML while it"
+            " is unchanged?\n"
+            "                        (default is false)\n",
+            METADATA_SIDECAR_SUFFIX);
+
+    printf ("    --dem_store: Index file of a tiled DEM store to extract the"
+            " elevation of\n"
+            "                 the scene from, instead of the elevation band"
+            " of the XML\n"
+            "                 (default is the elevation band of the XML)\n"
+            "                 The elevation, from either, must be in the"
+            " projection of the\n"
+            "                 reflectance bands.  Elevation in geographic"
+            " (degree)\n"
+            "                 coordinates is only accepted with geographic"
+            " reflectance\n"
+            "                 bands, so lat/lon DEM mosaics must be"
+            " reprojected to the\n"
+            "                 UTM or Albers grid of a Landsat scene"
+            " first.\n");
+
+    printf ("    --threads: Number of threads used for the terrain"
+            " derivation (default is\n"
+            "               0, meaning all the available cores; only has"
+            " an effect when\n"
+            "               built with ENABLE_THREADING=yes)\n");
+
+    printf ("    --band_reader: How the reflectance and QA bands are brought"
+            " into memory:\n"
+            "                   read, mmap (map the files and process them in"
+            " the page\n"
+            "                   cache) or mmap_populate (map the files and"
+            " read them in\n"
+            "                   up front) (default is read); bands kept"
+            " compressed as\n"
+            "                   .img.gz or .img.xz, or tiled as .tif, are"
+            " decoded as they\n"
+            "                   are read and need the read band reader\n");
+
+    printf ("    --io_backend: How the image files are read and written:"
+            " buffered (through\n"
+            "                  the page cache), mmap (through mappings of"
+            " the files) or\n"
+            "                  direct (around the page cache with O_DIRECT,"
+            " leaving it to\n"
+            "                  other jobs) (default is buffered)\n");
+
+    printf ("    --pipeline_lines: Lines in each strip when classifying the"
+            " scene a strip at\n"
+            "                      a time, reading the next strip and"
+            " writing the previous\n"
+            "                      one meanwhile (default is 0, meaning the"
+            " whole scene is\n"
+            "                      read, classified and written in turn)\n");
+
+    printf ("    --sparse_read: Should the pipeline only read the reflectance"
+            " of the blocks\n"
+            "                   of %d lines and %d samples holding a pixel"
+            " that is neither\n"
+            "                   fill nor cloud, cloud shadow or snow in the"
+            " Pixel QA?  The\n"
+            "                   filtered interpreted band is unchanged, but"
+            " the skipped\n"
+            "                   non-fill pixels are no data in the"
+            " interpreted and\n"
+            "                   diagnostic bands and never get the percent"
+            " slope mask bit\n"
+            "                   (requires --pipeline_lines, default is"
+            " false)\n",
+            SPARSE_BLOCK_LINES, SPARSE_BLOCK_SAMPLES);
+
+    printf ("    --window: Window of the scene to process, as"
+            " line0,sample0,lines,samples\n"
+            "              in pixels of the reflectance bands; only the"
+            " window and the\n"
+            "              elevation around it are read, and the outputs"
+            " and an XML\n"
+            "              named <scene>%s cover the window (default is the"
+            " whole\n"
+            "              scene)\n", WINDOW_NAME_SUFFIX);
+
+    printf ("    --bbox: Projected box of the scene to process, as"
+            " xmin,ymin,xmax,ymax in\n"
+            "            the projection of the scene; processed as the"
+            " window of the\n"
+            "            pixels it touches (default is the whole scene)\n");
 
     printf ("    --use_toa: Should Top of Atmosphere be used instead of"
             " Surface Reflectance\n"
@@ -212,11 +368,23 @@ get_args
     char *argv[],                /* I: string of cmd-line args */
     char **xml_filename,         /* O: input XML filename */
     Espa_internal_meta_t *xml_metadata, /* O: input metadata */
+    Tar_Archive_t **archive,     /* O: archive the bands are read from, NULL
+                                       when not given */
+    char **remote_bands,         /* O: URL of the directory the bands are
+                                       read from over HTTP, NULL when not
+                                       given */
+    char **remote_cache_dir,     /* O: block cache directory of the remote
+                                       bands, NULL when not given */
+    bool *metadata_sidecar_flag, /* O: use the metadata sidecar of the
+                                       XML */
     bool *use_zeven_thorne_flag, /* O: use zeven thorne */
     bool *use_toa_flag,          /* O: process using TOA */
     bool *include_tests_flag,    /* O: include raw DSWE with output */
     bool *include_ps_flag,       /* O: include percent slope with output */
     bool *include_hs_flag,       /* O: include hillshade with output */
+    bool *cast_shadow_flag,      /* O: apply the cast shadow mask */
+    bool *terrain_shm_flag,      /* O: share the terrain products through
+                                       shared memory */
     float *wigt,                 /* O: tolerance value */
     float *awgt,                 /* O: tolerance value */
     float *pswt_1_mndwi,         /* O: tolerance value */
@@ -236,18 +404,46 @@ get_args
     float *percent_slope_low,    /* O: slope tolerance for low confidence 
                                        water or wetland */
     int *hillshade,              /* O: hillshade tolerance value */ 
+    char **terrain_cache_dir,    /* O: terrain cache directory */
+    char **dem_store_index,      /* O: DEM tile store index file */
+    int *threads,                /* O: number of threads for the terrain
+                                       derivation */
+    char **band_reader,          /* O: band reader name, NULL when not
+                                       specified */
+    char **io_backend,           /* O: I/O backend name, NULL when not
+                                       specified */
+    int *pipeline_lines,         /* O: lines in each strip of the pipeline,
+                                       0 to not pipeline */
+    bool *sparse_read_flag,      /* O: only read the reflectance the
+                                       pipeline needs */
+    char **window,               /* O: window of the scene to process, NULL
+                                       when not specified */
+    char **bbox,                 /* O: projected box of the scene to
+                                       process, NULL when not specified */
+    char **gradient_operator,    /* O: gradient operator name, NULL when not
+                                       specified */
     bool *verbose_flag           /* O: verbose messaging */
 )
 {
     int c;
     int option_index;
+    char *archive_filename = NULL; /* Archive given on the command line */
+    const Tar_Member_t *member; /* Member of the archive holding the XML */
+    char xml_url[PATH_MAX];     /* URL of the XML of the remote bands */
+    const char *xml_name;       /* Name of the XML without its directory */
     char msg[256];
+    Scene_Window_t scene_window; /* Window given on the command line */
+    double scene_bbox[4];       /* Box given on the command line */
     int tmp_zeven_thorne_flag = false;
     int tmp_toa_flag = false;
     int tmp_verbose_flag = false;
     int tmp_include_tests_flag = false;
     int tmp_include_ps_flag = false;
     int tmp_include_hs_flag = false;
+    int tmp_cast_shadow_flag = false;
+    int tmp_terrain_shm_flag = false;
+    int tmp_sparse_read_flag = false;
+    int tmp_metadata_sidecar_flag = false;
 
     struct option long_options[] = {
         /* These options set a flag */
@@ -257,9 +453,14 @@ get_args
         {"include_tests", no_argument, &tmp_include_tests_flag, true},
         {"include_ps", no_argument, &tmp_include_ps_flag, true},
         {"include_hs", no_argument, &tmp_include_hs_flag, true},
+        {"cast_shadow", no_argument, &tmp_cast_shadow_flag, true},
+        {"terrain_shm", no_argument, &tmp_terrain_shm_flag, true},
 
         /* These options provide values */
         {"xml", required_argument, 0, 'x'},
+        {"archive", required_argument, 0, 'f'},
+        {"remote_bands", required_argument, 0, 'R'},
+        {"remote_cache", required_argument, 0, 'C'},
 
         {"wigt", required_argument, 0, 'w'},
         {"awgt", required_argument, 0, 'a'},
@@ -281,6 +482,18 @@ get_args
         {"percent_slope_low", required_argument, 0, 'l'},
         {"hillshade", required_argument, 0, 's'},
 
+        {"terrain_cache", required_argument, 0, 'c'},
+        {"dem_store", required_argument, 0, 'e'},
+        {"threads", required_argument, 0, 't'},
+        {"gradient_operator", required_argument, 0, 'o'},
+        {"band_reader", required_argument, 0, 'k'},
+        {"io_backend", required_argument, 0, 'u'},
+        {"pipeline_lines", required_argument, 0, 'p'},
+        {"sparse_read", no_argument, &tmp_sparse_read_flag, true},
+        {"metadata_sidecar", no_argument, &tmp_metadata_sidecar_flag, true},
+        {"window", required_argument, 0, 'W'},
+        {"bbox", required_argument, 0, 'B'},
+
         /* Special options */
         {"verbose", no_argument, &tmp_verbose_flag, true},
         {"version", no_argument, 0, 'v'},
@@ -318,6 +531,8 @@ get_args
     *percent_slope_wetland = NOT_SET;
     *percent_slope_low = NOT_SET;
     *hillshade = NOT_SET;
+    *threads = NOT_SET;
+    *pipeline_lines = NOT_SET;
 
     /* loop through all the cmd-line options */
     opterr = 0; /* turn off getopt_long error msgs as we'll print our own */
@@ -404,6 +619,54 @@ get_args
             *hillshade = atoi (optarg);
             break;
 
+        case 'c':
+            *terrain_cache_dir = strdup (optarg);
+            break;
+
+        case 'e':
+            *dem_store_index = strdup (optarg);
+            break;
+
+        case 'f':
+            archive_filename = optarg;
+            break;
+
+        case 'R':
+            *remote_bands = strdup (optarg);
+            break;
+
+        case 'C':
+            *remote_cache_dir = strdup (optarg);
+            break;
+
+        case 't':
+            *threads = atoi (optarg);
+            break;
+
+        case 'o':
+            *gradient_operator = strdup (optarg);
+            break;
+
+        case 'k':
+            *band_reader = strdup (optarg);
+            break;
+
+        case 'u':
+            *io_backend = strdup (optarg);
+            break;
+
+        case 'p':
+            *pipeline_lines = atoi (optarg);
+            break;
+
+        case 'W':
+            *window = strdup (optarg);
+            break;
+
+        case 'B':
+            *bbox = strdup (optarg);
+            break;
+
         case '?':
         default:
             snprintf (msg, sizeof (msg),
@@ -441,6 +704,26 @@ get_args
     else
         *include_hs_flag = false;
 
+    if (tmp_cast_shadow_flag)
+        *cast_shadow_flag = true;
+    else
+        *cast_shadow_flag = false;
+
+    if (tmp_terrain_shm_flag)
+        *terrain_shm_flag = true;
+    else
+        *terrain_shm_flag = false;
+
+    if (tmp_sparse_read_flag)
+        *sparse_read_flag = true;
+    else
+        *sparse_read_flag = false;
+
+    if (tmp_metadata_sidecar_flag)
+        *metadata_sidecar_flag = true;
+    else
+        *metadata_sidecar_flag = false;
+
     if (tmp_verbose_flag)
         *verbose_flag = true;
     else
@@ -456,23 +739,113 @@ get_args
         return ERROR;
     }
 
-    /* Validate the input XML metadata file */
-    if (validate_xml_file (*xml_filename) != SUCCESS)
+    if (*remote_bands != NULL)
     {
-        /* Error messages already written */
-        return ERROR;
+        if (!is_http_url (*remote_bands))
+        {
+            ERROR_MESSAGE ("--remote_bands has to be an http:// or https://"
+                           " URL\n\n", MODULE_NAME);
+
+            usage ();
+            return ERROR;
+        }
+
+        if (!HTTPS_SUPPORTED
+            && strncasecmp (*remote_bands, "https://", 8) == 0)
+        {
+            ERROR_MESSAGE ("--remote_bands https:// URLs need dswe built with"
+                           " ENABLE_TLS=yes, this build only reads http://"
+                           " URLs\n\n", MODULE_NAME);
+
+            usage ();
+            return ERROR;
+        }
+
+        if (archive_filename != NULL)
+        {
+            ERROR_MESSAGE ("Only one of --archive and --remote_bands can be"
+                           " specified\n\n", MODULE_NAME);
+
+            usage ();
+            return ERROR;
+        }
+
+        /* Download the XML when it is not here already, since the output
+           bands are added to it */
+        if (access (*xml_filename, F_OK) != 0)
+        {
+            xml_name = strrchr (*xml_filename, '/');
+            xml_name = (xml_name != NULL) ? xml_name + 1 : *xml_filename;
+            if (snprintf (xml_url, sizeof (xml_url), "%s%s%s", *remote_bands,
+                          (*remote_bands)[strlen (*remote_bands) - 1] == '/'
+                          ? "" : "/", xml_name) >= sizeof (xml_url)
+                || download_http_file (xml_url, *xml_filename) != SUCCESS)
+            {
+                ERROR_MESSAGE ("XML file is neither on disk nor in the"
+                               " remote bands directory", MODULE_NAME);
+                return ERROR;
+            }
+        }
     }
 
-    /* Initialize the metadata structure */
-    init_metadata_struct (xml_metadata);
+    /* Index the archive, and extract the XML from it when the XML is not
+       there already, since the output bands are added to it */
+    *archive = NULL;
+    if (archive_filename != NULL)
+    {
+        *archive = open_tar_archive (archive_filename);
+        if (*archive == NULL)
+        {
+            /* Error messages already written */
+            return ERROR;
+        }
 
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (*xml_filename, xml_metadata) != SUCCESS)
+        if (access (*xml_filename, F_OK) != 0)
+        {
+            member = find_tar_member (*archive, *xml_filename);
+            if (member == NULL)
+            {
+                ERROR_MESSAGE ("XML file is neither on disk nor in the"
+                               " archive", MODULE_NAME);
+                close_tar_archive (*archive);
+                *archive = NULL;
+                return ERROR;
+            }
+
+            if (extract_tar_member (*archive, member, *xml_filename)
+                != SUCCESS)
+            {
+                /* Error messages already written */
+                close_tar_archive (*archive);
+                *archive = NULL;
+                return ERROR;
+            }
+        }
+    }
+
+    /* A sidecar compiled from the XML as it is now stands in for the
+       validated and parsed XML */
+    if (!*metadata_sidecar_flag
+        || !read_metadata_sidecar (*xml_filename, xml_metadata))
     {
-        /* Error messages already written */
-        return ERROR;
+        /* Validate the input XML metadata file */
+        if (validate_xml_file (*xml_filename) != SUCCESS)
+        {
+            /* Error messages already written */
+            return ERROR;
+        }
+
+        /* Initialize the metadata structure */
+        init_metadata_struct (xml_metadata);
+
+        /* Parse the metadata file into our internal metadata structure;
+           also allocates space as needed for various pointers in the global
+           and band metadata */
+        if (parse_metadata (*xml_filename, xml_metadata) != SUCCESS)
+        {
+            /* Error messages already written */
+            return ERROR;
+        }
     }
 
     /* Assign the default values if not provided on the command line */
@@ -559,6 +932,12 @@ get_args
     if (*hillshade == NOT_SET)
         *hillshade = hillshade_default;
 
+    if (*threads == NOT_SET)
+        *threads = threads_default;
+
+    if (*pipeline_lines == NOT_SET)
+        *pipeline_lines = pipeline_lines_default;
+
 
     /* ---------- Validate the parameters ---------- */
     if ((*wigt < 0.0) || (*wigt > 2.0))
@@ -692,5 +1071,119 @@ get_args
         return ERROR;
     }
 
+    if (*threads < 0)
+    {
+        ERROR_MESSAGE ("Number of threads is out of range\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*band_reader != NULL && find_band_reader (*band_reader) < 0)
+    {
+        ERROR_MESSAGE ("Unknown band reader\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*io_backend != NULL && find_io_backend (*io_backend) < 0)
+    {
+        ERROR_MESSAGE ("Unknown I/O backend\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*pipeline_lines < 0)
+    {
+        ERROR_MESSAGE ("Pipeline lines is out of range\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    /* The pipeline reads the bands a strip at a time, so they are never
+       mapped */
+    if (*pipeline_lines > 0 && *band_reader != NULL
+        && find_band_reader (*band_reader) != BAND_READER_READ)
+    {
+        ERROR_MESSAGE ("--pipeline_lines can only be used with the read band"
+                       " reader\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    /* Only the pipeline reads the bands in blocks */
+    if (*sparse_read_flag && *pipeline_lines == 0)
+    {
+        ERROR_MESSAGE ("--sparse_read requires --pipeline_lines\n\n",
+                       MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*window != NULL && *bbox != NULL)
+    {
+        ERROR_MESSAGE ("Only one of --window and --bbox can be specified\n\n",
+                       MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*window != NULL
+        && parse_scene_window (*window, &scene_window) != SUCCESS)
+    {
+        ERROR_MESSAGE ("Invalid window, expected"
+                       " line0,sample0,lines,samples\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*bbox != NULL && parse_scene_bbox (*bbox, scene_bbox) != SUCCESS)
+    {
+        ERROR_MESSAGE ("Invalid bounding box, expected"
+                       " xmin,ymin,xmax,ymax\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    /* The lines of a window are not together in a mapped band */
+    if ((*window != NULL || *bbox != NULL) && *band_reader != NULL
+        && find_band_reader (*band_reader) != BAND_READER_READ)
+    {
+        ERROR_MESSAGE ("--window and --bbox can only be used with the read"
+                       " band reader\n\n", MODULE_NAME);
+
+        usage ();
+        return ERROR;
+    }
+
+    if (*gradient_operator != NULL)
+    {
+        if (find_gradient_operator (*gradient_operator) == NULL)
+        {
+            ERROR_MESSAGE ("Unknown gradient operator\n\n", MODULE_NAME);
+
+            usage ();
+            return ERROR;
+        }
+
+        if (*use_zeven_thorne_flag)
+        {
+            ERROR_MESSAGE ("Only one of --use_zeven_thorne and"
+                           " --gradient_operator can be specified\n\n",
+                           MODULE_NAME);
+
+            usage ();
+            return ERROR;
+        }
+    }
+
     return SUCCESS;
 }
@@ -8,17 +8,30 @@
 
 #include "espa_metadata.h"
 
+#include "tar_archive.h"
+
 
 int
 get_args (int argc,                    /* I: number of cmd-line args */
           char *argv[],                /* I: string of cmd-line args */
           char **xml_filename,         /* O: input XML filename */
           Espa_internal_meta_t *xml_metadata, /* O: input metadata */
+          Tar_Archive_t **archive,     /* O: archive the bands are read
+                                             from, NULL when not given */
+          char **remote_bands,         /* O: URL of the directory the bands
+                                             are read from over HTTP */
+          char **remote_cache_dir,     /* O: block cache directory of the
+                                             remote bands */
+          bool *metadata_sidecar_flag, /* O: use the metadata sidecar of
+                                             the XML */
           bool *use_zeven_thorne_flag, /* O: use zeven thorne */
           bool *use_toa_flag,          /* O: process using TOA */
           bool *include_tests_flag,    /* O: include raw DSWE with output */
           bool *include_ps_flag,       /* O: include ps with output */
           bool *include_hs_flag,       /* O: include hillshade with output */
+          bool *cast_shadow_flag,      /* O: apply the cast shadow mask */
+          bool *terrain_shm_flag,      /* O: share the terrain products
+                                             through shared memory */
           float *wigt,                 /* O: tolerance value */
           float *awgt,                 /* O: tolerance value */
           float *pswt_1_mndwi,         /* O: tolerance value */
@@ -39,6 +52,21 @@ get_args (int argc,                    /* I: number of cmd-line args */
           float *percent_slope_low,    /* O: slope tolerance for low confidence
                                           water or wetland */
           int *hillshade,              /* O: hillshade tolerance value */ 
+          char **terrain_cache_dir,    /* O: terrain cache directory */
+          char **dem_store_index,      /* O: DEM tile store index file */
+          int *threads,                /* O: number of threads for the
+                                             terrain derivation */
+          char **band_reader,          /* O: band reader name */
+          char **io_backend,           /* O: I/O backend name */
+          int *pipeline_lines,         /* O: lines in each strip of the
+                                             pipeline, 0 to not pipeline */
+          bool *sparse_read_flag,      /* O: only read the reflectance the
+                                             pipeline needs */
+          char **window,               /* O: window of the scene to
+                                             process */
+          char **bbox,                 /* O: projected box of the scene to
+                                             process */
+          char **gradient_operator,    /* O: gradient operator name */
           bool * verbose_flag);        /* O: verbose messaging */
 
 
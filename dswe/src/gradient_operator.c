@@ -0,0 +1,362 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "gradient_operator.h"
+#include "terrain_kernels.h"
+
+
+/*****************************************************************************
+  NAME: horn_sum_row
+
+  PURPOSE: Computes Horn's gradient sums (from GDALDEM) for every interior
+           sample of one line of the DEM.
+
+  RETURN VALUE: Type = None
+
+  NOTES:
+    Original Development (based on GDALHillshade algorithm in GDALDEM v1.9.2)
+
+    1. The literature suggests Zevenbergen and Thorne is more suited to
+       smooth landscapes, and Horn's formula performs better on rougher
+       terrain.
+    2. The sums are the weighted differences of horn_x_sum and horn_y_sum,
+       done on the int16 elevations in int arithmetic, which is exact.
+*****************************************************************************/
+static void horn_sum_row
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int *x_sum,              /* O: east/west gradient sums for the line */
+    int *y_sum               /* O: north/south gradient sums for the line */
+)
+{
+    const int16_t *restrict dem_above = dem_line - num_samples;
+    const int16_t *restrict dem_below = dem_line + num_samples;
+    int *restrict x_out = x_sum;
+    int *restrict y_out = y_sum;
+    int sample;
+
+    for (sample = 1; sample < num_samples - 1; sample++)
+    {
+        x_out[sample] = horn_x_sum (dem_above, dem_line, dem_below, sample);
+        y_out[sample] = horn_y_sum (dem_above, dem_below, sample);
+    }
+}
+
+
+/* Horn's gradient sums for a single sample, see horn_sum_row */
+static void horn_sum_pixel
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int sample,              /* I: sample being processed */
+    int *x_sum,              /* O: east/west gradient sum for the sample */
+    int *y_sum               /* O: north/south gradient sum for the sample */
+)
+{
+    const int16_t *dem_above = dem_line - num_samples;
+    const int16_t *dem_below = dem_line + num_samples;
+
+    *x_sum = horn_x_sum (dem_above, dem_line, dem_below, sample);
+    *y_sum = horn_y_sum (dem_above, dem_below, sample);
+}
+
+
+/*****************************************************************************
+  NAME: zevenbergen_thorne_sum_row
+
+  PURPOSE: Computes Zevenbergen and Thorne's gradient differences for every
+           interior sample of one line of the DEM.
+
+  RETURN VALUE: Type = None
+
+  HISTORY:
+  Date        Programmer       Reason
+  --------    ---------------  -------------------------------------
+  06/21/2013  Song Guo         Original Development (based on Zevenbergen and
+                               Thorne, 1987)
+*****************************************************************************/
+static void zevenbergen_thorne_sum_row
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int *x_sum,              /* O: east/west gradient sums for the line */
+    int *y_sum               /* O: north/south gradient sums for the line */
+)
+{
+    const int16_t *restrict dem_above = dem_line - num_samples;
+    const int16_t *restrict dem_below = dem_line + num_samples;
+    int *restrict x_out = x_sum;
+    int *restrict y_out = y_sum;
+    int sample;
+
+    for (sample = 1; sample < num_samples - 1; sample++)
+    {
+        x_out[sample] = zevenbergen_thorne_x_diff (dem_line, sample);
+        y_out[sample] = zevenbergen_thorne_y_diff (dem_above, dem_below,
+                                                   sample);
+    }
+}
+
+
+/* Zevenbergen and Thorne's gradient differences for a single sample, see
+   zevenbergen_thorne_sum_row */
+static void zevenbergen_thorne_sum_pixel
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int sample,              /* I: sample being processed */
+    int *x_sum,              /* O: east/west gradient sum for the sample */
+    int *y_sum               /* O: north/south gradient sum for the sample */
+)
+{
+    *x_sum = zevenbergen_thorne_x_diff (dem_line, sample);
+    *y_sum = zevenbergen_thorne_y_diff (dem_line - num_samples,
+                                        dem_line + num_samples, sample);
+}
+
+
+/*****************************************************************************
+  NAME: evans_young_sum_row
+
+  PURPOSE: Computes Evans and Young's gradient sums, the unweighted least
+           squares fit over the 3x3 window, for every interior sample of one
+           line of the DEM.
+
+  RETURN VALUE: Type = None
+*****************************************************************************/
+static void evans_young_sum_row
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int *x_sum,              /* O: east/west gradient sums for the line */
+    int *y_sum               /* O: north/south gradient sums for the line */
+)
+{
+    const int16_t *restrict dem_above = dem_line - num_samples;
+    const int16_t *restrict dem_below = dem_line + num_samples;
+    int *restrict x_out = x_sum;
+    int *restrict y_out = y_sum;
+    int sample;
+
+    for (sample = 1; sample < num_samples - 1; sample++)
+    {
+        x_out[sample] = evans_young_x_sum (dem_above, dem_line, dem_below,
+                                           sample);
+        y_out[sample] = evans_young_y_sum (dem_above, dem_below, sample);
+    }
+}
+
+
+/* Evans and Young's gradient sums for a single sample, see
+   evans_young_sum_row */
+static void evans_young_sum_pixel
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int sample,              /* I: sample being processed */
+    int *x_sum,              /* O: east/west gradient sum for the sample */
+    int *y_sum               /* O: north/south gradient sum for the sample */
+)
+{
+    const int16_t *dem_above = dem_line - num_samples;
+    const int16_t *dem_below = dem_line + num_samples;
+
+    *x_sum = evans_young_x_sum (dem_above, dem_line, dem_below, sample);
+    *y_sum = evans_young_y_sum (dem_above, dem_below, sample);
+}
+
+
+/*****************************************************************************
+  NAME: smoothed_5x5_sum_row
+
+  PURPOSE: Computes the 5x5 smoothed gradient sums for every sample of one
+           line of the DEM the 5x5 window fits around.
+
+  RETURN VALUE: Type = None
+
+  NOTES:
+    1. The wider window suppresses the noise of the DEM at the cost of
+       leaving two lines and samples at each edge unprocessed.
+*****************************************************************************/
+static void smoothed_5x5_sum_row
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int *x_sum,              /* O: east/west gradient sums for the line */
+    int *y_sum               /* O: north/south gradient sums for the line */
+)
+{
+    const int16_t *restrict dem_above_2 = dem_line - 2 * num_samples;
+    const int16_t *restrict dem_above = dem_line - num_samples;
+    const int16_t *restrict dem_below = dem_line + num_samples;
+    const int16_t *restrict dem_below_2 = dem_line + 2 * num_samples;
+    int *restrict x_out = x_sum;
+    int *restrict y_out = y_sum;
+    int sample;
+
+    for (sample = 2; sample < num_samples - 2; sample++)
+    {
+        x_out[sample] = smoothed_5x5_diff (dem_above_2, sample)
+                        + 4 * smoothed_5x5_diff (dem_above, sample)
+                        + 6 * smoothed_5x5_diff (dem_line, sample)
+                        + 4 * smoothed_5x5_diff (dem_below, sample)
+                        + smoothed_5x5_diff (dem_below_2, sample);
+        y_out[sample] = (smoothed_5x5_smooth (dem_above_2, sample)
+                         + 2 * smoothed_5x5_smooth (dem_above, sample))
+                        - (2 * smoothed_5x5_smooth (dem_below, sample)
+                           + smoothed_5x5_smooth (dem_below_2, sample));
+    }
+}
+
+
+/* The 5x5 smoothed gradient sums for a single sample, see
+   smoothed_5x5_sum_row */
+static void smoothed_5x5_sum_pixel
+(
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,         /* I: number of samples of data */
+    int sample,              /* I: sample being processed */
+    int *x_sum,              /* O: east/west gradient sum for the sample */
+    int *y_sum               /* O: north/south gradient sum for the sample */
+)
+{
+    const int16_t *dem_above_2 = dem_line - 2 * num_samples;
+    const int16_t *dem_above = dem_line - num_samples;
+    const int16_t *dem_below = dem_line + num_samples;
+    const int16_t *dem_below_2 = dem_line + 2 * num_samples;
+
+    *x_sum = smoothed_5x5_diff (dem_above_2, sample)
+             + 4 * smoothed_5x5_diff (dem_above, sample)
+             + 6 * smoothed_5x5_diff (dem_line, sample)
+             + 4 * smoothed_5x5_diff (dem_below, sample)
+             + smoothed_5x5_diff (dem_below_2, sample);
+    *y_sum = (smoothed_5x5_smooth (dem_above_2, sample)
+              + 2 * smoothed_5x5_smooth (dem_above, sample))
+             - (2 * smoothed_5x5_smooth (dem_below, sample)
+                + smoothed_5x5_smooth (dem_below_2, sample));
+}
+
+
+/* The available gradient operators, indexed by Gradient_Operator_Id_t.  The
+   divisor is the distance weighted sum of the weights, so a plane gives its
+   own gradient. */
+static const Gradient_Operator_t gradient_operators[GRADIENT_OPERATOR_COUNT] =
+{
+    {GRADIENT_HORN, "horn", 1, 8.0, horn_sum_row, horn_sum_pixel},
+    {GRADIENT_ZEVENBERGEN_THORNE, "zevenbergen_thorne", 1, 2.0,
+     zevenbergen_thorne_sum_row, zevenbergen_thorne_sum_pixel},
+    {GRADIENT_EVANS_YOUNG, "evans_young", 1, 6.0, evans_young_sum_row,
+     evans_young_sum_pixel},
+    {GRADIENT_SMOOTHED_5X5, "smoothed_5x5", 2, 128.0, smoothed_5x5_sum_row,
+     smoothed_5x5_sum_pixel}
+};
+
+
+/*****************************************************************************
+  NAME: get_gradient_operator
+
+  PURPOSE: Provides the gradient operator with the identifier.
+
+  RETURN VALUE: Type = const Gradient_Operator_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The identifier is not a known operator.
+      *        The operator.
+*****************************************************************************/
+const Gradient_Operator_t *
+get_gradient_operator
+(
+    Gradient_Operator_Id_t id /* I: identifier of the operator */
+)
+{
+    if (id < 0 || id >= GRADIENT_OPERATOR_COUNT)
+        return NULL;
+
+    return &gradient_operators[id];
+}
+
+
+/*****************************************************************************
+  NAME: find_gradient_operator
+
+  PURPOSE: Provides the gradient operator with the command line name.
+
+  RETURN VALUE: Type = const Gradient_Operator_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The name is not a known operator.
+      *        The operator.
+*****************************************************************************/
+const Gradient_Operator_t *
+find_gradient_operator
+(
+    const char *name      /* I: name of the operator */
+)
+{
+    int index;
+
+    for (index = 0; index < GRADIENT_OPERATOR_COUNT; index++)
+    {
+        if (strcmp (gradient_operators[index].name, name) == 0)
+            return &gradient_operators[index];
+    }
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME: allocate_gradient_sums
+
+  PURPOSE: Allocates the work rows compute_gradient_sums needs, one pair per
+           thread of a parallel region over the lines.
+
+  RETURN VALUE: Type = int *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to allocate the memory.
+      *        The work rows, to be released with free.
+*****************************************************************************/
+int *
+allocate_gradient_sums
+(
+    int num_samples       /* I: number of samples of data */
+)
+{
+    return calloc ((size_t) line_thread_count () * 2 * num_samples,
+                   sizeof (int));
+}
+
+
+/*****************************************************************************
+  NAME: compute_gradient_sums
+
+  PURPOSE: Applies the gradient operator to one line of the DEM, in the work
+           rows of the calling thread.
+
+  RETURN VALUE: Type = None
+
+  NOTES:
+    1. The operator is selected once per line, so the per sample loops are
+       the operator's own kernel without any branching on the operator.
+    2. Only the samples from margin to num_samples - margin - 1 are set.
+*****************************************************************************/
+void
+compute_gradient_sums
+(
+    const Gradient_Operator_t *gradient_operator, /* I: operator to apply */
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,      /* I: number of samples of data */
+    int *gradient_sums,   /* I: work rows from allocate_gradient_sums */
+    int **x_sum,          /* O: east/west gradient sums for the line */
+    int **y_sum           /* O: north/south gradient sums for the line */
+)
+{
+    *x_sum = &gradient_sums[(size_t) line_thread_index () * 2 * num_samples];
+    *y_sum = *x_sum + num_samples;
+
+    gradient_operator->sum_row (dem_line, num_samples, *x_sum, *y_sum);
+}
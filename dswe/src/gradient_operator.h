@@ -0,0 +1,95 @@
+
+#ifndef GRADIENT_OPERATOR_H
+#define GRADIENT_OPERATOR_H
+
+
+#include <stdint.h>
+
+
+/* Identifiers of the gradient operators */
+typedef enum
+{
+    GRADIENT_HORN = 0,
+    GRADIENT_ZEVENBERGEN_THORNE,
+    GRADIENT_EVANS_YOUNG,
+    GRADIENT_SMOOTHED_5X5,
+    GRADIENT_OPERATOR_COUNT
+} Gradient_Operator_Id_t;
+
+
+/* Computes the integer gradient sums of the operator for every sample of one
+   line the window fits around */
+typedef void (*Gradient_Sum_Row_t)
+(
+    const int16_t *dem_line, /* I: DEM line being processed, with the DEM
+                                   lines of the window above and below it */
+    int num_samples,         /* I: number of samples of data */
+    int *x_sum,              /* O: east/west gradient sums for the line */
+    int *y_sum               /* O: north/south gradient sums for the line */
+);
+
+
+/* Computes the integer gradient sums of the operator for one sample */
+typedef void (*Gradient_Sum_Pixel_t)
+(
+    const int16_t *dem_line, /* I: DEM line being processed, with the DEM
+                                   lines of the window above and below it */
+    int num_samples,         /* I: number of samples of data */
+    int sample,              /* I: sample being processed */
+    int *x_sum,              /* O: east/west gradient sum for the sample */
+    int *y_sum               /* O: north/south gradient sum for the sample */
+);
+
+
+/* Structure describing one gradient operator.  The gradients are
+       x = x_sum / (divisor * ew_resolution)
+       y = y_sum / (divisor * ns_resolution)
+   with x positive when the terrain falls to the east and y positive when it
+   falls to the south. */
+typedef struct
+{
+    Gradient_Operator_Id_t id; /* Identifier of the operator */
+    const char *name;     /* Name of the operator on the command line */
+    int margin;           /* Lines and samples at each edge of the DEM the
+                             window does not fit around */
+    double divisor;       /* Sum of the weights scaling the sums */
+    Gradient_Sum_Row_t sum_row; /* Kernel for the operator */
+    Gradient_Sum_Pixel_t sum_pixel; /* Kernel for a single sample, giving
+                                       the same sums as sum_row */
+} Gradient_Operator_t;
+
+
+const Gradient_Operator_t *
+get_gradient_operator
+(
+    Gradient_Operator_Id_t id /* I: identifier of the operator */
+);
+
+
+const Gradient_Operator_t *
+find_gradient_operator
+(
+    const char *name      /* I: name of the operator */
+);
+
+
+int *
+allocate_gradient_sums
+(
+    int num_samples       /* I: number of samples of data */
+);
+
+
+void
+compute_gradient_sums
+(
+    const Gradient_Operator_t *gradient_operator, /* I: operator to apply */
+    const int16_t *dem_line, /* I: DEM line being processed */
+    int num_samples,      /* I: number of samples of data */
+    int *gradient_sums,   /* I: work rows from allocate_gradient_sums */
+    int **x_sum,          /* O: east/west gradient sums for the line */
+    int **y_sum           /* O: north/south gradient sums for the line */
+);
+
+
+#endif /* GRADIENT_OPERATOR_H */
@@ -0,0 +1,320 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "const.h"
+#include "build_hillshade_band.h"
+#include "gradient_operator.h"
+#include "dem_grid.h"
+
+
+/* Most the hillshade may differ from the trigonometric reference, in
+   counts of the 0 to 255 output */
+#define MAX_HILLSHADE_DIFFERENCE 1
+
+/* Size of the synthetic DEMs */
+#define CHECK_LINES 601
+#define CHECK_SAMPLES 743
+
+/* Number of synthetic DEMs and of sun positions checked on each */
+#define CHECK_DEMS 4
+#define CHECK_SUNS 7
+
+
+/*****************************************************************************
+  NAME:  reference_hillshade
+
+  PURPOSE:  The trigonometric hillshade of a 3x3 window (from GDALDEM) that
+            build_hillshade_band replaced, kept as the reference the
+            replacement is checked against.
+
+  RETURN VALUE:  Type = float
+      The shaded relief of the center pixel, 1.0 for full illumination.
+*****************************************************************************/
+static float
+reference_hillshade
+(
+    double *elevation_window, /* I: 3x3 array of elevation values in meters */
+    float ew_resolution,  /* I: east/west resolution of the elevation data in
+                                meters */
+    float ns_resolution,  /* I: north/south resolution of the elevation data
+                                in meters */
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth   /* I: solar azimuth angle in radians */
+)
+{
+    float x_slope;        /* slope at this point in east/west direction */
+    float y_slope;        /* slope at this point in north/south direction */
+    float xx_plus_yy;     /* value of x * x + y * y */
+    float aspect;         /* aspect at this point in radians */
+    float z_scale = 0.125; /* constant from GDAL for Horn algorithm (1/8) */
+
+    /* The data goes from north to south */
+    ns_resolution = -ns_resolution;
+
+    x_slope = ((elevation_window[0]
+                + 2.0 * elevation_window[3] + elevation_window[6]) -
+               (elevation_window[2] + 2.0 * elevation_window[5]
+                + elevation_window[8])) / ew_resolution;
+    y_slope = ((elevation_window[6] + 2.0 * elevation_window[7]
+                + elevation_window[8]) -
+               (elevation_window[0] + 2.0 * elevation_window[1]
+                + elevation_window[2])) / ns_resolution;
+    xx_plus_yy = x_slope * x_slope + y_slope * y_slope;
+
+    aspect = atan2 (y_slope, x_slope);
+
+    return (sin (sun_elevation) - cos (sun_elevation) * z_scale
+        * sqrt (xx_plus_yy) * sin (aspect - solar_azimuth))
+        / sqrt (1.0 + z_scale * z_scale * xx_plus_yy);
+}
+
+
+/*****************************************************************************
+  NAME:  build_reference_hillshade
+
+  PURPOSE:  Computes the hillshade of the interior of the DEM with
+            reference_hillshade, scaled to the output counts.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+build_reference_hillshade
+(
+    const int16_t *dem,   /* I: DEM in meters */
+    int num_lines,        /* I: number of lines of data */
+    int num_samples,      /* I: number of samples of data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line */
+    float sun_elevation,  /* I: sun elevation angle in radians */
+    float solar_azimuth,  /* I: solar azimuth angle in radians */
+    uint8_t *shaded_relief /* O: hillshade counts */
+)
+{
+    int line;
+    int sample;
+    int pixel;
+    int index;
+    float shade;
+    double elevation_window[9];
+
+    for (line = 1; line < num_lines - 1; line++)
+    {
+        for (sample = 1; sample < num_samples - 1; sample++)
+        {
+            for (index = 0; index < 9; index++)
+            {
+                pixel = (line + index / 3 - 1) * num_samples
+                        + sample + index % 3 - 1;
+                elevation_window[index] = dem[pixel];
+            }
+
+            shade = reference_hillshade (elevation_window,
+                geometry->ew_resolution[line], geometry->ns_resolution[line],
+                sun_elevation, solar_azimuth);
+
+            pixel = line * num_samples + sample;
+            if (shade <= 0.0)
+                shaded_relief[pixel] = 0;
+            else
+                shaded_relief[pixel] = (uint8_t) (round (254.0 * shade) + 1.0);
+        }
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  build_check_dem
+
+  PURPOSE:  Fills a synthetic DEM of rolling hills, steep ridges and noise,
+            flatter or rougher with the DEM number.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+build_check_dem
+(
+    int dem_number,       /* I: which of the synthetic DEMs */
+    int16_t *dem          /* O: CHECK_LINES x CHECK_SAMPLES elevations */
+)
+{
+    int line;
+    int sample;
+    unsigned int random = 12345 + dem_number; /* Noise generator state */
+    double height;
+
+    for (line = 0; line < CHECK_LINES; line++)
+    {
+        for (sample = 0; sample < CHECK_SAMPLES; sample++)
+        {
+            random = random * 1103515245 + 12345;
+            height = 1500.0
+                + 400.0 * (dem_number + 1) * sin (line * 0.011 * (dem_number
+                  + 1)) * cos (sample * 0.017)
+                + 900.0 * fabs (sin ((line + sample) * 0.003 * dem_number))
+                + (double) ((random >> 16) % (1 + 60 * dem_number));
+            dem[line * CHECK_SAMPLES + sample] = (int16_t) height;
+        }
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  compare_hillshade
+
+  PURPOSE:  Compares the interior of a hillshade with the reference.
+
+  RETURN VALUE:  Type = int
+      The largest difference in counts.
+*****************************************************************************/
+static int
+compare_hillshade
+(
+    const uint8_t *reference, /* I: hillshade of the reference */
+    const uint8_t *hillshade, /* I: hillshade being checked */
+    long *pixel_count,    /* IO: pixels compared */
+    long *difference_count /* IO: pixels differing */
+)
+{
+    int line;
+    int sample;
+    int pixel;
+    int difference;
+    int max_difference = 0;
+
+    for (line = 1; line < CHECK_LINES - 1; line++)
+    {
+        for (sample = 1; sample < CHECK_SAMPLES - 1; sample++)
+        {
+            pixel = line * CHECK_SAMPLES + sample;
+            difference = abs (reference[pixel] - hillshade[pixel]);
+            if (difference != 0)
+                (*difference_count)++;
+            if (difference > max_difference)
+                max_difference = difference;
+            (*pixel_count)++;
+        }
+    }
+
+    return max_difference;
+}
+
+
+/*****************************************************************************
+  NAME:  main
+
+  PURPOSE:  Checks the hillshade built without per-pixel trigonometry,
+            directly and from kept gradients, against the trigonometric
+            reference on synthetic DEMs for several sun positions, on
+            projected and geographic grids.
+
+  RETURN VALUE:  Type = int
+      Value           Description
+      --------------  --------------------------------------------------------
+      EXIT_FAILURE    A pixel differs by more than MAX_HILLSHADE_DIFFERENCE.
+      EXIT_SUCCESS    All the pixels are within MAX_HILLSHADE_DIFFERENCE.
+*****************************************************************************/
+int
+main (void)
+{
+    const float sun_elevations[CHECK_SUNS] = {5, 18, 31, 44, 57, 70, 85};
+    const float solar_azimuths[CHECK_SUNS] = {0, 47, 95, 143, 201, 268, 333};
+    const Gradient_Operator_t *horn = get_gradient_operator (GRADIENT_HORN);
+    int pixel_count = CHECK_LINES * CHECK_SAMPLES;
+    int dem_number;
+    int sun;
+    int grid;
+    int difference;
+    int max_difference = 0;
+    long compared = 0;
+    long differing = 0;
+    float sun_elevation;
+    float solar_azimuth;
+    Dem_Geometry_t *geometry[2];
+    int16_t *dem = malloc (pixel_count * sizeof (int16_t));
+    uint8_t *reference = calloc (pixel_count, sizeof (uint8_t));
+    uint8_t *hillshade = calloc (pixel_count, sizeof (uint8_t));
+    float *x_gradient = malloc (pixel_count * sizeof (float));
+    float *y_gradient = malloc (pixel_count * sizeof (float));
+
+    /* A projected grid, and a geographic one of about the same resolution
+       whose east/west resolution changes per line */
+    geometry[0] = create_dem_geometry (CHECK_LINES, 30.0, 30.0, false, 0.0);
+    geometry[1] = create_dem_geometry (CHECK_LINES, 1.0 / 3600.0,
+                                       1.0 / 3600.0, true, 61.5);
+
+    if (dem == NULL || reference == NULL || hillshade == NULL
+        || x_gradient == NULL || y_gradient == NULL || geometry[0] == NULL
+        || geometry[1] == NULL)
+    {
+        printf ("Failed allocating memory for the hillshade check\n");
+        return EXIT_FAILURE;
+    }
+
+    for (dem_number = 0; dem_number < CHECK_DEMS; dem_number++)
+    {
+        build_check_dem (dem_number, dem);
+
+        for (grid = 0; grid < 2; grid++)
+        {
+            for (sun = 0; sun < CHECK_SUNS; sun++)
+            {
+                sun_elevation = sun_elevations[sun] * RAD;
+                solar_azimuth = solar_azimuths[sun] * RAD;
+
+                build_reference_hillshade (dem, CHECK_LINES, CHECK_SAMPLES,
+                    geometry[grid], sun_elevation, solar_azimuth, reference);
+
+                if (build_hillshade_band (dem, CHECK_LINES, CHECK_SAMPLES,
+                        geometry[grid], horn, sun_elevation, solar_azimuth,
+                        hillshade) != SUCCESS)
+                {
+                    printf ("Failed building the hillshade\n");
+                    return EXIT_FAILURE;
+                }
+                difference = compare_hillshade (reference, hillshade,
+                                                &compared, &differing);
+                if (difference > max_difference)
+                    max_difference = difference;
+
+                /* The hillshade from the gradients kept in the terrain
+                   cache */
+                if (build_gradient_bands (dem, CHECK_LINES, CHECK_SAMPLES,
+                        geometry[grid], horn, x_gradient, y_gradient)
+                    != SUCCESS)
+                {
+                    printf ("Failed building the gradients\n");
+                    return EXIT_FAILURE;
+                }
+                build_hillshade_band_from_gradients (x_gradient, y_gradient,
+                    CHECK_LINES, CHECK_SAMPLES, horn, sun_elevation,
+                    solar_azimuth, hillshade);
+                difference = compare_hillshade (reference, hillshade,
+                                                &compared, &differing);
+                if (difference > max_difference)
+                    max_difference = difference;
+            }
+        }
+    }
+
+    printf ("Hillshade check: %ld pixels, %ld differ from the reference,"
+            " largest difference %d\n", compared, differing, max_difference);
+
+    free (dem);
+    free (reference);
+    free (hillshade);
+    free (x_gradient);
+    free (y_gradient);
+    free_dem_geometry (geometry[0]);
+    free_dem_geometry (geometry[1]);
+
+    if (max_difference > MAX_HILLSHADE_DIFFERENCE)
+    {
+        printf ("The hillshade differs from the reference by more than %d\n",
+                MAX_HILLSHADE_DIFFERENCE);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1665 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#ifdef ENABLE_TLS
+#include <signal.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "http_range.h"
+
+
+/* Seconds a connection waits for the server before the request fails */
+#define HTTP_TIMEOUT 60
+
+
+#ifdef ENABLE_TLS
+/* TLS settings shared by all the https connections, set up once */
+static SSL_CTX *tls_context = NULL;
+static pthread_once_t tls_once = PTHREAD_ONCE_INIT;
+#endif
+
+
+/* Structure for a run of consecutive blocks fetched by one request */
+typedef struct
+{
+    int64_t first_block;      /* First block of the run */
+    int block_count;          /* Blocks in the run */
+    int first_missing;        /* First of the blocks asked for in the run,
+                                 as an index into the missing blocks */
+    int missing_count;        /* Blocks asked for in the run; the others
+                                 only join the run */
+    uint8_t *data;            /* The bytes of the run */
+    size_t size;              /* Bytes of the run */
+} Http_Run_t;
+
+
+/* Structure for the runs one connection fetches */
+typedef struct
+{
+    Http_Source_t *source;    /* File the runs are in */
+    Http_Connection_t *connection; /* Connection fetching the runs */
+    Http_Run_t *runs;         /* All the runs */
+    int run_count;            /* Number of runs */
+    int first_run;            /* First run fetched by this connection */
+    int run_step;             /* Runs between those fetched by it */
+    int status;               /* SUCCESS when all its runs were fetched */
+} Http_Fetch_t;
+
+
+/*****************************************************************************
+  NAME:  is_http_url
+
+  PURPOSE:  Check whether a file name is an HTTP or HTTPS URL.
+
+  RETURN VALUE:  Type = bool
+      True for a name starting with http:// or https://.
+*****************************************************************************/
+bool
+is_http_url
+(
+    const char *name          /* I: file name or URL */
+)
+{
+    return strncasecmp (name, "http://", 7) == 0
+           || strncasecmp (name, "https://", 8) == 0;
+}
+
+
+/*****************************************************************************
+  NAME:  parse_http_url
+
+  PURPOSE:  Split an http:// or https:// URL into the host, port and path
+            of the file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The URL was split.
+      ERROR    The URL is not an HTTP or HTTPS URL.
+*****************************************************************************/
+static int
+parse_http_url
+(
+    Http_Source_t *source     /* IO: source with the url, given the scheme,
+                                     host, port and path */
+)
+{
+    const char *host;
+    const char *host_end;
+    const char *path;
+    const char *port = NULL;
+    size_t port_length = 0;
+
+    if (strncasecmp (source->url, "http://", 7) == 0)
+    {
+        source->secure = false;
+        host = source->url + 7;
+    }
+    else if (strncasecmp (source->url, "https://", 8) == 0)
+    {
+        source->secure = true;
+        host = source->url + 8;
+    }
+    else
+        return ERROR;
+
+    path = strchr (host, '/');
+    if (path == NULL)
+        path = host + strlen (host);
+
+    /* An IPv6 address is in brackets, which the Host header keeps */
+    if (*host == '[')
+    {
+        host_end = memchr (host, ']', path - host);
+        if (host_end == NULL)
+            return ERROR;
+        host_end++;
+    }
+    else
+    {
+        host_end = memchr (host, ':', path - host);
+        if (host_end == NULL)
+            host_end = path;
+    }
+    if (host_end == host)
+        return ERROR;
+    if (host_end < path && *host_end == ':')
+    {
+        port = host_end + 1;
+        port_length = path - port;
+    }
+    else if (host_end != path)
+        return ERROR;
+
+    source->host = strndup (host, host_end - host);
+    if (port_length > 0)
+        source->port = strndup (port, port_length);
+    else
+        source->port = strdup (source->secure ? "443" : "80");
+    source->path = strdup (*path == '\0' ? "/" : path);
+    if (source->host == NULL || source->port == NULL || source->path == NULL)
+        return ERROR;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  close_connection
+
+  PURPOSE:  Close a connection to the server and drop its unused bytes.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+close_connection
+(
+    Http_Connection_t *connection /* IO: connection to close */
+)
+{
+#ifdef ENABLE_TLS
+    if (connection->tls != NULL)
+        SSL_free (connection->tls);
+#endif
+    connection->tls = NULL;
+    if (connection->fd >= 0)
+        close (connection->fd);
+    connection->fd = -1;
+    connection->start = 0;
+    connection->end = 0;
+}
+
+
+#ifdef ENABLE_TLS
+/*****************************************************************************
+  NAME:  init_tls
+
+  PURPOSE:  Set up the TLS settings of the https connections: TLS 1.2 or
+            later, with the certificate of the server verified against the
+            system certificate authorities.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. Called once through pthread_once; tls_context stays NULL when the
+       settings could not be made.
+    2. A server closing a connection while a request is written would raise
+       SIGPIPE from inside OpenSSL, so it is ignored, as send_all does for
+       http connections with MSG_NOSIGNAL.
+*****************************************************************************/
+static void
+init_tls (void)
+{
+    SSL_CTX *context;
+
+    signal (SIGPIPE, SIG_IGN);
+
+    context = SSL_CTX_new (TLS_client_method ());
+    if (context == NULL)
+        return;
+
+    if (SSL_CTX_set_min_proto_version (context, TLS1_2_VERSION) != 1
+        || SSL_CTX_set_default_verify_paths (context) != 1)
+    {
+        SSL_CTX_free (context);
+        return;
+    }
+    SSL_CTX_set_verify (context, SSL_VERIFY_PEER, NULL);
+
+    tls_context = context;
+}
+
+
+/*****************************************************************************
+  NAME:  start_tls
+
+  PURPOSE:  Start a TLS session on a connection to an https server, checking
+            the certificate of the server is valid for its host.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The session is started.
+      ERROR    The handshake failed or the certificate was not trusted.
+*****************************************************************************/
+static int
+start_tls
+(
+    const Http_Source_t *source, /* I: file on the server */
+    const char *host,         /* I: host of the server, without brackets */
+    Http_Connection_t *connection /* IO: connected socket, given its TLS
+                                        session */
+)
+{
+    SSL *tls;
+    unsigned char address[sizeof (struct in6_addr)];
+    bool numeric_host;
+    long verify_result;
+    char msg[PATH_MAX + 128];
+
+    pthread_once (&tls_once, init_tls);
+    if (tls_context == NULL)
+    {
+        RETURN_ERROR ("Failed setting up TLS for https connections",
+                      MODULE_NAME, ERROR);
+    }
+
+    tls = SSL_new (tls_context);
+    if (tls == NULL)
+        return ERROR;
+    connection->tls = tls;
+
+    /* Names are sent with the handshake for servers hosting several of
+       them, and addresses are checked against the address entries of the
+       certificate */
+    numeric_host = (inet_pton (AF_INET, host, address) == 1
+                    || inet_pton (AF_INET6, host, address) == 1);
+    if (numeric_host)
+    {
+        if (X509_VERIFY_PARAM_set1_ip_asc (SSL_get0_param (tls), host) != 1)
+            return ERROR;
+    }
+    else if (SSL_set_tlsext_host_name (tls, host) != 1
+             || SSL_set1_host (tls, host) != 1)
+    {
+        return ERROR;
+    }
+
+    if (SSL_set_fd (tls, connection->fd) != 1)
+        return ERROR;
+
+    if (SSL_connect (tls) != 1)
+    {
+        verify_result = SSL_get_verify_result (tls);
+        if (verify_result != X509_V_OK)
+        {
+            snprintf (msg, sizeof (msg), "The certificate of the server is"
+                      " not trusted: %s (%s)",
+                      X509_verify_cert_error_string (verify_result),
+                      source->url);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+        }
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+#endif
+
+
+/*****************************************************************************
+  NAME:  open_connection
+
+  PURPOSE:  Connect to the server of a remote file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The connection is open.
+      ERROR    The server could not be reached.
+*****************************************************************************/
+static int
+open_connection
+(
+    const Http_Source_t *source, /* I: file on the server */
+    Http_Connection_t *connection /* O: the open connection */
+)
+{
+    struct addrinfo hints;
+    struct addrinfo *addresses = NULL;
+    struct addrinfo *address;
+    struct timeval timeout;
+    char host[256];
+    size_t length = strlen (source->host);
+
+    /* The brackets of an IPv6 address are not part of it */
+    if (source->host[0] == '[')
+    {
+        snprintf (host, sizeof (host), "%.*s", (int) (length - 2),
+                  source->host + 1);
+    }
+    else
+        snprintf (host, sizeof (host), "%s", source->host);
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (host, source->port, &hints, &addresses) != 0)
+        return ERROR;
+
+    timeout.tv_sec = HTTP_TIMEOUT;
+    timeout.tv_usec = 0;
+    for (address = addresses; address != NULL; address = address->ai_next)
+    {
+        connection->fd = socket (address->ai_family, address->ai_socktype,
+                                 address->ai_protocol);
+        if (connection->fd < 0)
+            continue;
+
+        setsockopt (connection->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof (timeout));
+        setsockopt (connection->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                    sizeof (timeout));
+        if (connect (connection->fd, address->ai_addr, address->ai_addrlen)
+            == 0)
+        {
+            break;
+        }
+
+        close (connection->fd);
+        connection->fd = -1;
+    }
+    freeaddrinfo (addresses);
+
+    connection->start = 0;
+    connection->end = 0;
+
+    if (connection->fd < 0)
+        return ERROR;
+
+#ifdef ENABLE_TLS
+    if (source->secure && start_tls (source, host, connection) != SUCCESS)
+    {
+        close_connection (connection);
+        return ERROR;
+    }
+#endif
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  connection_receive
+
+  PURPOSE:  Receive bytes from the socket of a connection, through its TLS
+            session for https.
+
+  RETURN VALUE:  Type = ssize_t
+      The bytes received, 0 when the connection closed and -1 on errors,
+      with errno EINTR when the receive should be retried.
+*****************************************************************************/
+static ssize_t
+connection_receive
+(
+    Http_Connection_t *connection, /* IO: connection to receive on */
+    void *buffer,             /* O: memory for up to size bytes */
+    size_t size               /* I: most bytes to receive */
+)
+{
+#ifdef ENABLE_TLS
+    int received;
+
+    if (connection->tls != NULL)
+    {
+        if (size > INT_MAX)
+            size = INT_MAX;
+        received = SSL_read (connection->tls, buffer, size);
+        if (received > 0)
+            return received;
+        if (SSL_get_error (connection->tls, received) == SSL_ERROR_ZERO_RETURN)
+            return 0;
+        errno = 0;
+        return -1;
+    }
+#endif
+
+    return recv (connection->fd, buffer, size, 0);
+}
+
+
+/*****************************************************************************
+  NAME:  connection_send
+
+  PURPOSE:  Send bytes on the socket of a connection, through its TLS
+            session for https.
+
+  RETURN VALUE:  Type = ssize_t
+      The bytes sent and -1 on errors, with errno EINTR when the send
+      should be retried.
+*****************************************************************************/
+static ssize_t
+connection_send
+(
+    Http_Connection_t *connection, /* IO: connection to send on */
+    const void *buffer,       /* I: the bytes to send */
+    size_t size               /* I: number of bytes to send */
+)
+{
+#ifdef ENABLE_TLS
+    int sent;
+
+    if (connection->tls != NULL)
+    {
+        if (size > INT_MAX)
+            size = INT_MAX;
+        sent = SSL_write (connection->tls, buffer, size);
+        if (sent > 0)
+            return sent;
+        errno = 0;
+        return -1;
+    }
+#endif
+
+    return send (connection->fd, buffer, size, MSG_NOSIGNAL);
+}
+
+
+/*****************************************************************************
+  NAME:  receive_bytes
+
+  PURPOSE:  Take bytes of the response from the connection, first those
+            already received and then from the socket.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were received.
+      ERROR    The connection closed or failed before the bytes.
+
+  NOTES:
+    1. A NULL buffer discards the bytes.
+*****************************************************************************/
+static int
+receive_bytes
+(
+    Http_Connection_t *connection, /* IO: connection of the response */
+    void *buffer,             /* O: memory for size bytes, NULL to discard
+                                    them */
+    size_t size               /* I: number of bytes to receive */
+)
+{
+    char *next = buffer;
+    size_t count;
+    ssize_t received;
+
+    while (size > 0)
+    {
+        if (connection->start == connection->end)
+        {
+            /* Large reads go straight into the buffer */
+            if (next != NULL && size >= sizeof (connection->buffer))
+            {
+                received = connection_receive (connection, next, size);
+                if (received < 0 && errno == EINTR)
+                    continue;
+                if (received <= 0)
+                    return ERROR;
+
+                next += received;
+                size -= received;
+                continue;
+            }
+
+            received = connection_receive (connection, connection->buffer,
+                                           sizeof (connection->buffer));
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                return ERROR;
+            connection->start = 0;
+            connection->end = received;
+        }
+
+        count = connection->end - connection->start;
+        if (count > size)
+            count = size;
+        if (next != NULL)
+        {
+            memcpy (next, &connection->buffer[connection->start], count);
+            next += count;
+        }
+        connection->start += count;
+        size -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  receive_line
+
+  PURPOSE:  Take a line of the response headers from the connection.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The line was received, without its line end.
+      ERROR    The connection closed, or the line is too long.
+*****************************************************************************/
+static int
+receive_line
+(
+    Http_Connection_t *connection, /* IO: connection of the response */
+    char *line,               /* O: the line */
+    size_t line_size          /* I: size of the line memory */
+)
+{
+    size_t length = 0;
+    char c;
+
+    while (receive_bytes (connection, &c, 1) == SUCCESS)
+    {
+        if (c == '\n')
+        {
+            if (length > 0 && line[length - 1] == '\r')
+                length--;
+            line[length] = '\0';
+            return SUCCESS;
+        }
+
+        if (length + 1 >= line_size)
+            return ERROR;
+        line[length++] = c;
+    }
+
+    return ERROR;
+}
+
+
+/*****************************************************************************
+  NAME:  send_all
+
+  PURPOSE:  Send a request on the connection, retrying short sends.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The request was sent.
+      ERROR    The connection failed.
+*****************************************************************************/
+static int
+send_all
+(
+    Http_Connection_t *connection, /* I: connection to send on */
+    const char *request,      /* I: the request */
+    size_t size               /* I: bytes of the request */
+)
+{
+    ssize_t sent;
+
+    while (size > 0)
+    {
+        sent = connection_send (connection, request, size);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return ERROR;
+
+        request += sent;
+        size -= sent;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  exchange_range
+
+  PURPOSE:  Request a byte range of the remote file on a connection and
+            receive it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The range was received.
+      ERROR    The request failed.
+
+  NOTES:
+    1. The first response gives the size and entity tag of the file.
+    2. A server answering with the whole file, as simple static servers do,
+       has the bytes before the range skipped and the connection closed
+       after it.
+    3. Chunked responses are not handled; servers send range responses
+       with their length.
+*****************************************************************************/
+static int
+exchange_range
+(
+    Http_Source_t *source,    /* IO: file to read, given its size with the
+                                     first response */
+    Http_Connection_t *connection, /* IO: connection to request on */
+    uint64_t offset,          /* I: offset of the first byte */
+    size_t size,              /* I: number of bytes asked for */
+    void *buffer,             /* O: memory for size bytes */
+    size_t *received          /* O: bytes received, less than size at the
+                                    end of the file */
+)
+{
+    char request[PATH_MAX + 512];
+    char line[1024];
+    char *value;
+    int count;
+    int status_code;
+    long long content_length = -1;
+    unsigned long long range_first;
+    unsigned long long range_last;
+    unsigned long long range_total;
+    bool have_range = false;
+    bool keep_alive = true;
+    uint64_t total;
+    bool default_port = (strcmp (source->port,
+                                 source->secure ? "443" : "80") == 0);
+
+    if (connection->fd < 0 && open_connection (source, connection) != SUCCESS)
+        return ERROR;
+
+    count = snprintf (request, sizeof (request),
+                      "GET %s HTTP/1.1\r\n"
+                      "Host: %s%s%s\r\n"
+                      "Range: bytes=%llu-%llu\r\n"
+                      "User-Agent: dswe\r\n"
+                      "\r\n", source->path, source->host,
+                      default_port ? "" : ":",
+                      default_port ? "" : source->port,
+                      (unsigned long long) offset,
+                      (unsigned long long) (offset + size - 1));
+    if (count < 0 || count >= sizeof (request)
+        || send_all (connection, request, count) != SUCCESS)
+    {
+        return ERROR;
+    }
+
+    /* The status line and the headers used */
+    if (receive_line (connection, line, sizeof (line)) != SUCCESS
+        || sscanf (line, "HTTP/%*d.%*d %d", &status_code) != 1)
+    {
+        return ERROR;
+    }
+    if (strncmp (line, "HTTP/1.0", 8) == 0)
+        keep_alive = false;
+    while (true)
+    {
+        if (receive_line (connection, line, sizeof (line)) != SUCCESS)
+            return ERROR;
+        if (line[0] == '\0')
+            break;
+
+        value = strchr (line, ':');
+        if (value == NULL)
+            continue;
+        *value++ = '\0';
+        value += strspn (value, " \t");
+
+        if (strcasecmp (line, "Content-Length") == 0)
+            content_length = atoll (value);
+        else if (strcasecmp (line, "Content-Range") == 0)
+        {
+            have_range = (sscanf (value, "bytes %llu-%llu/%llu",
+                                  &range_first, &range_last, &range_total)
+                          == 3);
+        }
+        else if (strcasecmp (line, "Connection") == 0)
+            keep_alive = (strcasecmp (value, "close") != 0);
+        else if (strcasecmp (line, "Transfer-Encoding") == 0)
+        {
+            if (strcasecmp (value, "identity") != 0)
+                return ERROR;
+        }
+        else if (strcasecmp (line, "ETag") == 0 && source->size == 0)
+            snprintf (source->etag, sizeof (source->etag), "%s", value);
+    }
+
+    if (status_code == 206 && have_range && content_length >= 0
+        && range_first == offset && range_last >= range_first
+        && range_last - range_first + 1 == (unsigned long long) content_length
+        && (size_t) content_length <= size)
+    {
+        if (source->size == 0)
+            source->size = range_total;
+        if (receive_bytes (connection, buffer, content_length) != SUCCESS)
+            return ERROR;
+        *received = content_length;
+    }
+    else if (status_code == 200 && content_length >= 0)
+    {
+        /* The whole file came back */
+        total = content_length;
+        if (source->size == 0)
+            source->size = total;
+        if (!source->ranges_ignored && (offset > 0 || total > size))
+        {
+            source->ranges_ignored = true;
+            snprintf (line, sizeof (line), "The server ignores range"
+                      " requests, reading through the whole file (%s)",
+                      source->url);
+            WARNING_MESSAGE (line, MODULE_NAME);
+        }
+        if (offset > total)
+            return ERROR;
+        *received = (total - offset < size) ? total - offset : size;
+        if (receive_bytes (connection, NULL, offset) != SUCCESS
+            || receive_bytes (connection, buffer, *received) != SUCCESS)
+        {
+            return ERROR;
+        }
+
+        /* The rest of the file is not wanted */
+        keep_alive = false;
+    }
+    else
+        return ERROR;
+
+    if (!keep_alive)
+        close_connection (connection);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  request_range
+
+  PURPOSE:  Fetch a byte range of the remote file on a connection,
+            reconnecting once when the request fails.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The range was fetched.
+      ERROR    The request failed twice.
+
+  NOTES:
+    1. A kept open connection may have been closed by the server while
+       idle, which only shows when it is used.
+*****************************************************************************/
+static int
+request_range
+(
+    Http_Source_t *source,    /* IO: file to read */
+    Http_Connection_t *connection, /* IO: connection to request on */
+    uint64_t offset,          /* I: offset of the first byte */
+    size_t size,              /* I: number of bytes asked for */
+    void *buffer,             /* O: memory for size bytes */
+    size_t *received          /* O: bytes received */
+)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < 2; attempt++)
+    {
+        if (exchange_range (source, connection, offset, size, buffer,
+                            received) == SUCCESS)
+        {
+            return SUCCESS;
+        }
+        close_connection (connection);
+    }
+
+    return ERROR;
+}
+
+
+/*****************************************************************************
+  NAME:  hash_cache_key
+
+  PURPOSE:  Computes the key naming the cached blocks of a remote file.
+
+  RETURN VALUE:  Type = uint64_t
+      The 64 bit FNV-1a hash of the URL, size and entity tag of the file.
+*****************************************************************************/
+static uint64_t
+hash_cache_key
+(
+    const Http_Source_t *source /* I: file to key */
+)
+{
+    const uint64_t fnv_prime = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL;
+    char size_text[32];
+    const char *parts[3];
+    const char *next;
+    int index;
+
+    snprintf (size_text, sizeof (size_text), "%llu",
+              (unsigned long long) source->size);
+    parts[0] = source->url;
+    parts[1] = size_text;
+    parts[2] = source->etag;
+
+    for (index = 0; index < 3; index++)
+    {
+        for (next = parts[index]; *next != '\0'; next++)
+        {
+            hash ^= (unsigned char) *next;
+            hash *= fnv_prime;
+        }
+        hash ^= '\n';
+        hash *= fnv_prime;
+    }
+
+    return hash;
+}
+
+
+/*****************************************************************************
+  NAME:  block_size
+
+  PURPOSE:  Computes the bytes of a block of the remote file.
+
+  RETURN VALUE:  Type = size_t
+      HTTP_BLOCK_SIZE, or less for the last block.
+*****************************************************************************/
+static size_t
+block_size
+(
+    const Http_Source_t *source, /* I: file of the block */
+    int64_t block_index       /* I: block in the file */
+)
+{
+    uint64_t offset = (uint64_t) block_index * HTTP_BLOCK_SIZE;
+
+    if (source->size - offset < HTTP_BLOCK_SIZE)
+        return source->size - offset;
+
+    return HTTP_BLOCK_SIZE;
+}
+
+
+/*****************************************************************************
+  NAME:  cache_block
+
+  PURPOSE:  Put a block into the memory of the remote file, in place of the
+            least recently used one.
+
+  RETURN VALUE:  Type = Http_Block_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     Failed to allocate memory for the block.
+      *        The cached block.
+*****************************************************************************/
+static Http_Block_t *
+cache_block
+(
+    Http_Source_t *source,    /* IO: file of the block */
+    int64_t block_index,      /* I: block in the file */
+    const uint8_t *data       /* I: bytes of the block */
+)
+{
+    Http_Block_t *entry = &source->blocks[0];
+    int index;
+
+    for (index = 0; index < HTTP_CACHE_BLOCKS; index++)
+    {
+        if (source->blocks[index].index == block_index)
+        {
+            entry = &source->blocks[index];
+            break;
+        }
+        if (source->blocks[index].last_use < entry->last_use)
+            entry = &source->blocks[index];
+    }
+
+    if (entry->data == NULL)
+    {
+        entry->data = malloc (HTTP_BLOCK_SIZE);
+        if (entry->data == NULL)
+            return NULL;
+    }
+
+    entry->index = block_index;
+    entry->size = block_size (source, block_index);
+    entry->last_use = ++source->use_count;
+    memcpy (entry->data, data, entry->size);
+
+    return entry;
+}
+
+
+/*****************************************************************************
+  NAME:  block_filename
+
+  PURPOSE:  Build the name of the file of a block in the block cache.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The name was built.
+      ERROR    The name is too long.
+*****************************************************************************/
+static int
+block_filename
+(
+    const Http_Source_t *source, /* I: file of the block */
+    int64_t block_index,      /* I: block in the file */
+    char *filename,           /* O: name of the block file */
+    size_t filename_size      /* I: size of the name memory */
+)
+{
+    int count;
+
+    count = snprintf (filename, filename_size, "%s/%016llx_%lld.blk",
+                      source->cache_dir,
+                      (unsigned long long) source->cache_key,
+                      (long long) block_index);
+
+    return (count >= 0 && count < filename_size) ? SUCCESS : ERROR;
+}
+
+
+/*****************************************************************************
+  NAME:  load_cached_block
+
+  PURPOSE:  Read a block from the block cache on disk into memory.
+
+  RETURN VALUE:  Type = Http_Block_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The block is not in the block cache.
+      *        The block in memory.
+*****************************************************************************/
+static Http_Block_t *
+load_cached_block
+(
+    Http_Source_t *source,    /* IO: file of the block */
+    int64_t block_index       /* I: block in the file */
+)
+{
+    char filename[PATH_MAX];
+    uint8_t *data;
+    size_t size = block_size (source, block_index);
+    Http_Block_t *entry = NULL;
+    FILE *fd;
+
+    if (source->cache_dir == NULL
+        || block_filename (source, block_index, filename, sizeof (filename))
+           != SUCCESS)
+    {
+        return NULL;
+    }
+
+    fd = fopen (filename, "rb");
+    if (fd == NULL)
+        return NULL;
+
+    data = malloc (HTTP_BLOCK_SIZE);
+    if (data != NULL && fread (data, 1, size, fd) == size
+        && fgetc (fd) == EOF)
+    {
+        entry = cache_block (source, block_index, data);
+    }
+
+    free (data);
+    fclose (fd);
+
+    return entry;
+}
+
+
+/*****************************************************************************
+  NAME:  store_cached_block
+
+  PURPOSE:  Write a fetched block into the block cache on disk.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The block is written under a temporary name and renamed, so
+       concurrent runs never see a partially written block.  The cache is
+       only an optimization, so failures to write it are ignored.
+*****************************************************************************/
+static void
+store_cached_block
+(
+    const Http_Source_t *source, /* I: file of the block */
+    int64_t block_index,      /* I: block in the file */
+    const uint8_t *data       /* I: bytes of the block */
+)
+{
+    char filename[PATH_MAX];
+    char temp_filename[PATH_MAX];
+    size_t size = block_size (source, block_index);
+    int count;
+    FILE *fd;
+
+    if (source->cache_dir == NULL
+        || block_filename (source, block_index, filename, sizeof (filename))
+           != SUCCESS)
+    {
+        return;
+    }
+    count = snprintf (temp_filename, sizeof (temp_filename), "%s.%d.tmp",
+                      filename, (int) getpid ());
+    if (count < 0 || count >= sizeof (temp_filename))
+        return;
+
+    fd = fopen (temp_filename, "wb");
+    if (fd == NULL)
+        return;
+
+    if (fwrite (data, 1, size, fd) != size)
+    {
+        fclose (fd);
+        unlink (temp_filename);
+        return;
+    }
+    if (fclose (fd) != 0 || rename (temp_filename, filename) != 0)
+        unlink (temp_filename);
+}
+
+
+/*****************************************************************************
+  NAME:  find_block
+
+  PURPOSE:  Find a block of the remote file in memory or in the block cache
+            on disk.
+
+  RETURN VALUE:  Type = Http_Block_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     The block has to be fetched.
+      *        The block in memory, marked as just used.
+*****************************************************************************/
+static Http_Block_t *
+find_block
+(
+    Http_Source_t *source,    /* IO: file of the block */
+    int64_t block_index       /* I: block in the file */
+)
+{
+    int index;
+
+    for (index = 0; index < HTTP_CACHE_BLOCKS; index++)
+    {
+        if (source->blocks[index].index == block_index)
+        {
+            source->blocks[index].last_use = ++source->use_count;
+            return &source->blocks[index];
+        }
+    }
+
+    return load_cached_block (source, block_index);
+}
+
+
+/*****************************************************************************
+  NAME:  fetch_runs
+
+  PURPOSE:  Fetch the runs of blocks given to one connection.
+
+  RETURN VALUE:  Type = void *
+      NULL, with the status in the Http_Fetch_t.
+
+  NOTES:
+    1. The connections fetch into the memory of their own runs and only
+       read the file fields set when it was opened, so they need no lock.
+*****************************************************************************/
+static void *
+fetch_runs
+(
+    void *arg                 /* IO: the Http_Fetch_t of the connection */
+)
+{
+    Http_Fetch_t *fetch = arg;
+    Http_Run_t *run;
+    size_t received;
+    int index;
+
+    fetch->status = SUCCESS;
+    for (index = fetch->first_run; index < fetch->run_count;
+         index += fetch->run_step)
+    {
+        run = &fetch->runs[index];
+        if (request_range (fetch->source, fetch->connection,
+                           (uint64_t) run->first_block * HTTP_BLOCK_SIZE,
+                           run->size, run->data, &received) != SUCCESS
+            || received != run->size)
+        {
+            fetch->status = ERROR;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  compare_blocks
+
+  PURPOSE:  Orders block indexes for qsort.
+
+  RETURN VALUE:  Type = int
+      Negative, zero or positive as the first block is before, the same as
+      or after the second.
+*****************************************************************************/
+static int
+compare_blocks
+(
+    const void *first,        /* I: first block index */
+    const void *second        /* I: second block index */
+)
+{
+    int64_t a = *(const int64_t *) first;
+    int64_t b = *(const int64_t *) second;
+
+    return (a > b) - (a < b);
+}
+
+
+/*****************************************************************************
+  NAME:  prefetch_http_ranges
+
+  PURPOSE:  Bring the blocks of byte ranges about to be read into memory,
+            fetching the missing ones together.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The blocks were brought into memory.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. Blocks in memory or in the block cache on disk are not fetched.  The
+       missing blocks are coalesced into runs, joining runs separated by
+       at most HTTP_COALESCE_GAP_BLOCKS blocks, which trades a little
+       bandwidth for fewer round trips.  The runs are fetched in parallel
+       on HTTP_CONNECTIONS connections.
+    2. Only as many blocks as the memory holds are brought in; the rest are
+       fetched as they are read.
+*****************************************************************************/
+int
+prefetch_http_ranges
+(
+    Http_Source_t *source,    /* IO: file from open_http_source */
+    const Http_Range_t *ranges, /* I: byte ranges about to be read */
+    int range_count           /* I: number of ranges */
+)
+{
+    int64_t *blocks = NULL;   /* blocks of the ranges, then the missing
+                                 ones */
+    int block_count = 0;
+    int missing_count = 0;
+    Http_Run_t *runs = NULL;
+    int run_count = 0;
+    Http_Run_t *run;
+    Http_Fetch_t fetches[HTTP_CONNECTIONS];
+    pthread_t threads[HTTP_CONNECTIONS];
+    bool pending[HTTP_CONNECTIONS];
+    int fetch_count;
+    int64_t block;
+    int64_t last_block;
+    int index;
+    int run_block;
+    int status = SUCCESS;
+    char msg[PATH_MAX + 64];
+
+    /* Count the blocks of the ranges */
+    for (index = 0; index < range_count; index++)
+    {
+        if (ranges[index].size > 0)
+        {
+            block_count += (ranges[index].offset + ranges[index].size - 1)
+                           / HTTP_BLOCK_SIZE
+                           - ranges[index].offset / HTTP_BLOCK_SIZE + 1;
+        }
+    }
+    if (block_count == 0)
+        return SUCCESS;
+
+    blocks = malloc (block_count * sizeof (int64_t));
+    runs = malloc (block_count * sizeof (Http_Run_t));
+    if (blocks == NULL || runs == NULL)
+    {
+        free (blocks);
+        free (runs);
+        RETURN_ERROR ("Error allocating memory for the remote blocks",
+                      MODULE_NAME, ERROR);
+    }
+
+    /* The distinct blocks, in file order */
+    block_count = 0;
+    for (index = 0; index < range_count; index++)
+    {
+        if (ranges[index].size == 0)
+            continue;
+
+        last_block = (ranges[index].offset + ranges[index].size - 1)
+                     / HTTP_BLOCK_SIZE;
+        for (block = ranges[index].offset / HTTP_BLOCK_SIZE;
+             block <= last_block; block++)
+        {
+            blocks[block_count++] = block;
+        }
+    }
+    qsort (blocks, block_count, sizeof (int64_t), compare_blocks);
+    for (index = 0; index < block_count; index++)
+    {
+        if (missing_count == 0 || blocks[index] != blocks[missing_count - 1])
+            blocks[missing_count++] = blocks[index];
+    }
+    block_count = missing_count;
+    if (block_count > HTTP_CACHE_BLOCKS)
+        block_count = HTTP_CACHE_BLOCKS;
+
+    /* Keep the blocks already here, marking them used so fetching the
+       others does not push them out */
+    missing_count = 0;
+    for (index = 0; index < block_count; index++)
+    {
+        if (find_block (source, blocks[index]) == NULL)
+            blocks[missing_count++] = blocks[index];
+    }
+
+    /* Coalesce the missing blocks into runs */
+    for (index = 0; index < missing_count; index++)
+    {
+        if (run_count > 0)
+        {
+            run = &runs[run_count - 1];
+            if (blocks[index] - (run->first_block + run->block_count)
+                <= HTTP_COALESCE_GAP_BLOCKS
+                && blocks[index] - run->first_block < HTTP_MAX_RUN_BLOCKS)
+            {
+                run->block_count = blocks[index] - run->first_block + 1;
+                run->missing_count++;
+                continue;
+            }
+        }
+
+        run = &runs[run_count++];
+        run->first_block = blocks[index];
+        run->block_count = 1;
+        run->first_missing = index;
+        run->missing_count = 1;
+        run->data = NULL;
+    }
+
+    for (index = 0; index < run_count; index++)
+    {
+        run = &runs[index];
+        run->size = (uint64_t) (run->block_count - 1) * HTTP_BLOCK_SIZE
+                    + block_size (source, run->first_block
+                                          + run->block_count - 1);
+        run->data = malloc (run->size);
+        if (run->data == NULL)
+        {
+            ERROR_MESSAGE ("Error allocating memory for the remote blocks",
+                           MODULE_NAME);
+            status = ERROR;
+            run_count = index;
+            break;
+        }
+    }
+
+    /* Fetch the runs in parallel, the first connection on this thread.  A
+       connection whose thread cannot be started fetches here afterwards. */
+    fetch_count = (run_count < HTTP_CONNECTIONS) ? run_count
+                                                 : HTTP_CONNECTIONS;
+    if (status == SUCCESS)
+    {
+        for (index = 0; index < fetch_count; index++)
+        {
+            fetches[index].source = source;
+            fetches[index].connection = &source->connections[index];
+            fetches[index].runs = runs;
+            fetches[index].run_count = run_count;
+            fetches[index].first_run = index;
+            fetches[index].run_step = fetch_count;
+            pending[index] = (index > 0
+                              && pthread_create (&threads[index], NULL,
+                                                 fetch_runs, &fetches[index])
+                                 == 0);
+        }
+        for (index = 0; index < fetch_count; index++)
+        {
+            if (!pending[index])
+                fetch_runs (&fetches[index]);
+        }
+        for (index = 0; index < fetch_count; index++)
+        {
+            if (pending[index])
+                pthread_join (threads[index], NULL);
+            if (fetches[index].status != SUCCESS)
+                status = ERROR;
+        }
+        if (status != SUCCESS)
+        {
+            snprintf (msg, sizeof (msg), "Failed fetching byte ranges of"
+                      " (%s)", source->url);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+
+    /* Keep the blocks asked for in memory and every fetched block on
+       disk */
+    for (index = 0; index < run_count; index++)
+    {
+        run = &runs[index];
+        if (status == SUCCESS)
+        {
+            for (run_block = 0; run_block < run->block_count; run_block++)
+            {
+                store_cached_block (source, run->first_block + run_block,
+                    &run->data[(size_t) run_block * HTTP_BLOCK_SIZE]);
+            }
+            for (run_block = 0; run_block < run->missing_count; run_block++)
+            {
+                block = blocks[run->first_missing + run_block];
+                if (cache_block (source, block,
+                        &run->data[(size_t) (block - run->first_block)
+                                   * HTTP_BLOCK_SIZE]) == NULL)
+                {
+                    ERROR_MESSAGE ("Error allocating memory for the remote"
+                                   " blocks", MODULE_NAME);
+                    status = ERROR;
+                    break;
+                }
+            }
+        }
+        free (run->data);
+    }
+
+    free (blocks);
+    free (runs);
+
+    return status;
+}
+
+
+/*****************************************************************************
+  NAME:  read_http_source
+
+  PURPOSE:  Read bytes at an offset of a remote file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were read.
+      ERROR    The file ends before the bytes or could not be fetched.
+
+  NOTES:
+    1. The file is only read by one thread at a time, since the blocks in
+       memory are not locked.
+*****************************************************************************/
+int
+read_http_source
+(
+    Http_Source_t *source,    /* IO: file from open_http_source */
+    void *buffer,             /* O: memory for size bytes */
+    size_t size,              /* I: number of bytes to read */
+    uint64_t offset           /* I: offset of the bytes in the file */
+)
+{
+    Http_Range_t range;
+    Http_Block_t *block;
+    uint8_t *next = buffer;
+    int64_t block_index;
+    size_t start;
+    size_t count;
+    char msg[PATH_MAX + 64];
+
+    if (offset > source->size || size > source->size - offset)
+    {
+        snprintf (msg, sizeof (msg), "Read past the end of (%s)",
+                  source->url);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    range.offset = offset;
+    range.size = size;
+    if (prefetch_http_ranges (source, &range, 1) != SUCCESS)
+        return ERROR;
+
+    while (size > 0)
+    {
+        block_index = offset / HTTP_BLOCK_SIZE;
+
+        /* A read larger than the memory has its later blocks fetched
+           again */
+        block = find_block (source, block_index);
+        if (block == NULL)
+        {
+            range.offset = offset;
+            range.size = size;
+            if (prefetch_http_ranges (source, &range, 1) != SUCCESS)
+                return ERROR;
+            block = find_block (source, block_index);
+            if (block == NULL)
+                return ERROR;
+        }
+
+        start = offset - (uint64_t) block_index * HTTP_BLOCK_SIZE;
+        count = block->size - start;
+        if (count > size)
+            count = size;
+        memcpy (next, &block->data[start], count);
+
+        next += count;
+        offset += count;
+        size -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_http_source
+
+  PURPOSE:  Open a file on an HTTP or HTTPS server for reading it with range
+            requests.
+
+  RETURN VALUE:  Type = Http_Source_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The file, with its first block in memory.
+
+  NOTES:
+    1. https:// URLs need a build with ENABLE_TLS=yes, which links OpenSSL;
+       other builds only read http:// URLs.
+    2. The first block is fetched to learn the size of the file, and holds
+       the header of a Cloud Optimized GeoTIFF.
+*****************************************************************************/
+Http_Source_t *
+open_http_source
+(
+    const char *url,          /* I: http:// or https:// URL of the file */
+    const char *cache_dir     /* I: directory of the block cache on disk,
+                                    NULL for none */
+)
+{
+    Http_Source_t *source = NULL;
+    uint8_t *data = NULL;
+    size_t received;
+    int index;
+    char msg[PATH_MAX + 64];
+
+    if (!HTTPS_SUPPORTED && strncasecmp (url, "https://", 8) == 0)
+    {
+        snprintf (msg, sizeof (msg), "https:// URLs need dswe built with"
+                  " ENABLE_TLS=yes, this build only reads http:// URLs (%s)",
+                  url);
+        RETURN_ERROR (msg, MODULE_NAME, NULL);
+    }
+
+    source = calloc (1, sizeof (Http_Source_t));
+    if (source == NULL)
+    {
+        RETURN_ERROR ("Error allocating memory for a remote file",
+                      MODULE_NAME, NULL);
+    }
+    for (index = 0; index < HTTP_CONNECTIONS; index++)
+        source->connections[index].fd = -1;
+
+    source->url = strdup (url);
+    if (source->url == NULL || parse_http_url (source) != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Invalid HTTP URL (%s)", url);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        close_http_source (source);
+        return NULL;
+    }
+
+    if (cache_dir != NULL)
+    {
+        source->cache_dir = strdup (cache_dir);
+        if (source->cache_dir == NULL)
+        {
+            ERROR_MESSAGE ("Error allocating memory for a remote file",
+                           MODULE_NAME);
+            close_http_source (source);
+            return NULL;
+        }
+    }
+
+    source->blocks = calloc (HTTP_CACHE_BLOCKS, sizeof (Http_Block_t));
+    data = malloc (HTTP_BLOCK_SIZE);
+    if (source->blocks == NULL || data == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for a remote file",
+                       MODULE_NAME);
+        free (data);
+        close_http_source (source);
+        return NULL;
+    }
+    for (index = 0; index < HTTP_CACHE_BLOCKS; index++)
+        source->blocks[index].index = -1;
+
+    if (request_range (source, &source->connections[0], 0, HTTP_BLOCK_SIZE,
+                       data, &received) != SUCCESS
+        || source->size == 0 || received != block_size (source, 0))
+    {
+        snprintf (msg, sizeof (msg), "Failed fetching (%s)", url);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        free (data);
+        close_http_source (source);
+        return NULL;
+    }
+
+    source->cache_key = hash_cache_key (source);
+    cache_block (source, 0, data);
+    store_cached_block (source, 0, data);
+    free (data);
+
+    return source;
+}
+
+
+/*****************************************************************************
+  NAME:  download_http_file
+
+  PURPOSE:  Copy a whole remote file, such as the XML of remote bands, to a
+            local file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The file was copied.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+download_http_file
+(
+    const char *url,          /* I: http:// or https:// URL of the file */
+    const char *filename      /* I: local file to write */
+)
+{
+    Http_Source_t *source;
+    uint8_t *data;
+    uint64_t offset;
+    size_t size;
+    FILE *fd;
+    int status = SUCCESS;
+    char msg[PATH_MAX + 64];
+
+    /* open_http_source reports its own errors */
+    source = open_http_source (url, NULL);
+    if (source == NULL)
+        return ERROR;
+
+    data = malloc (HTTP_BLOCK_SIZE);
+    fd = fopen (filename, "wb");
+    if (data == NULL || fd == NULL)
+    {
+        free (data);
+        if (fd != NULL)
+            fclose (fd);
+        close_http_source (source);
+        snprintf (msg, sizeof (msg), "Failed creating (%s)", filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    for (offset = 0; offset < source->size && status == SUCCESS;
+         offset += size)
+    {
+        size = (source->size - offset < HTTP_BLOCK_SIZE)
+               ? source->size - offset : HTTP_BLOCK_SIZE;
+        if (read_http_source (source, data, size, offset) != SUCCESS
+            || fwrite (data, 1, size, fd) != size)
+        {
+            status = ERROR;
+        }
+    }
+    if (fclose (fd) != 0)
+        status = ERROR;
+
+    free (data);
+    close_http_source (source);
+
+    if (status != SUCCESS)
+    {
+        unlink (filename);
+        snprintf (msg, sizeof (msg), "Failed downloading (%s) to (%s)",
+                  url, filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  close_http_source
+
+  PURPOSE:  Close the connections of a remote file and free its blocks.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_http_source
+(
+    Http_Source_t *source     /* I: file from open_http_source */
+)
+{
+    int index;
+
+    if (source == NULL)
+        return;
+
+    for (index = 0; index < HTTP_CONNECTIONS; index++)
+        close_connection (&source->connections[index]);
+
+    if (source->blocks != NULL)
+    {
+        for (index = 0; index < HTTP_CACHE_BLOCKS; index++)
+            free (source->blocks[index].data);
+    }
+
+    free (source->blocks);
+    free (source->cache_dir);
+    free (source->url);
+    free (source->host);
+    free (source->port);
+    free (source->path);
+    free (source);
+}
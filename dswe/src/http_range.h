@@ -0,0 +1,145 @@
+
+#ifndef HTTP_RANGE_H
+#define HTTP_RANGE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+/* Bytes of a remote file fetched and cached together */
+#define HTTP_BLOCK_SIZE (64 * 1024)
+
+/* Blocks of each remote file held in memory */
+#define HTTP_CACHE_BLOCKS 128
+
+/* Most blocks not asked for fetched to join two runs of blocks into one
+   request */
+#define HTTP_COALESCE_GAP_BLOCKS 4
+
+/* Most blocks fetched by one request */
+#define HTTP_MAX_RUN_BLOCKS 64
+
+/* Requests of a remote file in flight at once, each on its own
+   connection */
+#define HTTP_CONNECTIONS 4
+
+/* Bytes of a response held while parsing its headers */
+#define HTTP_BUFFER_SIZE 8192
+
+/* Whether https:// URLs can be read, which needs a build with
+   ENABLE_TLS=yes and the OpenSSL library */
+#ifdef ENABLE_TLS
+#define HTTPS_SUPPORTED true
+#else
+#define HTTPS_SUPPORTED false
+#endif
+
+
+/* Structure for a connection to the server of a remote file, kept open
+   between requests */
+typedef struct
+{
+    int fd;                   /* Socket, -1 when not connected */
+    void *tls;                /* TLS session on the socket of an https
+                                 connection, NULL for http */
+    char buffer[HTTP_BUFFER_SIZE]; /* Received bytes not yet used */
+    size_t start;             /* First unused byte in the buffer */
+    size_t end;               /* End of the received bytes in the buffer */
+} Http_Connection_t;
+
+
+/* Structure for a block of a remote file held in memory */
+typedef struct
+{
+    int64_t index;            /* Block index in the file, -1 when unused */
+    uint64_t last_use;        /* Use count when the block was last used */
+    size_t size;              /* Bytes of the block, less than
+                                 HTTP_BLOCK_SIZE at the end of the file */
+    uint8_t *data;            /* HTTP_BLOCK_SIZE bytes */
+} Http_Block_t;
+
+
+/* Structure for a byte range of a remote file */
+typedef struct
+{
+    uint64_t offset;          /* Offset of the first byte */
+    size_t size;              /* Number of bytes */
+} Http_Range_t;
+
+
+/* Structure for a file read from an HTTP server with range requests */
+typedef struct
+{
+    char *url;                /* URL of the file, for messages */
+    bool secure;              /* The URL is https:// */
+    char *host;               /* Host of the server, as in the URL */
+    char *port;               /* Port of the server */
+    char *path;               /* Path of the file on the server */
+    uint64_t size;            /* Bytes of the file */
+    char etag[128];           /* Entity tag of the file, empty for none */
+    bool ranges_ignored;      /* The server answers range requests with the
+                                 whole file */
+    char *cache_dir;          /* Directory of the block cache on disk, NULL
+                                 for none */
+    uint64_t cache_key;       /* Hash of the URL, size and entity tag naming
+                                 the cached blocks */
+    Http_Block_t *blocks;     /* Most recently used blocks */
+    uint64_t use_count;       /* Block uses so far, for the recency */
+    Http_Connection_t connections[HTTP_CONNECTIONS]; /* Connections to the
+                                 server, one per request in flight */
+} Http_Source_t;
+
+
+bool
+is_http_url
+(
+    const char *name          /* I: file name or URL */
+);
+
+
+Http_Source_t *
+open_http_source
+(
+    const char *url,          /* I: http:// or https:// URL of the file */
+    const char *cache_dir     /* I: directory of the block cache on disk,
+                                    NULL for none */
+);
+
+
+int
+prefetch_http_ranges
+(
+    Http_Source_t *source,    /* IO: file from open_http_source */
+    const Http_Range_t *ranges, /* I: byte ranges about to be read */
+    int range_count           /* I: number of ranges */
+);
+
+
+int
+read_http_source
+(
+    Http_Source_t *source,    /* IO: file from open_http_source */
+    void *buffer,             /* O: memory for size bytes */
+    size_t size,              /* I: number of bytes to read */
+    uint64_t offset           /* I: offset of the bytes in the file */
+);
+
+
+int
+download_http_file
+(
+    const char *url,          /* I: http:// or https:// URL of the file */
+    const char *filename      /* I: local file to write */
+);
+
+
+void
+close_http_source
+(
+    Http_Source_t *source     /* I: file from open_http_source */
+);
+
+
+#endif /* HTTP_RANGE_H */
@@ -1,10 +1,120 @@
 
 #include <stdio.h>
+#include <errno.h>
 #include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "dswe.h"
 #include "utilities.h"
 #include "input.h"
+#include "dem_grid.h"
+
+
+/*****************************************************************************
+  NAME:  open_direct_band
+
+  PURPOSE:  Reopen the file of a band with O_DIRECT, for the direct I/O
+            backend.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. Where the file system has no O_DIRECT the band is read through the
+       page cache, dropping the pages after each read.
+*****************************************************************************/
+static void
+open_direct_band
+(
+    Input_Data_t *input_data, /* IO: input data record */
+    Input_Bands_e band_index  /* I: band opened in band_fd */
+)
+{
+    if (input_data->io_backend != IO_BACKEND_DIRECT
+        || input_data->band_fd[band_index] == NULL)
+    {
+        return;
+    }
+
+    input_data->band_direct_fd[band_index] =
+        open_direct_fd (fileno (input_data->band_fd[band_index]));
+}
+
+
+/*****************************************************************************
+  NAME:  open_remote_band
+
+  PURPOSE:  Open a band read from an HTTP server.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The URL of a band named by its file in the XML is that file in the
+       remote bands directory.
+*****************************************************************************/
+static void
+open_remote_band
+(
+    const char *filename,     /* I: input filename or URL */
+    Input_Data_t *input_data, /* IO: updated with the opened band */
+    Input_Bands_e band_index  /* I: index to place the band into */
+)
+{
+    char url[PATH_MAX];
+    const char *name;
+    const char *separator;
+    size_t base_length;
+    size_t name_length;
+    int count;
+    char msg[PATH_MAX + 64];
+
+    if (is_http_url (filename))
+        count = snprintf (url, sizeof (url), "%s", filename);
+    else
+    {
+        name = strrchr (filename, '/');
+        name = (name != NULL) ? name + 1 : filename;
+        name_length = strlen (name);
+        base_length = strlen (input_data->remote_bands);
+        separator = (base_length > 0
+                     && input_data->remote_bands[base_length - 1] == '/')
+                    ? "" : "/";
+
+        /* The TIFF suffix replaces the .img suffix */
+        if (name_length > 4 && strcmp (&name[name_length - 4], ".img") == 0)
+        {
+            count = snprintf (url, sizeof (url), "%s%s%.*s.tif",
+                              input_data->remote_bands, separator,
+                              (int) (name_length - 4), name);
+        }
+        else
+        {
+            count = snprintf (url, sizeof (url), "%s%s%s",
+                              input_data->remote_bands, separator, name);
+        }
+    }
+    if (count < 0 || count >= sizeof (url) || !is_tiff_band_file (url))
+    {
+        snprintf (msg, sizeof (msg), "Remote bands have to be tiled TIFF"
+                  " files (%s)", filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        return;
+    }
+
+    free (input_data->band_name[band_index]);
+    input_data->band_name[band_index] = strdup (url);
+    if (input_data->band_name[band_index] == NULL)
+        return;
+
+    /* open_tiff_band reports its own errors */
+    input_data->band_tiff[band_index] =
+        open_tiff_band (url, input_data->remote_cache_dir);
+}
 
 
 /*****************************************************************************
@@ -13,6 +123,24 @@
   PURPOSE:  Open the specified file and allocate the memory for the filename.
 
   RETURN VALUE:  None
+
+  NOTES:
+    1. A band kept compressed is opened as a decompressing stream.  That is
+       either a .gz or .xz file named in the XML, or the .gz or .xz file next
+       to a missing .img file named in the XML.
+    2. A band kept as a tiled TIFF, such as a Cloud Optimized GeoTIFF, is
+       opened for decoding its tiles.  That is either a .tif file named in
+       the XML, or the .tif file replacing a missing .img file named in the
+       XML.
+    3. A band in the tar archive is read from the archive in place: the
+       archive file is opened at the band when it is not compressed, and
+       decompressed as a stream up to the band when it is.  Bands that are
+       not in the archive, such as the elevation band, are opened from
+       disk.
+    4. A band named by an http(s):// URL in the XML, or any band when the
+       remote bands directory is given, is read from the server with range
+       requests.  Remote bands are tiled TIFF files, so the .tif file
+       replaces a .img file named in the XML.
 *****************************************************************************/
 void
 open_band
@@ -22,11 +150,87 @@ open_band
     Input_Bands_e band_index  /* I: index to place the band into */
 )
 {
+    static const char *stored_suffixes[] = {".gz", ".xz", ".tif"};
+    char stored_name[PATH_MAX];
+    size_t name_length;
+    const Tar_Member_t *member = NULL;
+    int index;
     char msg[256];
 
     /* Grab the name from the input */
     input_data->band_name[band_index] = strdup (filename);
 
+    if (is_http_url (filename) || input_data->remote_bands != NULL)
+    {
+        open_remote_band (filename, input_data, band_index);
+        return;
+    }
+
+    if (input_data->archive != NULL)
+        member = find_tar_member (input_data->archive, filename);
+    if (member != NULL)
+    {
+        input_data->band_offset[band_index] = member->offset;
+        if (input_data->archive->compressed)
+        {
+            /* open_band_stream reports its own errors */
+            input_data->band_stream[band_index] =
+                open_band_stream (input_data->archive->filename,
+                                  member->offset);
+            input_data->band_offset[band_index] = 0;
+        }
+        else
+        {
+            input_data->band_fd[band_index] =
+                open_tar_member (input_data->archive, member);
+            open_direct_band (input_data, band_index);
+        }
+        return;
+    }
+
+    /* Look for the band stored compressed or tiled when the image is not
+       there */
+    name_length = strlen (filename);
+    if (find_band_compression (filename) == BAND_COMPRESSION_NONE
+        && !is_tiff_band_file (filename) && access (filename, F_OK) != 0)
+    {
+        for (index = 0; index < 3; index++)
+        {
+            /* The TIFF suffix replaces the .img suffix */
+            if (index == 2 && name_length > 4
+                && strcmp (&filename[name_length - 4], ".img") == 0)
+            {
+                name_length -= 4;
+            }
+
+            snprintf (stored_name, sizeof (stored_name), "%.*s%s",
+                      (int) name_length, filename, stored_suffixes[index]);
+            if (access (stored_name, F_OK) == 0)
+            {
+                free (input_data->band_name[band_index]);
+                input_data->band_name[band_index] = strdup (stored_name);
+                break;
+            }
+        }
+    }
+
+    if (is_tiff_band_file (input_data->band_name[band_index]))
+    {
+        /* open_tiff_band reports its own errors */
+        input_data->band_tiff[band_index] =
+            open_tiff_band (input_data->band_name[band_index], NULL);
+        return;
+    }
+
+    if (find_band_compression (input_data->band_name[band_index])
+        != BAND_COMPRESSION_NONE)
+    {
+        /* open_band_stream reports its own errors */
+        input_data->band_stream[band_index] =
+            open_band_stream (input_data->band_name[band_index], 0);
+        return;
+    }
+
     /* Open a file descriptor for the band */
     input_data->band_fd[band_index] =
         fopen (input_data->band_name[band_index], "rb");
@@ -37,6 +241,7 @@ open_band
                   input_data->band_name[band_index]);
         ERROR_MESSAGE (msg, MODULE_NAME);
     }
+    open_direct_band (input_data, band_index);
 }
 
 
@@ -62,6 +267,7 @@ GetXMLInput
 {
     int index;
     char msg[256];
+    Dem_Tile_Store_t *store;
 
     char product_name[30];
     char blue_band_name[30];
@@ -140,27 +346,34 @@ GetXMLInput
                 open_band (metadata->band[index].file_name, input_data,
                            I_BAND_BLUE);
 
-                if (metadata->band[index].data_type != ESPA_INT16)
+                if (metadata->band[index].data_type != ESPA_INT16
+                    && metadata->band[index].data_type != ESPA_UINT16)
                 {
                     snprintf (msg, sizeof (msg),
-                              "%s incompatible data type expecting INT16",
-                              blue_band_name);
+                              "%s incompatible data type expecting INT16"
+                              " or UINT16", blue_band_name);
                     RETURN_ERROR(msg, MODULE_NAME, ERROR);
                 }
+                input_data->data_type[I_BAND_BLUE] =
+                    metadata->band[index].data_type;
 
                 /* Always use this one for the lines and samples since
                    they will be the same for us, along with the pixel
                    size values */
                 input_data->lines = metadata->band[index].nlines;
                 input_data->samples = metadata->band[index].nsamps;
+                input_data->band_lines = input_data->lines;
+                input_data->band_samples = input_data->samples;
                 input_data->x_pixel_size =
                     metadata->band[index].pixel_size[0];
                 input_data->y_pixel_size =
                     metadata->band[index].pixel_size[1];
 
-                /* Grab the scale factor for this band */
+                /* Grab the scale factor and offset for this band */
                 input_data->scale_factor[I_BAND_BLUE] =
                     metadata->band[index].scale_factor;
+                input_data->add_offset[I_BAND_BLUE] =
+                    metadata->band[index].add_offset;
 
                 /* Grab the fill value for this band */
                 input_data->fill_value[I_BAND_BLUE] =
@@ -171,17 +384,22 @@ GetXMLInput
                 open_band (metadata->band[index].file_name, input_data,
                            I_BAND_GREEN);
 
-                if (metadata->band[index].data_type != ESPA_INT16)
+                if (metadata->band[index].data_type != ESPA_INT16
+                    && metadata->band[index].data_type != ESPA_UINT16)
                 {
                     snprintf (msg, sizeof (msg),
-                              "%s incompatible data type expecting INT16",
-                              green_band_name);
+                              "%s incompatible data type expecting INT16"
+                              " or UINT16", green_band_name);
                     RETURN_ERROR(msg, MODULE_NAME, ERROR);
                 }
+                input_data->data_type[I_BAND_GREEN] =
+                    metadata->band[index].data_type;
 
-                /* Grab the scale factor for this band */
+                /* Grab the scale factor and offset for this band */
                 input_data->scale_factor[I_BAND_GREEN] =
                     metadata->band[index].scale_factor;
+                input_data->add_offset[I_BAND_GREEN] =
+                    metadata->band[index].add_offset;
 
                 /* Grab the fill value for this band */
                 input_data->fill_value[I_BAND_GREEN] =
@@ -192,17 +410,22 @@ GetXMLInput
                 open_band (metadata->band[index].file_name, input_data,
                            I_BAND_RED);
 
-                if (metadata->band[index].data_type != ESPA_INT16)
+                if (metadata->band[index].data_type != ESPA_INT16
+                    && metadata->band[index].data_type != ESPA_UINT16)
                 {
                     snprintf (msg, sizeof (msg),
-                              "%s incompatible data type expecting INT16",
-                              red_band_name);
+                              "%s incompatible data type expecting INT16"
+                              " or UINT16", red_band_name);
                     RETURN_ERROR(msg, MODULE_NAME, ERROR);
                 }
+                input_data->data_type[I_BAND_RED] =
+                    metadata->band[index].data_type;
 
-                /* Grab the scale factor for this band */
+                /* Grab the scale factor and offset for this band */
                 input_data->scale_factor[I_BAND_RED] =
                     metadata->band[index].scale_factor;
+                input_data->add_offset[I_BAND_RED] =
+                    metadata->band[index].add_offset;
 
                 /* Grab the fill value for this band */
                 input_data->fill_value[I_BAND_RED] =
@@ -213,17 +436,22 @@ GetXMLInput
                 open_band (metadata->band[index].file_name, input_data,
                            I_BAND_NIR);
 
-                if (metadata->band[index].data_type != ESPA_INT16)
+                if (metadata->band[index].data_type != ESPA_INT16
+                    && metadata->band[index].data_type != ESPA_UINT16)
                 {
                     snprintf (msg, sizeof (msg),
-                              "%s incompatible data type expecting INT16",
-                              nir_band_name);
+                              "%s incompatible data type expecting INT16"
+                              " or UINT16", nir_band_name);
                     RETURN_ERROR(msg, MODULE_NAME, ERROR);
                 }
+                input_data->data_type[I_BAND_NIR] =
+                    metadata->band[index].data_type;
 
-                /* Grab the scale factor for this band */
+                /* Grab the scale factor and offset for this band */
                 input_data->scale_factor[I_BAND_NIR] =
                     metadata->band[index].scale_factor;
+                input_data->add_offset[I_BAND_NIR] =
+                    metadata->band[index].add_offset;
 
                 /* Grab the fill value for this band */
                 input_data->fill_value[I_BAND_NIR] =
@@ -234,17 +462,22 @@ GetXMLInput
                 open_band (metadata->band[index].file_name, input_data,
                            I_BAND_SWIR1);
 
-                if (metadata->band[index].data_type != ESPA_INT16)
+                if (metadata->band[index].data_type != ESPA_INT16
+                    && metadata->band[index].data_type != ESPA_UINT16)
                 {
                     snprintf (msg, sizeof (msg),
-                              "%s incompatible data type expecting INT16",
-                              swir1_band_name);
+                              "%s incompatible data type expecting INT16"
+                              " or UINT16", swir1_band_name);
                     RETURN_ERROR(msg, MODULE_NAME, ERROR);
                 }
+                input_data->data_type[I_BAND_SWIR1] =
+                    metadata->band[index].data_type;
 
-                /* Grab the scale factor for this band */
+                /* Grab the scale factor and offset for this band */
                 input_data->scale_factor[I_BAND_SWIR1] =
                     metadata->band[index].scale_factor;
+                input_data->add_offset[I_BAND_SWIR1] =
+                    metadata->band[index].add_offset;
 
                 /* Grab the fill value for this band */
                 input_data->fill_value[I_BAND_SWIR1] =
@@ -255,17 +488,22 @@ GetXMLInput
                 open_band (metadata->band[index].file_name, input_data,
                            I_BAND_SWIR2);
 
-                if (metadata->band[index].data_type != ESPA_INT16)
+                if (metadata->band[index].data_type != ESPA_INT16
+                    && metadata->band[index].data_type != ESPA_UINT16)
                 {
                     snprintf (msg, sizeof (msg),
-                              "%s incompatible data type expecting INT16",
-                              swir2_band_name);
+                              "%s incompatible data type expecting INT16"
+                              " or UINT16", swir2_band_name);
                     RETURN_ERROR(msg, MODULE_NAME, ERROR);
                 }
+                input_data->data_type[I_BAND_SWIR2] =
+                    metadata->band[index].data_type;
 
-                /* Grab the scale factor for this band */
+                /* Grab the scale factor and offset for this band */
                 input_data->scale_factor[I_BAND_SWIR2] =
                     metadata->band[index].scale_factor;
+                input_data->add_offset[I_BAND_SWIR2] =
+                    metadata->band[index].add_offset;
 
                 /* Grab the fill value for this band */
                 input_data->fill_value[I_BAND_SWIR2] =
@@ -297,8 +535,10 @@ GetXMLInput
             }
         }
 
-        /* Search for the elevation band */
-        if (!strcmp (metadata->band[index].product, "elevation"))
+        /* Search for the elevation band, unless it comes from a DEM tile
+           store */
+        if (input_data->dem_store == NULL
+            && !strcmp (metadata->band[index].product, "elevation"))
         {
             if (!strcmp (metadata->band[index].name, "elevation"))
             {
@@ -311,6 +551,24 @@ GetXMLInput
                                  " INT16", MODULE_NAME, ERROR);
                 }
 
+                /* The elevation grid can differ from the reflectance grid,
+                   the terrain products are computed on its own grid */
+                input_data->dem_scene_lines = metadata->band[index].nlines;
+                input_data->dem_scene_samples =
+                    metadata->band[index].nsamps;
+                input_data->dem_lines = input_data->dem_scene_lines;
+                input_data->dem_samples = input_data->dem_scene_samples;
+                input_data->dem_x_pixel_size =
+                    metadata->band[index].pixel_size[0];
+                input_data->dem_y_pixel_size =
+                    metadata->band[index].pixel_size[1];
+
+                /* Global DEM mosaics are kept in geographic coordinates,
+                   the terrain products convert to meters per line */
+                input_data->dem_geographic =
+                    (strcmp (metadata->band[index].pixel_units, "degrees")
+                     == 0);
+
                 /* Default to a no-op since elevation doesn't have a scale
                    factor */
                 input_data->scale_factor[I_BAND_ELEVATION] = 1.0;
@@ -343,7 +601,12 @@ GetXMLInput
     /* Verify all the bands have something (all are required for DSWE) */
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
-        if (input_data->band_fd[index] == NULL ||
+        if (index == I_BAND_ELEVATION && input_data->dem_store != NULL)
+            continue;
+
+        if ((input_data->band_fd[index] == NULL
+             && input_data->band_stream[index] == NULL
+             && input_data->band_tiff[index] == NULL) ||
             input_data->band_name[index] == NULL)
         {
             ERROR_MESSAGE ("Error opening required input data", MODULE_NAME);
@@ -353,6 +616,142 @@ GetXMLInput
         }
     }
 
+    /* The classification converts its thresholds into the units of the
+       Collection 2 reflectance, so the bands have to share their scaling */
+    for (index = I_BAND_GREEN; index <= I_BAND_SWIR2; index++)
+    {
+        if (input_data->data_type[index] != input_data->data_type[I_BAND_BLUE]
+            || (input_data->data_type[index] == ESPA_UINT16
+                && (input_data->scale_factor[index]
+                    != input_data->scale_factor[I_BAND_BLUE]
+                    || input_data->add_offset[index]
+                       != input_data->add_offset[I_BAND_BLUE])))
+        {
+            snprintf (msg, sizeof (msg), "Data type or scaling of (%s) does"
+                      " not match the other reflectance bands",
+                      input_data->band_name[index]);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+
+            close_input (input_data);
+            return ERROR;
+        }
+    }
+
+    /* A tiled band has its size in the file, which has to match the XML.
+       Its missing tiles are fill. */
+    for (index = 0; index < MAX_INPUT_BANDS; index++)
+    {
+        if (input_data->band_tiff[index] == NULL)
+            continue;
+
+        if ((index == I_BAND_ELEVATION
+             && (input_data->band_tiff[index]->lines
+                    != input_data->dem_scene_lines
+                 || input_data->band_tiff[index]->samples
+                    != input_data->dem_scene_samples))
+            || (index != I_BAND_ELEVATION
+                && (input_data->band_tiff[index]->lines
+                    != input_data->band_lines
+                    || input_data->band_tiff[index]->samples
+                       != input_data->band_samples)))
+        {
+            snprintf (msg, sizeof (msg), "Size of (%s) does not match the"
+                      " XML", input_data->band_name[index]);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+
+            close_input (input_data);
+            return ERROR;
+        }
+
+        if (index != I_BAND_ELEVATION)
+        {
+            input_data->band_tiff[index]->missing_value =
+                input_data->fill_value[index];
+        }
+    }
+
+    /* The upper left corner of the reflectance grid, which the elevation
+       grid shares */
+    input_data->ul_x = metadata->global.proj_info.ul_corner[0];
+    input_data->ul_y = metadata->global.proj_info.ul_corner[1];
+    if (strcmp (metadata->global.proj_info.grid_origin, "CENTER") == 0)
+    {
+        input_data->ul_x -= 0.5 * input_data->x_pixel_size;
+        input_data->ul_y += 0.5 * input_data->y_pixel_size;
+    }
+
+    /* The elevation band from a DEM tile store is on the grid of the store,
+       covering the reflectance extent plus the halo */
+    if (input_data->dem_store != NULL)
+    {
+        store = input_data->dem_store;
+        if (store->proj_type != metadata->global.proj_info.proj_type
+            || (store->proj_type == GCTP_UTM_PROJ
+                && store->zone != metadata->global.proj_info.utm_zone))
+        {
+            ERROR_MESSAGE ("DEM tile store projection does not match the"
+                           " reflectance bands", MODULE_NAME);
+
+            close_input (input_data);
+            return ERROR;
+        }
+
+        input_data->dem_x_pixel_size = store->x_pixel_size;
+        input_data->dem_y_pixel_size = store->y_pixel_size;
+        input_data->dem_scene_samples = (int) ceil (input_data->samples
+                                                    * input_data->x_pixel_size
+                                                    / store->x_pixel_size
+                                                    - 1e-6);
+        input_data->dem_scene_lines = (int) ceil (input_data->lines
+                                                  * input_data->y_pixel_size
+                                                  / store->y_pixel_size
+                                                  - 1e-6);
+        input_data->dem_samples = input_data->dem_scene_samples
+                                  - 2 * input_data->dem_first_sample;
+        input_data->dem_lines = input_data->dem_scene_lines
+                                - 2 * input_data->dem_first_line;
+        input_data->dem_geographic = store->geographic;
+    }
+
+    /* The elevation band has to cover the same extent as the reflectance
+       bands, to within one of its pixels */
+    if (input_data->dem_x_pixel_size <= 0.0
+        || input_data->dem_y_pixel_size <= 0.0
+        || fabs (input_data->dem_scene_samples
+                 * input_data->dem_x_pixel_size
+                 - input_data->samples * input_data->x_pixel_size)
+           >= input_data->dem_x_pixel_size
+        || fabs (input_data->dem_scene_lines
+                 * input_data->dem_y_pixel_size
+                 - input_data->lines * input_data->y_pixel_size)
+           >= input_data->dem_y_pixel_size)
+    {
+        ERROR_MESSAGE ("Elevation band extent does not match the reflectance"
+                       " bands", MODULE_NAME);
+
+        close_input (input_data);
+        return ERROR;
+    }
+
+    /* A geographic elevation band shares the upper left corner of the
+       geographic reflectance grid, which gives its latitude */
+    if (input_data->dem_geographic)
+    {
+        if (metadata->global.proj_info.proj_type != GCTP_GEO_PROJ)
+        {
+            ERROR_MESSAGE ("Geographic (degree) elevation band requires"
+                           " geographic reflectance bands, reproject the"
+                           " elevation to the projection of the reflectance"
+                           " bands", MODULE_NAME);
+
+            close_input (input_data);
+            return ERROR;
+        }
+
+        input_data->dem_ul_latitude = input_data->ul_y
+            - input_data->dem_first_line * input_data->dem_y_pixel_size;
+    }
+
     return SUCCESS;
 }
 
@@ -373,7 +772,21 @@ Input_Data_t *
 open_input
 (
     Espa_internal_meta_t *metadata, /* I: input metadata */
-    bool use_toa_flag               /* I: use TOA or SR data */
+    bool use_toa_flag,              /* I: use TOA or SR data */
+    const Tar_Archive_t *archive,   /* I: archive to read the images from
+                                          when in it, NULL for none */
+    const char *remote_bands,       /* I: URL of the directory to read the
+                                          images from over HTTP, NULL for
+                                          local images */
+    const char *remote_cache_dir,   /* I: directory of the block cache of
+                                          the remote images, NULL for none */
+    Io_Backend_e io_backend,        /* I: how to read the image files */
+    char *dem_store_index,          /* I: index of a DEM tile store to
+                                          extract the elevation band from,
+                                          NULL to use the XML band */
+    int dem_store_halo              /* I: elevation pixels to extract
+                                          outside the reflectance extent on
+                                          each side */
 )
 {
     int index;
@@ -392,10 +805,48 @@ open_input
     {
         input_data->band_name[index] = NULL;
         input_data->band_fd[index] = NULL;
+        input_data->band_stream[index] = NULL;
+        input_data->band_tiff[index] = NULL;
+        input_data->band_offset[index] = 0;
+        input_data->band_direct_fd[index] = -1;
     }
+    input_data->archive = archive;
+    input_data->remote_bands = remote_bands;
+    input_data->remote_cache_dir = remote_cache_dir;
+    input_data->io_backend = io_backend;
 
     input_data->lines = 0;
     input_data->samples = 0;
+    input_data->window_line = 0;
+    input_data->window_sample = 0;
+    input_data->band_lines = 0;
+    input_data->band_samples = 0;
+    input_data->dem_lines = 0;
+    input_data->dem_samples = 0;
+    input_data->dem_first_line = 0;
+    input_data->dem_first_sample = 0;
+    input_data->dem_scene_lines = 0;
+    input_data->dem_scene_samples = 0;
+    input_data->dem_x_pixel_size = 0.0;
+    input_data->dem_y_pixel_size = 0.0;
+    input_data->dem_geographic = false;
+    input_data->dem_ul_latitude = 0.0;
+    input_data->dem_store = NULL;
+
+    /* The elevation band can be extracted from a DEM tile store instead of
+       being produced for the scene beforehand */
+    if (dem_store_index != NULL)
+    {
+        input_data->dem_store = open_dem_tile_store (dem_store_index);
+        if (input_data->dem_store == NULL)
+        {
+            /* error messages provided by open_dem_tile_store */
+            close_input (input_data);
+            return NULL;
+        }
+        input_data->dem_first_line = -dem_store_halo;
+        input_data->dem_first_sample = -dem_store_halo;
+    }
 
     /* Open the input images from the XML file */
     if (GetXMLInput (metadata, use_toa_flag, input_data)
@@ -405,11 +856,114 @@ open_input
         close_input (input_data);
         return NULL;
     }
+    input_data->archive = NULL;
+    input_data->remote_bands = NULL;
+    input_data->remote_cache_dir = NULL;
 
     return input_data;
 }
 
 
+/*****************************************************************************
+  NAME:  set_input_window
+
+  PURPOSE:  Restrict the processing to a window of the scene, so only the
+            pixels of the window and the elevation around it are read.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The window was set.
+      ERROR    The window is not inside the scene.
+
+  NOTES:
+    1. The elevation band is read over the elevation pixels the window maps
+       to, plus a halo of elevation_halo pixels on each side, so the terrain
+       products at the edges of the window have their real neighbors.  The
+       halo stops at the edges of an elevation band file, where the terrain
+       products of the whole scene are not processed either; a DEM tile
+       store supplies it beyond the scene.
+*****************************************************************************/
+int
+set_input_window
+(
+    Input_Data_t *input_data,       /* IO: input data record */
+    const Scene_Window_t *window,   /* I: window of the scene to process */
+    int elevation_halo              /* I: elevation pixels to keep around
+                                          the window on each side, -1 to
+                                          keep the whole elevation band */
+)
+{
+    int first;                      /* first elevation pixel kept */
+    int last;                       /* last elevation pixel kept */
+    char msg[256];
+
+    if (window->line < 0 || window->sample < 0 || window->lines <= 0
+        || window->samples <= 0
+        || window->lines > input_data->band_lines - window->line
+        || window->samples > input_data->band_samples - window->sample)
+    {
+        snprintf (msg, sizeof (msg), "Window %d,%d,%d,%d is not inside the"
+                  " %d lines and %d samples of the scene", window->line,
+                  window->sample, window->lines, window->samples,
+                  input_data->band_lines, input_data->band_samples);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    input_data->window_line = window->line;
+    input_data->window_sample = window->sample;
+    input_data->lines = window->lines;
+    input_data->samples = window->samples;
+
+    if (elevation_halo < 0)
+        return SUCCESS;
+
+    /* The elevation lines the window lines map to, with the halo */
+    first = dem_grid_cell (window->line, input_data->y_pixel_size,
+                           input_data->dem_y_pixel_size,
+                           input_data->dem_scene_lines) - elevation_halo;
+    last = dem_grid_cell (window->line + window->lines - 1,
+                          input_data->y_pixel_size,
+                          input_data->dem_y_pixel_size,
+                          input_data->dem_scene_lines) + elevation_halo;
+    if (input_data->dem_store == NULL)
+    {
+        if (first < 0)
+            first = 0;
+        if (last > input_data->dem_scene_lines - 1)
+            last = input_data->dem_scene_lines - 1;
+    }
+    input_data->dem_first_line = first;
+    input_data->dem_lines = last - first + 1;
+
+    /* The elevation samples the window samples map to, with the halo */
+    first = dem_grid_cell (window->sample, input_data->x_pixel_size,
+                           input_data->dem_x_pixel_size,
+                           input_data->dem_scene_samples) - elevation_halo;
+    last = dem_grid_cell (window->sample + window->samples - 1,
+                          input_data->x_pixel_size,
+                          input_data->dem_x_pixel_size,
+                          input_data->dem_scene_samples) + elevation_halo;
+    if (input_data->dem_store == NULL)
+    {
+        if (first < 0)
+            first = 0;
+        if (last > input_data->dem_scene_samples - 1)
+            last = input_data->dem_scene_samples - 1;
+    }
+    input_data->dem_first_sample = first;
+    input_data->dem_samples = last - first + 1;
+
+    if (input_data->dem_geographic)
+    {
+        input_data->dem_ul_latitude = input_data->ul_y
+            - input_data->dem_first_line * input_data->dem_y_pixel_size;
+    }
+
+    return SUCCESS;
+}
+
+
 /*****************************************************************************
   NAME:  close_input
 
@@ -436,8 +990,9 @@ close_input
     had_issue = false;
     for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
-        if (input_data->band_fd[index] == NULL &&
-            input_data->band_name[index] == NULL)
+        /* The elevation band is not opened when it comes from a DEM tile
+           store */
+        if (input_data->band_fd[index] != NULL)
         {
             status = fclose (input_data->band_fd[index]);
             if (status != 0)
@@ -449,16 +1004,33 @@ close_input
 
                 had_issue = true;
             }
-
-            free (input_data->band_name[index]);
         }
-        else
+
+        if (close_band_stream (input_data->band_stream[index]) != SUCCESS)
         {
-            fclose (input_data->band_fd[index]);
-            free (input_data->band_name[index]);
+            snprintf (msg, sizeof (msg), "Failed to close (%s)",
+                      input_data->band_name[index]);
+            WARNING_MESSAGE (msg, MODULE_NAME);
+
+            had_issue = true;
         }
+
+        close_tiff_band (input_data->band_tiff[index]);
+
+        if (input_data->band_direct_fd[index] >= 0)
+            close (input_data->band_direct_fd[index]);
+
+        free (input_data->band_name[index]);
+        input_data->band_fd[index] = NULL;
+        input_data->band_stream[index] = NULL;
+        input_data->band_tiff[index] = NULL;
+        input_data->band_direct_fd[index] = -1;
+        input_data->band_name[index] = NULL;
     }
 
+    close_dem_tile_store (input_data->dem_store);
+    input_data->dem_store = NULL;
+
     if (had_issue)
         return ERROR;
 
@@ -467,106 +1039,765 @@ close_input
 
 
 /*****************************************************************************
-  NAME: read_bands_into_memory
+  NAME:  input_bands_compressed
 
-  PURPOSE: To read the specified input band data into memory for later
-           processing.
+  PURPOSE:  Check whether any band is read from a compressed image file.
+
+  RETURN VALUE:  Type = bool
+      True when a band is compressed, so the bands can neither be mapped
+      nor read out of order.
+*****************************************************************************/
+bool
+input_bands_compressed
+(
+    const Input_Data_t *input_data /* I: input data record */
+)
+{
+    int index;
+
+    for (index = 0; index < MAX_INPUT_BANDS; index++)
+    {
+        if (input_data->band_stream[index] != NULL)
+            return true;
+    }
+
+    return false;
+}
+
+
+/*****************************************************************************
+  NAME:  input_bands_raw
+
+  PURPOSE:  Check whether all the bands are read from raw binary files.
 
   RETURN VALUE:  Type = bool
+      True when no band is compressed, tiled or in a tar archive, so the
+      bands can be mapped.
+*****************************************************************************/
+bool
+input_bands_raw
+(
+    const Input_Data_t *input_data /* I: input data record */
+)
+{
+    int index;
+
+    for (index = 0; index < MAX_INPUT_BANDS; index++)
+    {
+        if (input_data->band_stream[index] != NULL
+            || input_data->band_tiff[index] != NULL
+            || input_data->band_offset[index] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  find_band_reader
+
+  PURPOSE:  Look up a band reader by its name on the command line.
+
+  RETURN VALUE:  Type = Band_Reader_e
       Value    Description
       -------  ---------------------------------------------------------------
-      true     Success with reading all of the bands into memory.
-      false    Failed to read a band into memory.
+      -1       No band reader has the name.
+      *        The band reader.
 *****************************************************************************/
-int
-read_bands_into_memory
+Band_Reader_e
+find_band_reader
 (
-    Input_Data_t *input_data,
-    int16_t *band_blue,
-    int16_t *band_green,
-    int16_t *band_red,
-    int16_t *band_nir,
-    int16_t *band_swir1,
-    int16_t *band_swir2,
-    int16_t *band_elevation,
-    uint16_t *band_pixelqa,
-    int pixel_count
+    const char *name          /* I: name of the band reader */
 )
 {
-    int count;
+    if (strcmp (name, "read") == 0)
+        return BAND_READER_READ;
+    if (strcmp (name, "mmap") == 0)
+        return BAND_READER_MMAP;
+    if (strcmp (name, "mmap_populate") == 0)
+        return BAND_READER_MMAP_POPULATE;
+
+    return (Band_Reader_e) -1;
+}
+
+
+/*****************************************************************************
+  NAME:  pread_band_run
+
+  PURPOSE:  Read a run of pixels of a band at their offset in the band file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The pixels were read.
+      ERROR    The file ended or could not be read.
+
+  NOTES:
+    1. The I/O backend reads at an offset without using the file position,
+       so different runs of a band can be read without seeking and from any
+       thread.
+    2. A compressed band is decompressed instead, which only goes forward
+       through the band.  A tiled band is decoded from its tiles.
+*****************************************************************************/
+static int
+pread_band_run
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read */
+    off_t first_pixel,        /* I: first pixel to read, counted along the
+                                    lines of the band file */
+    size_t pixel_count,       /* I: number of pixels to read */
+    void *band                /* O: memory for pixel_count 16 bit values */
+)
+{
+    size_t remaining = pixel_count * sizeof (int16_t);
+    off_t offset = first_pixel * (off_t) sizeof (int16_t);
+
+    if (input_data->band_stream[band_index] != NULL)
+    {
+        return read_band_stream (input_data->band_stream[band_index], offset,
+                                 remaining, band);
+    }
 
-    count = fread (band_blue, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_BLUE]);
-    if (count != pixel_count)
+    if (input_data->band_tiff[band_index] != NULL)
     {
-        ERROR_MESSAGE ("Failed reading blue band data", MODULE_NAME);
+        return read_tiff_band (input_data->band_tiff[band_index],
+                               first_pixel, pixel_count, band);
+    }
 
-        return ERROR;
+    return read_io_range (input_data->io_backend,
+                          fileno (input_data->band_fd[band_index]),
+                          input_data->band_direct_fd[band_index],
+                          offset + input_data->band_offset[band_index],
+                          remaining, band);
+}
+
+
+/*****************************************************************************
+  NAME:  read_band_window
+
+  PURPOSE:  Read a run of pixels of a window of a band file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The pixels were read.
+      ERROR    The file ended or could not be read.
+
+  NOTES:
+    1. A window of whole lines of the file is one run of the file, otherwise
+       the part of each line in the window is read as its own run, so only
+       the pixels of the window are read.
+*****************************************************************************/
+static int
+read_band_window
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read */
+    int file_samples,         /* I: samples of the band file */
+    int window_line,          /* I: line of the file at the first line of
+                                    the window */
+    int window_sample,        /* I: sample of the file at the first sample
+                                    of the window */
+    int window_samples,       /* I: samples of the window */
+    off_t first_pixel,        /* I: first pixel to read, counted along the
+                                    lines of the window */
+    size_t pixel_count,       /* I: number of pixels to read */
+    void *band                /* O: memory for pixel_count 16 bit values */
+)
+{
+    int16_t *next = band;     /* memory for the next run */
+    off_t line;               /* line of the window of the next run */
+    int sample;               /* sample of the window of the next run */
+    size_t count;             /* pixels in the next run */
+
+    if (window_sample == 0 && window_samples == file_samples)
+    {
+        return pread_band_run (input_data, band_index,
+                               (off_t) window_line * file_samples
+                               + first_pixel, pixel_count, band);
     }
 
-    count = fread (band_green, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_GREEN]);
-    if (count != pixel_count)
+    while (pixel_count > 0)
     {
-        ERROR_MESSAGE ("Failed reading green band data", MODULE_NAME);
+        line = first_pixel / window_samples;
+        sample = first_pixel % window_samples;
+        count = window_samples - sample;
+        if (count > pixel_count)
+            count = pixel_count;
+
+        if (pread_band_run (input_data, band_index,
+                            (window_line + line) * file_samples
+                            + window_sample + sample, count, next)
+            != SUCCESS)
+        {
+            return ERROR;
+        }
 
-        return ERROR;
+        next += count;
+        first_pixel += count;
+        pixel_count -= count;
     }
 
-    count = fread (band_red, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_RED]);
-    if (count != pixel_count)
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  pread_band
+
+  PURPOSE:  Read a run of pixels of a reflectance or QA band, in the window
+            of the scene being processed.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The pixels were read.
+      ERROR    The file ended or could not be read.
+*****************************************************************************/
+static int
+pread_band
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read, not the elevation band */
+    off_t first_pixel,        /* I: first pixel to read */
+    size_t pixel_count,       /* I: number of pixels to read */
+    void *band                /* O: memory for pixel_count 16 bit values */
+)
+{
+    return read_band_window (input_data, band_index,
+                             input_data->band_samples,
+                             input_data->window_line,
+                             input_data->window_sample, input_data->samples,
+                             first_pixel, pixel_count, band);
+}
+
+
+/*****************************************************************************
+  NAME:  read_input_band
+
+  PURPOSE:  Bring one band into memory, either reading it into the allocated
+            buffer or mapping its file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The band is in memory.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The mappings are private and read only, so the processing runs
+       directly on the page cache without a copy of the band.  The
+       classification walks the bands once from start to end, which
+       MADV_SEQUENTIAL tells the kernel to read ahead for.
+*****************************************************************************/
+static int
+read_input_band
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Band_Reader_e band_reader, /* I: how to bring the band into memory */
+    Input_Bands_e band_index, /* I: band to bring into memory */
+    const char *band_desc,    /* I: description of the band for messages */
+    size_t band_size,         /* I: size of the band in bytes */
+    void **band               /* IO: allocated memory when reading, the
+                                     mapping of the band when mapping */
+)
+{
+    FILE *band_fd = input_data->band_fd[band_index];
+    struct stat band_stat;
+    void *map;
+    int flags = MAP_PRIVATE;
+    char msg[256];
+
+    if (band_reader == BAND_READER_READ)
     {
-        ERROR_MESSAGE ("Failed reading red band data", MODULE_NAME);
+        if (pread_band (input_data, band_index, 0,
+                        band_size / sizeof (int16_t), *band) != SUCCESS)
+        {
+            snprintf (msg, sizeof (msg), "Failed reading %s band data",
+                      band_desc);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
 
-        return ERROR;
+        return SUCCESS;
     }
 
-    count = fread (band_nir, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_NIR]);
-    if (count != pixel_count)
+    if (input_data->band_fd[band_index] == NULL
+        || input_data->band_offset[band_index] != 0)
     {
-        ERROR_MESSAGE ("Failed reading nir band data", MODULE_NAME);
+        snprintf (msg, sizeof (msg), "Failed mapping %s band data, the file"
+                  " is not raw binary", band_desc);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
 
-        return ERROR;
+    /* The lines of a window are not together in the file */
+    if (input_data->lines != input_data->band_lines
+        || input_data->samples != input_data->band_samples)
+    {
+        snprintf (msg, sizeof (msg), "Failed mapping %s band data, only"
+                  " whole bands can be mapped", band_desc);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
     }
 
-    count = fread (band_swir1, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_SWIR1]);
-    if (count != pixel_count)
+    /* Mapping past the end of the file would fault on access */
+    if (fstat (fileno (band_fd), &band_stat) != 0
+        || (size_t) band_stat.st_size < band_size)
     {
-        ERROR_MESSAGE ("Failed reading swir1 band data", MODULE_NAME);
+        snprintf (msg, sizeof (msg), "Failed reading %s band data, the file"
+                  " is too small", band_desc);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
 
-        return ERROR;
+    if (band_reader == BAND_READER_MMAP_POPULATE)
+        flags |= MAP_POPULATE;
+
+    map = mmap (NULL, band_size, PROT_READ, flags, fileno (band_fd), 0);
+    if (map == MAP_FAILED)
+    {
+        snprintf (msg, sizeof (msg), "Failed mapping %s band data",
+                  band_desc);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
     }
+    madvise (map, band_size, MADV_SEQUENTIAL);
+
+    *band = map;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_elevation_band
 
-    count = fread (band_swir2, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_SWIR2]);
-    if (count != pixel_count)
+  PURPOSE:  Read the elevation band, from its file or from the DEM tile store.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The band was read.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+read_elevation_band
+(
+    Input_Data_t *input_data, /* I: input data record */
+    int16_t *band_elevation   /* O: pointer to allocated memory of
+                                    dem_lines * dem_samples values */
+)
+{
+    int dem_pixel_count;
+
+    /* The elevation band is on its own grid */
+    dem_pixel_count = input_data->dem_lines * input_data->dem_samples;
+    if (input_data->dem_store != NULL)
     {
-        ERROR_MESSAGE ("Failed reading swir2 band data", MODULE_NAME);
+        if (read_dem_tile_store (input_data->dem_store, input_data->ul_x,
+                                 input_data->ul_y, input_data->dem_lines,
+                                 input_data->dem_samples,
+                                 input_data->dem_first_line,
+                                 input_data->dem_first_sample,
+                                 band_elevation)
+            != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed extracting elevation band data from the"
+                           " DEM tile store", MODULE_NAME);
 
-        return ERROR;
+            return ERROR;
+        }
     }
+    else
+    {
+        /* Only the part of the file around the window is read */
+        if (read_band_window (input_data, I_BAND_ELEVATION,
+                              input_data->dem_scene_samples,
+                              input_data->dem_first_line,
+                              input_data->dem_first_sample,
+                              input_data->dem_samples, 0, dem_pixel_count,
+                              band_elevation) != SUCCESS)
+        {
+            ERROR_MESSAGE ("Failed reading elevation band data",
+                           MODULE_NAME);
+
+            return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
 
-    count = fread (band_elevation, sizeof (int16_t), pixel_count,
-                   input_data->band_fd[I_BAND_ELEVATION]);
-    if (count != pixel_count)
+
+/*****************************************************************************
+  NAME:  read_band_thread
+
+  PURPOSE:  Thread body doing one band read of start_band_reads.
+
+  RETURN VALUE:  Type = void *
+      Always NULL; the outcome is in the status of the read.
+*****************************************************************************/
+static void *
+read_band_thread
+(
+    void *arg                 /* IO: the Band_Read_t of the read */
+)
+{
+    Band_Read_t *read = arg;
+    struct timespec start_time;
+    struct timespec end_time;
+
+    clock_gettime (CLOCK_MONOTONIC, &start_time);
+
+    if (read->band_index == I_BAND_ELEVATION)
+        read->status = read_elevation_band (read->input_data, *read->band);
+    else
     {
-        ERROR_MESSAGE ("Failed reading elevation band data", MODULE_NAME);
+        read->status = read_input_band (read->input_data, read->band_reader,
+                                        read->band_index, read->band_desc,
+                                        read->band_size, read->band);
+    }
 
-        return ERROR;
+    clock_gettime (CLOCK_MONOTONIC, &end_time);
+    read->seconds = (end_time.tv_sec - start_time.tv_sec)
+                    + (end_time.tv_nsec - start_time.tv_nsec) * 1e-9;
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  start_band_reads
+
+  PURPOSE:  Issue the reads of all the bands at once, each on its own thread,
+            so a parallel filesystem serves them concurrently.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The reads were issued.
+      ERROR    A read could not be issued and failed; finish_band_reads must
+               still be called for the others.
+
+  NOTES:
+    1. Each band has its own file, so the reads do not share a file
+       position.  A read whose thread cannot be created is done right away
+       instead.
+    2. The bands must not be used before wait_band_read or
+       finish_band_reads returns for them, which lets the terrain
+       processing start as soon as the elevation band is in.
+    3. A NULL reflectance or QA band is not read; the strip pipeline reads
+       those bands with read_band_lines.
+*****************************************************************************/
+int
+start_band_reads
+(
+    Input_Data_t *input_data,
+    Band_Reader_e band_reader,
+    int16_t **band_blue,
+    int16_t **band_green,
+    int16_t **band_red,
+    int16_t **band_nir,
+    int16_t **band_swir1,
+    int16_t **band_swir2,
+    int16_t *band_elevation,
+    uint16_t **band_pixelqa,
+    int pixel_count,
+    Band_Reads_t *reads
+)
+{
+    size_t band_size = (size_t) pixel_count * sizeof (int16_t);
+    Band_Read_t *read;
+    int index;
+    int status = SUCCESS;
+
+    /* The elevation band is always read, since the terrain processing may
+       replace it or extract it from a DEM tile store */
+    reads->elevation = band_elevation;
+
+    reads->read[I_BAND_BLUE].band = (void **) band_blue;
+    reads->read[I_BAND_BLUE].band_desc = "blue";
+    reads->read[I_BAND_GREEN].band = (void **) band_green;
+    reads->read[I_BAND_GREEN].band_desc = "green";
+    reads->read[I_BAND_RED].band = (void **) band_red;
+    reads->read[I_BAND_RED].band_desc = "red";
+    reads->read[I_BAND_NIR].band = (void **) band_nir;
+    reads->read[I_BAND_NIR].band_desc = "nir";
+    reads->read[I_BAND_SWIR1].band = (void **) band_swir1;
+    reads->read[I_BAND_SWIR1].band_desc = "swir1";
+    reads->read[I_BAND_SWIR2].band = (void **) band_swir2;
+    reads->read[I_BAND_SWIR2].band_desc = "swir2";
+    reads->read[I_BAND_PIXELQA].band = (void **) band_pixelqa;
+    reads->read[I_BAND_PIXELQA].band_desc = "Pixel QA";
+    reads->read[I_BAND_ELEVATION].band = &reads->elevation;
+    reads->read[I_BAND_ELEVATION].band_desc = "elevation";
+
+    /* Start with the elevation band, which the processing waits for
+       first */
+    for (index = MAX_INPUT_BANDS - 1; index >= 0; index--)
+    {
+        read = &reads->read[index];
+        read->input_data = input_data;
+        read->band_reader = band_reader;
+        read->band_index = index;
+        read->band_size = band_size;
+        read->status = SUCCESS;
+        read->seconds = 0.0;
+        read->pending = false;
+
+        /* Bands without memory are read a strip at a time instead */
+        if (read->band == NULL)
+            continue;
+
+        read->pending = (pthread_create (&read->thread, NULL,
+                                         read_band_thread, read) == 0);
+        if (!read->pending)
+        {
+            read_band_thread (read);
+            if (read->status != SUCCESS)
+                status = ERROR;
+        }
+    }
+
+    return status;
+}
+
+
+/*****************************************************************************
+  NAME:  wait_band_read
+
+  PURPOSE:  Wait for the read of one band issued by start_band_reads.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The band was read.
+      ERROR    The read failed.
+*****************************************************************************/
+int
+wait_band_read
+(
+    Band_Reads_t *reads,      /* IO: reads from start_band_reads */
+    Input_Bands_e band_index  /* I: band to wait for */
+)
+{
+    Band_Read_t *read = &reads->read[band_index];
+
+    if (read->pending)
+    {
+        pthread_join (read->thread, NULL);
+        read->pending = false;
     }
 
-    count = fread (band_pixelqa, sizeof (uint16_t), pixel_count,
-                   input_data->band_fd[I_BAND_PIXELQA]);
-    if (count != pixel_count)
+    return read->status;
+}
+
+
+/*****************************************************************************
+  NAME:  finish_band_reads
+
+  PURPOSE:  Wait for all the reads issued by start_band_reads.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  All the bands were read.
+      ERROR    A read failed.
+*****************************************************************************/
+int
+finish_band_reads
+(
+    Band_Reads_t *reads,      /* IO: reads from start_band_reads */
+    bool verbose_flag         /* I: report the time of each read */
+)
+{
+    int index;
+    int status = SUCCESS;
+    char msg[256];
+
+    for (index = 0; index < MAX_INPUT_BANDS; index++)
     {
-        ERROR_MESSAGE ("Failed reading Pixel QA band data", MODULE_NAME);
+        if (wait_band_read (reads, index) != SUCCESS)
+            status = ERROR;
 
-        return ERROR;
+        if (verbose_flag && reads->read[index].band != NULL)
+        {
+            snprintf (msg, sizeof (msg), "Read %s band in %0.3f seconds",
+                      reads->read[index].band_desc,
+                      reads->read[index].seconds);
+            LOG_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+
+    return status;
+}
+
+
+/*****************************************************************************
+  NAME:  read_band_lines
+
+  PURPOSE:  Read a run of lines of a reflectance or QA band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The lines were read.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+read_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read, not the elevation band */
+    int first_line,           /* I: first line to read */
+    int line_count,           /* I: number of lines to read */
+    void *band                /* O: memory for line_count lines of 16 bit
+                                    values */
+)
+{
+    char msg[256];
+
+    if (pread_band (input_data, band_index,
+                    (off_t) first_line * input_data->samples,
+                    (size_t) line_count * input_data->samples, band)
+        != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed reading lines %d to %d of %s",
+                  first_line, first_line + line_count - 1,
+                  input_data->band_name[band_index]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  read_band_samples
+
+  PURPOSE:  Read a run of samples on one line of a reflectance or QA band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The samples were read.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+read_band_samples
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read, not the elevation band */
+    int line,                 /* I: line to read */
+    int first_sample,         /* I: first sample to read */
+    int sample_count,         /* I: number of samples to read */
+    void *band                /* O: memory for sample_count 16 bit values */
+)
+{
+    char msg[256];
+
+    if (pread_band (input_data, band_index,
+                    (off_t) line * input_data->samples + first_sample,
+                    sample_count, band)
+        != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed reading samples %d to %d of"
+                  " line %d of %s", first_sample,
+                  first_sample + sample_count - 1, line,
+                  input_data->band_name[band_index]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
     }
 
     return SUCCESS;
 }
 
+
+/*****************************************************************************
+  NAME: read_bands_into_memory
+
+  PURPOSE: To read the specified input band data into memory for later
+           processing.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  Success with reading all of the bands into memory.
+      ERROR    Failed to read a band into memory.
+
+  NOTES:
+    1. The bands are read concurrently; see start_band_reads.
+    2. When mapping, the reflectance and QA band pointers are set to the
+       mappings, which are released with release_mapped_bands.  The
+       elevation band is always read.
+*****************************************************************************/
+int
+read_bands_into_memory
+(
+    Input_Data_t *input_data,
+    Band_Reader_e band_reader,
+    int16_t **band_blue,
+    int16_t **band_green,
+    int16_t **band_red,
+    int16_t **band_nir,
+    int16_t **band_swir1,
+    int16_t **band_swir2,
+    int16_t *band_elevation,
+    uint16_t **band_pixelqa,
+    int pixel_count
+)
+{
+    Band_Reads_t reads;
+
+    start_band_reads (input_data, band_reader, band_blue, band_green,
+                      band_red, band_nir, band_swir1, band_swir2,
+                      band_elevation, band_pixelqa, pixel_count, &reads);
+
+    /* error messages provided by the reads */
+    return finish_band_reads (&reads, false);
+}
+
+
+/*****************************************************************************
+  NAME:  release_mapped_bands
+
+  PURPOSE:  Unmap the reflectance and QA bands mapped by
+            read_bands_into_memory, leaving the pointers NULL so the band
+            memory can be freed as usual afterwards.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+release_mapped_bands
+(
+    Band_Reader_e band_reader, /* I: reader the bands were brought into
+                                     memory with */
+    int16_t **band_blue,      /* IO: unmapped and set to NULL when mapped */
+    int16_t **band_green,     /* IO: as band_blue */
+    int16_t **band_red,       /* IO: as band_blue */
+    int16_t **band_nir,       /* IO: as band_blue */
+    int16_t **band_swir1,     /* IO: as band_blue */
+    int16_t **band_swir2,     /* IO: as band_blue */
+    uint16_t **band_pixelqa,  /* IO: as band_blue */
+    int pixel_count           /* I: number of pixels in each band */
+)
+{
+    int16_t **bands[] = {band_blue, band_green, band_red, band_nir,
+                         band_swir1, band_swir2};
+    size_t band_size = (size_t) pixel_count * sizeof (int16_t);
+    int index;
+
+    if (band_reader == BAND_READER_READ)
+        return;
+
+    for (index = 0; index < sizeof (bands) / sizeof (bands[0]); index++)
+    {
+        if (*bands[index] != NULL)
+            munmap (*bands[index], band_size);
+        *bands[index] = NULL;
+    }
+
+    if (*band_pixelqa != NULL)
+        munmap (*band_pixelqa, (size_t) pixel_count * sizeof (uint16_t));
+    *band_pixelqa = NULL;
+}
+
@@ -4,24 +4,110 @@
 
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
 
 #include "espa_metadata.h"
 
 #include "const.h"
+#include "dem_store.h"
+#include "band_stream.h"
+#include "tiff_band.h"
+#include "tar_archive.h"
+#include "io_backend.h"
+#include "scene_window.h"
+
+
+/* How the reflectance and QA bands are brought into memory */
+typedef enum
+{
+    BAND_READER_READ = 0,     /* Read into allocated buffers */
+    BAND_READER_MMAP,         /* Map the band files read only, paging them
+                                 in sequentially as they are used */
+    BAND_READER_MMAP_POPULATE /* Map the band files read only and page them
+                                 all in when mapped */
+} Band_Reader_e;
 
 
 /* Structure for the 'input' data */
 typedef struct
 {
-    int lines;
-    int samples;
+    int lines;                           /* Lines processed, those of the
+                                            window when one is set */
+    int samples;                         /* Samples processed */
+    int window_line;                     /* Line of the band files at the
+                                            first line processed */
+    int window_sample;                   /* Sample of the band files at the
+                                            first sample processed */
+    int band_lines;                      /* Lines of the reflectance and QA
+                                            band files */
+    int band_samples;                    /* Samples of the reflectance and
+                                            QA band files */
     float solar_elevation;               /* Solar zenith angle */
     float solar_azimuth;                 /* Solar azimuth angle */
     double x_pixel_size;
     double y_pixel_size;
+    double ul_x;                         /* x of the upper left corner of
+                                            the reflectance band files */
+    double ul_y;                         /* y of the upper left corner of
+                                            the reflectance band files */
+    /* The elevation band may be on a coarser grid than the other bands,
+       sharing the upper left corner of their files */
+    int dem_lines;                       /* Lines of the elevation band in
+                                            memory */
+    int dem_samples;                     /* Samples of the elevation band in
+                                            memory */
+    int dem_first_line;                  /* Line of the elevation grid at
+                                            the first line in memory,
+                                            negative for a halo outside the
+                                            scene */
+    int dem_first_sample;                /* Sample of the elevation grid at
+                                            the first sample in memory */
+    int dem_scene_lines;                 /* Lines of the elevation grid
+                                            covering the scene, those of the
+                                            elevation band file */
+    int dem_scene_samples;               /* Samples of the elevation grid
+                                            covering the scene */
+    double dem_x_pixel_size;
+    double dem_y_pixel_size;
+    bool dem_geographic;                 /* Elevation pixel sizes are in
+                                            degrees */
+    double dem_ul_latitude;              /* Latitude of the top edge of a
+                                            geographic elevation band in
+                                            memory */
+    Dem_Tile_Store_t *dem_store;         /* Store the elevation band is
+                                            extracted from, NULL when it
+                                            is read from the XML */
     char *band_name[MAX_INPUT_BANDS];    /* Name of the input image files */
     FILE *band_fd[MAX_INPUT_BANDS];      /* Open fd's for the image */
+    Band_Stream_t *band_stream[MAX_INPUT_BANDS]; /* Decompressing streams
+                                            of the compressed images, which
+                                            have no fd */
+    Tiff_Band_t *band_tiff[MAX_INPUT_BANDS]; /* Tile decoders of the tiled
+                                            images, which have no fd */
+    off_t band_offset[MAX_INPUT_BANDS];  /* Offset of the image in its file,
+                                            non zero for a member of a tar
+                                            archive */
+    int band_direct_fd[MAX_INPUT_BANDS]; /* The fd's reopened with
+                                            O_DIRECT for the direct I/O
+                                            backend, -1 for none */
+    Io_Backend_e io_backend;             /* How the image files are read */
+    const Tar_Archive_t *archive;        /* Archive the images are read
+                                            from when in it, NULL for none;
+                                            only used while opening */
+    const char *remote_bands;            /* URL of the directory the
+                                            images are read from over HTTP,
+                                            NULL for local images; only
+                                            used while opening */
+    const char *remote_cache_dir;        /* Directory of the block cache of
+                                            the remote images, NULL for
+                                            none; only used while opening */
+    Espa_data_type_t data_type[MAX_INPUT_BANDS]; /* Data types of the
+                                            reflectance bands, INT16 or the
+                                            UINT16 of Collection 2 */
     float scale_factor[MAX_INPUT_BANDS]; /* Scale factors from the metadata */
+    float add_offset[MAX_INPUT_BANDS];   /* Offsets from the metadata */
     int fill_value[MAX_INPUT_BANDS];     /* Fill value from the metadata */
 } Input_Data_t;
 
@@ -30,7 +116,32 @@ Input_Data_t *
 open_input
 (
     Espa_internal_meta_t *metadata, /* I: input metadata */
-    bool use_toa_flag               /* I: use TOA or SR data */
+    bool use_toa_flag,              /* I: use TOA or SR data */
+    const Tar_Archive_t *archive,   /* I: archive to read the images from
+                                          when in it, NULL for none */
+    const char *remote_bands,       /* I: URL of the directory to read the
+                                          images from over HTTP, NULL for
+                                          local images */
+    const char *remote_cache_dir,   /* I: directory of the block cache of
+                                          the remote images, NULL for none */
+    Io_Backend_e io_backend,        /* I: how to read the image files */
+    char *dem_store_index,          /* I: index of a DEM tile store to
+                                          extract the elevation band from,
+                                          NULL to use the XML band */
+    int dem_store_halo              /* I: elevation pixels to extract
+                                          outside the reflectance extent on
+                                          each side */
+);
+
+
+int
+set_input_window
+(
+    Input_Data_t *input_data,       /* IO: input data record */
+    const Scene_Window_t *window,   /* I: window of the scene to process */
+    int elevation_halo              /* I: elevation pixels to keep around
+                                          the window on each side, -1 to
+                                          keep the whole elevation band */
 );
 
 
@@ -41,20 +152,146 @@ close_input
 );
 
 
+bool
+input_bands_compressed
+(
+    const Input_Data_t *input_data /* I: input data record */
+);
+
+
+bool
+input_bands_raw
+(
+    const Input_Data_t *input_data /* I: input data record */
+);
+
+
+/* Structure for one band read issued by start_band_reads */
+typedef struct
+{
+    Input_Data_t *input_data; /* Input the band is read from */
+    Band_Reader_e band_reader; /* How to bring the band into memory */
+    Input_Bands_e band_index; /* Band being read */
+    const char *band_desc;    /* Description of the band for messages */
+    size_t band_size;         /* Size of the band in bytes */
+    void **band;              /* Allocated memory when reading, the mapping
+                                 of the band when mapping */
+    int status;               /* SUCCESS or ERROR once the read is done */
+    double seconds;           /* Time taken by the read */
+    pthread_t thread;         /* Thread doing the read */
+    bool pending;             /* The thread has not been joined yet */
+} Band_Read_t;
+
+
+/* Structure for the band reads of a scene, which run concurrently */
+typedef struct
+{
+    Band_Read_t read[MAX_INPUT_BANDS]; /* The read of each band */
+    void *elevation;          /* The elevation band memory */
+} Band_Reads_t;
+
+
+Band_Reader_e
+find_band_reader
+(
+    const char *name          /* I: name of the band reader */
+);
+
+
 int
 read_bands_into_memory
 (
     Input_Data_t *input_data, /* I: input data record */
-    int16_t *band_blue,       /* I: pointer to allocated memory */
-    int16_t *band_green,      /* I: pointer to allocated memory */
-    int16_t *band_red,        /* I: pointer to allocated memory */
-    int16_t *band_nir,        /* I: pointer to allocated memory */
-    int16_t *band_swir1,      /* I: pointer to allocated memory */
-    int16_t *band_swir2,      /* I: pointer to allocated memory */
-    int16_t *band_elevation,  /* I: pointer to allocated memory */
-    uint16_t *band_pixelqa,   /* I: pointer to allocated memory */
+    Band_Reader_e band_reader, /* I: how to bring the bands into memory */
+    int16_t **band_blue,      /* IO: allocated memory when reading, the
+                                     mapping of the band when mapping */
+    int16_t **band_green,     /* IO: as band_blue */
+    int16_t **band_red,       /* IO: as band_blue */
+    int16_t **band_nir,       /* IO: as band_blue */
+    int16_t **band_swir1,     /* IO: as band_blue */
+    int16_t **band_swir2,     /* IO: as band_blue */
+    int16_t *band_elevation,  /* I: pointer to allocated memory of
+                                    dem_lines * dem_samples values */
+    uint16_t **band_pixelqa,  /* IO: as band_blue */
     int pixel_count           /* I: how many pixel are to be read in */
 );
 
 
+int
+start_band_reads
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Band_Reader_e band_reader, /* I: how to bring the bands into memory */
+    int16_t **band_blue,      /* IO: allocated memory when reading, the
+                                     mapping of the band when mapping; NULL
+                                     to not read the band */
+    int16_t **band_green,     /* IO: as band_blue */
+    int16_t **band_red,       /* IO: as band_blue */
+    int16_t **band_nir,       /* IO: as band_blue */
+    int16_t **band_swir1,     /* IO: as band_blue */
+    int16_t **band_swir2,     /* IO: as band_blue */
+    int16_t *band_elevation,  /* I: pointer to allocated memory of
+                                    dem_lines * dem_samples values */
+    uint16_t **band_pixelqa,  /* IO: as band_blue */
+    int pixel_count,          /* I: how many pixel are to be read in */
+    Band_Reads_t *reads       /* O: the reads in progress */
+);
+
+
+int
+wait_band_read
+(
+    Band_Reads_t *reads,      /* IO: reads from start_band_reads */
+    Input_Bands_e band_index  /* I: band to wait for */
+);
+
+
+int
+finish_band_reads
+(
+    Band_Reads_t *reads,      /* IO: reads from start_band_reads */
+    bool verbose_flag         /* I: report the time of each read */
+);
+
+
+int
+read_band_lines
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read, not the elevation band */
+    int first_line,           /* I: first line to read */
+    int line_count,           /* I: number of lines to read */
+    void *band                /* O: memory for line_count lines of 16 bit
+                                    values */
+);
+
+
+int
+read_band_samples
+(
+    Input_Data_t *input_data, /* I: input data record */
+    Input_Bands_e band_index, /* I: band to read, not the elevation band */
+    int line,                 /* I: line to read */
+    int first_sample,         /* I: first sample to read */
+    int sample_count,         /* I: number of samples to read */
+    void *band                /* O: memory for sample_count 16 bit values */
+);
+
+
+void
+release_mapped_bands
+(
+    Band_Reader_e band_reader, /* I: reader the bands were brought into
+                                     memory with */
+    int16_t **band_blue,      /* IO: unmapped and set to NULL when mapped */
+    int16_t **band_green,     /* IO: as band_blue */
+    int16_t **band_red,       /* IO: as band_blue */
+    int16_t **band_nir,       /* IO: as band_blue */
+    int16_t **band_swir1,     /* IO: as band_blue */
+    int16_t **band_swir2,     /* IO: as band_blue */
+    uint16_t **band_pixelqa,  /* IO: as band_blue */
+    int pixel_count           /* I: number of pixels in each band */
+);
+
+
 #endif /* INPUT_H */
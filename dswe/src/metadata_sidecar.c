@@ -0,0 +1,330 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "espa_metadata.h"
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "metadata_sidecar.h"
+
+
+#define METADATA_SIDECAR_MAGIC "DSWEMETA"
+#define METADATA_SIDECAR_VERSION 1
+
+/* Bytes of the XML hashed at a time */
+#define METADATA_SIDECAR_READ_SIZE (64 * 1024)
+
+
+/* Structure for the header at the start of a metadata sidecar, which
+   identifies the XML the sidecar was compiled from.  The header is followed
+   by the namespace, the global metadata and the band metadata. */
+typedef struct
+{
+    char magic[8];           /* METADATA_SIDECAR_MAGIC, not terminated */
+    int32_t version;         /* METADATA_SIDECAR_VERSION */
+    int32_t global_size;     /* Size of the global metadata structure */
+    int32_t band_size;       /* Size of a band metadata structure */
+    int32_t nbands;          /* Number of bands in the XML */
+    int64_t xml_size;        /* Size of the XML in bytes */
+    int64_t xml_mtime_sec;   /* Modification time of the XML */
+    int64_t xml_mtime_nsec;
+    uint64_t xml_hash;       /* Content hash of the XML */
+} Metadata_Sidecar_Header_t;
+
+
+/*****************************************************************************
+  NAME:  hash_xml_file
+
+  PURPOSE:  Computes a content hash of the XML for keying its sidecar.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The XML was hashed.
+      ERROR    The XML could not be read.
+
+  NOTES:
+    1. The hash is the 64 bit FNV-1a hash of the bytes of the file.  Reading
+       the XML is a small part of the cost of validating and parsing it.
+*****************************************************************************/
+static int
+hash_xml_file
+(
+    const char *xml_filename, /* I: name of the XML file */
+    uint64_t *hash            /* O: content hash of the file */
+)
+{
+    const uint64_t fnv_prime = 1099511628211ULL;
+    unsigned char *buffer;
+    size_t count;
+    size_t index;
+    FILE *fd;
+    int status = SUCCESS;
+
+    fd = fopen (xml_filename, "rb");
+    if (fd == NULL)
+        return ERROR;
+
+    buffer = malloc (METADATA_SIDECAR_READ_SIZE);
+    if (buffer == NULL)
+    {
+        fclose (fd);
+        return ERROR;
+    }
+
+    *hash = 14695981039346656037ULL;
+    while ((count = fread (buffer, 1, METADATA_SIDECAR_READ_SIZE, fd)) > 0)
+    {
+        for (index = 0; index < count; index++)
+        {
+            *hash ^= buffer[index];
+            *hash *= fnv_prime;
+        }
+    }
+    if (ferror (fd))
+        status = ERROR;
+
+    free (buffer);
+    fclose (fd);
+
+    return status;
+}
+
+
+/*****************************************************************************
+  NAME:  identify_xml
+
+  PURPOSE:  Fill in the header identifying the current contents of the XML.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The header was filled in.
+      ERROR    The XML could not be read.
+*****************************************************************************/
+static int
+identify_xml
+(
+    const char *xml_filename, /* I: name of the XML file */
+    int nbands,               /* I: number of bands in the XML */
+    Metadata_Sidecar_Header_t *header /* O: header for the sidecar */
+)
+{
+    struct stat xml_stat;
+
+    memset (header, 0, sizeof (*header));
+    memcpy (header->magic, METADATA_SIDECAR_MAGIC, sizeof (header->magic));
+    header->version = METADATA_SIDECAR_VERSION;
+    header->global_size = sizeof (Espa_global_meta_t);
+    header->band_size = sizeof (Espa_band_meta_t);
+    header->nbands = nbands;
+
+    if (stat (xml_filename, &xml_stat) != 0)
+        return ERROR;
+    header->xml_size = xml_stat.st_size;
+    header->xml_mtime_sec = xml_stat.st_mtim.tv_sec;
+    header->xml_mtime_nsec = xml_stat.st_mtim.tv_nsec;
+
+    return hash_xml_file (xml_filename, &header->xml_hash);
+}
+
+
+/*****************************************************************************
+  NAME:  read_metadata_sidecar
+
+  PURPOSE:  Read the metadata of the XML from its sidecar, instead of
+            validating and parsing the XML.
+
+  RETURN VALUE:  Type = bool
+      Value    Description
+      -------  ---------------------------------------------------------------
+      true     The metadata was read from a sidecar compiled from the XML as
+               it is now.
+      false    There is no such sidecar, and the XML has to be parsed.
+
+  NOTES:
+    1. The sidecar is only used when the size, modification time and
+       content hash of the XML are the ones it was compiled from.  The sizes
+       of the metadata structures are checked too, so a sidecar written by
+       a build against a different metadata library is not used.
+    2. The sidecar holds the global metadata and every band with its files,
+       dimensions, fill values, scale factors and pixel sizes, but not the
+       class values, bitmap descriptions or percent covers of the bands.
+*****************************************************************************/
+bool
+read_metadata_sidecar
+(
+    const char *xml_filename, /* I: XML the sidecar was compiled from */
+    Espa_internal_meta_t *metadata /* O: metadata from the sidecar, left
+                                         initialized when none is used */
+)
+{
+    Metadata_Sidecar_Header_t header;
+    Metadata_Sidecar_Header_t expected;
+    char sidecar_filename[PATH_MAX];
+    char msg[PATH_MAX + 64];
+    FILE *fd;
+    int count;
+
+    init_metadata_struct (metadata);
+
+    count = snprintf (sidecar_filename, sizeof (sidecar_filename), "%s%s",
+                      xml_filename, METADATA_SIDECAR_SUFFIX);
+    if (count < 0 || count >= sizeof (sidecar_filename))
+        return false;
+
+    fd = fopen (sidecar_filename, "rb");
+    if (fd == NULL)
+        return false;
+
+    /* Only a sidecar of the XML as it is now is used */
+    if (fread (&header, sizeof (header), 1, fd) != 1
+        || memcmp (header.magic, METADATA_SIDECAR_MAGIC,
+                   sizeof (header.magic)) != 0
+        || header.nbands < 0)
+    {
+        fclose (fd);
+        return false;
+    }
+    if (identify_xml (xml_filename, header.nbands, &expected) != SUCCESS
+        || header.version != expected.version
+        || header.global_size != expected.global_size
+        || header.band_size != expected.band_size
+        || header.xml_size != expected.xml_size
+        || header.xml_mtime_sec != expected.xml_mtime_sec
+        || header.xml_mtime_nsec != expected.xml_mtime_nsec
+        || header.xml_hash != expected.xml_hash)
+    {
+        fclose (fd);
+        return false;
+    }
+
+    if (fread (metadata->meta_namespace, sizeof (metadata->meta_namespace),
+               1, fd) != 1
+        || fread (&metadata->global, sizeof (metadata->global), 1, fd) != 1
+        || (header.nbands > 0
+            && (allocate_band_metadata (metadata, header.nbands) != SUCCESS
+                || fread (metadata->band, sizeof (Espa_band_meta_t),
+                          header.nbands, fd) != header.nbands)))
+    {
+        fclose (fd);
+        free_metadata (metadata);
+        init_metadata_struct (metadata);
+
+        snprintf (msg, sizeof (msg), "Ignoring unreadable metadata sidecar"
+                  " (%s)", sidecar_filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        return false;
+    }
+
+    fclose (fd);
+
+    return true;
+}
+
+
+/*****************************************************************************
+  NAME:  write_metadata_sidecar
+
+  PURPOSE:  Compile the metadata of the XML into its sidecar, for later runs
+            to read instead of the XML.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The sidecar was written.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The metadata has to be that of the XML as it is now, including any
+       bands appended to it.
+    2. The sidecar is written under a temporary name and renamed, so
+       concurrent runs never see a partially written sidecar.
+*****************************************************************************/
+int
+write_metadata_sidecar
+(
+    const char *xml_filename, /* I: XML the metadata was parsed from */
+    const Espa_internal_meta_t *metadata /* I: metadata of the XML */
+)
+{
+    Metadata_Sidecar_Header_t header;
+    Espa_band_meta_t band;
+    char sidecar_filename[PATH_MAX];
+    char temp_filename[PATH_MAX];
+    char msg[PATH_MAX + 64];
+    FILE *fd;
+    int index;
+    int count;
+    int status = SUCCESS;
+
+    count = snprintf (sidecar_filename, sizeof (sidecar_filename), "%s%s",
+                      xml_filename, METADATA_SIDECAR_SUFFIX);
+    if (count >= 0 && count < sizeof (sidecar_filename))
+    {
+        count = snprintf (temp_filename, sizeof (temp_filename), "%s.%d.tmp",
+                          sidecar_filename, (int) getpid ());
+    }
+    if (count < 0 || count >= sizeof (temp_filename))
+    {
+        RETURN_ERROR ("Failed creating the metadata sidecar filename",
+                      MODULE_NAME, ERROR);
+    }
+
+    if (identify_xml (xml_filename, metadata->nbands, &header) != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed reading the XML (%s)",
+                  xml_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    fd = fopen (temp_filename, "wb");
+    if (fd == NULL)
+    {
+        snprintf (msg, sizeof (msg), "Failed creating metadata sidecar (%s)",
+                  temp_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    if (fwrite (&header, sizeof (header), 1, fd) != 1
+        || fwrite (metadata->meta_namespace,
+                   sizeof (metadata->meta_namespace), 1, fd) != 1
+        || fwrite (&metadata->global, sizeof (metadata->global), 1, fd) != 1)
+    {
+        status = ERROR;
+    }
+
+    /* The lists a band points to are not kept */
+    for (index = 0; index < metadata->nbands && status == SUCCESS; index++)
+    {
+        band = metadata->band[index];
+        band.nbits = 0;
+        band.bitmap_description = NULL;
+        band.nclass = 0;
+        band.class_values = NULL;
+        band.ncover = 0;
+        band.percent_cover = NULL;
+        if (fwrite (&band, sizeof (band), 1, fd) != 1)
+            status = ERROR;
+    }
+
+    if (fclose (fd) != 0)
+        status = ERROR;
+    if (status != SUCCESS || rename (temp_filename, sidecar_filename) != 0)
+    {
+        unlink (temp_filename);
+        snprintf (msg, sizeof (msg), "Failed writing metadata sidecar (%s)",
+                  sidecar_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
@@ -0,0 +1,32 @@
+
+#ifndef METADATA_SIDECAR_H
+#define METADATA_SIDECAR_H
+
+
+#include <stdbool.h>
+
+#include "espa_metadata.h"
+
+
+/* Suffix added to the XML filename to name its metadata sidecar */
+#define METADATA_SIDECAR_SUFFIX ".meta"
+
+
+bool
+read_metadata_sidecar
+(
+    const char *xml_filename, /* I: XML the sidecar was compiled from */
+    Espa_internal_meta_t *metadata /* O: metadata from the sidecar, left
+                                         initialized when none is used */
+);
+
+
+int
+write_metadata_sidecar
+(
+    const char *xml_filename, /* I: XML the metadata was parsed from */
+    const Espa_internal_meta_t *metadata /* I: metadata of the XML */
+);
+
+
+#endif /* METADATA_SIDECAR_H */
@@ -7,12 +7,11 @@
 #include <time.h>
 
 #include "espa_metadata.h"
-#include "parse_metadata.h"
 #include "write_metadata.h"
 #include "envi_header.h"
-#include "raw_binary_io.h"
 
 #include "const.h"
+#include "io_backend.h"
 #include "dswe.h"
 #include "utilities.h"
 
@@ -35,32 +34,26 @@ int
 write_u8bit_dswe_product
 (
     char *output_filename,
+    Io_Backend_e io_backend,
     int element_count,
     uint8_t *data
 )
 {
-    FILE *fd = NULL;
-    char msg[512];
+    Io_Writer_t *writer = NULL;
 
-    fd = fopen(output_filename, "w");
-    if (fd == NULL)
-    {
-        snprintf (msg, sizeof (msg), "Failed creating file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
-    }
+    /* The I/O backend reports its own errors */
+    writer = open_io_writer (io_backend, output_filename);
+    if (writer == NULL)
+        return ERROR;
 
-    if (write_raw_binary(fd, 1, element_count, sizeof (uint8_t), data)
+    if (write_io_writer (writer, data, element_count * sizeof (uint8_t))
         != SUCCESS)
     {
-        snprintf (msg, sizeof (msg), "Failed writing file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        close_io_writer (writer);
+        return ERROR;
     }
 
-    fclose(fd);
-
-    return SUCCESS;
+    return close_io_writer (writer);
 }
 
 
@@ -79,30 +72,73 @@ int
 write_16bit_dswe_product
 (
     char *output_filename,
+    Io_Backend_e io_backend,
     int element_count,
     int16_t *data
 )
 {
-    FILE *fd = NULL;
-    char msg[512];
+    Io_Writer_t *writer = NULL;
+
+    /* The I/O backend reports its own errors */
+    writer = open_io_writer (io_backend, output_filename);
+    if (writer == NULL)
+        return ERROR;
 
-    fd = fopen(output_filename, "w");
-    if (fd == NULL)
+    if (write_io_writer (writer, data, element_count * sizeof (int16_t))
+        != SUCCESS)
     {
-        snprintf (msg, sizeof (msg), "Failed creating file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        close_io_writer (writer);
+        return ERROR;
     }
 
-    if (write_raw_binary(fd, 1, element_count, sizeof (int16_t), data)
-        != SUCCESS)
+    return close_io_writer (writer);
+}
+
+
+/*****************************************************************************
+  NAME:  add_band_to_metadata
+
+  PURPOSE:  Add a band appended to the XML to the metadata parsed from the
+            XML, so the metadata stays that of the XML.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The band was added.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The class values and bitmap descriptions stay with the band metadata
+       they were allocated for, and are not added.
+*****************************************************************************/
+static int
+add_band_to_metadata
+(
+    Espa_internal_meta_t *xml_metadata, /* IO: metadata of the XML */
+    const Espa_band_meta_t *band        /* I: band appended to the XML */
+)
+{
+    Espa_band_meta_t *bands;
+    Espa_band_meta_t *added;
+
+    bands = realloc (xml_metadata->band,
+                     (xml_metadata->nbands + 1) * sizeof (Espa_band_meta_t));
+    if (bands == NULL)
     {
-        snprintf (msg, sizeof (msg), "Failed writing file %s",
-                  output_filename);
-        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        RETURN_ERROR ("Failed allocating band metadata", MODULE_NAME,
+                      ERROR);
     }
+    xml_metadata->band = bands;
 
-    fclose(fd);
+    added = &bands[xml_metadata->nbands];
+    *added = *band;
+    added->nbits = 0;
+    added->bitmap_description = NULL;
+    added->nclass = 0;
+    added->class_values = NULL;
+    added->ncover = 0;
+    added->percent_cover = NULL;
+    xml_metadata->nbands++;
 
     return SUCCESS;
 }
@@ -119,12 +155,21 @@ write_16bit_dswe_product
       -------  ---------------------------------------------------------------
       SUCCESS  No errors were encountered.
       ERROR    An error was encountered.
+
+  NOTES:
+    1. With NULL data the image file is not written, because it was written
+       through open_band_product_image.
+    2. The output is described from the metadata parsed from the XML at the
+       start of the run, rather than by parsing the XML again, and the band
+       is added to that metadata as it is appended to the XML.
 *****************************************************************************/
 int
 add_dswe_band_product
 (
     char *xml_filename,
+    Espa_internal_meta_t *xml_metadata,
     bool use_toa_flag,
+    Io_Backend_e io_backend,
     char *product_name,
     char *band_name,
     char *short_name,
@@ -143,7 +188,6 @@ add_dswe_band_product
     char scene_name[PATH_MAX];
     char image_filename[PATH_MAX];
     char *my_char = NULL;
-    Espa_internal_meta_t in_meta;
     Espa_internal_meta_t tmp_meta;
     Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata array
                                        within the output structure */
@@ -156,25 +200,13 @@ add_dswe_band_product
     int bit_count;            /* number of bits in the bitmap */
     char search_string[PATH_MAX];
 
-    /* Initialize the input metadata structure */
-    init_metadata_struct (&in_meta);
-
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (xml_filename, &in_meta) != SUCCESS)
-    {
-        /* Error messages already written */
-        return ERROR;
-    }
-
     /* Find the representative band for metadata information */
-    for (band_index = 0; band_index < in_meta.nbands; band_index++)
+    for (band_index = 0; band_index < xml_metadata->nbands; band_index++)
     {
         if (use_toa_flag)
         {
-            if (!strcmp (in_meta.band[band_index].name, "toa_band1") &&
-                !strcmp (in_meta.band[band_index].product, "toa_refl"))
+            if (!strcmp (xml_metadata->band[band_index].name, "toa_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "toa_refl"))
             {
                 /* this is the index we'll use for reflectance band info */
                 src_index = band_index;
@@ -183,8 +215,8 @@ add_dswe_band_product
         }
         else
         {
-            if (!strcmp (in_meta.band[band_index].name, "sr_band1") &&
-                !strcmp (in_meta.band[band_index].product, "sr_refl"))
+            if (!strcmp (xml_metadata->band[band_index].name, "sr_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "sr_refl"))
             {
                 /* this is the index we'll use for reflectance band info */
                 src_index = band_index;
@@ -194,9 +226,9 @@ add_dswe_band_product
     }
 
     /* Figure out the scene name */
-    strcpy (scene_name, in_meta.band[src_index].file_name);
+    strcpy (scene_name, xml_metadata->band[src_index].file_name);
     snprintf (search_string, sizeof(search_string), "_%s",
-              in_meta.band[src_index].name);
+              xml_metadata->band[src_index].name);
     my_char = strstr(scene_name, search_string);
     if (my_char != NULL)
         *my_char = '\0';
@@ -229,12 +261,15 @@ add_dswe_band_product
     }
 
     /* Figure out how many elements are in the data */
-    element_count = in_meta.band[src_index].nlines *
-                    in_meta.band[src_index].nsamps;
+    element_count = xml_metadata->band[src_index].nlines *
+                    xml_metadata->band[src_index].nsamps;
 
-    /* First write out the ENVI band and header files */
-    if (write_u8bit_dswe_product (image_filename, element_count, data)
-        != SUCCESS)
+    /* First write out the ENVI band and header files, unless the strip
+       pipeline has written the band already */
+    if (data != NULL
+        && write_u8bit_dswe_product (image_filename, io_backend,
+                                     element_count, data)
+           != SUCCESS)
     {
         RETURN_ERROR ("Failed creating output ENVI files", MODULE_NAME,
                       ERROR);
@@ -253,7 +288,7 @@ add_dswe_band_product
     bmeta = tmp_meta.band;
 
     snprintf (bmeta[0].short_name, sizeof (bmeta[0].short_name),
-              "%s", in_meta.band[src_index].short_name);
+              "%s", xml_metadata->band[src_index].short_name);
     bmeta[0].short_name[4] = '\0';
     strcat (bmeta[0].short_name, short_name);
     snprintf (bmeta[0].product, sizeof (bmeta[0].product),
@@ -274,10 +309,10 @@ add_dswe_band_product
     {
         snprintf (bmeta[0].category, sizeof (bmeta[0].category), "qa");
     }
-    bmeta[0].nlines = in_meta.band[src_index].nlines;
-    bmeta[0].nsamps = in_meta.band[src_index].nsamps;
-    bmeta[0].pixel_size[0] = in_meta.band[src_index].pixel_size[0];
-    bmeta[0].pixel_size[1] = in_meta.band[src_index].pixel_size[1];
+    bmeta[0].nlines = xml_metadata->band[src_index].nlines;
+    bmeta[0].nsamps = xml_metadata->band[src_index].nsamps;
+    bmeta[0].pixel_size[0] = xml_metadata->band[src_index].pixel_size[0];
+    bmeta[0].pixel_size[1] = xml_metadata->band[src_index].pixel_size[1];
     snprintf (bmeta[0].pixel_units, sizeof (bmeta[0].pixel_units), "meters");
     snprintf (bmeta[0].app_version, sizeof (bmeta[0].app_version),
               "dswe_%s", DSWE_VERSION);
@@ -353,10 +388,10 @@ add_dswe_band_product
                   "fill");
     }
 
-    /* This is for the mask band */
+    /* This is for the mask band; add_bitmap is the number of mask bits */
     if (add_bitmap)
     {
-        bit_count = 5;
+        bit_count = add_bitmap;
 
         /* Set up bit values information */
         if (allocate_bitmap_metadata (&bmeta[0], bit_count) != SUCCESS)
@@ -367,10 +402,16 @@ add_dswe_band_product
         snprintf (bmeta[0].bitmap_description[2], STR_SIZE, "cloud");
         snprintf (bmeta[0].bitmap_description[3], STR_SIZE, "percent slope");
         snprintf (bmeta[0].bitmap_description[4], STR_SIZE, "hillshade");
+        if (bit_count > MASK_CAST_SHADOW)
+        {
+            snprintf (bmeta[0].bitmap_description[MASK_CAST_SHADOW],
+                      STR_SIZE, "cast shadow");
+        }
     }
 
     /* Create the ENVI header file this band */
-    if (create_envi_struct (&bmeta[0], &in_meta.global, &envi_hdr) != SUCCESS)
+    if (create_envi_struct (&bmeta[0], &xml_metadata->global, &envi_hdr)
+        != SUCCESS)
     {
         RETURN_ERROR ("Failed to create ENVI header structure.", MODULE_NAME,
                       ERROR);
@@ -398,7 +439,13 @@ add_dswe_band_product
         RETURN_ERROR ("Appending DSWE band to XML file", MODULE_NAME, ERROR);
     }
 
-    free_metadata (&in_meta);
+    /* Keep the metadata in step with the XML */
+    if (add_band_to_metadata (xml_metadata, &bmeta[0]) != SUCCESS)
+    {
+        /* Error messages already written */
+        return ERROR;
+    }
+
     free_metadata (&tmp_meta);
 
     return SUCCESS;
@@ -411,7 +458,9 @@ add_dswe_band_product
   PURPOSE:  Create a new envi output file including envi header and add the
             associated information to the XML metadata file.
 
-  NOTE: Only for the "test" DSWE band output.
+  NOTE: Only for the "test" DSWE band output.  With NULL data the image
+        file is not written, because it was written through
+        open_band_product_image.
 
   RETURN VALUE:  Type = int
       Value    Description
@@ -423,7 +472,9 @@ int
 add_test_band_product
 (
     char *xml_filename,
+    Espa_internal_meta_t *xml_metadata,
     bool use_toa_flag,
+    Io_Backend_e io_backend,
     char *product_name,
     char *band_name,
     char *short_name,
@@ -440,7 +491,6 @@ add_test_band_product
     char scene_name[PATH_MAX];
     char image_filename[PATH_MAX];
     char *my_char = NULL;
-    Espa_internal_meta_t in_meta;
     Espa_internal_meta_t tmp_meta;
     Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata array
                                        within the output structure */
@@ -451,25 +501,13 @@ add_test_band_product
     char envi_file[PATH_MAX];
     char search_string[PATH_MAX];
 
-    /* Initialize the input metadata structure */
-    init_metadata_struct (&in_meta);
-
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (xml_filename, &in_meta) != SUCCESS)
-    {
-        /* Error messages already written */
-        return ERROR;
-    }
-
     /* Find the representative band for metadata information */
-    for (band_index = 0; band_index < in_meta.nbands; band_index++)
+    for (band_index = 0; band_index < xml_metadata->nbands; band_index++)
     {
         if (use_toa_flag)
         {
-            if (!strcmp (in_meta.band[band_index].name, "toa_band1") &&
-                !strcmp (in_meta.band[band_index].product, "toa_refl"))
+            if (!strcmp (xml_metadata->band[band_index].name, "toa_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "toa_refl"))
             {
                 /* this is the index we'll use for reflectance band info */
                 src_index = band_index;
@@ -478,8 +516,8 @@ add_test_band_product
         }
         else
         {
-            if (!strcmp (in_meta.band[band_index].name, "sr_band1") &&
-                !strcmp (in_meta.band[band_index].product, "sr_refl"))
+            if (!strcmp (xml_metadata->band[band_index].name, "sr_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "sr_refl"))
             {
                 /* this is the index we'll use for reflectance band info */
                 src_index = band_index;
@@ -490,9 +528,9 @@ add_test_band_product
 
     /* Figure out the scene name */
     snprintf (scene_name, sizeof(scene_name), "%s",
-              in_meta.band[src_index].file_name);
+              xml_metadata->band[src_index].file_name);
     snprintf (search_string, sizeof(search_string), "_%s",
-              in_meta.band[src_index].name);
+              xml_metadata->band[src_index].name);
     my_char = strstr(scene_name, search_string);
     if (my_char != NULL)
         *my_char = '\0';
@@ -525,12 +563,15 @@ add_test_band_product
     }
 
     /* Figure out how many elements are in the data */
-    element_count = in_meta.band[src_index].nlines *
-                    in_meta.band[src_index].nsamps;
+    element_count = xml_metadata->band[src_index].nlines *
+                    xml_metadata->band[src_index].nsamps;
 
-    /* First write out the ENVI band and header files */
-    if (write_16bit_dswe_product (image_filename, element_count, data)
-        != SUCCESS)
+    /* First write out the ENVI band and header files, unless the strip
+       pipeline has written the band already */
+    if (data != NULL
+        && write_16bit_dswe_product (image_filename, io_backend,
+                                     element_count, data)
+           != SUCCESS)
     {
         RETURN_ERROR ("Failed creating output ENVI files", MODULE_NAME,
                       ERROR);
@@ -549,7 +590,7 @@ add_test_band_product
     bmeta = tmp_meta.band;
 
     snprintf (bmeta[0].short_name, sizeof (bmeta[0].short_name),
-              "%s", in_meta.band[src_index].short_name);
+              "%s", xml_metadata->band[src_index].short_name);
     bmeta[0].short_name[4] = '\0';
     strcat (bmeta[0].short_name, short_name);
     snprintf (bmeta[0].product, sizeof (bmeta[0].product),
@@ -563,10 +604,10 @@ add_test_band_product
         snprintf (bmeta[0].source, sizeof (bmeta[0].source), "sr_refl");
     }
     snprintf (bmeta[0].category, sizeof (bmeta[0].category), "qa");
-    bmeta[0].nlines = in_meta.band[src_index].nlines;
-    bmeta[0].nsamps = in_meta.band[src_index].nsamps;
-    bmeta[0].pixel_size[0] = in_meta.band[src_index].pixel_size[0];
-    bmeta[0].pixel_size[1] = in_meta.band[src_index].pixel_size[1];
+    bmeta[0].nlines = xml_metadata->band[src_index].nlines;
+    bmeta[0].nsamps = xml_metadata->band[src_index].nsamps;
+    bmeta[0].pixel_size[0] = xml_metadata->band[src_index].pixel_size[0];
+    bmeta[0].pixel_size[1] = xml_metadata->band[src_index].pixel_size[1];
     snprintf (bmeta[0].pixel_units, sizeof (bmeta[0].pixel_units), "meters");
     snprintf (bmeta[0].app_version, sizeof (bmeta[0].app_version),
               "dswe_%s", DSWE_VERSION);
@@ -586,7 +627,8 @@ add_test_band_product
               "%s", image_filename);
 
     /* Create the ENVI header file this band */
-    if (create_envi_struct (&bmeta[0], &in_meta.global, &envi_hdr) != SUCCESS)
+    if (create_envi_struct (&bmeta[0], &xml_metadata->global, &envi_hdr)
+        != SUCCESS)
     {
         RETURN_ERROR ("Failed to create ENVI header structure.", MODULE_NAME,
                       ERROR);
@@ -615,7 +657,13 @@ add_test_band_product
                       ERROR);
     }
 
-    free_metadata (&in_meta);
+    /* Keep the metadata in step with the XML */
+    if (add_band_to_metadata (xml_metadata, &bmeta[0]) != SUCCESS)
+    {
+        /* Error messages already written */
+        return ERROR;
+    }
+
     free_metadata (&tmp_meta);
 
     return SUCCESS;
@@ -628,7 +676,9 @@ add_test_band_product
   PURPOSE:  Create a new envi output file including envi header and add the
             associated information to the XML metadata file.
 
-  NOTE: Only for the Percent-Slope DSWE band output.
+  NOTE: Only for the Percent-Slope DSWE band output.  With NULL data the
+        image file is not written, because it was written through
+        open_band_product_image.
 
   RETURN VALUE:  Type = int
       Value    Description
@@ -640,7 +690,9 @@ int
 add_ps_band_product
 (
     char *xml_filename,
+    Espa_internal_meta_t *xml_metadata,
     bool use_toa_flag,
+    Io_Backend_e io_backend,
     char *product_name,
     char *band_name,
     char *short_name,
@@ -657,7 +709,6 @@ add_ps_band_product
     char scene_name[PATH_MAX];
     char image_filename[PATH_MAX];
     char *my_char = NULL;
-    Espa_internal_meta_t in_meta;
     Espa_internal_meta_t tmp_meta;
     Espa_band_meta_t *bmeta = NULL; /* pointer to the band metadata array
                                        within the output structure */
@@ -668,25 +719,13 @@ add_ps_band_product
     char envi_file[PATH_MAX];
     char search_string[PATH_MAX];
 
-    /* Initialize the input metadata structure */
-    init_metadata_struct (&in_meta);
-
-    /* Parse the metadata file into our internal metadata structure; also
-       allocates space as needed for various pointers in the global and band
-       metadata */
-    if (parse_metadata (xml_filename, &in_meta) != SUCCESS)
-    {
-        /* Error messages already written */
-        return ERROR;
-    }
-
     /* Find the representative band for metadata information */
-    for (band_index = 0; band_index < in_meta.nbands; band_index++)
+    for (band_index = 0; band_index < xml_metadata->nbands; band_index++)
     {
         if (use_toa_flag)
         {
-            if (!strcmp (in_meta.band[band_index].name, "toa_band1") &&
-                !strcmp (in_meta.band[band_index].product, "toa_refl"))
+            if (!strcmp (xml_metadata->band[band_index].name, "toa_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "toa_refl"))
             {
                 /* this is the index we'll use for reflectance band info */
                 src_index = band_index;
@@ -695,8 +734,8 @@ add_ps_band_product
         }
         else
         {
-            if (!strcmp (in_meta.band[band_index].name, "sr_band1") &&
-                !strcmp (in_meta.band[band_index].product, "sr_refl"))
+            if (!strcmp (xml_metadata->band[band_index].name, "sr_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "sr_refl"))
             {
                 /* this is the index we'll use for reflectance band info */
                 src_index = band_index;
@@ -706,9 +745,9 @@ add_ps_band_product
     }
 
     /* Figure out the scene name */
-    strcpy (scene_name, in_meta.band[src_index].file_name);
+    strcpy (scene_name, xml_metadata->band[src_index].file_name);
     snprintf (search_string, sizeof(search_string), "_%s",
-              in_meta.band[src_index].name);
+              xml_metadata->band[src_index].name);
     my_char = strstr(scene_name, search_string);
     if (my_char != NULL)
         *my_char = '\0';
@@ -741,12 +780,15 @@ add_ps_band_product
     }
 
     /* Figure out how many elements are in the data */
-    element_count = in_meta.band[src_index].nlines *
-                    in_meta.band[src_index].nsamps;
+    element_count = xml_metadata->band[src_index].nlines *
+                    xml_metadata->band[src_index].nsamps;
 
-    /* First write out the ENVI band and header files */
-    if (write_16bit_dswe_product (image_filename, element_count, data)
-        != SUCCESS)
+    /* First write out the ENVI band and header files, unless the strip
+       pipeline has written the band already */
+    if (data != NULL
+        && write_16bit_dswe_product (image_filename, io_backend,
+                                     element_count, data)
+           != SUCCESS)
     {
         RETURN_ERROR ("Failed creating output ENVI files", MODULE_NAME,
                       ERROR);
@@ -765,7 +807,7 @@ add_ps_band_product
     bmeta = tmp_meta.band;
 
     snprintf (bmeta[0].short_name, sizeof (bmeta[0].short_name),
-              "%s", in_meta.band[src_index].short_name);
+              "%s", xml_metadata->band[src_index].short_name);
     bmeta[0].short_name[4] = '\0';
     strcat (bmeta[0].short_name, short_name);
     snprintf (bmeta[0].product, sizeof (bmeta[0].product),
@@ -779,10 +821,10 @@ add_ps_band_product
         snprintf (bmeta[0].source, sizeof (bmeta[0].source), "sr_refl");
     }
     snprintf (bmeta[0].category, sizeof (bmeta[0].category), "image");
-    bmeta[0].nlines = in_meta.band[src_index].nlines;
-    bmeta[0].nsamps = in_meta.band[src_index].nsamps;
-    bmeta[0].pixel_size[0] = in_meta.band[src_index].pixel_size[0];
-    bmeta[0].pixel_size[1] = in_meta.band[src_index].pixel_size[1];
+    bmeta[0].nlines = xml_metadata->band[src_index].nlines;
+    bmeta[0].nsamps = xml_metadata->band[src_index].nsamps;
+    bmeta[0].pixel_size[0] = xml_metadata->band[src_index].pixel_size[0];
+    bmeta[0].pixel_size[1] = xml_metadata->band[src_index].pixel_size[1];
     bmeta[0].scale_factor = PERCENT_SLOPE_SCALE_FACTOR;
     snprintf (bmeta[0].pixel_units, sizeof (bmeta[0].pixel_units), "meters");
     snprintf (bmeta[0].app_version, sizeof (bmeta[0].app_version),
@@ -803,7 +845,8 @@ add_ps_band_product
               "%s", image_filename);
 
     /* Create the ENVI header file this band */
-    if (create_envi_struct (&bmeta[0], &in_meta.global, &envi_hdr) != SUCCESS)
+    if (create_envi_struct (&bmeta[0], &xml_metadata->global, &envi_hdr)
+        != SUCCESS)
     {
         RETURN_ERROR ("Failed to create ENVI header structure.", MODULE_NAME,
                       ERROR);
@@ -832,8 +875,93 @@ add_ps_band_product
                        MODULE_NAME, ERROR);
     }
 
-    free_metadata (&in_meta);
+    /* Keep the metadata in step with the XML */
+    if (add_band_to_metadata (xml_metadata, &bmeta[0]) != SUCCESS)
+    {
+        /* Error messages already written */
+        return ERROR;
+    }
+
     free_metadata (&tmp_meta);
 
     return SUCCESS;
 }
+
+
+/*****************************************************************************
+  NAME:  open_band_product_image
+
+  PURPOSE:  Create the image file of an output band, for writing the band a
+            strip at a time before add_*_band_product is called for it with
+            NULL data.
+
+  RETURN VALUE:  Type = Io_Writer_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The writer of the image file, at its start.
+*****************************************************************************/
+Io_Writer_t *
+open_band_product_image
+(
+    Espa_internal_meta_t *xml_metadata,
+    bool use_toa_flag,
+    Io_Backend_e io_backend,
+    char *band_name
+)
+{
+    int count;
+    int band_index = -1;
+    int src_index = -1;
+    char scene_name[PATH_MAX];
+    char image_filename[PATH_MAX];
+    char search_string[PATH_MAX];
+    char *my_char = NULL;
+
+    /* Find the representative band, which the output is named after */
+    for (band_index = 0; band_index < xml_metadata->nbands; band_index++)
+    {
+        if (use_toa_flag)
+        {
+            if (!strcmp (xml_metadata->band[band_index].name, "toa_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "toa_refl"))
+            {
+                src_index = band_index;
+                break;
+            }
+        }
+        else
+        {
+            if (!strcmp (xml_metadata->band[band_index].name, "sr_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "sr_refl"))
+            {
+                src_index = band_index;
+                break;
+            }
+        }
+    }
+    if (src_index == -1)
+    {
+        RETURN_ERROR ("Failed finding the representative band", MODULE_NAME,
+                      NULL);
+    }
+
+    /* Figure out the scene name */
+    strcpy (scene_name, xml_metadata->band[src_index].file_name);
+    snprintf (search_string, sizeof(search_string), "_%s",
+              xml_metadata->band[src_index].name);
+    my_char = strstr(scene_name, search_string);
+    if (my_char != NULL)
+        *my_char = '\0';
+
+    /* Figure out the output filename, as add_*_band_product does */
+    count = snprintf (image_filename, sizeof (image_filename),
+                      "%s_%s.img", scene_name, band_name);
+    if (count < 0 || count >= sizeof (image_filename))
+    {
+        RETURN_ERROR ("Failed creating output filename", MODULE_NAME, NULL);
+    }
+
+    /* The I/O backend reports its own errors */
+    return open_io_writer (io_backend, image_filename);
+}
@@ -3,19 +3,23 @@
 #define OUTPUT_H
 
 
+#include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
 
 #include "espa_metadata.h"
 
 #include "const.h"
+#include "io_backend.h"
 
 
 int
 add_dswe_band_product
 (
     char *xml_filename,
+    Espa_internal_meta_t *xml_metadata,
     bool use_toa_flag,
+    Io_Backend_e io_backend,
     char *product_name,
     char *band_name,
     char *short_name,
@@ -32,7 +36,9 @@ int
 add_test_band_product
 (
     char *xml_filename,
+    Espa_internal_meta_t *xml_metadata,
     bool use_toa_flag,
+    Io_Backend_e io_backend,
     char *product_name,
     char *band_name,
     char *short_name,
@@ -47,7 +53,9 @@ int
 add_ps_band_product
 (
     char *xml_filename,
+    Espa_internal_meta_t *xml_metadata,
     bool use_toa_flag,
+    Io_Backend_e io_backend,
     char *product_name,
     char *band_name,
     char *short_name,
@@ -58,4 +66,14 @@ add_ps_band_product
 );
 
 
+Io_Writer_t *
+open_band_product_image
+(
+    Espa_internal_meta_t *xml_metadata,
+    bool use_toa_flag,
+    Io_Backend_e io_backend,
+    char *band_name
+);
+
+
 #endif /* OUTPUT_H */
@@ -0,0 +1,756 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "output.h"
+#include "pipeline.h"
+
+
+/* Number of reflectance and QA bands read a strip at a time */
+#define STRIP_BAND_COUNT I_BAND_ELEVATION
+
+
+/* Structure for reading one strip of the reflectance and QA bands */
+typedef struct
+{
+    Input_Data_t *input_data;   /* Input the strip is read from */
+    int16_t *band[STRIP_BAND_COUNT]; /* Lines of each band; the Pixel QA
+                                        values are unsigned */
+    int first_line;             /* First line of the strip */
+    int line_count;             /* Lines in the strip */
+    const Dswe_Classifier_t *classifier; /* Settings the Pixel QA is checked
+                                            with when sparse */
+    bool sparse_flag;           /* Only read the reflectance of the blocks
+                                   needing it */
+    uint8_t *block_read;        /* Whether the reflectance of each block of
+                                   the strip was read, when sparse */
+    int block_cols;             /* Blocks across the strip */
+    int blocks_skipped;         /* Blocks of the strip whose reflectance was
+                                   not read */
+    int status;                 /* SUCCESS or ERROR once the read is done */
+    pthread_t thread;           /* Thread doing the read */
+    bool pending;               /* The thread has not been joined yet */
+} Strip_Read_t;
+
+
+/* Structure for classifying one strip and writing it to the output bands */
+typedef struct
+{
+    Dswe_Product_Files_t *files; /* Image files of the output bands */
+    int16_t *diag;              /* Lines of each output band, NULL for the */
+    uint8_t *interpreted;       /* bands that are not output */
+    uint8_t *pshsccss;
+    uint8_t *mask;
+    int16_t *ps;
+    uint8_t *hillshade;
+    int samples;                /* Samples in each line */
+    int line_count;             /* Lines in the strip */
+    int status;                 /* SUCCESS or ERROR once the write is done */
+    pthread_t thread;           /* Thread doing the write */
+    bool pending;               /* The thread has not been joined yet */
+} Strip_Write_t;
+
+
+/*****************************************************************************
+  NAME:  close_dswe_product_files
+
+  PURPOSE:  Close the image files of the output bands written by the
+            pipeline.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  All the files were flushed and closed.
+      ERROR    A file could not be flushed; its band is incomplete.
+*****************************************************************************/
+int
+close_dswe_product_files
+(
+    Dswe_Product_Files_t *files /* IO: files from open_dswe_product_files */
+)
+{
+    Io_Writer_t **file[] = {&files->diag, &files->interpreted,
+                            &files->pshsccss, &files->mask, &files->ps,
+                            &files->hillshade};
+    int index;
+    int status = SUCCESS;
+
+    /* close_io_writer reports its own errors */
+    for (index = 0; index < sizeof (file) / sizeof (file[0]); index++)
+    {
+        if (*file[index] != NULL && close_io_writer (*file[index]) != SUCCESS)
+            status = ERROR;
+        *file[index] = NULL;
+    }
+
+    return status;
+}
+
+
+/*****************************************************************************
+  NAME:  open_dswe_product_files
+
+  PURPOSE:  Create the image files of the output bands, which the pipeline
+            writes a strip at a time.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The files were created.
+      ERROR    An error was encountered; no file is left open.
+
+  NOTES:
+    1. The bands are added to the XML with NULL data once the pipeline is
+       done, which writes their ENVI headers and metadata without writing
+       the images again.
+*****************************************************************************/
+int
+open_dswe_product_files
+(
+    Espa_internal_meta_t *xml_metadata, /* I: metadata of the scene */
+    bool use_toa_flag,          /* I: the scene is processed from TOA */
+    Io_Backend_e io_backend,    /* I: how to write the image files */
+    bool include_tests_flag,    /* I: the diagnostic band is output */
+    bool include_ps_flag,       /* I: the percent slope band is output */
+    bool include_hs_flag,       /* I: the hillshade band is output */
+    Dswe_Product_Files_t *files /* O: image files of the output bands */
+)
+{
+    files->diag = NULL;
+    files->ps = NULL;
+    files->hillshade = NULL;
+
+    files->interpreted = open_band_product_image (xml_metadata, use_toa_flag,
+                                                  io_backend,
+                                                  INTERPRETED_BAND_NAME);
+    files->pshsccss = open_band_product_image (xml_metadata, use_toa_flag,
+                                               io_backend, PS_SC_BAND_NAME);
+    files->mask = open_band_product_image (xml_metadata, use_toa_flag,
+                                           io_backend, MASK_BAND_NAME);
+    if (files->interpreted == NULL || files->pshsccss == NULL
+        || files->mask == NULL)
+    {
+        close_dswe_product_files (files);
+        return ERROR;
+    }
+
+    if (include_tests_flag)
+    {
+        files->diag = open_band_product_image (xml_metadata, use_toa_flag,
+                                               io_backend, DIAG_BAND_NAME);
+        if (files->diag == NULL)
+        {
+            close_dswe_product_files (files);
+            return ERROR;
+        }
+    }
+
+    if (include_ps_flag)
+    {
+        files->ps = open_band_product_image (xml_metadata, use_toa_flag,
+                                             io_backend, PS_BAND_NAME);
+        if (files->ps == NULL)
+        {
+            close_dswe_product_files (files);
+            return ERROR;
+        }
+    }
+
+    if (include_hs_flag)
+    {
+        files->hillshade = open_band_product_image (xml_metadata,
+                                                    use_toa_flag, io_backend,
+                                                    HS_BAND_NAME);
+        if (files->hillshade == NULL)
+        {
+            close_dswe_product_files (files);
+            return ERROR;
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  block_run_end
+
+  PURPOSE:  Find the end of the run of blocks on a row of blocks of a strip
+            that were read, or skipped, like the first block of the run.
+
+  RETURN VALUE:  Type = int
+      The block column following the run.
+*****************************************************************************/
+static int
+block_run_end
+(
+    const Strip_Read_t *read,   /* I: strip read sparsely */
+    int block_row,              /* I: row of blocks of the strip */
+    int block_col               /* I: first block of the run */
+)
+{
+    const uint8_t *row = &read->block_read[block_row * read->block_cols];
+    int end = block_col + 1;
+
+    while (end < read->block_cols && row[end] == row[block_col])
+        end++;
+
+    return end;
+}
+
+
+/*****************************************************************************
+  NAME:  read_sparse_strip
+
+  PURPOSE:  Read the Pixel QA of a strip, then the reflectance of only the
+            blocks of the strip that need it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The strip was read.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. Blocks whose pixels are all fill, cloud, cloud shadow or snow are
+       populated from their Pixel QA alone, see mask_dswe_samples, so their
+       reflectance is never read and is left undefined in the buffers.
+*****************************************************************************/
+static int
+read_sparse_strip
+(
+    Strip_Read_t *read          /* IO: the strip to read */
+)
+{
+    Input_Data_t *input_data = read->input_data;
+    int samples = input_data->samples;
+    uint16_t *band_pixelqa = (uint16_t *) read->band[I_BAND_PIXELQA];
+    int block_rows;
+    int block_row;
+    int block_col;
+    int run_end;
+    int block_first_line;       /* First line of the row of blocks in the
+                                   strip */
+    int block_lines;            /* Lines in the row of blocks */
+    int first_sample;
+    int sample_count;
+    int line;
+    int index;
+    size_t offset;
+
+    if (read_band_lines (input_data, I_BAND_PIXELQA, read->first_line,
+                         read->line_count, band_pixelqa) != SUCCESS)
+    {
+        return ERROR;
+    }
+
+    block_rows = (read->line_count + SPARSE_BLOCK_LINES - 1)
+                 / SPARSE_BLOCK_LINES;
+    for (block_row = 0; block_row < block_rows; block_row++)
+    {
+        block_first_line = block_row * SPARSE_BLOCK_LINES;
+        block_lines = read->line_count - block_first_line;
+        if (block_lines > SPARSE_BLOCK_LINES)
+            block_lines = SPARSE_BLOCK_LINES;
+
+        /* Decide for every block of the row from its Pixel QA */
+        for (block_col = 0; block_col < read->block_cols; block_col++)
+        {
+            first_sample = block_col * SPARSE_BLOCK_SAMPLES;
+            sample_count = samples - first_sample;
+            if (sample_count > SPARSE_BLOCK_SAMPLES)
+                sample_count = SPARSE_BLOCK_SAMPLES;
+
+            offset = (size_t) block_first_line * samples + first_sample;
+            read->block_read[block_row * read->block_cols + block_col] =
+                dswe_block_needs_reflectance (read->classifier,
+                    &band_pixelqa[offset], block_lines, sample_count,
+                    samples);
+            if (!read->block_read[block_row * read->block_cols + block_col])
+                read->blocks_skipped++;
+        }
+
+        /* Read the runs of blocks needing their reflectance line by line */
+        for (block_col = 0; block_col < read->block_cols;
+             block_col = run_end)
+        {
+            run_end = block_run_end (read, block_row, block_col);
+            if (!read->block_read[block_row * read->block_cols + block_col])
+                continue;
+
+            first_sample = block_col * SPARSE_BLOCK_SAMPLES;
+            sample_count = run_end * SPARSE_BLOCK_SAMPLES - first_sample;
+            if (first_sample + sample_count > samples)
+                sample_count = samples - first_sample;
+
+            for (line = block_first_line;
+                 line < block_first_line + block_lines; line++)
+            {
+                offset = (size_t) line * samples + first_sample;
+                for (index = 0; index < STRIP_BAND_COUNT; index++)
+                {
+                    if (index == I_BAND_PIXELQA)
+                        continue;
+
+                    if (read_band_samples (input_data, index,
+                                           read->first_line + line,
+                                           first_sample, sample_count,
+                                           &read->band[index][offset])
+                        != SUCCESS)
+                    {
+                        return ERROR;
+                    }
+                }
+            }
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  classify_sparse_strip
+
+  PURPOSE:  Classify a strip read by read_sparse_strip, populating the blocks
+            whose reflectance was skipped from their Pixel QA.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+classify_sparse_strip
+(
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    const Strip_Read_t *read,   /* I: the strip */
+    Strip_Write_t *write        /* O: the classified strip */
+)
+{
+    int samples = read->input_data->samples;
+    int block_row;
+    int block_col;
+    int run_end;
+    int first_sample;
+    int sample_count;
+    int line;                   /* Line in the strip */
+    size_t offset;
+
+    for (line = 0; line < read->line_count; line++)
+    {
+        block_row = line / SPARSE_BLOCK_LINES;
+
+        for (block_col = 0; block_col < read->block_cols;
+             block_col = run_end)
+        {
+            run_end = block_run_end (read, block_row, block_col);
+
+            first_sample = block_col * SPARSE_BLOCK_SAMPLES;
+            sample_count = run_end * SPARSE_BLOCK_SAMPLES - first_sample;
+            if (first_sample + sample_count > samples)
+                sample_count = samples - first_sample;
+            offset = (size_t) line * samples + first_sample;
+
+            if (read->block_read[block_row * read->block_cols + block_col])
+            {
+                classify_dswe_samples (classifier, read->first_line + line,
+                    first_sample, sample_count,
+                    &read->band[I_BAND_BLUE][offset],
+                    &read->band[I_BAND_GREEN][offset],
+                    &read->band[I_BAND_RED][offset],
+                    &read->band[I_BAND_NIR][offset],
+                    &read->band[I_BAND_SWIR1][offset],
+                    &read->band[I_BAND_SWIR2][offset],
+                    (uint16_t *) &read->band[I_BAND_PIXELQA][offset],
+                    (write->diag != NULL) ? &write->diag[offset] : NULL,
+                    &write->interpreted[offset], &write->pshsccss[offset],
+                    &write->mask[offset]);
+            }
+            else
+            {
+                mask_dswe_samples (classifier, read->first_line + line,
+                    first_sample, sample_count,
+                    (uint16_t *) &read->band[I_BAND_PIXELQA][offset],
+                    (write->diag != NULL) ? &write->diag[offset] : NULL,
+                    &write->interpreted[offset], &write->pshsccss[offset],
+                    &write->mask[offset]);
+            }
+        }
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  read_strip_thread
+
+  PURPOSE:  Thread body reading one strip of the reflectance and QA bands.
+
+  RETURN VALUE:  Type = void *
+      Always NULL; the outcome is in the status of the read.
+*****************************************************************************/
+static void *
+read_strip_thread
+(
+    void *arg                   /* IO: the Strip_Read_t of the strip */
+)
+{
+    Strip_Read_t *read = arg;
+    int index;
+
+    read->status = SUCCESS;
+    read->blocks_skipped = 0;
+    if (read->sparse_flag)
+    {
+        read->status = read_sparse_strip (read);
+        return NULL;
+    }
+
+    for (index = 0; index < STRIP_BAND_COUNT; index++)
+    {
+        if (read_band_lines (read->input_data, index, read->first_line,
+                             read->line_count, read->band[index])
+            != SUCCESS)
+        {
+            read->status = ERROR;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  write_strip_thread
+
+  PURPOSE:  Thread body appending one classified strip to the output bands.
+
+  RETURN VALUE:  Type = void *
+      Always NULL; the outcome is in the status of the write.
+*****************************************************************************/
+static void *
+write_strip_thread
+(
+    void *arg                   /* IO: the Strip_Write_t of the strip */
+)
+{
+    Strip_Write_t *write = arg;
+    Dswe_Product_Files_t *files = write->files;
+    size_t pixels = (size_t) write->line_count * write->samples;
+
+    write->status = SUCCESS;
+    if ((files->diag != NULL
+         && write_io_writer (files->diag, write->diag,
+                             pixels * sizeof (int16_t)) != SUCCESS)
+        || write_io_writer (files->interpreted, write->interpreted,
+                            pixels * sizeof (uint8_t)) != SUCCESS
+        || write_io_writer (files->pshsccss, write->pshsccss,
+                            pixels * sizeof (uint8_t)) != SUCCESS
+        || write_io_writer (files->mask, write->mask,
+                            pixels * sizeof (uint8_t)) != SUCCESS
+        || (files->ps != NULL
+            && write_io_writer (files->ps, write->ps,
+                                pixels * sizeof (int16_t)) != SUCCESS)
+        || (files->hillshade != NULL
+            && write_io_writer (files->hillshade, write->hillshade,
+                                pixels * sizeof (uint8_t)) != SUCCESS))
+    {
+        write->status = ERROR;
+    }
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  start_stage
+
+  PURPOSE:  Run a pipeline stage on its own thread, or right away when the
+            thread cannot be created.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+start_stage
+(
+    void *(*stage) (void *),    /* I: thread body of the stage */
+    void *arg,                  /* IO: argument of the thread body */
+    pthread_t *thread,          /* O: thread running the stage */
+    bool *pending               /* O: the thread needs to be joined */
+)
+{
+    *pending = (pthread_create (thread, NULL, stage, arg) == 0);
+    if (!*pending)
+        stage (arg);
+}
+
+
+/*****************************************************************************
+  NAME:  finish_stage
+
+  PURPOSE:  Wait for a pipeline stage started by start_stage.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+finish_stage
+(
+    pthread_t thread,           /* I: thread running the stage */
+    bool *pending               /* IO: the thread needs to be joined */
+)
+{
+    if (*pending)
+    {
+        pthread_join (thread, NULL);
+        *pending = false;
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  run_dswe_pipeline
+
+  PURPOSE:  Classify the scene a strip of lines at a time, reading the next
+            strip and writing the previous one while a strip is classified.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  All the strips were read, classified and written.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. Each step of the pipeline reads strip N + 1 and writes strip N - 1 on
+       their own threads while strip N is classified, then waits for both.
+       The wall time of a step is the longest of the three, so the I/O is
+       hidden behind the classification and the other way around.
+    2. The input and output strips are double buffered: the classification
+       uses one buffer of each while the read fills the other input buffer
+       and the write drains the other output buffer.  Only four strips are
+       in memory, whatever the size of the scene.
+    3. The classification stays on the calling thread, since it computes
+       slope classes on demand.
+    4. When sparse, the read of a strip starts with its Pixel QA and skips
+       the reflectance of the blocks that are all fill, cloud, cloud shadow
+       or snow.  Those pixels are populated from their Pixel QA alone.
+*****************************************************************************/
+int
+run_dswe_pipeline
+(
+    Input_Data_t *input_data,   /* I: input with the band files open */
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    const float *band_ps,       /* I: percent slope on the elevation grid,
+                                      used when files->ps is set */
+    int strip_lines,            /* I: lines in each strip */
+    bool sparse_flag,           /* I: only read the reflectance of the
+                                      blocks whose Pixel QA needs it */
+    Dswe_Product_Files_t *files, /* I: image files of the output bands */
+    bool verbose_flag           /* I: report the pipeline setup */
+)
+{
+    Strip_Read_t reads[2];      /* Double buffered input strips */
+    Strip_Write_t writes[2];    /* Double buffered output strips */
+    Strip_Read_t *read;
+    Strip_Write_t *write;
+    int lines = input_data->lines;
+    int samples = input_data->samples;
+    size_t strip_pixels;        /* Pixels in a full strip */
+    int strip_count;            /* Strips in the scene */
+    int step;
+    int strip;                  /* Strip being classified */
+    int buffer;
+    int index;
+    int block_cols;             /* Sparse blocks across a strip */
+    int block_count;            /* Sparse blocks in a full strip */
+    int blocks_skipped = 0;     /* Sparse blocks not read in the scene */
+    int blocks_total = 0;       /* Sparse blocks in the scene */
+    int status = SUCCESS;
+    char msg[256];
+
+    if (strip_lines > lines)
+        strip_lines = lines;
+    strip_pixels = (size_t) strip_lines * samples;
+    strip_count = (lines + strip_lines - 1) / strip_lines;
+    block_cols = (samples + SPARSE_BLOCK_SAMPLES - 1) / SPARSE_BLOCK_SAMPLES;
+    block_count = ((strip_lines + SPARSE_BLOCK_LINES - 1)
+                   / SPARSE_BLOCK_LINES) * block_cols;
+
+    if (verbose_flag)
+    {
+        snprintf (msg, sizeof (msg), "Pipelining %d strips of %d lines",
+                  strip_count, strip_lines);
+        LOG_MESSAGE (msg, MODULE_NAME);
+    }
+
+    /* Allocate both buffers of each stage; calloc leaves the unused
+       output bands NULL for the cleanup */
+    for (buffer = 0; buffer < 2; buffer++)
+    {
+        read = &reads[buffer];
+        write = &writes[buffer];
+
+        read->input_data = input_data;
+        read->classifier = classifier;
+        read->sparse_flag = sparse_flag;
+        read->block_cols = block_cols;
+        read->block_read = NULL;
+        read->pending = false;
+        if (sparse_flag)
+        {
+            read->block_read = malloc (block_count * sizeof (uint8_t));
+            if (read->block_read == NULL)
+                status = ERROR;
+        }
+        for (index = 0; index < STRIP_BAND_COUNT; index++)
+        {
+            read->band[index] = malloc (strip_pixels * sizeof (int16_t));
+            if (read->band[index] == NULL)
+                status = ERROR;
+        }
+
+        write->files = files;
+        write->samples = samples;
+        write->pending = false;
+        write->diag = NULL;
+        write->ps = NULL;
+        write->hillshade = NULL;
+        write->interpreted = malloc (strip_pixels * sizeof (uint8_t));
+        write->pshsccss = malloc (strip_pixels * sizeof (uint8_t));
+        write->mask = malloc (strip_pixels * sizeof (uint8_t));
+        if (write->interpreted == NULL || write->pshsccss == NULL
+            || write->mask == NULL)
+            status = ERROR;
+        if (files->diag != NULL)
+        {
+            write->diag = malloc (strip_pixels * sizeof (int16_t));
+            if (write->diag == NULL)
+                status = ERROR;
+        }
+        if (files->ps != NULL)
+        {
+            write->ps = malloc (strip_pixels * sizeof (int16_t));
+            if (write->ps == NULL)
+                status = ERROR;
+        }
+        if (files->hillshade != NULL)
+        {
+            write->hillshade = malloc (strip_pixels * sizeof (uint8_t));
+            if (write->hillshade == NULL)
+                status = ERROR;
+        }
+    }
+    if (status != SUCCESS)
+        ERROR_MESSAGE ("Failed allocating memory for the strip buffers",
+                       MODULE_NAME);
+
+    /* Step N reads strip N, classifies strip N - 1 and writes strip N - 2,
+       so the pipeline fills over the first two steps and drains over the
+       last two */
+    for (step = 0; status == SUCCESS && step < strip_count + 2; step++)
+    {
+        if (step < strip_count)
+        {
+            read = &reads[step % 2];
+            read->first_line = step * strip_lines;
+            read->line_count = strip_lines;
+            if (read->first_line + read->line_count > lines)
+                read->line_count = lines - read->first_line;
+            start_stage (read_strip_thread, read, &read->thread,
+                         &read->pending);
+        }
+
+        if (step >= 2)
+        {
+            write = &writes[step % 2];
+            start_stage (write_strip_thread, write, &write->thread,
+                         &write->pending);
+        }
+
+        strip = step - 1;
+        if (strip >= 0 && strip < strip_count)
+        {
+            read = &reads[strip % 2];
+            write = &writes[strip % 2];
+            write->line_count = read->line_count;
+
+            if (sparse_flag)
+                classify_sparse_strip (classifier, read, write);
+            else
+            {
+                classify_dswe_lines (classifier, read->first_line,
+                    read->line_count, read->band[I_BAND_BLUE],
+                    read->band[I_BAND_GREEN], read->band[I_BAND_RED],
+                    read->band[I_BAND_NIR], read->band[I_BAND_SWIR1],
+                    read->band[I_BAND_SWIR2],
+                    (uint16_t *) read->band[I_BAND_PIXELQA], write->diag,
+                    write->interpreted, write->pshsccss, write->mask);
+            }
+
+            if (files->ps != NULL)
+            {
+                scale_percent_slope_lines (classifier->dem_grid_map, band_ps,
+                    read->first_line, read->line_count, write->ps);
+            }
+            if (files->hillshade != NULL)
+            {
+                resample_dem_grid_lines_uint8 (classifier->dem_grid_map,
+                    classifier->band_hillshade, read->first_line,
+                    read->line_count, write->hillshade);
+            }
+        }
+
+        /* Both buffers change roles on the next step */
+        if (step < strip_count)
+        {
+            read = &reads[step % 2];
+            finish_stage (read->thread, &read->pending);
+            if (read->status != SUCCESS)
+            {
+                snprintf (msg, sizeof (msg), "Failed reading the strip"
+                          " starting at line %d", read->first_line);
+                ERROR_MESSAGE (msg, MODULE_NAME);
+                status = ERROR;
+            }
+            blocks_skipped += read->blocks_skipped;
+            blocks_total += ((read->line_count + SPARSE_BLOCK_LINES - 1)
+                             / SPARSE_BLOCK_LINES) * block_cols;
+        }
+        if (step >= 2)
+        {
+            write = &writes[step % 2];
+            finish_stage (write->thread, &write->pending);
+            if (write->status != SUCCESS)
+            {
+                ERROR_MESSAGE ("Failed writing a strip of the output bands",
+                               MODULE_NAME);
+                status = ERROR;
+            }
+        }
+    }
+
+    if (verbose_flag && sparse_flag && status == SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Sparse reading skipped the reflectance"
+                  " of %d of %d blocks", blocks_skipped, blocks_total);
+        LOG_MESSAGE (msg, MODULE_NAME);
+    }
+
+    for (buffer = 0; buffer < 2; buffer++)
+    {
+        free (reads[buffer].block_read);
+        for (index = 0; index < STRIP_BAND_COUNT; index++)
+            free (reads[buffer].band[index]);
+        free (writes[buffer].diag);
+        free (writes[buffer].interpreted);
+        free (writes[buffer].pshsccss);
+        free (writes[buffer].mask);
+        free (writes[buffer].ps);
+        free (writes[buffer].hillshade);
+    }
+
+    return status;
+}
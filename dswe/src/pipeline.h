@@ -0,0 +1,72 @@
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+
+#include "input.h"
+#include "classify.h"
+#include "io_backend.h"
+
+
+/* Size of the blocks whose reflectance is skipped by the sparse reading
+   when their Pixel QA makes it unnecessary.  Runs of blocks needing it on a
+   line are read together, so a strip without cloud or fill is read with
+   one read per line and band. */
+#define SPARSE_BLOCK_LINES 16
+#define SPARSE_BLOCK_SAMPLES 256
+
+
+/* Structure for the image files of the output bands written by the strip
+   pipeline, NULL for the bands that are not output */
+typedef struct
+{
+    Io_Writer_t *diag;          /* Diagnostic band, int16 */
+    Io_Writer_t *interpreted;   /* Interpreted band, uint8 */
+    Io_Writer_t *pshsccss;      /* Filtered interpreted band, uint8 */
+    Io_Writer_t *mask;          /* Mask band, uint8 */
+    Io_Writer_t *ps;            /* Scaled percent slope band, int16 */
+    Io_Writer_t *hillshade;     /* Hillshade band, uint8 */
+} Dswe_Product_Files_t;
+
+
+int
+open_dswe_product_files
+(
+    Espa_internal_meta_t *xml_metadata, /* I: metadata of the scene */
+    bool use_toa_flag,          /* I: the scene is processed from TOA */
+    Io_Backend_e io_backend,    /* I: how to write the image files */
+    bool include_tests_flag,    /* I: the diagnostic band is output */
+    bool include_ps_flag,       /* I: the percent slope band is output */
+    bool include_hs_flag,       /* I: the hillshade band is output */
+    Dswe_Product_Files_t *files /* O: image files of the output bands */
+);
+
+
+int
+close_dswe_product_files
+(
+    Dswe_Product_Files_t *files /* IO: files from open_dswe_product_files */
+);
+
+
+int
+run_dswe_pipeline
+(
+    Input_Data_t *input_data,   /* I: input with the band files open */
+    const Dswe_Classifier_t *classifier, /* I: classification settings */
+    const float *band_ps,       /* I: percent slope on the elevation grid,
+                                      used when files->ps is set */
+    int strip_lines,            /* I: lines in each strip */
+    bool sparse_flag,           /* I: only read the reflectance of the
+                                      blocks whose Pixel QA needs it */
+    Dswe_Product_Files_t *files, /* I: image files of the output bands */
+    bool verbose_flag           /* I: report the pipeline setup */
+);
+
+
+#endif /* PIPELINE_H */
@@ -0,0 +1,417 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+#include "espa_metadata.h"
+#include "write_metadata.h"
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "scene_window.h"
+
+
+/*****************************************************************************
+  NAME:  parse_scene_window
+
+  PURPOSE:  Parse a window of the scene given on the command line.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The window was parsed.
+      ERROR    The text is not a window.
+*****************************************************************************/
+int
+parse_scene_window
+(
+    const char *text,         /* I: line0,sample0,lines,samples */
+    Scene_Window_t *window    /* O: the window */
+)
+{
+    int consumed = 0;
+
+    if (sscanf (text, "%d,%d,%d,%d%n", &window->line, &window->sample,
+                &window->lines, &window->samples, &consumed) != 4
+        || text[consumed] != '\0')
+    {
+        return ERROR;
+    }
+
+    if (window->line < 0 || window->sample < 0 || window->lines <= 0
+        || window->samples <= 0)
+    {
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  parse_scene_bbox
+
+  PURPOSE:  Parse a bounding box given on the command line.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bounding box was parsed.
+      ERROR    The text is not a bounding box.
+*****************************************************************************/
+int
+parse_scene_bbox
+(
+    const char *text,         /* I: xmin,ymin,xmax,ymax */
+    double bbox[4]            /* O: xmin, ymin, xmax and ymax */
+)
+{
+    int consumed = 0;
+
+    if (sscanf (text, "%lf,%lf,%lf,%lf%n", &bbox[0], &bbox[1], &bbox[2],
+                &bbox[3], &consumed) != 4
+        || text[consumed] != '\0')
+    {
+        return ERROR;
+    }
+
+    if (!(bbox[0] < bbox[2]) || !(bbox[1] < bbox[3]))
+        return ERROR;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  find_bbox_window
+
+  PURPOSE:  Find the window of the scene holding the pixels a bounding box in
+            the projection of the scene overlaps.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The window was found.
+      ERROR    The bounding box does not overlap the scene.
+
+  NOTES:
+    1. An edge of the box within a millionth of a pixel of a pixel edge is
+       taken to be on it, so a box snapped to the grid gives the pixels
+       inside it.
+*****************************************************************************/
+int
+find_bbox_window
+(
+    const double bbox[4],     /* I: xmin, ymin, xmax and ymax in the
+                                    projection of the scene */
+    double ul_x,              /* I: x of the upper left corner of the
+                                    scene */
+    double ul_y,              /* I: y of the upper left corner of the
+                                    scene */
+    double x_pixel_size,      /* I: pixel size of the scene in x */
+    double y_pixel_size,      /* I: pixel size of the scene in y */
+    int lines,                /* I: lines of the scene */
+    int samples,              /* I: samples of the scene */
+    Scene_Window_t *window    /* O: pixels of the scene in the box */
+)
+{
+    double first_sample;
+    double end_sample;
+    double first_line;
+    double end_line;
+    char msg[256];
+
+    /* The box in pixels, clipped to the scene */
+    first_sample = floor ((bbox[0] - ul_x) / x_pixel_size + 1e-6);
+    end_sample = ceil ((bbox[2] - ul_x) / x_pixel_size - 1e-6);
+    first_line = floor ((ul_y - bbox[3]) / y_pixel_size + 1e-6);
+    end_line = ceil ((ul_y - bbox[1]) / y_pixel_size - 1e-6);
+
+    first_sample = fmax (first_sample, 0.0);
+    end_sample = fmin (end_sample, samples);
+    first_line = fmax (first_line, 0.0);
+    end_line = fmin (end_line, lines);
+    if (!(first_sample < end_sample) || !(first_line < end_line))
+    {
+        snprintf (msg, sizeof (msg), "Bounding box %g,%g,%g,%g does not"
+                  " overlap the scene", bbox[0], bbox[1], bbox[2], bbox[3]);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    window->line = (int) first_line;
+    window->sample = (int) first_sample;
+    window->lines = (int) end_line - window->line;
+    window->samples = (int) end_sample - window->sample;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  find_representative_band
+
+  PURPOSE:  Find the band the output bands take their size and names from,
+            as add_*_band_product does.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      -1       The metadata has no such band.
+      *        Index of the band in the metadata.
+*****************************************************************************/
+static int
+find_representative_band
+(
+    const Espa_internal_meta_t *xml_metadata, /* I: metadata of the scene */
+    bool use_toa_flag         /* I: the scene is processed from TOA */
+)
+{
+    int band_index;
+
+    for (band_index = 0; band_index < xml_metadata->nbands; band_index++)
+    {
+        if (use_toa_flag)
+        {
+            if (!strcmp (xml_metadata->band[band_index].name, "toa_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "toa_refl"))
+            {
+                return band_index;
+            }
+        }
+        else
+        {
+            if (!strcmp (xml_metadata->band[band_index].name, "sr_band1") &&
+                !strcmp (xml_metadata->band[band_index].product, "sr_refl"))
+            {
+                return band_index;
+            }
+        }
+    }
+
+    return -1;
+}
+
+
+/*****************************************************************************
+  NAME:  window_global_metadata
+
+  PURPOSE:  Move the corners in the global metadata of the scene to those of
+            a window of it.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The projection corners are moved by whole pixels, so they keep the
+       grid origin of the scene.
+    2. The geographic corners and bounding coordinates are interpolated
+       between those of the scene.  That is exact for geographic scenes, and
+       approximates the curvature of the latitude and longitude lines across
+       a projected scene.
+*****************************************************************************/
+static void
+window_global_metadata
+(
+    Espa_global_meta_t *global, /* IO: global metadata of the scene, then of
+                                       the window */
+    const Scene_Window_t *window, /* I: window of the scene */
+    int lines,                /* I: lines of the scene */
+    int samples,              /* I: samples of the scene */
+    double x_pixel_size,      /* I: pixel size of the scene in x */
+    double y_pixel_size       /* I: pixel size of the scene in y */
+)
+{
+    Espa_proj_meta_t *proj = &global->proj_info;
+    double x_span = proj->lr_corner[0] - proj->ul_corner[0];
+    double y_span = proj->ul_corner[1] - proj->lr_corner[1];
+    double ul_x_fraction = 0.0;
+    double lr_x_fraction = 1.0;
+    double ul_y_fraction = 0.0;
+    double lr_y_fraction = 1.0;
+    double ul_lat = global->ul_corner[0];
+    double ul_lon = global->ul_corner[1];
+    double lr_lat = global->lr_corner[0];
+    double lr_lon = global->lr_corner[1];
+    double west = global->bounding_coords[ESPA_WEST];
+    double east = global->bounding_coords[ESPA_EAST];
+    double north = global->bounding_coords[ESPA_NORTH];
+    double south = global->bounding_coords[ESPA_SOUTH];
+
+    proj->ul_corner[0] += window->sample * x_pixel_size;
+    proj->ul_corner[1] -= window->line * y_pixel_size;
+    proj->lr_corner[0] -= (samples - window->sample - window->samples)
+                          * x_pixel_size;
+    proj->lr_corner[1] += (lines - window->line - window->lines)
+                          * y_pixel_size;
+
+    /* Where the window corners are between the scene corners */
+    if (x_span != 0.0)
+    {
+        ul_x_fraction = (double) window->sample * x_pixel_size / x_span;
+        lr_x_fraction = 1.0 - (double) (samples - window->sample
+                                        - window->samples)
+                              * x_pixel_size / x_span;
+    }
+    if (y_span != 0.0)
+    {
+        ul_y_fraction = (double) window->line * y_pixel_size / y_span;
+        lr_y_fraction = 1.0 - (double) (lines - window->line - window->lines)
+                              * y_pixel_size / y_span;
+    }
+
+    global->ul_corner[0] = ul_lat + ul_y_fraction * (lr_lat - ul_lat);
+    global->ul_corner[1] = ul_lon + ul_x_fraction * (lr_lon - ul_lon);
+    global->lr_corner[0] = ul_lat + lr_y_fraction * (lr_lat - ul_lat);
+    global->lr_corner[1] = ul_lon + lr_x_fraction * (lr_lon - ul_lon);
+
+    global->bounding_coords[ESPA_WEST] = west + ul_x_fraction * (east - west);
+    global->bounding_coords[ESPA_EAST] = west + lr_x_fraction * (east - west);
+    global->bounding_coords[ESPA_NORTH] = north
+                                          - ul_y_fraction * (north - south);
+    global->bounding_coords[ESPA_SOUTH] = north
+                                          - lr_y_fraction * (north - south);
+}
+
+
+/*****************************************************************************
+  NAME:  create_window_metadata
+
+  PURPOSE:  Write the XML of a window of the scene, and replace the metadata
+            of the scene with that of the window, for adding the DSWE bands
+            of the window to.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The XML of the window was written.
+      ERROR    An error was encountered; the scene is left as it was.
+
+  NOTES:
+    1. The XML of the window is named after the XML of the scene with
+       WINDOW_NAME_SUFFIX added, and holds the global metadata of the window
+       without any bands, since the bands of the scene are not cropped.  The
+       DSWE bands are appended to it as they are written.
+    2. The metadata of the window keeps the representative band, cropped to
+       the window and renamed with WINDOW_NAME_SUFFIX after the scene name,
+       so the DSWE bands of the window get the size of the window and names
+       of their own.  That band is not in the XML of the window, so no
+       metadata sidecar is compiled from the metadata of the window.
+*****************************************************************************/
+int
+create_window_metadata
+(
+    char **xml_filename,      /* IO: XML of the scene, replaced by the XML
+                                     of the window */
+    Espa_internal_meta_t *xml_metadata, /* IO: metadata of the scene,
+                                     replaced by that of the window */
+    bool use_toa_flag,        /* I: the scene is processed from TOA */
+    const Scene_Window_t *window /* I: window of the scene */
+)
+{
+    Espa_internal_meta_t window_metadata;
+    Espa_internal_meta_t window_xml; /* what is written to the XML */
+    Espa_band_meta_t *band;
+    char *window_filename = NULL;
+    char search_string[STR_SIZE + 1];
+    char *my_char = NULL;
+    size_t stem_length;
+    int src_index;
+    int count;
+
+    src_index = find_representative_band (xml_metadata, use_toa_flag);
+    if (src_index == -1)
+    {
+        RETURN_ERROR ("Failed finding the representative band", MODULE_NAME,
+                      ERROR);
+    }
+
+    /* Name the XML of the window after the XML of the scene */
+    stem_length = strlen (*xml_filename);
+    if (stem_length > 4
+        && strcmp (&(*xml_filename)[stem_length - 4], ".xml") == 0)
+    {
+        stem_length -= 4;
+    }
+    window_filename = malloc (stem_length + strlen (WINDOW_NAME_SUFFIX) + 5);
+    if (window_filename == NULL)
+    {
+        RETURN_ERROR ("Failed allocating the window XML filename",
+                      MODULE_NAME, ERROR);
+    }
+    sprintf (window_filename, "%.*s%s.xml", (int) stem_length, *xml_filename,
+             WINDOW_NAME_SUFFIX);
+
+    /* The global metadata of the window and the cropped representative
+       band */
+    init_metadata_struct (&window_metadata);
+    memcpy (window_metadata.meta_namespace, xml_metadata->meta_namespace,
+            sizeof (window_metadata.meta_namespace));
+    window_metadata.global = xml_metadata->global;
+    window_global_metadata (&window_metadata.global, window,
+                            xml_metadata->band[src_index].nlines,
+                            xml_metadata->band[src_index].nsamps,
+                            xml_metadata->band[src_index].pixel_size[0],
+                            xml_metadata->band[src_index].pixel_size[1]);
+
+    if (allocate_band_metadata (&window_metadata, 1) != SUCCESS)
+    {
+        free (window_filename);
+        RETURN_ERROR ("Failed allocating band metadata", MODULE_NAME, ERROR);
+    }
+    band = &window_metadata.band[0];
+    *band = xml_metadata->band[src_index];
+    band->nbits = 0;
+    band->bitmap_description = NULL;
+    band->nclass = 0;
+    band->class_values = NULL;
+    band->ncover = 0;
+    band->percent_cover = NULL;
+    band->nlines = window->lines;
+    band->nsamps = window->samples;
+
+    snprintf (search_string, sizeof (search_string), "_%s", band->name);
+    my_char = strstr (xml_metadata->band[src_index].file_name,
+                      search_string);
+    if (my_char != NULL)
+    {
+        count = snprintf (band->file_name, sizeof (band->file_name),
+                          "%.*s%s%s",
+                          (int) (my_char
+                                 - xml_metadata->band[src_index].file_name),
+                          xml_metadata->band[src_index].file_name,
+                          WINDOW_NAME_SUFFIX, my_char);
+    }
+    else
+    {
+        count = snprintf (band->file_name, sizeof (band->file_name), "%s%s",
+                          xml_metadata->band[src_index].file_name,
+                          WINDOW_NAME_SUFFIX);
+    }
+    if (count < 0 || count >= sizeof (band->file_name))
+    {
+        free_metadata (&window_metadata);
+        free (window_filename);
+        RETURN_ERROR ("Failed creating the window band filename",
+                      MODULE_NAME, ERROR);
+    }
+
+    /* None of the bands of the scene are in the XML of the window */
+    window_xml = window_metadata;
+    window_xml.nbands = 0;
+    window_xml.band = NULL;
+    if (write_metadata (&window_xml, window_filename) != SUCCESS)
+    {
+        free_metadata (&window_metadata);
+        free (window_filename);
+        RETURN_ERROR ("Failed writing the window XML", MODULE_NAME, ERROR);
+    }
+
+    free_metadata (xml_metadata);
+    *xml_metadata = window_metadata;
+    free (*xml_filename);
+    *xml_filename = window_filename;
+
+    return SUCCESS;
+}
@@ -0,0 +1,71 @@
+
+#ifndef SCENE_WINDOW_H
+#define SCENE_WINDOW_H
+
+
+#include <stdbool.h>
+
+#include "espa_metadata.h"
+
+
+/* Suffix added to the scene name in the names of the XML and the images of
+   a window */
+#define WINDOW_NAME_SUFFIX "_window"
+
+
+/* Structure for a window of the scene, in pixels of the reflectance grid */
+typedef struct
+{
+    int line;                 /* First line of the window */
+    int sample;               /* First sample of the window */
+    int lines;                /* Lines in the window */
+    int samples;              /* Samples in the window */
+} Scene_Window_t;
+
+
+int
+parse_scene_window
+(
+    const char *text,         /* I: line0,sample0,lines,samples */
+    Scene_Window_t *window    /* O: the window */
+);
+
+
+int
+parse_scene_bbox
+(
+    const char *text,         /* I: xmin,ymin,xmax,ymax */
+    double bbox[4]            /* O: xmin, ymin, xmax and ymax */
+);
+
+
+int
+find_bbox_window
+(
+    const double bbox[4],     /* I: xmin, ymin, xmax and ymax in the
+                                    projection of the scene */
+    double ul_x,              /* I: x of the upper left corner of the
+                                    scene */
+    double ul_y,              /* I: y of the upper left corner of the
+                                    scene */
+    double x_pixel_size,      /* I: pixel size of the scene in x */
+    double y_pixel_size,      /* I: pixel size of the scene in y */
+    int lines,                /* I: lines of the scene */
+    int samples,              /* I: samples of the scene */
+    Scene_Window_t *window    /* O: pixels of the scene in the box */
+);
+
+
+int
+create_window_metadata
+(
+    char **xml_filename,      /* IO: XML of the scene, replaced by the XML
+                                     of the window */
+    Espa_internal_meta_t *xml_metadata, /* IO: metadata of the scene,
+                                     replaced by that of the window */
+    bool use_toa_flag,        /* I: the scene is processed from TOA */
+    const Scene_Window_t *window /* I: window of the scene */
+);
+
+
+#endif /* SCENE_WINDOW_H */
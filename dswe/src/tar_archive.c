@@ -0,0 +1,682 @@
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "tar_archive.h"
+
+
+/* Tar archives are made of 512 byte blocks */
+#define TAR_BLOCK_SIZE 512
+
+/* Size of the data copied at a time when extracting a member */
+#define TAR_COPY_SIZE (64 * 1024)
+
+
+/* Structure for the state of the scan of the headers of an archive */
+typedef struct
+{
+    int fd;               /* The archive, when not compressed */
+    gzFile gz;            /* The archive, when gzip compressed */
+} Tar_Scan_t;
+
+
+/* Structure for reading a member of a gzip compressed archive through a
+   stdio stream */
+typedef struct
+{
+    gzFile gz;            /* The archive, positioned in the member */
+    uint64_t remaining;   /* Bytes of the member not read yet */
+} Tar_Gz_Member_t;
+
+
+/*****************************************************************************
+  NAME:  is_compressed_archive
+
+  PURPOSE:  Check whether an archive is gzip compressed from its suffix.
+
+  RETURN VALUE:  Type = bool
+      True for a .gz or .tgz file.
+*****************************************************************************/
+static bool
+is_compressed_archive
+(
+    const char *filename      /* I: name of the archive */
+)
+{
+    const char *suffix = strrchr (filename, '.');
+
+    return suffix != NULL
+           && (strcmp (suffix, ".gz") == 0 || strcmp (suffix, ".tgz") == 0);
+}
+
+
+/*****************************************************************************
+  NAME:  read_scan_bytes
+
+  PURPOSE:  Read bytes of the uncompressed archive being scanned.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were read.
+      ERROR    The archive failed to read or ends before the bytes.
+
+  NOTES:
+    1. A compressed archive is only read forward, so seeking to the next
+       header decompresses the member data in between.
+*****************************************************************************/
+static int
+read_scan_bytes
+(
+    Tar_Scan_t *scan,         /* IO: scan in progress */
+    uint64_t offset,          /* I: offset in the uncompressed archive */
+    size_t size,              /* I: number of bytes to read */
+    void *buffer              /* O: memory for size bytes */
+)
+{
+    char *next = buffer;
+    ssize_t count;
+
+    if (scan->gz != NULL)
+    {
+        if (gzseek (scan->gz, (z_off_t) offset, SEEK_SET) != (z_off_t) offset
+            || gzread (scan->gz, buffer, size) != (int) size)
+        {
+            return ERROR;
+        }
+        return SUCCESS;
+    }
+
+    while (size > 0)
+    {
+        count = pread (scan->fd, next, size, (off_t) offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return ERROR;
+
+        next += count;
+        offset += count;
+        size -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  parse_number
+
+  PURPOSE:  Parse a numeric field of a tar header, which is octal text or,
+            for large values written by GNU tar, base 256.
+
+  RETURN VALUE:  Type = uint64_t
+      The value of the field.
+*****************************************************************************/
+static uint64_t
+parse_number
+(
+    const uint8_t *field,     /* I: the field */
+    int size                  /* I: size of the field in bytes */
+)
+{
+    uint64_t value = 0;
+    int index;
+
+    if (field[0] & 0x80)
+    {
+        value = field[0] & 0x7f;
+        for (index = 1; index < size; index++)
+            value = (value << 8) | field[index];
+        return value;
+    }
+
+    for (index = 0; index < size && field[index] == ' '; index++)
+        ;
+    for (; index < size && field[index] >= '0' && field[index] <= '7';
+         index++)
+    {
+        value = (value << 3) | (field[index] - '0');
+    }
+
+    return value;
+}
+
+
+/*****************************************************************************
+  NAME:  valid_header
+
+  PURPOSE:  Check the checksum of a tar header.
+
+  RETURN VALUE:  Type = bool
+      True when the header checksum matches.
+*****************************************************************************/
+static bool
+valid_header
+(
+    const uint8_t *header     /* I: the header block */
+)
+{
+    uint64_t sum = 0;
+    int index;
+
+    /* The checksum is computed with its own field as spaces */
+    for (index = 0; index < TAR_BLOCK_SIZE; index++)
+    {
+        if (index >= 148 && index < 156)
+            sum += ' ';
+        else
+            sum += header[index];
+    }
+
+    return sum == parse_number (&header[148], 8);
+}
+
+
+/*****************************************************************************
+  NAME:  add_member
+
+  PURPOSE:  Append a regular file to the index of an archive.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The member was added.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+add_member
+(
+    Tar_Archive_t *archive,   /* IO: archive being indexed */
+    const char *name,         /* I: name of the member */
+    uint64_t offset,          /* I: offset of the member data */
+    uint64_t size             /* I: size of the member data */
+)
+{
+    Tar_Member_t *members;
+    Tar_Member_t *member;
+
+    members = realloc (archive->members, (archive->member_count + 1)
+                                         * sizeof (Tar_Member_t));
+    if (members == NULL)
+    {
+        RETURN_ERROR ("Error allocating memory for the tar archive index",
+                      MODULE_NAME, ERROR);
+    }
+    archive->members = members;
+
+    member = &archive->members[archive->member_count];
+    member->name = strdup (name);
+    if (member->name == NULL)
+    {
+        RETURN_ERROR ("Error allocating memory for the tar archive index",
+                      MODULE_NAME, ERROR);
+    }
+    member->offset = offset;
+    member->size = size;
+    archive->member_count++;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  scan_headers
+
+  PURPOSE:  Index the regular files of an archive from its headers.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The archive was indexed.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. ustar names with a prefix and GNU long names are understood.  Other
+       extended headers, directories and links are skipped.
+    2. An archive ending without its end of archive blocks is accepted,
+       as long as the data of its last member is all there.
+*****************************************************************************/
+static int
+scan_headers
+(
+    Tar_Scan_t *scan,         /* IO: scan of the archive */
+    Tar_Archive_t *archive    /* IO: archive being indexed */
+)
+{
+    uint8_t header[TAR_BLOCK_SIZE];
+    char name[PATH_MAX];
+    char long_name[PATH_MAX] = "";
+    uint64_t offset = 0;
+    uint64_t size;
+    const Tar_Member_t *last;
+    int index;
+    int type;
+    char msg[256];
+
+    while (read_scan_bytes (scan, offset, TAR_BLOCK_SIZE, header) == SUCCESS)
+    {
+        /* A zero block ends the archive */
+        for (index = 0; index < TAR_BLOCK_SIZE && header[index] == 0; index++)
+            ;
+        if (index == TAR_BLOCK_SIZE)
+            break;
+
+        if (!valid_header (header))
+        {
+            snprintf (msg, sizeof (msg), "Invalid tar header in (%s)",
+                      archive->filename);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
+
+        size = parse_number (&header[124], 12);
+        type = header[156];
+        offset += TAR_BLOCK_SIZE;
+
+        if (type == 'L')
+        {
+            /* GNU long name of the next member */
+            if (size >= sizeof (long_name)
+                || read_scan_bytes (scan, offset, size, long_name) != SUCCESS)
+            {
+                snprintf (msg, sizeof (msg), "Invalid tar long name in (%s)",
+                          archive->filename);
+                RETURN_ERROR (msg, MODULE_NAME, ERROR);
+            }
+            long_name[size] = '\0';
+        }
+        else if (type == '0' || type == '\0' || type == '7')
+        {
+            if (long_name[0] != '\0')
+                snprintf (name, sizeof (name), "%s", long_name);
+            else if (header[345] != '\0')
+            {
+                snprintf (name, sizeof (name), "%.155s/%.100s",
+                          (char *) &header[345], (char *) header);
+            }
+            else
+                snprintf (name, sizeof (name), "%.100s", (char *) header);
+            long_name[0] = '\0';
+
+            if (add_member (archive, name, offset, size) != SUCCESS)
+                return ERROR;
+        }
+        else
+            long_name[0] = '\0';
+
+        offset += (size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE
+                  * TAR_BLOCK_SIZE;
+    }
+
+    /* The members before the last header read are complete, the last one
+       may have been cut short */
+    if (archive->member_count > 0)
+    {
+        last = &archive->members[archive->member_count - 1];
+        if (last->size > 0
+            && read_scan_bytes (scan, last->offset + last->size - 1, 1,
+                                header) != SUCCESS)
+        {
+            snprintf (msg, sizeof (msg), "Truncated tar archive (%s)",
+                      archive->filename);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_tar_archive
+
+  PURPOSE:  Open a tar archive and index its regular files from one scan of
+            its headers.
+
+  RETURN VALUE:  Type = Tar_Archive_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The index of the archive.
+
+  NOTES:
+    1. The headers of an uncompressed archive are read with a seek from
+       one to the next, which only reads the headers.  A compressed archive
+       has to be decompressed once to find them.
+*****************************************************************************/
+Tar_Archive_t *
+open_tar_archive
+(
+    const char *filename      /* I: name of a .tar, .tar.gz or .tgz file */
+)
+{
+    Tar_Archive_t *archive = NULL;
+    Tar_Scan_t scan;
+    int status;
+    char msg[256];
+
+    archive = calloc (1, sizeof (Tar_Archive_t));
+    if (archive == NULL)
+    {
+        RETURN_ERROR ("Error allocating memory for a tar archive",
+                      MODULE_NAME, NULL);
+    }
+    archive->filename = strdup (filename);
+    archive->compressed = is_compressed_archive (filename);
+
+    scan.fd = -1;
+    scan.gz = NULL;
+    if (archive->compressed)
+        scan.gz = gzopen (filename, "rb");
+    else
+        scan.fd = open (filename, O_RDONLY);
+    if (archive->filename == NULL || (scan.gz == NULL && scan.fd < 0))
+    {
+        snprintf (msg, sizeof (msg), "Failed to open (%s)", filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        if (scan.gz != NULL)
+            gzclose (scan.gz);
+        close_tar_archive (archive);
+        return NULL;
+    }
+
+    status = scan_headers (&scan, archive);
+
+    if (scan.gz != NULL)
+        gzclose (scan.gz);
+    if (scan.fd >= 0)
+        close (scan.fd);
+
+    if (status != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed indexing the tar archive (%s)",
+                  filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        close_tar_archive (archive);
+        return NULL;
+    }
+
+    return archive;
+}
+
+
+/*****************************************************************************
+  NAME:  find_tar_member
+
+  PURPOSE:  Find the member of an archive for a file.
+
+  RETURN VALUE:  Type = const Tar_Member_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     No member has the name of the file.
+      *        The last member with the name of the file.
+
+  NOTES:
+    1. Only the names without their directories are compared, so the XML
+       can name its bands relative to wherever the archive was made from.
+*****************************************************************************/
+const Tar_Member_t *
+find_tar_member
+(
+    const Tar_Archive_t *archive, /* I: archive from open_tar_archive */
+    const char *filename      /* I: file to look for, matched on the name
+                                    without its directories */
+)
+{
+    const char *base_name;
+    const char *member_name;
+    int index;
+
+    base_name = strrchr (filename, '/');
+    base_name = (base_name != NULL) ? base_name + 1 : filename;
+
+    /* A member added again later replaces the earlier one */
+    for (index = archive->member_count - 1; index >= 0; index--)
+    {
+        member_name = strrchr (archive->members[index].name, '/');
+        member_name = (member_name != NULL) ? member_name + 1
+                                            : archive->members[index].name;
+        if (strcmp (member_name, base_name) == 0)
+            return &archive->members[index];
+    }
+
+    return NULL;
+}
+
+
+/*****************************************************************************
+  NAME:  read_gz_member
+
+  PURPOSE:  Read function of the stdio stream of a member of a compressed
+            archive, which ends at the end of the member.
+
+  RETURN VALUE:  Type = ssize_t
+      The number of bytes read, 0 at the end of the member, -1 on error.
+*****************************************************************************/
+static ssize_t
+read_gz_member
+(
+    void *cookie,             /* IO: the Tar_Gz_Member_t of the stream */
+    char *buffer,             /* O: memory for size bytes */
+    size_t size               /* I: most bytes to read */
+)
+{
+    Tar_Gz_Member_t *member = cookie;
+    int count;
+
+    if (size > member->remaining)
+        size = member->remaining;
+    if (size > INT_MAX)
+        size = INT_MAX;
+    if (size == 0)
+        return 0;
+
+    count = gzread (member->gz, buffer, size);
+    if (count <= 0)
+        return -1;
+    member->remaining -= count;
+
+    return count;
+}
+
+
+/*****************************************************************************
+  NAME:  close_gz_member
+
+  PURPOSE:  Close function of the stdio stream of a member of a compressed
+            archive.
+
+  RETURN VALUE:  Type = int
+      0 on success, EOF on error.
+*****************************************************************************/
+static int
+close_gz_member
+(
+    void *cookie              /* I: the Tar_Gz_Member_t of the stream */
+)
+{
+    Tar_Gz_Member_t *member = cookie;
+    int status;
+
+    status = gzclose (member->gz);
+    free (member);
+
+    return (status == Z_OK) ? 0 : EOF;
+}
+
+
+/*****************************************************************************
+  NAME:  open_tar_member
+
+  PURPOSE:  Open a member of an archive for reading it with stdio.
+
+  RETURN VALUE:  Type = FILE *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A stream positioned at the start of the member data, to be
+               closed with fclose.
+
+  NOTES:
+    1. The stream of an uncompressed archive is the archive file itself,
+       so it can be read with pread and mapped at the member offset.
+       Reading it past the size of the member reads the rest of the
+       archive.
+    2. The stream of a compressed archive decompresses the archive up to
+       the member when opened, then ends with the member.
+*****************************************************************************/
+FILE *
+open_tar_member
+(
+    const Tar_Archive_t *archive, /* I: archive from open_tar_archive */
+    const Tar_Member_t *member /* I: member to read */
+)
+{
+    FILE *file;
+    Tar_Gz_Member_t *gz_member;
+    cookie_io_functions_t functions = {read_gz_member, NULL, NULL,
+                                       close_gz_member};
+    char msg[256];
+
+    snprintf (msg, sizeof (msg), "Failed to open (%s) in (%s)",
+              member->name, archive->filename);
+
+    if (!archive->compressed)
+    {
+        file = fopen (archive->filename, "rb");
+        if (file == NULL || fseeko (file, member->offset, SEEK_SET) != 0)
+        {
+            if (file != NULL)
+                fclose (file);
+            RETURN_ERROR (msg, MODULE_NAME, NULL);
+        }
+        return file;
+    }
+
+    gz_member = malloc (sizeof (Tar_Gz_Member_t));
+    if (gz_member == NULL)
+        RETURN_ERROR (msg, MODULE_NAME, NULL);
+    gz_member->remaining = member->size;
+    gz_member->gz = gzopen (archive->filename, "rb");
+    if (gz_member->gz == NULL)
+    {
+        free (gz_member);
+        RETURN_ERROR (msg, MODULE_NAME, NULL);
+    }
+
+    if (gzseek (gz_member->gz, (z_off_t) member->offset, SEEK_SET)
+        != (z_off_t) member->offset)
+    {
+        close_gz_member (gz_member);
+        RETURN_ERROR (msg, MODULE_NAME, NULL);
+    }
+
+    file = fopencookie (gz_member, "rb", functions);
+    if (file == NULL)
+    {
+        close_gz_member (gz_member);
+        RETURN_ERROR (msg, MODULE_NAME, NULL);
+    }
+
+    return file;
+}
+
+
+/*****************************************************************************
+  NAME:  extract_tar_member
+
+  PURPOSE:  Write the data of a member of an archive to a file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The member was extracted.
+      ERROR    An error was encountered.
+*****************************************************************************/
+int
+extract_tar_member
+(
+    const Tar_Archive_t *archive, /* I: archive from open_tar_archive */
+    const Tar_Member_t *member, /* I: member to extract */
+    const char *filename      /* I: file to write the member data to */
+)
+{
+    FILE *input;
+    FILE *output;
+    char *buffer;
+    uint64_t remaining = member->size;
+    size_t count;
+    int status = SUCCESS;
+    char msg[256];
+
+    input = open_tar_member (archive, member);
+    if (input == NULL)
+        return ERROR;
+
+    output = fopen (filename, "wb");
+    buffer = malloc (TAR_COPY_SIZE);
+    if (output == NULL || buffer == NULL)
+        status = ERROR;
+
+    while (status == SUCCESS && remaining > 0)
+    {
+        count = (remaining > TAR_COPY_SIZE) ? TAR_COPY_SIZE : remaining;
+        if (fread (buffer, 1, count, input) != count
+            || fwrite (buffer, 1, count, output) != count)
+        {
+            status = ERROR;
+        }
+        remaining -= count;
+    }
+
+    free (buffer);
+    fclose (input);
+    if (output != NULL && fclose (output) != 0)
+        status = ERROR;
+
+    if (status != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed extracting (%s) to (%s)",
+                  member->name, filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  close_tar_archive
+
+  PURPOSE:  Free the index of an archive.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_tar_archive
+(
+    Tar_Archive_t *archive    /* I: archive from open_tar_archive */
+)
+{
+    int index;
+
+    if (archive == NULL)
+        return;
+
+    for (index = 0; index < archive->member_count; index++)
+        free (archive->members[index].name);
+    free (archive->members);
+    free (archive->filename);
+    free (archive);
+}
@@ -0,0 +1,1225 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "build_slope_band.h"
+#include "build_hillshade_band.h"
+#include "gradient_operator.h"
+#include "build_horizon_band.h"
+#include "terrain_cache.h"
+
+
+#define TERRAIN_CACHE_MAGIC "DSWETRN"
+#define TERRAIN_CACHE_VERSION 3
+
+#define HORIZON_CACHE_MAGIC "DSWEHZN"
+#define HORIZON_CACHE_VERSION 2
+
+/* The bands start on a page boundary after the header */
+#define TERRAIN_CACHE_DATA_OFFSET 4096
+
+/* Rounds a band size up to a whole number of pages */
+#define PAGE_ALIGN(size) \
+    (((size) + TERRAIN_CACHE_DATA_OFFSET - 1) \
+     & ~((size_t) TERRAIN_CACHE_DATA_OFFSET - 1))
+
+/* States of the products in a shared memory segment */
+#define TERRAIN_SHM_BUILDING 0
+#define TERRAIN_SHM_READY 1
+#define TERRAIN_SHM_FAILED 2
+
+/* Seconds to wait for another process to build the shared products */
+#define TERRAIN_SHM_WAIT_SECONDS 300
+
+/* Milliseconds between checks of a segment another process is building */
+#define TERRAIN_SHM_POLL_MSEC 20
+
+
+/* Structure for the header at the start of a terrain cache file */
+typedef struct
+{
+    char magic[8];           /* TERRAIN_CACHE_MAGIC */
+    int32_t version;         /* TERRAIN_CACHE_VERSION */
+    int32_t slope_operator;  /* Gradient_Operator_Id_t of the percent
+                                slope */
+    int32_t hillshade_operator; /* Gradient_Operator_Id_t of the gradients */
+    uint64_t dem_hash;       /* Content hash of the DEM */
+    int32_t lines;           /* Number of lines in each band */
+    int32_t samples;         /* Number of samples in each band */
+    int32_t geographic;      /* 1 when the pixel sizes are in degrees */
+    int32_t reserved;        /* Padding, always 0 */
+    double x_pixel_size;     /* Pixel size of the DEM in x */
+    double y_pixel_size;     /* Pixel size of the DEM in y */
+    double ul_latitude;      /* Latitude of the top edge of a geographic
+                                DEM, 0 otherwise */
+} Terrain_Cache_Header_t;
+
+
+/* Structure for the header at the start of a shared memory segment.  The
+   state and reference count are only accessed atomically. */
+typedef struct
+{
+    Terrain_Cache_Header_t identity; /* Products held by the segment */
+    int32_t state;           /* TERRAIN_SHM_* state of the products */
+    int32_t creator_pid;     /* Process building the products */
+    int32_t ref_count;       /* Number of processes using the segment */
+} Terrain_Shm_Header_t;
+
+
+/* Structure for the header at the start of a horizon cache file */
+typedef struct
+{
+    char magic[8];           /* HORIZON_CACHE_MAGIC */
+    int32_t version;         /* HORIZON_CACHE_VERSION */
+    int32_t sector;          /* Azimuth sector of the horizon angles */
+    int32_t sector_count;    /* HORIZON_SECTOR_COUNT */
+    int32_t geographic;      /* 1 when the pixel sizes are in degrees */
+    uint64_t dem_hash;       /* Content hash of the DEM */
+    int32_t lines;           /* Number of lines in the band */
+    int32_t samples;         /* Number of samples in the band */
+    double x_pixel_size;     /* Pixel size of the DEM in x */
+    double y_pixel_size;     /* Pixel size of the DEM in y */
+    double ul_latitude;      /* Latitude of the top edge of a geographic
+                                DEM, 0 otherwise */
+} Horizon_Cache_Header_t;
+
+
+/*****************************************************************************
+  NAME:  hash_dem
+
+  PURPOSE:  Computes a content hash of the DEM for keying the cache files.
+
+  RETURN VALUE:  Type = uint64_t
+      The 64 bit FNV-1a hash of the DEM, taken a 64 bit word at a time.
+
+  NOTES:
+    1. This identifies the DEM, it is not meant to protect against deliberate
+       collisions.  The header of a cache file also records the DEM size and
+       geometry, which are checked before the cache file is used.
+*****************************************************************************/
+static uint64_t
+hash_dem
+(
+    int16_t *band_dem, /* I: the elevation data */
+    size_t pixel_count /* I: number of elevation values */
+)
+{
+    const uint64_t fnv_offset = 14695981039346656037ULL;
+    const uint64_t fnv_prime = 1099511628211ULL;
+    uint64_t hash = fnv_offset;
+    uint64_t word;
+    size_t index;
+    size_t byte_count = pixel_count * sizeof (int16_t);
+    unsigned char *bytes = (unsigned char *) band_dem;
+
+    for (index = 0; index + sizeof (word) <= byte_count;
+         index += sizeof (word))
+    {
+        memcpy (&word, &bytes[index], sizeof (word));
+        hash ^= word;
+        hash *= fnv_prime;
+    }
+
+    for (; index < byte_count; index++)
+    {
+        hash ^= bytes[index];
+        hash *= fnv_prime;
+    }
+
+    return hash;
+}
+
+
+/*****************************************************************************
+  NAME:  map_cache_file
+
+  PURPOSE:  Memory map an existing cache file and verify it holds the products
+            for the expected DEM.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The cache file was mapped and matches the DEM.
+      ERROR    No usable cache file exists.
+*****************************************************************************/
+static int
+map_cache_file
+(
+    const char *filename, /* I: name of the cache file */
+    size_t map_size,      /* I: expected size of the cache file */
+    const void *expected, /* I: header the cache file must have */
+    size_t header_size,   /* I: size of the header */
+    void **map            /* O: memory mapping of the cache file */
+)
+{
+    int fd;
+    struct stat file_stat;
+    char msg[PATH_MAX + 64];
+
+    fd = open (filename, O_RDONLY);
+    if (fd < 0)
+        return ERROR;
+
+    if (fstat (fd, &file_stat) != 0
+        || (size_t) file_stat.st_size != map_size)
+    {
+        close (fd);
+        snprintf (msg, sizeof (msg), "Ignoring terrain cache file with"
+                  " unexpected size (%s)", filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        return ERROR;
+    }
+
+    *map = mmap (NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (*map == MAP_FAILED)
+    {
+        *map = NULL;
+        return ERROR;
+    }
+
+    if (memcmp (*map, expected, header_size) != 0)
+    {
+        munmap (*map, map_size);
+        *map = NULL;
+        snprintf (msg, sizeof (msg), "Ignoring terrain cache file built for"
+                  " a different DEM (%s)", filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        return ERROR;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  create_cache_file
+
+  PURPOSE:  Create and memory map a zero filled temporary file for building
+            a cache file in place.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The temporary file was created and is mapped.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The blocks of the file are allocated up front, since a write through
+       the mapping that finds the file system full raises SIGBUS rather than
+       returning an error.
+*****************************************************************************/
+static int
+create_cache_file
+(
+    const char *filename, /* I: name of the cache file */
+    size_t map_size,      /* I: size of the cache file */
+    char *temp_filename,  /* O: name of the temporary file, PATH_MAX bytes */
+    void **map            /* O: memory mapping of the temporary file */
+)
+{
+    int fd;
+    int status;
+    char msg[PATH_MAX + 64];
+
+    snprintf (temp_filename, PATH_MAX, "%s.%d.tmp", filename,
+              (int) getpid ());
+
+    fd = open (temp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        snprintf (msg, sizeof (msg), "Failed creating terrain cache file"
+                  " (%s)", temp_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    status = posix_fallocate (fd, 0, map_size);
+    if (status != 0)
+    {
+        close (fd);
+        unlink (temp_filename);
+        snprintf (msg, sizeof (msg), "Failed allocating terrain cache file:"
+                  " %s (%s)", strerror (status), temp_filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    *map = mmap (NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (*map == MAP_FAILED)
+    {
+        *map = NULL;
+        unlink (temp_filename);
+        RETURN_ERROR ("Failed mapping terrain cache file", MODULE_NAME,
+                      ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  discard_cache_file
+
+  PURPOSE:  Unmap and remove a temporary file from create_cache_file whose
+            products could not be built.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+discard_cache_file
+(
+    const char *temp_filename, /* I: name of the temporary file */
+    void **map,           /* IO: memory mapping of the temporary file */
+    size_t map_size       /* I: size of the memory mapping */
+)
+{
+    munmap (*map, map_size);
+    *map = NULL;
+    unlink (temp_filename);
+}
+
+
+/*****************************************************************************
+  NAME:  publish_cache_file
+
+  PURPOSE:  Write the header of a cache file built with create_cache_file and
+            move it under its final name.
+
+  RETURN VALUE:  None
+
+  NOTES:
+    1. The header is written last so the file only identifies as a cache file
+       once the products are complete, and the rename means concurrent runs
+       never see a partially written cache file.
+    2. The products are synced to disk before the header is written, and the
+       header before the rename, so a file left by a crash or power loss
+       never has a valid header over missing products.
+*****************************************************************************/
+static void
+publish_cache_file
+(
+    const char *filename, /* I: name of the cache file */
+    const char *temp_filename, /* I: name of the temporary file */
+    void *map,            /* I: memory mapping of the temporary file */
+    size_t map_size,      /* I: size of the memory mapping */
+    const void *header,   /* I: header for the cache file */
+    size_t header_size    /* I: size of the header */
+)
+{
+    char msg[PATH_MAX + 64];
+
+    if (msync (map, map_size, MS_SYNC) != 0)
+    {
+        /* Still usable for this run, just not kept for the next */
+        unlink (temp_filename);
+        snprintf (msg, sizeof (msg), "Failed writing terrain cache file"
+                  " (%s)", filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+        return;
+    }
+
+    memcpy (map, header, header_size);
+
+    if (msync (map, header_size, MS_SYNC) != 0
+        || rename (temp_filename, filename) != 0)
+    {
+        /* Still usable for this run, just not kept for the next */
+        unlink (temp_filename);
+        snprintf (msg, sizeof (msg), "Failed publishing terrain cache file"
+                  " (%s)", filename);
+        WARNING_MESSAGE (msg, MODULE_NAME);
+    }
+}
+
+
+/*****************************************************************************
+  NAME:  init_terrain_cache_header
+
+  PURPOSE:  Fill in the header identifying the terrain products of the DEM.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+init_terrain_cache_header
+(
+    Terrain_Cache_Header_t *header, /* O: header for the products */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator /* I: operator for the
+                                                        gradients */
+)
+{
+    memset (header, 0, sizeof (*header));
+    snprintf (header->magic, sizeof (header->magic), "%s",
+              TERRAIN_CACHE_MAGIC);
+    header->version = TERRAIN_CACHE_VERSION;
+    header->slope_operator = slope_operator->id;
+    header->hillshade_operator = hillshade_operator->id;
+    header->dem_hash = hash_dem (band_dem, (size_t) num_lines * num_samples);
+    header->lines = num_lines;
+    header->samples = num_samples;
+    header->geographic = geometry->geographic;
+    header->x_pixel_size = geometry->x_pixel_size;
+    header->y_pixel_size = geometry->y_pixel_size;
+    header->ul_latitude = geometry->ul_latitude;
+}
+
+
+/*****************************************************************************
+  NAME:  build_terrain_products
+
+  PURPOSE:  Compute the percent slope and gradient bands, one after the
+            other, into zero filled memory.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The products were built.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+build_terrain_products
+(
+    Terrain_Cache_Header_t *header, /* I: header of the products */
+    int16_t *band_dem,              /* I: the elevation data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                          elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator, /* I: operator for the
+                                                         gradients */
+    float *percent_slope            /* O: percent slope band, followed by
+                                          the x and y gradient bands */
+)
+{
+    size_t pixel_count = (size_t) header->lines * header->samples;
+
+    /* The memory starts zero filled, which is the value the unprocessed
+       edge pixels need */
+    if (build_slope_band (band_dem, header->lines, header->samples,
+                          geometry, slope_operator, percent_slope) != SUCCESS
+        || build_gradient_bands (band_dem, header->lines, header->samples,
+                                 geometry, hillshade_operator,
+                                 percent_slope + pixel_count,
+                                 percent_slope + 2 * pixel_count) != SUCCESS)
+    {
+        RETURN_ERROR ("Failed building the terrain cache products",
+                      MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  build_terrain_cache_file
+
+  PURPOSE:  Compute the DEM derived products directly into a new cache file,
+            which is published under its final name once complete.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The cache file was built and is mapped.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+build_terrain_cache_file
+(
+    Terrain_Cache_t *terrain_cache, /* IO: filename and size in, mapping
+                                            out */
+    Terrain_Cache_Header_t *header, /* I: header for the cache file */
+    int16_t *band_dem,              /* I: the elevation data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                          elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator /* I: operator for the
+                                                        gradients */
+)
+{
+    char temp_filename[PATH_MAX];
+
+    if (create_cache_file (terrain_cache->filename, terrain_cache->map_size,
+                           temp_filename, &terrain_cache->map) != SUCCESS)
+    {
+        /* error messages provided by create_cache_file */
+        return ERROR;
+    }
+
+    /* Build the products in place */
+    if (build_terrain_products (header, band_dem, geometry, slope_operator,
+            hillshade_operator, (float *) ((char *) terrain_cache->map
+                                           + TERRAIN_CACHE_DATA_OFFSET))
+        != SUCCESS)
+    {
+        /* error messages provided by build_terrain_products */
+        discard_cache_file (temp_filename, &terrain_cache->map,
+                            terrain_cache->map_size);
+        return ERROR;
+    }
+
+    publish_cache_file (terrain_cache->filename, temp_filename,
+                        terrain_cache->map, terrain_cache->map_size, header,
+                        sizeof (*header));
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_terrain_cache
+
+  PURPOSE:  Provide the DEM derived products (percent slope and hillshade
+            gradients) for the DEM, from the cache file when one exists for
+            the DEM and by building one otherwise.
+
+  RETURN VALUE:  Type = Terrain_Cache_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A pointer to the populated Terrain_Cache_t structure.
+
+  NOTES:
+    1. Cache files are keyed by the DEM content hash, the pixel size and the
+       gradient operators, so they can be shared by every acquisition of a
+       WRS path/row.
+    2. The sun dependent hillshade is not cached; it is built per scene with
+       build_hillshade_band_from_gradients.
+*****************************************************************************/
+Terrain_Cache_t *
+open_terrain_cache
+(
+    char *cache_dir,      /* I: directory holding the cache files */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator, /* I: operator for the
+                                                         gradients */
+    bool verbose_flag     /* I: verbose messaging */
+)
+{
+    Terrain_Cache_t *terrain_cache = NULL;
+    Terrain_Cache_Header_t header;
+    size_t pixel_count = (size_t) num_lines * num_samples;
+    char filename[PATH_MAX];
+    char msg[PATH_MAX + 64];
+    int count;
+
+    /* Build the header identifying the products for this DEM */
+    init_terrain_cache_header (&header, band_dem, num_lines, num_samples,
+                               geometry, slope_operator, hillshade_operator);
+
+    count = snprintf (filename, sizeof (filename),
+                      "%s/dswe_terrain_%016" PRIx64 "_%d_%d_%g_%g.bin",
+                      cache_dir, header.dem_hash, header.slope_operator,
+                      header.hillshade_operator, header.x_pixel_size,
+                      header.y_pixel_size);
+    if (count < 0 || count >= sizeof (filename))
+    {
+        ERROR_MESSAGE ("Failed creating terrain cache filename", MODULE_NAME);
+        return NULL;
+    }
+
+    terrain_cache = calloc (1, sizeof (Terrain_Cache_t));
+    if (terrain_cache == NULL)
+    {
+        ERROR_MESSAGE ("Failed allocating memory for terrain cache",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    terrain_cache->filename = strdup (filename);
+    terrain_cache->dem_hash = header.dem_hash;
+    terrain_cache->map_size = TERRAIN_CACHE_DATA_OFFSET
+                              + 3 * pixel_count * sizeof (float);
+
+    if (map_cache_file (terrain_cache->filename, terrain_cache->map_size,
+                        &header, sizeof (header), &terrain_cache->map)
+        == SUCCESS)
+    {
+        if (verbose_flag)
+        {
+            snprintf (msg, sizeof (msg), "Using terrain cache file %s",
+                      terrain_cache->filename);
+            LOG_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+    else if (build_terrain_cache_file (terrain_cache, &header, band_dem,
+                                       geometry, slope_operator,
+                                       hillshade_operator) == SUCCESS)
+    {
+        if (verbose_flag)
+        {
+            snprintf (msg, sizeof (msg), "Created terrain cache file %s",
+                      terrain_cache->filename);
+            LOG_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+    else
+    {
+        /* error messages provided by build_terrain_cache_file */
+        close_terrain_cache (terrain_cache);
+        return NULL;
+    }
+
+    /* Point at the bands within the mapping */
+    terrain_cache->percent_slope =
+        (float *) ((char *) terrain_cache->map + TERRAIN_CACHE_DATA_OFFSET);
+    terrain_cache->x_gradient = terrain_cache->percent_slope + pixel_count;
+    terrain_cache->y_gradient = terrain_cache->x_gradient + pixel_count;
+
+    return terrain_cache;
+}
+
+
+/*****************************************************************************
+  NAME:  unlink_terrain_shm
+
+  PURPOSE:  Remove the name of a shared memory segment, unless the name has
+            already been reused for a newer segment.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+static void
+unlink_terrain_shm
+(
+    const char *shm_name, /* I: name of the segment */
+    uint64_t shm_inode    /* I: inode of the segment that was mapped */
+)
+{
+    int fd;
+    struct stat shm_stat;
+
+    fd = shm_open (shm_name, O_RDONLY, 0);
+    if (fd < 0)
+        return;
+
+    if (fstat (fd, &shm_stat) == 0 && (uint64_t) shm_stat.st_ino == shm_inode)
+        shm_unlink (shm_name);
+    close (fd);
+}
+
+
+/*****************************************************************************
+  NAME:  create_terrain_shm
+
+  PURPOSE:  Size a newly created shared memory segment and build the DEM and
+            its derived products into it.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The products were built and the segment is mapped.
+      ERROR    An error was encountered, the segment was removed.
+
+  NOTES:
+    1. Other processes wait for the state in the segment header to become
+       TERRAIN_SHM_READY, which is stored after everything else.
+    2. This process holds the first reference to the segment.
+    3. The pages of the segment are allocated up front, since a write
+       through the mapping that finds /dev/shm full raises SIGBUS rather
+       than returning an error.  A segment that does not fit is removed and
+       reported as unavailable.
+*****************************************************************************/
+static int
+create_terrain_shm
+(
+    Terrain_Cache_t *terrain_cache, /* IO: name and sizes in, mappings out */
+    int fd,                         /* I: descriptor of the new segment */
+    Terrain_Cache_Header_t *header, /* I: header of the products */
+    int16_t *band_dem,              /* I: the elevation data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                          elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator /* I: operator for the
+                                                        gradients */
+)
+{
+    size_t pixel_count = (size_t) header->lines * header->samples;
+    size_t dem_size = PAGE_ALIGN (pixel_count * sizeof (int16_t));
+    Terrain_Shm_Header_t *shm_header;
+    void *map;
+    int status;
+    char msg[PATH_MAX + 64];
+
+    status = posix_fallocate (fd, 0,
+                              TERRAIN_CACHE_DATA_OFFSET
+                              + terrain_cache->map_size);
+    if (status != 0)
+    {
+        shm_unlink (terrain_cache->filename);
+        snprintf (msg, sizeof (msg), "Failed allocating terrain shared memory"
+                  " segment: %s (%s)", strerror (status),
+                  terrain_cache->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    shm_header = mmap (NULL, TERRAIN_CACHE_DATA_OFFSET,
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm_header == MAP_FAILED)
+    {
+        shm_unlink (terrain_cache->filename);
+        RETURN_ERROR ("Failed mapping terrain shared memory segment",
+                      MODULE_NAME, ERROR);
+    }
+    shm_header->creator_pid = (int32_t) getpid ();
+    __atomic_store_n (&shm_header->ref_count, 1, __ATOMIC_RELAXED);
+
+    map = mmap (NULL, terrain_cache->map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, TERRAIN_CACHE_DATA_OFFSET);
+    if (map == MAP_FAILED)
+    {
+        __atomic_store_n (&shm_header->state, TERRAIN_SHM_FAILED,
+                          __ATOMIC_RELEASE);
+        munmap (shm_header, TERRAIN_CACHE_DATA_OFFSET);
+        shm_unlink (terrain_cache->filename);
+        RETURN_ERROR ("Failed mapping terrain shared memory segment",
+                      MODULE_NAME, ERROR);
+    }
+
+    /* Build the products in place; the segment starts zero filled */
+    memcpy (map, band_dem, pixel_count * sizeof (int16_t));
+    if (build_terrain_products (header, band_dem, geometry, slope_operator,
+            hillshade_operator, (float *) ((char *) map + dem_size))
+        != SUCCESS)
+    {
+        /* error messages provided by build_terrain_products */
+        __atomic_store_n (&shm_header->state, TERRAIN_SHM_FAILED,
+                          __ATOMIC_RELEASE);
+        munmap (map, terrain_cache->map_size);
+        munmap (shm_header, TERRAIN_CACHE_DATA_OFFSET);
+        shm_unlink (terrain_cache->filename);
+        return ERROR;
+    }
+
+    /* The products are read only from here on, for this process too */
+    mprotect (map, terrain_cache->map_size, PROT_READ);
+
+    memcpy (&shm_header->identity, header, sizeof (*header));
+    __atomic_store_n (&shm_header->state, TERRAIN_SHM_READY,
+                      __ATOMIC_RELEASE);
+
+    terrain_cache->map = map;
+    terrain_cache->shm_header = shm_header;
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  attach_terrain_shm
+
+  PURPOSE:  Wait for another process to build the products into an existing
+            shared memory segment, then take a reference to the segment and
+            map the products read only.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The segment holds the products and is mapped.
+      ERROR    The segment is not usable.
+
+  NOTES:
+    1. A segment whose building process failed or died is removed, so the
+       next run can create it again.  That includes a segment still empty
+       after the wait, whose creator died before sizing it.
+    2. No reference is taken on a segment whose count already dropped to
+       zero, since its last user is removing it.
+*****************************************************************************/
+static int
+attach_terrain_shm
+(
+    Terrain_Cache_t *terrain_cache, /* IO: name and sizes in, mappings out */
+    int fd,                         /* I: descriptor of the segment */
+    Terrain_Cache_Header_t *header  /* I: header the products must have */
+)
+{
+    struct timespec poll_time = {0, TERRAIN_SHM_POLL_MSEC * 1000000L};
+    long poll_count = TERRAIN_SHM_WAIT_SECONDS * 1000L
+                      / TERRAIN_SHM_POLL_MSEC;
+    long poll;
+    struct stat shm_stat;
+    Terrain_Shm_Header_t *shm_header;
+    int32_t state = TERRAIN_SHM_BUILDING;
+    int32_t ref_count;
+    char msg[PATH_MAX + 64];
+
+    /* The creating process sizes the segment right after creating it, or
+       removes it when it does not fit */
+    for (poll = 0; poll < poll_count; poll++)
+    {
+        if (fstat (fd, &shm_stat) != 0)
+            RETURN_ERROR ("Failed checking terrain shared memory segment",
+                          MODULE_NAME, ERROR);
+        if (shm_stat.st_size != 0 || shm_stat.st_nlink == 0)
+            break;
+        nanosleep (&poll_time, NULL);
+    }
+    if (shm_stat.st_size == 0)
+    {
+        if (shm_stat.st_nlink != 0)
+        {
+            unlink_terrain_shm (terrain_cache->filename,
+                                (uint64_t) shm_stat.st_ino);
+        }
+        snprintf (msg, sizeof (msg), "Terrain shared memory segment was not"
+                  " built (%s)", terrain_cache->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+    if ((size_t) shm_stat.st_size
+        != TERRAIN_CACHE_DATA_OFFSET + terrain_cache->map_size)
+    {
+        snprintf (msg, sizeof (msg), "Terrain shared memory segment has an"
+                  " unexpected size (%s)", terrain_cache->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+    terrain_cache->shm_inode = (uint64_t) shm_stat.st_ino;
+
+    shm_header = mmap (NULL, TERRAIN_CACHE_DATA_OFFSET,
+                       PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm_header == MAP_FAILED)
+    {
+        RETURN_ERROR ("Failed mapping terrain shared memory segment",
+                      MODULE_NAME, ERROR);
+    }
+
+    for (poll = 0; poll < poll_count; poll++)
+    {
+        state = __atomic_load_n (&shm_header->state, __ATOMIC_ACQUIRE);
+        if (state != TERRAIN_SHM_BUILDING)
+            break;
+
+        /* A creating process that died leaves the segment building */
+        if (shm_header->creator_pid != 0
+            && kill ((pid_t) shm_header->creator_pid, 0) != 0
+            && errno == ESRCH)
+        {
+            state = TERRAIN_SHM_FAILED;
+            break;
+        }
+        nanosleep (&poll_time, NULL);
+    }
+
+    if (state != TERRAIN_SHM_READY)
+    {
+        if (state == TERRAIN_SHM_FAILED)
+        {
+            unlink_terrain_shm (terrain_cache->filename,
+                                terrain_cache->shm_inode);
+        }
+        munmap (shm_header, TERRAIN_CACHE_DATA_OFFSET);
+        snprintf (msg, sizeof (msg), "Terrain shared memory segment was not"
+                  " built (%s)", terrain_cache->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    if (memcmp (&shm_header->identity, header, sizeof (*header)) != 0)
+    {
+        munmap (shm_header, TERRAIN_CACHE_DATA_OFFSET);
+        snprintf (msg, sizeof (msg), "Terrain shared memory segment holds"
+                  " a different DEM (%s)", terrain_cache->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    ref_count = __atomic_load_n (&shm_header->ref_count, __ATOMIC_RELAXED);
+    do
+    {
+        if (ref_count == 0)
+        {
+            munmap (shm_header, TERRAIN_CACHE_DATA_OFFSET);
+            snprintf (msg, sizeof (msg), "Terrain shared memory segment is"
+                      " being removed (%s)", terrain_cache->filename);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
+    } while (!__atomic_compare_exchange_n (&shm_header->ref_count,
+                 &ref_count, ref_count + 1, false, __ATOMIC_ACQ_REL,
+                 __ATOMIC_RELAXED));
+    terrain_cache->shm_header = shm_header;
+
+    terrain_cache->map = mmap (NULL, terrain_cache->map_size, PROT_READ,
+                               MAP_SHARED, fd, TERRAIN_CACHE_DATA_OFFSET);
+    if (terrain_cache->map == MAP_FAILED)
+    {
+        /* close_terrain_cache drops the reference */
+        terrain_cache->map = NULL;
+        RETURN_ERROR ("Failed mapping terrain shared memory segment",
+                      MODULE_NAME, ERROR);
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_terrain_shm
+
+  PURPOSE:  Provide the DEM and its derived products (percent slope and
+            hillshade gradients) from a POSIX shared memory segment, so
+            concurrent runs on scenes sharing the DEM build them once and
+            hold a single copy in memory.
+
+  RETURN VALUE:  Type = Terrain_Cache_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A pointer to the populated Terrain_Cache_t structure.
+
+  NOTES:
+    1. Segments are named like the terrain cache files.  The first process
+       to create the segment builds the products into it while the others
+       wait, then every process maps them read only.
+    2. The segment holds a count of the processes using it, and the last one
+       to close it removes it.  A process killed while using the segment
+       never drops its reference, so the segment stays until removed from
+       /dev/shm by hand; it is still reused by later runs in the meantime.
+    3. The segment bands are a page aligned DEM followed by the percent slope
+       and the x and y gradients.
+*****************************************************************************/
+Terrain_Cache_t *
+open_terrain_shm
+(
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator, /* I: operator for the
+                                                         gradients */
+    bool verbose_flag     /* I: verbose messaging */
+)
+{
+    Terrain_Cache_t *terrain_cache = NULL;
+    Terrain_Cache_Header_t header;
+    size_t pixel_count = (size_t) num_lines * num_samples;
+    size_t dem_size = PAGE_ALIGN (pixel_count * sizeof (int16_t));
+    struct stat shm_stat;
+    char shm_name[NAME_MAX];
+    char msg[PATH_MAX + 64];
+    int count;
+    int fd;
+    int status;
+    bool created;
+
+    /* Build the header identifying the products for this DEM */
+    init_terrain_cache_header (&header, band_dem, num_lines, num_samples,
+                               geometry, slope_operator, hillshade_operator);
+
+    count = snprintf (shm_name, sizeof (shm_name),
+                      "/dswe_terrain_%016" PRIx64 "_%d_%d_%g_%g",
+                      header.dem_hash, header.slope_operator,
+                      header.hillshade_operator, header.x_pixel_size,
+                      header.y_pixel_size);
+    if (count < 0 || count >= sizeof (shm_name))
+    {
+        ERROR_MESSAGE ("Failed creating terrain shared memory name",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    terrain_cache = calloc (1, sizeof (Terrain_Cache_t));
+    if (terrain_cache == NULL)
+    {
+        ERROR_MESSAGE ("Failed allocating memory for terrain cache",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    terrain_cache->filename = strdup (shm_name);
+    terrain_cache->dem_hash = header.dem_hash;
+    terrain_cache->map_size = dem_size + 3 * pixel_count * sizeof (float);
+
+    fd = shm_open (shm_name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    created = (fd >= 0);
+    if (!created && errno == EEXIST)
+        fd = shm_open (shm_name, O_RDWR, 0);
+    if (fd < 0)
+    {
+        close_terrain_cache (terrain_cache);
+        snprintf (msg, sizeof (msg), "Failed opening terrain shared memory"
+                  " segment (%s)", shm_name);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        return NULL;
+    }
+
+    if (created)
+    {
+        if (fstat (fd, &shm_stat) == 0)
+            terrain_cache->shm_inode = (uint64_t) shm_stat.st_ino;
+        status = create_terrain_shm (terrain_cache, fd, &header, band_dem,
+                                     geometry, slope_operator,
+                                     hillshade_operator);
+    }
+    else
+        status = attach_terrain_shm (terrain_cache, fd, &header);
+    close (fd);
+
+    if (status != SUCCESS)
+    {
+        /* error messages provided by create_terrain_shm and
+           attach_terrain_shm */
+        close_terrain_cache (terrain_cache);
+        return NULL;
+    }
+
+    if (verbose_flag)
+    {
+        snprintf (msg, sizeof (msg), "%s terrain shared memory segment %s",
+                  created ? "Created" : "Using", shm_name);
+        LOG_MESSAGE (msg, MODULE_NAME);
+    }
+
+    /* Point at the bands within the mapping */
+    terrain_cache->dem = (int16_t *) terrain_cache->map;
+    terrain_cache->percent_slope =
+        (float *) ((char *) terrain_cache->map + dem_size);
+    terrain_cache->x_gradient = terrain_cache->percent_slope + pixel_count;
+    terrain_cache->y_gradient = terrain_cache->x_gradient + pixel_count;
+
+    return terrain_cache;
+}
+
+
+/*****************************************************************************
+  NAME:  close_terrain_cache
+
+  PURPOSE:  Unmap the cache file or shared memory segment and free the memory
+            associated with it.  The last process using a shared memory
+            segment removes it.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_terrain_cache
+(
+    Terrain_Cache_t *terrain_cache /* I: cache opened by open_terrain_cache */
+)
+{
+    Terrain_Shm_Header_t *shm_header = terrain_cache->shm_header;
+
+    if (terrain_cache->map != NULL)
+        munmap (terrain_cache->map, terrain_cache->map_size);
+
+    if (shm_header != NULL)
+    {
+        if (__atomic_sub_fetch (&shm_header->ref_count, 1, __ATOMIC_ACQ_REL)
+            == 0)
+        {
+            unlink_terrain_shm (terrain_cache->filename,
+                                terrain_cache->shm_inode);
+        }
+        munmap (shm_header, TERRAIN_CACHE_DATA_OFFSET);
+    }
+
+    free (terrain_cache->filename);
+    free (terrain_cache);
+}
+
+
+/*****************************************************************************
+  NAME:  build_horizon_cache_file
+
+  PURPOSE:  Compute the horizon angles directly into a new cache file, which
+            is published under its final name once complete.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The cache file was built and is mapped.
+      ERROR    An error was encountered.
+*****************************************************************************/
+static int
+build_horizon_cache_file
+(
+    Horizon_Cache_t *horizon_cache, /* IO: filename and size in, mapping
+                                            out */
+    Horizon_Cache_Header_t *header, /* I: header for the cache file */
+    int16_t *band_dem,              /* I: the elevation data */
+    const Dem_Geometry_t *geometry  /* I: resolution of each line of the
+                                          elevation data */
+)
+{
+    char temp_filename[PATH_MAX];
+
+    if (create_cache_file (horizon_cache->filename, horizon_cache->map_size,
+                           temp_filename, &horizon_cache->map) != SUCCESS)
+    {
+        /* error messages provided by create_cache_file */
+        return ERROR;
+    }
+
+    if (build_horizon_band (band_dem, header->lines, header->samples,
+            geometry, horizon_sector_azimuth (header->sector),
+            (int16_t *) ((char *) horizon_cache->map
+                         + TERRAIN_CACHE_DATA_OFFSET)) != SUCCESS)
+    {
+        discard_cache_file (temp_filename, &horizon_cache->map,
+                            horizon_cache->map_size);
+        RETURN_ERROR ("Failed building the horizon angles", MODULE_NAME,
+                      ERROR);
+    }
+
+    publish_cache_file (horizon_cache->filename, temp_filename,
+                        horizon_cache->map, horizon_cache->map_size, header,
+                        sizeof (*header));
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_horizon_cache
+
+  PURPOSE:  Provide the horizon angles of the DEM for an azimuth sector, from
+            the cache file when one exists and by building one otherwise.
+
+  RETURN VALUE:  Type = Horizon_Cache_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        A pointer to the populated Horizon_Cache_t structure.
+
+  NOTES:
+    1. Cache files are keyed by the DEM content hash, the pixel size and the
+       azimuth sector.  The solar azimuth of a WRS path/row only moves through
+       a few sectors over the year, so most scenes find their file already
+       built.
+*****************************************************************************/
+Horizon_Cache_t *
+open_horizon_cache
+(
+    char *cache_dir,      /* I: directory holding the cache files */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    int sector,           /* I: azimuth sector from horizon_sector */
+    bool verbose_flag     /* I: verbose messaging */
+)
+{
+    Horizon_Cache_t *horizon_cache = NULL;
+    Horizon_Cache_Header_t header;
+    size_t pixel_count = (size_t) num_lines * num_samples;
+    char filename[PATH_MAX];
+    char msg[PATH_MAX + 64];
+    int count;
+
+    /* Build the header identifying the horizon angles for this DEM */
+    memset (&header, 0, sizeof (header));
+    snprintf (header.magic, sizeof (header.magic), "%s", HORIZON_CACHE_MAGIC);
+    header.version = HORIZON_CACHE_VERSION;
+    header.sector = sector;
+    header.sector_count = HORIZON_SECTOR_COUNT;
+    header.dem_hash = hash_dem (band_dem, pixel_count);
+    header.lines = num_lines;
+    header.samples = num_samples;
+    header.geographic = geometry->geographic;
+    header.x_pixel_size = geometry->x_pixel_size;
+    header.y_pixel_size = geometry->y_pixel_size;
+    header.ul_latitude = geometry->ul_latitude;
+
+    count = snprintf (filename, sizeof (filename),
+                      "%s/dswe_horizon_%016" PRIx64 "_%d_%d_%g_%g.bin",
+                      cache_dir, header.dem_hash, sector,
+                      HORIZON_SECTOR_COUNT, header.x_pixel_size,
+                      header.y_pixel_size);
+    if (count < 0 || count >= sizeof (filename))
+    {
+        ERROR_MESSAGE ("Failed creating horizon cache filename", MODULE_NAME);
+        return NULL;
+    }
+
+    horizon_cache = calloc (1, sizeof (Horizon_Cache_t));
+    if (horizon_cache == NULL)
+    {
+        ERROR_MESSAGE ("Failed allocating memory for horizon cache",
+                       MODULE_NAME);
+        return NULL;
+    }
+
+    horizon_cache->filename = strdup (filename);
+    horizon_cache->sector = sector;
+    horizon_cache->map_size = TERRAIN_CACHE_DATA_OFFSET
+                              + pixel_count * sizeof (int16_t);
+
+    if (map_cache_file (horizon_cache->filename, horizon_cache->map_size,
+                        &header, sizeof (header), &horizon_cache->map)
+        == SUCCESS)
+    {
+        if (verbose_flag)
+        {
+            snprintf (msg, sizeof (msg), "Using horizon cache file %s",
+                      horizon_cache->filename);
+            LOG_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+    else if (build_horizon_cache_file (horizon_cache, &header, band_dem,
+                                       geometry) == SUCCESS)
+    {
+        if (verbose_flag)
+        {
+            snprintf (msg, sizeof (msg), "Created horizon cache file %s",
+                      horizon_cache->filename);
+            LOG_MESSAGE (msg, MODULE_NAME);
+        }
+    }
+    else
+    {
+        /* error messages provided by build_horizon_cache_file */
+        close_horizon_cache (horizon_cache);
+        return NULL;
+    }
+
+    horizon_cache->horizon =
+        (int16_t *) ((char *) horizon_cache->map + TERRAIN_CACHE_DATA_OFFSET);
+
+    return horizon_cache;
+}
+
+
+/*****************************************************************************
+  NAME:  close_horizon_cache
+
+  PURPOSE:  Unmap the cache file and free the memory associated with it.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_horizon_cache
+(
+    Horizon_Cache_t *horizon_cache /* I: cache opened by open_horizon_cache */
+)
+{
+    if (horizon_cache->map != NULL)
+        munmap (horizon_cache->map, horizon_cache->map_size);
+
+    free (horizon_cache->filename);
+    free (horizon_cache);
+}
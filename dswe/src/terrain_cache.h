@@ -0,0 +1,113 @@
+
+#ifndef TERRAIN_CACHE_H
+#define TERRAIN_CACHE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+
+#include "gradient_operator.h"
+#include "dem_grid.h"
+
+
+/* Structure for the DEM derived products of a terrain cache file or shared
+   memory segment, which are the same for every scene sharing the DEM */
+typedef struct
+{
+    char *filename;       /* Name of the cache file, or of the shared memory
+                             segment */
+    void *map;            /* Memory mapping of the cache file, or read only
+                             mapping of the segment bands */
+    size_t map_size;      /* Size of the memory mapping in bytes */
+    void *shm_header;     /* Mapping of the segment header, NULL for a cache
+                             file */
+    uint64_t shm_inode;   /* Inode of the segment, to only unlink the segment
+                             that was mapped */
+    uint64_t dem_hash;    /* Content hash of the DEM the products are from */
+    int16_t *dem;         /* Elevation band shared through the segment, NULL
+                             for a cache file */
+    float *percent_slope; /* Percent slope band from build_slope_band */
+    float *x_gradient;    /* East/west gradient band from
+                             build_gradient_bands */
+    float *y_gradient;    /* North/south gradient band from
+                             build_gradient_bands */
+} Terrain_Cache_t;
+
+
+/* Structure for the horizon angles of a horizon cache file, which are the
+   same for every scene sharing the DEM and the solar azimuth sector */
+typedef struct
+{
+    char *filename;       /* Name of the cache file */
+    void *map;            /* Memory mapping of the cache file */
+    size_t map_size;      /* Size of the memory mapping in bytes */
+    int sector;           /* Azimuth sector of the horizon angles */
+    int16_t *horizon;     /* Horizon angle band from build_horizon_band */
+} Horizon_Cache_t;
+
+
+Terrain_Cache_t *
+open_terrain_cache
+(
+    char *cache_dir,      /* I: directory holding the cache files */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator, /* I: operator for the
+                                                         gradients */
+    bool verbose_flag     /* I: verbose messaging */
+);
+
+
+Terrain_Cache_t *
+open_terrain_shm
+(
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    const Gradient_Operator_t *slope_operator, /* I: operator for the
+                                                     percent slope */
+    const Gradient_Operator_t *hillshade_operator, /* I: operator for the
+                                                         gradients */
+    bool verbose_flag     /* I: verbose messaging */
+);
+
+
+void
+close_terrain_cache
+(
+    Terrain_Cache_t *terrain_cache /* I: cache opened by open_terrain_cache
+                                         or open_terrain_shm */
+);
+
+
+Horizon_Cache_t *
+open_horizon_cache
+(
+    char *cache_dir,      /* I: directory holding the cache files */
+    int16_t *band_dem,    /* I: the elevation data to use in meters */
+    int num_lines,        /* I: the number of lines in the data */
+    int num_samples,      /* I: the number of samples in the data */
+    const Dem_Geometry_t *geometry, /* I: resolution of each line of the
+                                         elevation data */
+    int sector,           /* I: azimuth sector from horizon_sector */
+    bool verbose_flag     /* I: verbose messaging */
+);
+
+
+void
+close_horizon_cache
+(
+    Horizon_Cache_t *horizon_cache /* I: cache opened by open_horizon_cache */
+);
+
+
+#endif /* TERRAIN_CACHE_H */
@@ -0,0 +1,165 @@
+
+#ifndef TERRAIN_KERNELS_H
+#define TERRAIN_KERNELS_H
+
+
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+/* Number of threads a parallel region over the lines will use, 1 when built
+   without threading support */
+static inline int line_thread_count ()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads ();
+#else
+    return 1;
+#endif
+}
+
+
+/* Index of the calling thread within the parallel region over the lines */
+static inline int line_thread_index ()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num ();
+#else
+    return 0;
+#endif
+}
+
+
+/* The 3x3 window around the sample being processed is
+       0 1 2
+       3 4 5
+       6 7 8
+   with 0 1 2 from the line above and 6 7 8 from the line below.  The
+   weighted differences of int16 elevations are exact in int arithmetic, so
+   they only need converting to floating point once per pixel. */
+
+
+/* Horn's x gradient sum, (w0 + 2w3 + w6) - (w2 + 2w5 + w8), for the sample
+   of the line */
+static inline int horn_x_sum
+(
+    const int16_t *restrict dem_above, /* I: DEM line above the current line */
+    const int16_t *restrict dem_line,  /* I: DEM line being processed */
+    const int16_t *restrict dem_below, /* I: DEM line below the current line */
+    int sample                         /* I: sample being processed */
+)
+{
+    return (dem_above[sample - 1] + 2 * dem_line[sample - 1]
+            + dem_below[sample - 1])
+           - (dem_above[sample + 1] + 2 * dem_line[sample + 1]
+              + dem_below[sample + 1]);
+}
+
+
+/* Horn's y gradient sum, (w0 + 2w1 + w2) - (w6 + 2w7 + w8), for the sample
+   of the line */
+static inline int horn_y_sum
+(
+    const int16_t *restrict dem_above, /* I: DEM line above the current line */
+    const int16_t *restrict dem_below, /* I: DEM line below the current line */
+    int sample                         /* I: sample being processed */
+)
+{
+    return (dem_above[sample - 1] + 2 * dem_above[sample]
+            + dem_above[sample + 1])
+           - (dem_below[sample - 1] + 2 * dem_below[sample]
+              + dem_below[sample + 1]);
+}
+
+
+/* Zevenbergen and Thorne's x gradient difference, w3 - w5, for the sample of
+   the line; the sign is the same as for horn_x_sum */
+static inline int zevenbergen_thorne_x_diff
+(
+    const int16_t *restrict dem_line,  /* I: DEM line being processed */
+    int sample                         /* I: sample being processed */
+)
+{
+    return dem_line[sample - 1] - dem_line[sample + 1];
+}
+
+
+/* Zevenbergen and Thorne's y gradient difference, w1 - w7, for the sample of
+   the line */
+static inline int zevenbergen_thorne_y_diff
+(
+    const int16_t *restrict dem_above, /* I: DEM line above the current line */
+    const int16_t *restrict dem_below, /* I: DEM line below the current line */
+    int sample                         /* I: sample being processed */
+)
+{
+    return dem_above[sample] - dem_below[sample];
+}
+
+
+/* Evans and Young's x gradient sum, (w0 + w3 + w6) - (w2 + w5 + w8), for the
+   sample of the line */
+static inline int evans_young_x_sum
+(
+    const int16_t *restrict dem_above, /* I: DEM line above the current line */
+    const int16_t *restrict dem_line,  /* I: DEM line being processed */
+    const int16_t *restrict dem_below, /* I: DEM line below the current line */
+    int sample                         /* I: sample being processed */
+)
+{
+    return (dem_above[sample - 1] + dem_line[sample - 1]
+            + dem_below[sample - 1])
+           - (dem_above[sample + 1] + dem_line[sample + 1]
+              + dem_below[sample + 1]);
+}
+
+
+/* Evans and Young's y gradient sum, (w0 + w1 + w2) - (w6 + w7 + w8), for the
+   sample of the line */
+static inline int evans_young_y_sum
+(
+    const int16_t *restrict dem_above, /* I: DEM line above the current line */
+    const int16_t *restrict dem_below, /* I: DEM line below the current line */
+    int sample                         /* I: sample being processed */
+)
+{
+    return (dem_above[sample - 1] + dem_above[sample] + dem_above[sample + 1])
+           - (dem_below[sample - 1] + dem_below[sample]
+              + dem_below[sample + 1]);
+}
+
+
+/* The 5x5 smoothed operator is separable: the derivative weights 1 2 0 -2 -1
+   across the gradient direction and the binomial smoothing weights
+   1 4 6 4 1 along it.  These give the two factors for five samples of one
+   line. */
+
+
+/* Derivative weights applied to the five samples around the sample */
+static inline int smoothed_5x5_diff
+(
+    const int16_t *restrict dem_line,  /* I: DEM line to weight */
+    int sample                         /* I: sample being processed */
+)
+{
+    return (dem_line[sample - 2] + 2 * dem_line[sample - 1])
+           - (2 * dem_line[sample + 1] + dem_line[sample + 2]);
+}
+
+
+/* Smoothing weights applied to the five samples around the sample */
+static inline int smoothed_5x5_smooth
+(
+    const int16_t *restrict dem_line,  /* I: DEM line to weight */
+    int sample                         /* I: sample being processed */
+)
+{
+    return dem_line[sample - 2] + 4 * dem_line[sample - 1]
+           + 6 * dem_line[sample] + 4 * dem_line[sample + 1]
+           + dem_line[sample + 2];
+}
+
+
+#endif /* TERRAIN_KERNELS_H */
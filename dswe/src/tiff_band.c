@@ -0,0 +1,904 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+
+#include "const.h"
+#include "dswe.h"
+#include "utilities.h"
+#include "tiff_band.h"
+
+
+/* TIFF tags read from the first image file directory */
+#define TIFF_TAG_IMAGE_WIDTH 256
+#define TIFF_TAG_IMAGE_LENGTH 257
+#define TIFF_TAG_BITS_PER_SAMPLE 258
+#define TIFF_TAG_COMPRESSION 259
+#define TIFF_TAG_SAMPLES_PER_PIXEL 277
+#define TIFF_TAG_PLANAR_CONFIG 284
+#define TIFF_TAG_PREDICTOR 317
+#define TIFF_TAG_TILE_WIDTH 322
+#define TIFF_TAG_TILE_LENGTH 323
+#define TIFF_TAG_TILE_OFFSETS 324
+#define TIFF_TAG_TILE_BYTE_COUNTS 325
+#define TIFF_TAG_SAMPLE_FORMAT 339
+
+/* TIFF field types holding the integers the tags above use */
+#define TIFF_TYPE_BYTE 1
+#define TIFF_TYPE_SHORT 3
+#define TIFF_TYPE_LONG 4
+#define TIFF_TYPE_LONG8 16
+
+/* TIFF codes of the supported compressions and predictors */
+#define TIFF_COMPRESSION_NONE 1
+#define TIFF_COMPRESSION_DEFLATE 8
+#define TIFF_COMPRESSION_ADOBE_DEFLATE 32946
+#define TIFF_PREDICTOR_NONE 1
+#define TIFF_PREDICTOR_HORIZONTAL 2
+
+/* Most directory entries expected in the first image file directory */
+#define TIFF_MAX_ENTRIES 1024
+
+
+/*****************************************************************************
+  NAME:  is_tiff_band_file
+
+  PURPOSE:  Check whether an image file is a TIFF file from its suffix.
+
+  RETURN VALUE:  Type = bool
+      True for a .tif or .tiff file.
+*****************************************************************************/
+bool
+is_tiff_band_file
+(
+    const char *filename      /* I: name of the image file */
+)
+{
+    const char *suffix = strrchr (filename, '.');
+
+    return suffix != NULL
+           && (strcmp (suffix, ".tif") == 0 || strcmp (suffix, ".tiff") == 0
+               || strcmp (suffix, ".TIF") == 0);
+}
+
+
+/*****************************************************************************
+  NAME:  read_tiff_bytes
+
+  PURPOSE:  Read bytes at an offset of the TIFF file, retrying short reads.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The bytes were read.
+      ERROR    The file failed to read or ends before the bytes.
+
+  NOTES:
+    1. A remote file is read with range requests, through its blocks in
+       memory.
+*****************************************************************************/
+static int
+read_tiff_bytes
+(
+    Tiff_Band_t *tiff,    /* IO: band to read the file of */
+    void *buffer,         /* O: memory for size bytes */
+    size_t size,          /* I: number of bytes to read */
+    uint64_t offset       /* I: offset of the bytes in the file */
+)
+{
+    char *next = buffer;
+    ssize_t count;
+
+    if (tiff->http != NULL)
+        return read_http_source (tiff->http, buffer, size, offset);
+
+    while (size > 0)
+    {
+        count = pread (tiff->fd, next, size, (off_t) offset);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return ERROR;
+
+        next += count;
+        offset += count;
+        size -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  get_uint
+
+  PURPOSE:  Get an unsigned integer of 1, 2, 4 or 8 bytes in the byte order
+            of the file.
+
+  RETURN VALUE:  Type = uint64_t
+      The integer.
+*****************************************************************************/
+static uint64_t
+get_uint
+(
+    const Tiff_Band_t *tiff,  /* I: band the bytes are from */
+    const uint8_t *bytes,     /* I: the bytes of the integer */
+    int size                  /* I: number of bytes */
+)
+{
+    uint64_t value = 0;
+    int index;
+
+    for (index = 0; index < size; index++)
+    {
+        if (tiff->little_endian)
+            value |= (uint64_t) bytes[index] << (8 * index);
+        else
+            value = (value << 8) | bytes[index];
+    }
+
+    return value;
+}
+
+
+/*****************************************************************************
+  NAME:  read_tag_values
+
+  PURPOSE:  Read the integer values of an image file directory entry, which
+            are either in the entry or at the offset it holds.
+
+  RETURN VALUE:  Type = uint64_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        Allocated array of *count values.
+*****************************************************************************/
+static uint64_t *
+read_tag_values
+(
+    Tiff_Band_t *tiff,        /* IO: band being opened */
+    bool big_tiff,            /* I: the file is a BigTIFF */
+    const uint8_t *entry,     /* I: the directory entry */
+    uint64_t *count           /* O: number of values */
+)
+{
+    int type = get_uint (tiff, &entry[2], 2);
+    int field_size = big_tiff ? 8 : 4;
+    const uint8_t *field = &entry[big_tiff ? 12 : 8];
+    int type_size;
+    uint64_t *values = NULL;
+    uint8_t *bytes = NULL;
+    uint64_t index;
+
+    switch (type)
+    {
+        case TIFF_TYPE_BYTE:
+            type_size = 1;
+            break;
+        case TIFF_TYPE_SHORT:
+            type_size = 2;
+            break;
+        case TIFF_TYPE_LONG:
+            type_size = 4;
+            break;
+        case TIFF_TYPE_LONG8:
+            type_size = 8;
+            break;
+        default:
+            RETURN_ERROR ("Unsupported TIFF field type", MODULE_NAME, NULL);
+    }
+
+    *count = get_uint (tiff, &entry[4], field_size);
+    if (*count == 0 || *count > (uint64_t) INT32_MAX)
+        RETURN_ERROR ("Invalid TIFF field count", MODULE_NAME, NULL);
+
+    values = malloc (*count * sizeof (uint64_t));
+    if (values == NULL)
+    {
+        RETURN_ERROR ("Error allocating memory for TIFF field values",
+                      MODULE_NAME, NULL);
+    }
+
+    /* Values that do not fit in the entry are at the offset it holds */
+    if (*count * type_size <= (uint64_t) field_size)
+    {
+        for (index = 0; index < *count; index++)
+            values[index] = get_uint (tiff, &field[index * type_size],
+                                      type_size);
+        return values;
+    }
+
+    bytes = malloc (*count * type_size);
+    if (bytes == NULL
+        || read_tiff_bytes (tiff, bytes, *count * type_size,
+                            get_uint (tiff, field, field_size)) != SUCCESS)
+    {
+        free (bytes);
+        free (values);
+        RETURN_ERROR ("Failed reading TIFF field values", MODULE_NAME, NULL);
+    }
+
+    for (index = 0; index < *count; index++)
+        values[index] = get_uint (tiff, &bytes[index * type_size], type_size);
+    free (bytes);
+
+    return values;
+}
+
+
+/*****************************************************************************
+  NAME:  read_directory
+
+  PURPOSE:  Read the layout of the full resolution image from the first
+            image file directory of a TIFF file.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The image is a supported tiled image.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The overviews of a Cloud Optimized GeoTIFF are in the directories
+       after the first one, so they are never looked at.
+*****************************************************************************/
+static int
+read_directory
+(
+    Tiff_Band_t *tiff         /* IO: band being opened, with the file open */
+)
+{
+    const uint16_t host_one = 1;
+    uint8_t header[16];
+    bool big_tiff;
+    uint64_t directory_offset;
+    uint8_t count_bytes[8];
+    uint64_t entry_count;
+    int entry_size;
+    uint8_t *entries = NULL;
+    uint64_t index;
+    uint64_t count;
+    uint64_t *values;
+    uint64_t byte_count_count = 0;
+    int tag;
+    int bits_per_sample = 0;
+    int samples_per_pixel = 1;
+    int planar_config = 1;
+    int sample_format = 1;
+    int tiles_down;
+    int status = SUCCESS;
+    char msg[256];
+
+    if (read_tiff_bytes (tiff, header, sizeof (header), 0) != SUCCESS)
+        RETURN_ERROR ("Failed reading the TIFF header", MODULE_NAME, ERROR);
+
+    if (header[0] == 'I' && header[1] == 'I')
+        tiff->little_endian = true;
+    else if (header[0] == 'M' && header[1] == 'M')
+        tiff->little_endian = false;
+    else
+        RETURN_ERROR ("Not a TIFF file", MODULE_NAME, ERROR);
+    tiff->swap_bytes = (tiff->little_endian != (*(uint8_t *) &host_one == 1));
+
+    switch (get_uint (tiff, &header[2], 2))
+    {
+        case 42:
+            big_tiff = false;
+            directory_offset = get_uint (tiff, &header[4], 4);
+            break;
+        case 43:
+            big_tiff = true;
+            directory_offset = get_uint (tiff, &header[8], 8);
+            break;
+        default:
+            RETURN_ERROR ("Not a TIFF file", MODULE_NAME, ERROR);
+    }
+    entry_size = big_tiff ? 20 : 12;
+
+    if (read_tiff_bytes (tiff, count_bytes, big_tiff ? 8 : 2,
+                         directory_offset) != SUCCESS)
+    {
+        RETURN_ERROR ("Failed reading the TIFF directory", MODULE_NAME,
+                      ERROR);
+    }
+    entry_count = get_uint (tiff, count_bytes, big_tiff ? 8 : 2);
+    if (entry_count == 0 || entry_count > TIFF_MAX_ENTRIES)
+        RETURN_ERROR ("Invalid TIFF directory", MODULE_NAME, ERROR);
+
+    entries = malloc (entry_count * entry_size);
+    if (entries == NULL
+        || read_tiff_bytes (tiff, entries, entry_count * entry_size,
+                            directory_offset + (big_tiff ? 8 : 2)) != SUCCESS)
+    {
+        free (entries);
+        RETURN_ERROR ("Failed reading the TIFF directory", MODULE_NAME,
+                      ERROR);
+    }
+
+    for (index = 0; index < entry_count && status == SUCCESS; index++)
+    {
+        tag = get_uint (tiff, &entries[index * entry_size], 2);
+        if (tag != TIFF_TAG_IMAGE_WIDTH && tag != TIFF_TAG_IMAGE_LENGTH
+            && tag != TIFF_TAG_BITS_PER_SAMPLE
+            && tag != TIFF_TAG_COMPRESSION
+            && tag != TIFF_TAG_SAMPLES_PER_PIXEL
+            && tag != TIFF_TAG_PLANAR_CONFIG && tag != TIFF_TAG_PREDICTOR
+            && tag != TIFF_TAG_TILE_WIDTH && tag != TIFF_TAG_TILE_LENGTH
+            && tag != TIFF_TAG_TILE_OFFSETS
+            && tag != TIFF_TAG_TILE_BYTE_COUNTS
+            && tag != TIFF_TAG_SAMPLE_FORMAT)
+        {
+            continue;
+        }
+
+        values = read_tag_values (tiff, big_tiff,
+                                  &entries[index * entry_size], &count);
+        if (values == NULL)
+        {
+            status = ERROR;
+            break;
+        }
+
+        switch (tag)
+        {
+            case TIFF_TAG_IMAGE_WIDTH:
+                tiff->samples = values[0];
+                break;
+            case TIFF_TAG_IMAGE_LENGTH:
+                tiff->lines = values[0];
+                break;
+            case TIFF_TAG_BITS_PER_SAMPLE:
+                bits_per_sample = values[0];
+                break;
+            case TIFF_TAG_COMPRESSION:
+                tiff->compression = values[0];
+                break;
+            case TIFF_TAG_SAMPLES_PER_PIXEL:
+                samples_per_pixel = values[0];
+                break;
+            case TIFF_TAG_PLANAR_CONFIG:
+                planar_config = values[0];
+                break;
+            case TIFF_TAG_PREDICTOR:
+                tiff->predictor = values[0];
+                break;
+            case TIFF_TAG_TILE_WIDTH:
+                tiff->tile_samples = values[0];
+                break;
+            case TIFF_TAG_TILE_LENGTH:
+                tiff->tile_lines = values[0];
+                break;
+            case TIFF_TAG_SAMPLE_FORMAT:
+                sample_format = values[0];
+                break;
+            case TIFF_TAG_TILE_OFFSETS:
+                free (tiff->tile_offsets);
+                tiff->tile_offsets = values;
+                tiff->tile_count = count;
+                values = NULL;
+                break;
+            case TIFF_TAG_TILE_BYTE_COUNTS:
+                free (tiff->tile_byte_counts);
+                tiff->tile_byte_counts = values;
+                byte_count_count = count;
+                values = NULL;
+                break;
+        }
+        free (values);
+    }
+    free (entries);
+    if (status != SUCCESS)
+        RETURN_ERROR ("Invalid TIFF directory", MODULE_NAME, ERROR);
+
+    if (tiff->tile_offsets == NULL || tiff->tile_byte_counts == NULL
+        || byte_count_count != (uint64_t) tiff->tile_count
+        || tiff->tile_lines <= 0 || tiff->tile_samples <= 0)
+    {
+        snprintf (msg, sizeof (msg), "TIFF file is not tiled (%s)",
+                  tiff->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    if (bits_per_sample != 16 || samples_per_pixel != 1
+        || planar_config != 1 || (sample_format != 1 && sample_format != 2))
+    {
+        snprintf (msg, sizeof (msg), "TIFF file is not a single band of 16"
+                  " bit integers (%s)", tiff->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    if ((tiff->compression != TIFF_COMPRESSION_NONE
+         && tiff->compression != TIFF_COMPRESSION_DEFLATE
+         && tiff->compression != TIFF_COMPRESSION_ADOBE_DEFLATE)
+        || (tiff->predictor != TIFF_PREDICTOR_NONE
+            && tiff->predictor != TIFF_PREDICTOR_HORIZONTAL))
+    {
+        snprintf (msg, sizeof (msg), "TIFF file compression is not none or"
+                  " deflate (%s)", tiff->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    if (tiff->lines <= 0 || tiff->samples <= 0)
+        RETURN_ERROR ("Invalid TIFF image size", MODULE_NAME, ERROR);
+
+    tiff->tiles_across = (tiff->samples + tiff->tile_samples - 1)
+                         / tiff->tile_samples;
+    tiles_down = (tiff->lines + tiff->tile_lines - 1) / tiff->tile_lines;
+    if ((int64_t) tiff->tiles_across * tiles_down != tiff->tile_count)
+        RETURN_ERROR ("Invalid TIFF tile count", MODULE_NAME, ERROR);
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  open_tiff_band
+
+  PURPOSE:  Open a tiled TIFF file and read the layout of its image.
+
+  RETURN VALUE:  Type = Tiff_Band_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The band, with an empty tile cache.
+
+  NOTES:
+    1. Baseline TIFF and BigTIFF in either byte order are read.  The image
+       has to be tiled, with one 16 bit integer sample per pixel, either
+       uncompressed or deflate compressed with or without the horizontal
+       predictor.
+    2. The tile cache holds a row of tiles plus one, so reading the image
+       a line or a strip at a time decodes each tile once.
+    3. A file given by its URL is read from the server with range requests,
+       so only the header, directory and tiles read are transferred.
+*****************************************************************************/
+Tiff_Band_t *
+open_tiff_band
+(
+    const char *filename,     /* I: name or http(s):// URL of the tiled TIFF
+                                    file */
+    const char *http_cache_dir /* I: directory of the block cache of a
+                                    remote file, NULL for none */
+)
+{
+    Tiff_Band_t *tiff = NULL;
+    size_t tile_size;
+    int index;
+    char msg[256];
+
+    tiff = calloc (1, sizeof (Tiff_Band_t));
+    if (tiff == NULL)
+    {
+        RETURN_ERROR ("Error allocating memory for a TIFF band", MODULE_NAME,
+                      NULL);
+    }
+    tiff->fd = -1;
+    tiff->compression = TIFF_COMPRESSION_NONE;
+    tiff->predictor = TIFF_PREDICTOR_NONE;
+
+    tiff->filename = strdup (filename);
+    if (tiff->filename == NULL)
+    {
+        ERROR_MESSAGE ("Error allocating memory for a TIFF band",
+                       MODULE_NAME);
+        close_tiff_band (tiff);
+        return NULL;
+    }
+
+    if (is_http_url (filename))
+    {
+        /* open_http_source reports its own errors */
+        tiff->http = open_http_source (filename, http_cache_dir);
+        if (tiff->http == NULL)
+        {
+            close_tiff_band (tiff);
+            return NULL;
+        }
+    }
+    else
+    {
+        tiff->fd = open (filename, O_RDONLY);
+        if (tiff->fd < 0)
+        {
+            snprintf (msg, sizeof (msg), "Failed to open (%s)", filename);
+            ERROR_MESSAGE (msg, MODULE_NAME);
+            close_tiff_band (tiff);
+            return NULL;
+        }
+    }
+
+    if (read_directory (tiff) != SUCCESS)
+    {
+        snprintf (msg, sizeof (msg), "Failed reading the TIFF layout of (%s)",
+                  filename);
+        ERROR_MESSAGE (msg, MODULE_NAME);
+        close_tiff_band (tiff);
+        return NULL;
+    }
+
+    tiff->cache_size = tiff->tiles_across + 1;
+    tiff->cache = calloc (tiff->cache_size, sizeof (Tiff_Tile_t));
+    if (tiff->http != NULL)
+    {
+        tiff->tile_ranges = malloc (tiff->tiles_across
+                                    * sizeof (Http_Range_t));
+    }
+    if (tiff->cache == NULL
+        || (tiff->http != NULL && tiff->tile_ranges == NULL))
+    {
+        ERROR_MESSAGE ("Error allocating memory for the TIFF tile cache",
+                       MODULE_NAME);
+        close_tiff_band (tiff);
+        return NULL;
+    }
+
+    tile_size = (size_t) tiff->tile_lines * tiff->tile_samples;
+    for (index = 0; index < tiff->cache_size; index++)
+    {
+        tiff->cache[index].index = -1;
+        tiff->cache[index].data = malloc (tile_size * sizeof (int16_t));
+        if (tiff->cache[index].data == NULL)
+        {
+            ERROR_MESSAGE ("Error allocating memory for the TIFF tile cache",
+                           MODULE_NAME);
+            close_tiff_band (tiff);
+            return NULL;
+        }
+    }
+
+    return tiff;
+}
+
+
+/*****************************************************************************
+  NAME:  decode_tile
+
+  PURPOSE:  Read and decode one tile of a TIFF band.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The tile was decoded.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. A tile that is not in the file, which Cloud Optimized GeoTIFF
+       writers do for tiles without data, is all missing_value.
+*****************************************************************************/
+static int
+decode_tile
+(
+    Tiff_Band_t *tiff,        /* IO: band to decode the tile of */
+    int tile_index,           /* I: tile to decode */
+    int16_t *data             /* O: the decoded tile */
+)
+{
+    size_t tile_pixels = (size_t) tiff->tile_lines * tiff->tile_samples;
+    size_t tile_bytes = tile_pixels * sizeof (int16_t);
+    uint64_t byte_count = tiff->tile_byte_counts[tile_index];
+    uLongf decoded_bytes;
+    uint16_t *values = (uint16_t *) data;
+    uint8_t *buffer;
+    size_t index;
+    int line;
+    int sample;
+
+    if (byte_count == 0)
+    {
+        for (index = 0; index < tile_pixels; index++)
+            data[index] = tiff->missing_value;
+        return SUCCESS;
+    }
+
+    if (tiff->compression == TIFF_COMPRESSION_NONE)
+    {
+        if (byte_count < tile_bytes)
+            RETURN_ERROR ("Truncated TIFF tile", MODULE_NAME, ERROR);
+
+        if (read_tiff_bytes (tiff, data, tile_bytes,
+                             tiff->tile_offsets[tile_index]) != SUCCESS)
+        {
+            RETURN_ERROR ("Failed reading a TIFF tile", MODULE_NAME, ERROR);
+        }
+    }
+    else
+    {
+        if (byte_count > tiff->compressed_size)
+        {
+            buffer = realloc (tiff->compressed, byte_count);
+            if (buffer == NULL)
+            {
+                RETURN_ERROR ("Error allocating memory for a TIFF tile",
+                              MODULE_NAME, ERROR);
+            }
+            tiff->compressed = buffer;
+            tiff->compressed_size = byte_count;
+        }
+
+        if (read_tiff_bytes (tiff, tiff->compressed, byte_count,
+                             tiff->tile_offsets[tile_index]) != SUCCESS)
+        {
+            RETURN_ERROR ("Failed reading a TIFF tile", MODULE_NAME, ERROR);
+        }
+
+        decoded_bytes = tile_bytes;
+        if (uncompress ((Bytef *) data, &decoded_bytes, tiff->compressed,
+                        byte_count) != Z_OK
+            || decoded_bytes != tile_bytes)
+        {
+            RETURN_ERROR ("Failed decompressing a TIFF tile", MODULE_NAME,
+                          ERROR);
+        }
+    }
+
+    if (tiff->swap_bytes)
+    {
+        for (index = 0; index < tile_pixels; index++)
+            values[index] = (uint16_t) ((values[index] << 8)
+                                        | (values[index] >> 8));
+    }
+
+    /* The horizontal predictor stores each sample as the difference from
+       the previous one on the line of the tile */
+    if (tiff->predictor == TIFF_PREDICTOR_HORIZONTAL)
+    {
+        for (line = 0; line < tiff->tile_lines; line++)
+        {
+            index = (size_t) line * tiff->tile_samples;
+            for (sample = 1; sample < tiff->tile_samples; sample++)
+                values[index + sample] += values[index + sample - 1];
+        }
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  get_tile
+
+  PURPOSE:  Get a decoded tile from the tile cache, decoding it into the
+            least recently used entry when it is not there.
+
+  RETURN VALUE:  Type = const int16_t *
+      Value    Description
+      -------  ---------------------------------------------------------------
+      NULL     An error was encountered.
+      *        The decoded tile.
+*****************************************************************************/
+static const int16_t *
+get_tile
+(
+    Tiff_Band_t *tiff,        /* IO: band to get the tile of */
+    int tile_index            /* I: tile to get */
+)
+{
+    Tiff_Tile_t *entry = &tiff->cache[0];
+    int index;
+
+    tiff->read_count++;
+    for (index = 0; index < tiff->cache_size; index++)
+    {
+        if (tiff->cache[index].index == tile_index)
+        {
+            tiff->cache[index].last_use = tiff->read_count;
+            return tiff->cache[index].data;
+        }
+
+        if (tiff->cache[index].last_use < entry->last_use)
+            entry = &tiff->cache[index];
+    }
+
+    entry->index = -1;
+    if (decode_tile (tiff, tile_index, entry->data) != SUCCESS)
+        return NULL;
+    entry->index = tile_index;
+    entry->last_use = tiff->read_count;
+
+    return entry->data;
+}
+
+
+/*****************************************************************************
+  NAME:  fetch_tile_row
+
+  PURPOSE:  Fetch the tiles of a remote TIFF band a run of pixels needs
+            from one row of tiles, together.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The tiles were fetched.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The tiles already decoded and those not in the file are skipped.
+       The others are fetched with coalesced range requests in parallel,
+       instead of one request per tile as they are decoded.
+*****************************************************************************/
+static int
+fetch_tile_row
+(
+    Tiff_Band_t *tiff,        /* IO: remote band */
+    int tile_row,             /* I: row of tiles */
+    int first_sample,         /* I: first sample of the run in the row */
+    int last_sample           /* I: last sample of the run in the row */
+)
+{
+    size_t tile_bytes = (size_t) tiff->tile_lines * tiff->tile_samples
+                        * sizeof (int16_t);
+    int range_count = 0;
+    int tile_col;
+    int tile_index;
+    int index;
+
+    for (tile_col = first_sample / tiff->tile_samples;
+         tile_col <= last_sample / tiff->tile_samples; tile_col++)
+    {
+        tile_index = tile_row * tiff->tiles_across + tile_col;
+        if (tiff->tile_byte_counts[tile_index] == 0)
+            continue;
+
+        for (index = 0; index < tiff->cache_size; index++)
+        {
+            if (tiff->cache[index].index == tile_index)
+                break;
+        }
+        if (index < tiff->cache_size)
+            continue;
+
+        tiff->tile_ranges[range_count].offset =
+            tiff->tile_offsets[tile_index];
+        tiff->tile_ranges[range_count].size =
+            (tiff->compression == TIFF_COMPRESSION_NONE)
+            ? tile_bytes : tiff->tile_byte_counts[tile_index];
+        range_count++;
+    }
+
+    return prefetch_http_ranges (tiff->http, tiff->tile_ranges, range_count);
+}
+
+
+/*****************************************************************************
+  NAME:  read_tiff_band
+
+  PURPOSE:  Read a run of pixels of a TIFF band, as if it was a raw binary
+            band, from the tiles covering them.
+
+  RETURN VALUE:  Type = int
+      Value    Description
+      -------  ---------------------------------------------------------------
+      SUCCESS  The pixels were read.
+      ERROR    An error was encountered.
+
+  NOTES:
+    1. The band is only read by one thread at a time, since the tile cache
+       is not locked.
+    2. The tiles of a remote band are fetched a row of tiles at a time.
+*****************************************************************************/
+int
+read_tiff_band
+(
+    Tiff_Band_t *tiff,        /* IO: band from open_tiff_band */
+    off_t first_pixel,        /* I: first pixel to read, counted along the
+                                    lines of the image */
+    size_t pixel_count,       /* I: number of pixels to read */
+    void *band                /* O: memory for pixel_count 16 bit values */
+)
+{
+    int16_t *next = band;
+    const int16_t *tile;
+    int line;
+    int sample;
+    int tile_line;
+    int tile_sample;
+    int tile_row;
+    int fetched_row = -1;     /* row of tiles fetched for the run */
+    off_t row_end;            /* end of the run in the row of tiles */
+    size_t count;
+    char msg[256];
+
+    if (first_pixel < 0 || (uint64_t) first_pixel + pixel_count
+                           > (uint64_t) tiff->lines * tiff->samples)
+    {
+        snprintf (msg, sizeof (msg), "Read past the end of the TIFF image"
+                  " (%s)", tiff->filename);
+        RETURN_ERROR (msg, MODULE_NAME, ERROR);
+    }
+
+    while (pixel_count > 0)
+    {
+        line = first_pixel / tiff->samples;
+        sample = first_pixel % tiff->samples;
+        tile_line = line % tiff->tile_lines;
+        tile_sample = sample % tiff->tile_samples;
+        tile_row = line / tiff->tile_lines;
+
+        /* A run over more than one line needs the whole row of tiles */
+        if (tiff->http != NULL && tile_row != fetched_row)
+        {
+            row_end = (off_t) (tile_row + 1) * tiff->tile_lines
+                      * tiff->samples;
+            if (row_end > first_pixel + (off_t) pixel_count)
+                row_end = first_pixel + pixel_count;
+
+            if (fetch_tile_row (tiff, tile_row,
+                    ((row_end - 1) / tiff->samples > line) ? 0 : sample,
+                    ((row_end - 1) / tiff->samples > line)
+                    ? tiff->samples - 1 : (row_end - 1) % tiff->samples)
+                != SUCCESS)
+            {
+                snprintf (msg, sizeof (msg), "Failed fetching line %d of"
+                          " (%s)", line, tiff->filename);
+                RETURN_ERROR (msg, MODULE_NAME, ERROR);
+            }
+            fetched_row = tile_row;
+        }
+
+        /* Copy the part of the line inside this tile */
+        count = tiff->tile_samples - tile_sample;
+        if (count > (size_t) (tiff->samples - sample))
+            count = tiff->samples - sample;
+        if (count > pixel_count)
+            count = pixel_count;
+
+        tile = get_tile (tiff, tile_row * tiff->tiles_across
+                               + sample / tiff->tile_samples);
+        if (tile == NULL)
+        {
+            snprintf (msg, sizeof (msg), "Failed decoding line %d of (%s)",
+                      line, tiff->filename);
+            RETURN_ERROR (msg, MODULE_NAME, ERROR);
+        }
+        memcpy (next, &tile[(size_t) tile_line * tiff->tile_samples
+                            + tile_sample], count * sizeof (int16_t));
+
+        next += count;
+        first_pixel += count;
+        pixel_count -= count;
+    }
+
+    return SUCCESS;
+}
+
+
+/*****************************************************************************
+  NAME:  close_tiff_band
+
+  PURPOSE:  Close a TIFF band and free its tile cache.
+
+  RETURN VALUE:  None
+*****************************************************************************/
+void
+close_tiff_band
+(
+    Tiff_Band_t *tiff         /* I: band from open_tiff_band */
+)
+{
+    int index;
+
+    if (tiff == NULL)
+        return;
+
+    if (tiff->fd >= 0)
+        close (tiff->fd);
+    close_http_source (tiff->http);
+
+    if (tiff->cache != NULL)
+    {
+        for (index = 0; index < tiff->cache_size; index++)
+            free (tiff->cache[index].data);
+    }
+
+    free (tiff->cache);
+    free (tiff->tile_ranges);
+    free (tiff->compressed);
+    free (tiff->tile_offsets);
+    free (tiff->tile_byte_counts);
+    free (tiff->filename);
+    free (tiff);
+}
@@ -0,0 +1,90 @@
+
+#ifndef TIFF_BAND_H
+#define TIFF_BAND_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "http_range.h"
+
+
+/* Structure for a decoded tile held by the tile cache of a TIFF band */
+typedef struct
+{
+    int index;            /* Tile index in the image, -1 when unused */
+    uint64_t last_use;    /* Read count when the tile was last used */
+    int16_t *data;        /* tile_lines * tile_samples decoded values */
+} Tiff_Tile_t;
+
+
+/* Structure for a 16 bit single band tiled TIFF or BigTIFF image, as
+   written for Cloud Optimized GeoTIFFs, which is decoded a tile at a time
+   as it is read */
+typedef struct
+{
+    char *filename;       /* Name of the image file */
+    int fd;               /* Open file, only read with pread */
+    Http_Source_t *http;  /* Remote file read with range requests, NULL
+                             for a local file */
+    Http_Range_t *tile_ranges; /* Byte ranges of a row of tiles, for
+                             fetching the remote tiles together */
+    bool little_endian;   /* The file byte order is little endian */
+    bool swap_bytes;      /* The file byte order is not the host's */
+    int lines;            /* Lines of the full resolution image */
+    int samples;          /* Samples of the full resolution image */
+    int tile_lines;       /* Lines in each tile */
+    int tile_samples;     /* Samples in each tile */
+    int tiles_across;     /* Tiles in each row of tiles */
+    int tile_count;       /* Tiles in the image */
+    int compression;      /* TIFF compression code, none or deflate */
+    int predictor;        /* TIFF predictor code, none or horizontal */
+    uint64_t *tile_offsets; /* File offset of each tile */
+    uint64_t *tile_byte_counts; /* Compressed size of each tile, 0 for a
+                                   tile that is not in the file */
+    int16_t missing_value; /* Value of the pixels of missing tiles */
+    uint8_t *compressed;  /* Compressed data of the tile being decoded */
+    size_t compressed_size; /* Allocated size of compressed */
+    Tiff_Tile_t *cache;   /* Most recently used decoded tiles */
+    int cache_size;       /* Tiles in the cache */
+    uint64_t read_count;  /* Tile reads so far, for the cache recency */
+} Tiff_Band_t;
+
+
+bool
+is_tiff_band_file
+(
+    const char *filename      /* I: name of the image file */
+);
+
+
+Tiff_Band_t *
+open_tiff_band
+(
+    const char *filename,     /* I: name or http(s):// URL of the tiled TIFF
+                                    file */
+    const char *http_cache_dir /* I: directory of the block cache of a
+                                    remote file, NULL for none */
+);
+
+
+int
+read_tiff_band
+(
+    Tiff_Band_t *tiff,        /* IO: band from open_tiff_band */
+    off_t first_pixel,        /* I: first pixel to read, counted along the
+                                    lines of the image */
+    size_t pixel_count,       /* I: number of pixels to read */
+    void *band                /* O: memory for pixel_count 16 bit values */
+);
+
+
+void
+close_tiff_band
+(
+    Tiff_Band_t *tiff         /* I: band from open_tiff_band */
+);
+
+
+#endif /* TIFF_BAND_H */